@@ -13,6 +13,7 @@
 #include "hook/iobuf.h"
 #include "hook/iohook.h"
 
+#include "hooklib/iostat.h"
 #include "hooklib/setupapi.h"
 
 #include "util/crc.h"
@@ -72,7 +73,7 @@ HRESULT ds_hook_init(const struct ds_config *cfg)
     ds_eeprom.region = cfg->region;
     ds_eeprom.crc32 = crc32(&ds_eeprom.unk_04, 0x1C, 0);
 
-    hr = iohook_push_handler(ds_handle_irp);
+    hr = iostat_push_handler("ds", ds_handle_irp);
 
     if (FAILED(hr)) {
         return hr;
@@ -15,6 +15,7 @@
 
 #include "hook/iohook.h"
 
+#include "hooklib/iostat.h"
 #include "hooklib/setupapi.h"
 
 #include "util/dprintf.h"
@@ -44,7 +45,7 @@ HRESULT eeprom_hook_init(const struct eeprom_config *cfg)
 
     memcpy(&eeprom_config, cfg, sizeof(*cfg));
 
-    hr = iohook_push_handler(eeprom_handle_irp);
+    hr = iostat_push_handler("eeprom", eeprom_handle_irp);
 
     if (FAILED(hr)) {
         return hr;
@@ -8,6 +8,7 @@
 
 #include "hook/iohook.h"
 
+#include "hooklib/iostat.h"
 #include "hooklib/setupapi.h"
 
 #include "util/dprintf.h"
@@ -94,7 +95,7 @@ HRESULT gpio_hook_init(const struct gpio_config *cfg)
         return hr;
     }
 
-    hr = iohook_push_handler(gpio_handle_irp);
+    hr = iostat_push_handler("gpio", gpio_handle_irp);
 
     if (FAILED(hr)) {
         return hr;
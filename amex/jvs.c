@@ -13,6 +13,7 @@
 #include "hook/iobuf.h"
 #include "hook/iohook.h"
 
+#include "hooklib/iostat.h"
 #include "hooklib/setupapi.h"
 
 #include "jvs/jvs-bus.h"
@@ -50,7 +51,7 @@ HRESULT jvs_hook_init(const struct jvs_config *cfg, jvs_provider_t provider)
         return S_FALSE;
     }
 
-    hr = iohook_push_handler(jvs_handle_irp);
+    hr = iostat_push_handler("jvs", jvs_handle_irp);
 
     if (FAILED(hr)) {
         return hr;
@@ -93,7 +94,8 @@ static HRESULT jvs_handle_open(struct irp *irp)
     }
 
     if (jvs_fd != NULL) {
-        dprintf("JVS Port: Already open\n");
+        dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_ERROR,
+                "JVS Port: Already open\n");
 
         return HRESULT_FROM_WIN32(ERROR_SHARING_VIOLATION);
     }
@@ -104,7 +106,7 @@ static HRESULT jvs_handle_open(struct irp *irp)
         return hr;
     }
 
-    dprintf("JVS Port: Open device\n");
+    dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_INFO, "JVS Port: Open device\n");
 
     if (jvs_provider != NULL) {
         hr = jvs_provider(&root);
@@ -121,7 +123,7 @@ static HRESULT jvs_handle_open(struct irp *irp)
 
 static HRESULT jvs_handle_close(struct irp *irp)
 {
-    dprintf("JVS Port: Close device\n");
+    dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_INFO, "JVS Port: Close device\n");
     jvs_fd = NULL;
 
     return iohook_invoke_next(irp);
@@ -140,7 +142,8 @@ static HRESULT jvs_handle_ioctl(struct irp *irp)
         return jvs_ioctl_transact(irp);
 
     default:
-        dprintf("JVS Port: Unknown ioctl %#x\n", irp->ioctl);
+        dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_ERROR,
+                "JVS Port: Unknown ioctl %#x\n", irp->ioctl);
 
         return HRESULT_FROM_WIN32(ERROR_INVALID_FUNCTION);
     }
@@ -152,7 +155,8 @@ static HRESULT jvs_ioctl_hello(struct irp *irp)
 
     // uuh fucked if i know
 
-    dprintf("JVS Port: Port startup (?)\n");
+    dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_INFO,
+            "JVS Port: Port startup (?)\n");
 
          iobuf_write_8(&irp->read, 0);
     hr = iobuf_write_8(&irp->read, 0);
@@ -169,14 +173,17 @@ static HRESULT jvs_ioctl_sense(struct irp *irp)
         sense = jvs_root->sense(jvs_root);
 
         if (sense) {
-            dprintf("JVS Port: Sense line 2.5 V (address unassigned)\n");
+            dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_INFO,
+                    "JVS Port: Sense line 2.5 V (address unassigned)\n");
             code = 3;
         } else {
-            dprintf("JVS Port: Sense line 0.0 V (address assigned)\n");
+            dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_INFO,
+                    "JVS Port: Sense line 0.0 V (address assigned)\n");
             code = 2;
         }
     } else {
-        dprintf("JVS Port: Sense line 5.0 V (no downstream PCB)\n");
+        dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_INFO,
+                "JVS Port: Sense line 5.0 V (no downstream PCB)\n");
         code = 1;
     }
 
@@ -185,18 +192,18 @@ static HRESULT jvs_ioctl_sense(struct irp *irp)
 
 static HRESULT jvs_ioctl_transact(struct irp *irp)
 {
-#if 0
-    dprintf("\nJVS Port: Outbound frame:\n");
-    dump_const_iobuf(&irp->write);
-#endif
+    if (dprintf_enabled(DPRINTF_CAT_JVS, DPRINTF_LEVEL_TRACE)) {
+        dprintf("\nJVS Port: Outbound frame:\n");
+        dump_const_iobuf(&irp->write);
+    }
 
     jvs_bus_transact(jvs_root, irp->write.bytes, irp->write.nbytes, &irp->read);
 
-#if 0
-    dprintf("JVS Port: Inbound frame:\n");
-    dump_iobuf(&irp->read);
-    dprintf("\n");
-#endif
+    if (dprintf_enabled(DPRINTF_CAT_JVS, DPRINTF_LEVEL_TRACE)) {
+        dprintf("JVS Port: Inbound frame:\n");
+        dump_iobuf(&irp->read);
+        dprintf("\n");
+    }
 
     if (irp->read.pos == 0) {
         /* The un-acked JVS reset command must return ERROR_NO_DATA_DETECTED,
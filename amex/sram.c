@@ -15,6 +15,7 @@
 
 #include "hook/iohook.h"
 
+#include "hooklib/iostat.h"
 #include "hooklib/setupapi.h"
 
 #include "util/dprintf.h"
@@ -42,7 +43,7 @@ HRESULT sram_hook_init(const struct sram_config *cfg)
 
     memcpy(&sram_config, cfg, sizeof(*cfg));
 
-    hr = iohook_push_handler(sram_handle_irp);
+    hr = iostat_push_handler("sram", sram_handle_irp);
 
     if (FAILED(hr)) {
         return hr;
@@ -229,7 +229,8 @@ static HRESULT io3_cmd(
         return io3_cmd_assign_addr(io3, req, resp);
 
     default:
-        dprintf("JVS I/O: Node %02x: Unhandled command byte %02x\n",
+        dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_ERROR,
+                "JVS I/O: Node %02x: Unhandled command byte %02x\n",
                 io3->addr,
                 req->bytes[req->pos]);
 
@@ -251,7 +252,7 @@ static HRESULT io3_cmd_read_id(
         return hr;
     }
 
-    dprintf("JVS I/O: Read ID\n");
+    dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_INFO, "JVS I/O: Read ID\n");
 
     /* Write report byte */
 
@@ -282,7 +283,8 @@ static HRESULT io3_cmd_get_cmd_version(
         return hr;
     }
 
-    dprintf("JVS I/O: Get command format version\n");
+    dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_INFO,
+            "JVS I/O: Get command format version\n");
     resp[0] = 0x01; /* Report byte */
     resp[1] = 0x13; /* Command format version BCD */
 
@@ -304,7 +306,7 @@ static HRESULT io3_cmd_get_jvs_version(
         return hr;
     }
 
-    dprintf("JVS I/O: Get JVS version\n");
+    dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_INFO, "JVS I/O: Get JVS version\n");
     resp[0] = 0x01; /* Report byte */
     resp[1] = 0x20; /* JVS version BCD */
 
@@ -326,7 +328,8 @@ static HRESULT io3_cmd_get_comm_version(
         return hr;
     }
 
-    dprintf("JVS I/O: Get communication version\n");
+    dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_INFO,
+            "JVS I/O: Get communication version\n");
     resp[0] = 0x01; /* Report byte */
     resp[1] = 0x10; /* "Communication version" BCD */
 
@@ -347,7 +350,7 @@ static HRESULT io3_cmd_get_features(
         return hr;
     }
 
-    dprintf("JVS I/O: Get features\n");
+    dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_INFO, "JVS I/O: Get features\n");
 
     hr = iobuf_write_8(resp_buf, 0x01); /* Write report byte */
 
@@ -375,14 +378,15 @@ static HRESULT io3_cmd_read_switches(
         return hr;
     }
 
-#if 0
-    dprintf("JVS I/O: Read switches, np=%i, bpp=%i\n",
-            req.num_players,
-            req.bytes_per_player);
-#endif
+    if (dprintf_enabled(DPRINTF_CAT_JVS, DPRINTF_LEVEL_TRACE)) {
+        dprintf("JVS I/O: Read switches, np=%i, bpp=%i\n",
+                req.num_players,
+                req.bytes_per_player);
+    }
 
     if (req.num_players > 2 || req.bytes_per_player != 2) {
-        dprintf("JVS I/O: Invalid read size "
+        dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_ERROR,
+                "JVS I/O: Invalid read size "
                         "num_players=%i "
                         "bytes_per_player=%i\n",
                 req.num_players,
@@ -453,7 +457,8 @@ static HRESULT io3_cmd_read_coin(
         return hr;
     }
 
-    //dprintf("JVS I/O: Read coin, nslots=%i\n", req.nslots);
+    dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_TRACE,
+            "JVS I/O: Read coin, nslots=%i\n", req.nslots);
 
     /* Write report byte */
 
@@ -501,12 +506,14 @@ static HRESULT io3_cmd_read_analogs(
     }
 
     if (req.nanalogs > _countof(analogs)) {
-        dprintf("JVS I/O: Invalid analog count %i\n", req.nanalogs);
+        dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_ERROR,
+                "JVS I/O: Invalid analog count %i\n", req.nanalogs);
 
         return E_FAIL;
     }
 
-    //dprintf("JVS I/O: Read analogs, nanalogs=%i\n", req.nanalogs);
+    dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_TRACE,
+            "JVS I/O: Read analogs, nanalogs=%i\n", req.nanalogs);
 
     /* Write report byte */
 
@@ -561,7 +568,8 @@ static HRESULT io3_cmd_write_gpio(
     }
 
     if (nbytes > 3) {
-        dprintf("JVS I/O: Invalid GPIO write size %i\n", nbytes);
+        dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_ERROR,
+                "JVS I/O: Invalid GPIO write size %i\n", nbytes);
         hr = iobuf_write_8(resp_buf, 0x02);
 
         if (FAILED(hr)) {
@@ -602,7 +610,8 @@ static HRESULT io3_cmd_reset(struct io3 *io3, struct const_iobuf *req_buf)
         return hr;
     }
 
-    dprintf("JVS I/O: Reset (param %02x)\n", req.unknown);
+    dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_INFO,
+            "JVS I/O: Reset (param %02x)\n", req.unknown);
     io3->addr = 0xFF;
 
     if (io3->ops->reset != NULL) {
@@ -630,7 +639,8 @@ static HRESULT io3_cmd_assign_addr(
     }
 
     sense = jvs_node_sense(io3->jvs.next);
-    dprintf("JVS I/O: Assign addr %02x sense %i\n", req.addr, sense);
+    dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_INFO,
+            "JVS I/O: Assign addr %02x sense %i\n", req.addr, sense);
 
     if (sense) {
         /* That address is for somebody else */
@@ -14,6 +14,7 @@
 #include "hook/iobuf.h"
 #include "hook/iohook.h"
 
+#include "hooklib/iostat.h"
 #include "hooklib/setupapi.h"
 
 #include "util/async.h"
@@ -66,6 +67,11 @@ static HRESULT io4_ioctl_get_product_string(struct irp *irp);
 
 static HRESULT io4_async_poll(void *ctx, struct irp *irp);
 
+/* Delay long enough for the instigating thread in amdaemon to be satisfied
+   that all queued-up reports have been drained. */
+
+static const uint32_t io4_report_delay_us = 1000;
+
 /* Device node path must contain substring "vid_0ca3" (case-insensitive). */
 static const wchar_t io4_path[] = L"$io4\\vid_0ca3";
 
@@ -103,7 +109,11 @@ HRESULT io4_hook_init(const struct io4_ops *ops, void *ctx)
 
     assert(ops != NULL);
 
-    async_init(&io4_async, NULL);
+    hr = async_init(&io4_async, NULL, ASYNC_DEFAULT_DEPTH);
+
+    if (FAILED(hr)) {
+        return hr;
+    }
 
     hr = iohook_open_nul_fd(&io4_fd);
 
@@ -114,7 +124,7 @@ HRESULT io4_hook_init(const struct io4_ops *ops, void *ctx)
     io4_ops = ops;
     io4_ops_ctx = ctx;
     io4_system_status = 0x02; /* idk */
-    iohook_push_handler(io4_handle_irp);
+    iostat_push_handler("io4", io4_handle_irp);
 
     hr = setupapi_add_phantom_dev(&hid_guid, io4_path);
 
@@ -149,7 +159,7 @@ static HRESULT io4_handle_open(struct irp *irp)
         return iohook_invoke_next(irp);
     }
 
-    dprintf("USB I/O: Device opened\n");
+    dprintfc(DPRINTF_CAT_IO4, DPRINTF_LEVEL_INFO, "USB I/O: Device opened\n");
     irp->fd = io4_fd;
 
     return S_OK;
@@ -157,7 +167,7 @@ static HRESULT io4_handle_open(struct irp *irp)
 
 static HRESULT io4_handle_close(struct irp *irp)
 {
-    dprintf("USB I/O: Device closed\n");
+    dprintfc(DPRINTF_CAT_IO4, DPRINTF_LEVEL_INFO, "USB I/O: Device closed\n");
 
     return S_OK;
 }
@@ -169,7 +179,11 @@ static HRESULT io4_handle_read(struct irp *irp)
        signal the OVERLAPPED event object "a little bit later" in order to avoid
        an infinite loop. */
 
-    return async_submit(&io4_async, irp, io4_async_poll);
+    return async_submit_deadline(
+            &io4_async,
+            irp,
+            io4_async_poll,
+            io4_report_delay_us);
 }
 
 static HRESULT io4_handle_write(struct irp *irp)
@@ -184,14 +198,16 @@ static HRESULT io4_handle_write(struct irp *irp)
     }
 
     if (out.report_id != 0x10) {
-        dprintf("USB I/O: OUT Report ID is incorrect");
+        dprintfc(DPRINTF_CAT_IO4, DPRINTF_LEVEL_ERROR,
+                "USB I/O: OUT Report ID is incorrect");
 
         return E_FAIL;
     }
 
     switch (out.cmd) {
     case IO4_CMD_SET_COMM_TIMEOUT:
-        dprintf("USB I/O: Set comm timeout\n");
+        dprintfc(DPRINTF_CAT_IO4, DPRINTF_LEVEL_INFO,
+                "USB I/O: Set comm timeout\n");
 
         // Ongeki Summer expects the system status to be 0x30 at this point
         io4_system_status = 0x30;
@@ -199,7 +215,8 @@ static HRESULT io4_handle_write(struct irp *irp)
         return S_OK;
 
     case IO4_CMD_SET_SAMPLING_COUNT:
-        dprintf("USB I/O: Set sampling count\n");
+        dprintfc(DPRINTF_CAT_IO4, DPRINTF_LEVEL_INFO,
+                "USB I/O: Set sampling count\n");
 
         // Ongeki Summer expects the system status to be 0x30 at this point
         io4_system_status = 0x30;
@@ -207,28 +224,31 @@ static HRESULT io4_handle_write(struct irp *irp)
         return S_OK;
 
     case IO4_CMD_CLEAR_BOARD_STATUS:
-        dprintf("USB I/O: Clear board status\n");
+        dprintfc(DPRINTF_CAT_IO4, DPRINTF_LEVEL_INFO,
+                "USB I/O: Clear board status\n");
         io4_system_status = 0x00;
 
         return S_OK;
 
     case IO4_CMD_SET_GENERAL_OUTPUT:
-        dprintf("USB I/O: GPIO Out\n");
+        dprintfc(DPRINTF_CAT_IO4, DPRINTF_LEVEL_DEBUG, "USB I/O: GPIO Out\n");
 
         return S_OK;
 
     case IO4_CMD_SET_PWM_OUTPUT:
-        dprintf("USB I/O: PWM Out\n");
+        dprintfc(DPRINTF_CAT_IO4, DPRINTF_LEVEL_DEBUG, "USB I/O: PWM Out\n");
 
         return S_OK;
 
     case IO4_CMD_UPDATE_FIRMWARE:
-        dprintf("USB I/O: Update firmware..?\n");
+        dprintfc(DPRINTF_CAT_IO4, DPRINTF_LEVEL_INFO,
+                "USB I/O: Update firmware..?\n");
 
         return E_FAIL;
 
     default:
-        dprintf("USB I/O: Unknown command %02x\n", out.cmd);
+        dprintfc(DPRINTF_CAT_IO4, DPRINTF_LEVEL_ERROR,
+                "USB I/O: Unknown command %02x\n", out.cmd);
 
         return E_FAIL;
     }
@@ -244,17 +264,20 @@ static HRESULT io4_handle_ioctl(struct irp *irp)
         return io4_ioctl_get_product_string(irp);
 
     case IOCTL_HID_GET_INPUT_REPORT:
-        dprintf("USB I/O: Control IN (untested!!)\n");
+        dprintfc(DPRINTF_CAT_IO4, DPRINTF_LEVEL_INFO,
+                "USB I/O: Control IN (untested!!)\n");
 
         return io4_handle_read(irp);
 
     case IOCTL_HID_SET_OUTPUT_REPORT:
-        dprintf("USB I/O: Control OUT (untested!!)\n");
+        dprintfc(DPRINTF_CAT_IO4, DPRINTF_LEVEL_INFO,
+                "USB I/O: Control OUT (untested!!)\n");
 
         return io4_handle_write(irp);
 
     default:
-        dprintf("USB I/O: Unknown ioctl %#08x, write %i read %i\n",
+        dprintfc(DPRINTF_CAT_IO4, DPRINTF_LEVEL_ERROR,
+                "USB I/O: Unknown ioctl %#08x, write %i read %i\n",
                 irp->ioctl,
                 (int) irp->write.nbytes,
                 (int) irp->read.nbytes);
@@ -265,7 +288,8 @@ static HRESULT io4_handle_ioctl(struct irp *irp)
 
 static HRESULT io4_ioctl_get_manufacturer_string(struct irp *irp)
 {
-    dprintf("USB I/O: Get manufacturer string\n");
+    dprintfc(DPRINTF_CAT_IO4, DPRINTF_LEVEL_INFO,
+            "USB I/O: Get manufacturer string\n");
 
     if (irp->read.nbytes < sizeof(io4_manf)) {
         return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
@@ -279,7 +303,8 @@ static HRESULT io4_ioctl_get_manufacturer_string(struct irp *irp)
 
 static HRESULT io4_ioctl_get_product_string(struct irp *irp)
 {
-    dprintf("USB I/O: Get product string\n");
+    dprintfc(DPRINTF_CAT_IO4, DPRINTF_LEVEL_INFO,
+            "USB I/O: Get product string\n");
 
     if (irp->read.nbytes < sizeof(io4_prod)) {
         return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
@@ -298,11 +323,6 @@ static HRESULT io4_async_poll(void *ctx, struct irp *irp)
     HRESULT hr;
     size_t i;
 
-    /* Delay long enough for the instigating thread in amdaemon to be satisfied
-       that all queued-up reports have been drained. */
-
-    Sleep(1);
-
     /* Call into ops to poll the underlying inputs */
 
     memset(&state, 0, sizeof(state));
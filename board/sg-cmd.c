@@ -7,11 +7,6 @@
 
 #include "util/dprintf.h"
 
-union sg_req_any {
-    struct sg_req_header req;
-    uint8_t bytes[256];
-};
-
 union sg_res_any {
     struct sg_res_header res;
     uint8_t bytes[256];
@@ -31,7 +26,8 @@ static HRESULT sg_req_validate(const void *ptr, size_t nbytes)
     assert(ptr != NULL);
 
     if (nbytes < sizeof(*req)) {
-        dprintf("SG Cmd: Request header truncated\n");
+        dprintfc(DPRINTF_CAT_SG, DPRINTF_LEVEL_ERROR,
+                "SG Cmd: Request header truncated\n");
 
         return E_FAIL;
     }
@@ -39,7 +35,8 @@ static HRESULT sg_req_validate(const void *ptr, size_t nbytes)
     req = ptr;
 
     if (req->hdr.frame_len != nbytes) {
-        dprintf("SG Cmd: Frame length mismatch: got %i exp %i\n",
+        dprintfc(DPRINTF_CAT_SG, DPRINTF_LEVEL_ERROR,
+                "SG Cmd: Frame length mismatch: got %i exp %i\n",
                 req->hdr.frame_len,
                 (int) nbytes);
 
@@ -49,7 +46,8 @@ static HRESULT sg_req_validate(const void *ptr, size_t nbytes)
     payload_len = req->hdr.frame_len - sizeof(*req);
 
     if (req->payload_len != payload_len) {
-        dprintf("SG Cmd: Payload length mismatch: got %i exp %i\n",
+        dprintfc(DPRINTF_CAT_SG, DPRINTF_LEVEL_ERROR,
+                "SG Cmd: Payload length mismatch: got %i exp %i\n",
                 req->payload_len,
                 (int) payload_len);
 
@@ -66,8 +64,6 @@ void sg_req_transact(
         sg_dispatch_fn_t dispatch,
         void *ctx)
 {
-    struct iobuf req_span;
-    union sg_req_any req;
     union sg_res_any res;
     HRESULT hr;
 
@@ -75,27 +71,17 @@ void sg_req_transact(
     assert(req_bytes != NULL);
     assert(dispatch != NULL);
 
-    req_span.bytes = req.bytes;
-    req_span.nbytes = sizeof(req.bytes);
-    req_span.pos = 0;
-
-    hr = sg_frame_decode(&req_span, req_bytes, req_nbytes);
-
-    if (FAILED(hr)) {
-        return;
-    }
-
-    hr = sg_req_validate(req.bytes, req_span.pos);
+    hr = sg_req_validate(req_bytes, req_nbytes);
 
     if (FAILED(hr)) {
         return;
     }
 
-    hr = dispatch(ctx, &req, &res);
+    hr = dispatch(ctx, req_bytes, &res);
 
     if (hr != S_FALSE) {
         if (FAILED(hr)) {
-            sg_res_error(&res.res, &req.req);
+            sg_res_error(&res.res, (const struct sg_req_header *) req_bytes);
         }
 
         sg_frame_encode(res_frame, res.bytes, res.res.hdr.frame_len);
@@ -30,6 +30,13 @@ typedef HRESULT (*sg_dispatch_fn_t)(
         const void *req,
         void *res);
 
+/* req_bytes is a single frame that has already been through the SG frame
+   decoder. Command handlers may read up to SG_REQ_MAX_SIZE bytes from it
+   regardless of the actual frame length, so it must point into a buffer at
+   least that large. */
+
+#define SG_REQ_MAX_SIZE 256
+
 void sg_req_transact(
         struct iobuf *res_frame,
         const uint8_t *req_bytes,
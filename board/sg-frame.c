@@ -4,15 +4,18 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "board/sg-frame.h"
 
 #include "hook/iobuf.h"
 
+#include "util/bytestuff.h"
 #include "util/dprintf.h"
 
-static HRESULT sg_frame_accept(struct iobuf *dest);
-static HRESULT sg_frame_encode_byte(struct iobuf *dest, uint8_t byte);
+static void sg_frame_decoder_compact(
+        struct sg_frame_decoder *dec,
+        struct iobuf *src);
 
 /* Frame structure:
 
@@ -27,80 +30,137 @@ static HRESULT sg_frame_encode_byte(struct iobuf *dest, uint8_t byte);
 
    0xD0 is an escape byte. Un-escape the subsequent byte by adding 1. */
 
-static HRESULT sg_frame_accept(struct iobuf *dest)
+void sg_frame_decoder_init(struct sg_frame_decoder *dec)
 {
-    uint8_t checksum;
-    size_t i;
+    assert(dec != NULL);
 
-    if (dest->pos < 1 || dest->pos != dest->bytes[0] + 1) {
-        dprintf("SG Frame: Size mismatch\n");
+    memset(dec, 0, sizeof(*dec));
+}
 
-        return S_FALSE;
-    }
+static void sg_frame_decoder_compact(
+        struct sg_frame_decoder *dec,
+        struct iobuf *src)
+{
+    /* Discard everything in front of the read cursor (i.e. the frame we
+       handed out last time, along with its escapes and checksum) */
 
-    checksum = 0;
+    memmove(&src->bytes[0], &src->bytes[dec->in], src->pos - dec->in);
+    src->pos -= dec->in;
+    dec->in = 0;
+    dec->out = 0;
+}
 
-    for (i = 0 ; i < dest->pos - 1 ; i++) {
-        checksum += dest->bytes[i];
+HRESULT sg_frame_decoder_next(
+        struct sg_frame_decoder *dec,
+        struct iobuf *src,
+        struct const_iobuf *frame)
+{
+    uint8_t checksum;
+    uint8_t byte;
+    size_t nskipped;
+
+    assert(dec != NULL);
+    assert(src != NULL);
+    assert(src->bytes != NULL || src->nbytes == 0);
+    assert(src->pos <= src->nbytes);
+    assert(dec->out <= dec->in && dec->in <= src->pos);
+    assert(frame != NULL);
+
+    if (dec->emitted) {
+        sg_frame_decoder_compact(dec, src);
+        dec->emitted = false;
     }
 
-    if (checksum != dest->bytes[dest->pos - 1]) {
-        dprintf("SG Frame: Checksum mismatch\n");
+    /* Unstuffed bytes of the frame in progress live in bytes[0..out), the
+       raw bytes we have yet to look at live in bytes[in..pos). Unstuffing
+       never makes anything longer, so out can never overtake in. */
 
-        return HRESULT_FROM_WIN32(ERROR_CRC);
-    }
+    nskipped = 0;
 
-    /* Discard checksum */
-    dest->pos--;
+    while (dec->in < src->pos) {
+        byte = src->bytes[dec->in++];
 
-    return S_OK;
-}
+        if (!dec->synced) {
+            if (byte == 0xE0) {
+                dec->synced = true;
+                dec->escape = false;
+                dec->out = 0;
+            } else {
+                nskipped++;
+            }
 
-HRESULT sg_frame_decode(struct iobuf *dest, const uint8_t *bytes, size_t nbytes)
-{
-    uint8_t byte;
-    size_t i;
+            continue;
+        }
 
-    assert(dest != NULL);
-    assert(dest->bytes != NULL || dest->nbytes == 0);
-    assert(dest->pos <= dest->nbytes);
-    assert(bytes != NULL);
+        if (byte == 0xE0) {
+            /* The host gave up on whatever it was sending, start over */
+            dprintfc(DPRINTF_CAT_SG, DPRINTF_LEVEL_ERROR,
+                    "SG Frame: Unescaped sync\n");
 
-    if (nbytes < 1 || bytes[0] != 0xE0) {
-        dprintf("SG Frame: Bad sync\n");
+            dec->escape = false;
+            dec->out = 0;
 
-        return E_FAIL;
-    }
+            continue;
+        }
 
-    dest->pos = 0;
-    i = 1;
+        if (byte == 0xD0 && !dec->escape) {
+            dec->escape = true;
 
-    while (i < nbytes) {
-        if (dest->pos >= dest->nbytes) {
-            return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+            continue;
         }
 
-        byte = bytes[i++];
+        if (dec->escape) {
+            byte++;
+            dec->escape = false;
+        }
 
-        if (byte == 0xE0) {
-            dprintf("SG Frame: Unescaped sync\n");
+        src->bytes[dec->out++] = byte;
 
-            return E_FAIL;
-        } else if (byte == 0xD0) {
-            if (i >= nbytes) {
-                dprintf("SG Frame: Trailing escape\n");
+        if (dec->out != (size_t) src->bytes[0] + 1) {
+            continue;
+        }
 
-                return E_FAIL;
-            }
+        /* Got the whole frame, check it */
 
-            byte = bytes[i++];
-            dest->bytes[dest->pos++] = byte + 1;
-        } else {
-            dest->bytes[dest->pos++] = byte;
+        dec->synced = false;
+        checksum = bytestuff_sum(src->bytes, dec->out - 1);
+
+        if (checksum != src->bytes[dec->out - 1]) {
+            dprintfc(DPRINTF_CAT_SG, DPRINTF_LEVEL_ERROR,
+                    "SG Frame: Checksum mismatch\n");
+
+            dec->out = 0;
+
+            continue;
         }
+
+        if (nskipped > 0) {
+            dprintfc(DPRINTF_CAT_SG, DPRINTF_LEVEL_ERROR,
+                    "SG Frame: Skipped %u bytes of garbage\n",
+                    (unsigned int) nskipped);
+        }
+
+        frame->bytes = src->bytes;
+        frame->nbytes = dec->out - 1;
+        frame->pos = 0;
+        dec->emitted = true;
+
+        return S_OK;
+    }
+
+    if (nskipped > 0) {
+        dprintfc(DPRINTF_CAT_SG, DPRINTF_LEVEL_ERROR,
+                "SG Frame: Skipped %u bytes of garbage\n",
+                (unsigned int) nskipped);
     }
 
-    return sg_frame_accept(dest);
+    /* Out of input. Keep the partial frame (if any) at the front of the
+       buffer and let the caller append the rest of it directly after. */
+
+    src->pos = dec->out;
+    dec->in = dec->out;
+
+    return S_FALSE;
 }
 
 HRESULT sg_frame_encode(
@@ -110,8 +170,6 @@ HRESULT sg_frame_encode(
 {
     const uint8_t *src;
     uint8_t checksum;
-    uint8_t byte;
-    size_t i;
     HRESULT hr;
 
     assert(dest != NULL);
@@ -128,38 +186,13 @@ HRESULT sg_frame_encode(
     }
 
     dest->bytes[dest->pos++] = 0xE0;
-    checksum = 0;
+    checksum = bytestuff_sum(src, nbytes);
 
-    for (i = 0 ; i < nbytes ; i++) {
-        byte = src[i];
-        checksum += byte;
-
-        hr = sg_frame_encode_byte(dest, byte);
-
-        if (FAILED(hr)) {
-            return hr;
-        }
-    }
-
-    return sg_frame_encode_byte(dest, checksum);
-}
-
-static HRESULT sg_frame_encode_byte(struct iobuf *dest, uint8_t byte)
-{
-    if (byte == 0xD0 || byte == 0xE0) {
-        if (dest->pos + 2 > dest->nbytes) {
-            return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
-        }
-
-        dest->bytes[dest->pos++] = 0xD0;
-        dest->bytes[dest->pos++] = byte - 1;
-    } else {
-        if (dest->pos + 1 > dest->nbytes) {
-            return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
-        }
+    hr = bytestuff_encode(dest, src, nbytes, 0xE0, 0xD0);
 
-        dest->bytes[dest->pos++] = byte;
+    if (FAILED(hr)) {
+        return hr;
     }
 
-    return S_OK;
+    return bytestuff_encode(dest, &checksum, sizeof(checksum), 0xE0, 0xD0);
 }
@@ -2,14 +2,36 @@
 
 #include <windows.h>
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #include "hook/iobuf.h"
 
-HRESULT sg_frame_decode(
-        struct iobuf *dest,
-        const uint8_t *bytes,
-        size_t nbytes);
+/* Resumable decoder for a stream of SG frames.
+
+   Frames are unstuffed in place at the start of the source buffer, so the
+   caller must not touch src->bytes between calls except to append newly
+   received data at src->pos. */
+
+struct sg_frame_decoder {
+    size_t in;
+    size_t out;
+    bool synced;
+    bool escape;
+    bool emitted;
+};
+
+void sg_frame_decoder_init(struct sg_frame_decoder *dec);
+
+/* Returns S_OK and points frame at the next complete frame (size byte through
+   to the end of the body, without the checksum), or S_FALSE once src has run
+   dry. The frame remains valid until the next call. Corrupt frames and
+   garbage between frames are logged and skipped. */
+
+HRESULT sg_frame_decoder_next(
+        struct sg_frame_decoder *dec,
+        struct iobuf *src,
+        struct const_iobuf *frame);
 
 HRESULT sg_frame_encode(struct iobuf *dest, const void *ptr, size_t nbytes);
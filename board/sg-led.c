@@ -58,31 +58,13 @@ void sg_led_transact(
     sg_req_transact(res_frame, req_bytes, req_nbytes, sg_led_dispatch, led);
 }
 
-#ifdef NDEBUG
-#define sg_led_dprintfv(led, fmt, ap)
-#define sg_led_dprintf(led, fmt, ...)
-#else
-static void sg_led_dprintfv(
-        const struct sg_led *led,
-        const char *fmt,
-        va_list ap)
-{
-    dprintf("RGB LED %02x: ", led->addr);
-    dprintfv(fmt, ap);
-}
-
-static void sg_led_dprintf(
-        const struct sg_led *led,
-        const char *fmt,
-        ...)
-{
-    va_list ap;
-
-    va_start(ap, fmt);
-    sg_led_dprintfv(led, fmt, ap);
-    va_end(ap);
-}
-#endif
+#define sg_led_dprintf(led, fmt, ...) \
+        dprintfc( \
+                DPRINTF_CAT_SG, \
+                DPRINTF_LEVEL_INFO, \
+                "RGB LED %02x: " fmt, \
+                (led)->addr, \
+                ## __VA_ARGS__)
 
 static HRESULT sg_led_dispatch(
         void *ctx,
@@ -137,7 +119,10 @@ static HRESULT sg_led_cmd_reset(
     }
 
     if (FAILED(hr)) {
-        sg_led_dprintf(led, "led->ops->reset: Error %x\n", hr);
+        sg_led_dprintf(
+                led,
+                "led->ops->reset: Error %x\n",
+                (int) hr);
         return hr;
     }
 
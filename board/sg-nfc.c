@@ -79,31 +79,13 @@ void sg_nfc_init(
     nfc->addr = addr;
 }
 
-#ifdef NDEBUG
-#define sg_nfc_dprintfv(nfc, fmt, ap)
-#define sg_nfc_dprintf(nfc, fmt, ...)
-#else
-static void sg_nfc_dprintfv(
-        const struct sg_nfc *nfc,
-        const char *fmt,
-        va_list ap)
-{
-    dprintf("NFC %02x: ", nfc->addr);
-    dprintfv(fmt, ap);
-}
-
-static void sg_nfc_dprintf(
-        const struct sg_nfc *nfc,
-        const char *fmt,
-        ...)
-{
-    va_list ap;
-
-    va_start(ap, fmt);
-    sg_nfc_dprintfv(nfc, fmt, ap);
-    va_end(ap);
-}
-#endif
+#define sg_nfc_dprintf(nfc, fmt, ...) \
+        dprintfc( \
+                DPRINTF_CAT_SG, \
+                DPRINTF_LEVEL_INFO, \
+                "NFC %02x: " fmt, \
+                (nfc)->addr, \
+                ## __VA_ARGS__)
 
 void sg_nfc_transact(
         struct sg_nfc *nfc,
@@ -401,10 +383,10 @@ static HRESULT sg_nfc_cmd_felica_encap(
     f_res.nbytes = sizeof(res->payload);
     f_res.pos = 1;
 
-#if 0
-    dprintf("FELICA OUTBOUND:\n");
-    dump_const_iobuf(&f_req);
-#endif
+    if (dprintf_enabled(DPRINTF_CAT_SG, DPRINTF_LEVEL_TRACE)) {
+        dprintf("FELICA OUTBOUND:\n");
+        dump_const_iobuf(&f_req);
+    }
 
     hr = felica_transact(&nfc->felica, &f_req, &f_res);
 
@@ -415,10 +397,10 @@ static HRESULT sg_nfc_cmd_felica_encap(
     sg_res_init(&res->res, &req->req, f_res.pos);
     res->payload[0] = f_res.pos;
 
-#if 0
-    dprintf("FELICA INBOUND:\n");
-    dump_iobuf(&f_res);
-#endif
+    if (dprintf_enabled(DPRINTF_CAT_SG, DPRINTF_LEVEL_TRACE)) {
+        dprintf("FELICA INBOUND:\n");
+        dump_iobuf(&f_res);
+    }
 
     return S_OK;
 }
@@ -6,12 +6,15 @@
 
 #include "aimeio/aimeio.h"
 
+#include "board/sg-cmd.h"
+#include "board/sg-frame.h"
 #include "board/sg-led.h"
 #include "board/sg-nfc.h"
 #include "board/sg-reader.h"
 
 #include "hook/iohook.h"
 
+#include "hooklib/iostat.h"
 #include "hooklib/uart.h"
 
 #include "util/dprintf.h"
@@ -43,9 +46,17 @@ static HRESULT sg_reader_start_hr;
 static struct uart sg_reader_uart;
 static uint8_t sg_reader_written_bytes[520];
 static uint8_t sg_reader_readable_bytes[520];
+static struct sg_frame_decoder sg_reader_decoder;
 static struct sg_nfc sg_reader_nfc;
 static struct sg_led sg_reader_led;
 
+/* Decoded requests are handed to the command handlers straight out of the
+   UART's write buffer. */
+
+static_assert(
+        sizeof(sg_reader_written_bytes) >= SG_REQ_MAX_SIZE,
+        "SG reader write buffer size");
+
 HRESULT sg_reader_hook_init(
         const struct aime_config *cfg,
         unsigned int port_no)
@@ -62,12 +73,13 @@ HRESULT sg_reader_hook_init(
     InitializeCriticalSection(&sg_reader_lock);
 
     uart_init(&sg_reader_uart, port_no);
+    sg_frame_decoder_init(&sg_reader_decoder);
     sg_reader_uart.written.bytes = sg_reader_written_bytes;
     sg_reader_uart.written.nbytes = sizeof(sg_reader_written_bytes);
     sg_reader_uart.readable.bytes = sg_reader_readable_bytes;
     sg_reader_uart.readable.nbytes = sizeof(sg_reader_readable_bytes);
 
-    return iohook_push_handler(sg_reader_handle_irp);
+    return iostat_push_handler("sg-reader", sg_reader_handle_irp);
 }
 
 static HRESULT sg_reader_handle_irp(struct irp *irp)
@@ -89,35 +101,42 @@ static HRESULT sg_reader_handle_irp(struct irp *irp)
 
 static HRESULT sg_reader_handle_irp_locked(struct irp *irp)
 {
+    struct const_iobuf frame;
     HRESULT hr;
 
-#if 0
-    if (irp->op == IRP_OP_WRITE) {
+    if (    irp->op == IRP_OP_WRITE &&
+            dprintf_enabled(DPRINTF_CAT_SG, DPRINTF_LEVEL_TRACE)) {
         dprintf("WRITE:\n");
         dump_const_iobuf(&irp->write);
     }
-#endif
 
-#if 0
-    if (irp->op == IRP_OP_READ) {
+    if (    irp->op == IRP_OP_READ &&
+            dprintf_enabled(DPRINTF_CAT_SG, DPRINTF_LEVEL_TRACE)) {
         dprintf("READ:\n");
         dump_iobuf(&sg_reader_uart.readable);
     }
-#endif
 
     if (irp->op == IRP_OP_OPEN) {
+        /* Don't let half a frame from the previous session leak into this
+           one */
+
+        sg_reader_uart.written.pos = 0;
+        sg_frame_decoder_init(&sg_reader_decoder);
+
         /* Unfortunately the card reader UART gets opened and closed
            repeatedly */
 
         if (!sg_reader_started) {
-            dprintf("NFC Assembly: Starting backend DLL\n");
+            dprintfc(DPRINTF_CAT_SG, DPRINTF_LEVEL_INFO,
+                    "NFC Assembly: Starting backend DLL\n");
             hr = aime_io_init();
 
             sg_reader_started = true;
             sg_reader_start_hr = hr;
 
             if (FAILED(hr)) {
-                dprintf("NFC Assembly: Backend error: %x\n", (int) hr);
+                dprintfc(DPRINTF_CAT_SG, DPRINTF_LEVEL_ERROR,
+                        "NFC Assembly: Backend error: %x\n", (int) hr);
 
                 return hr;
             }
@@ -136,19 +155,26 @@ static HRESULT sg_reader_handle_irp_locked(struct irp *irp)
         return hr;
     }
 
-    sg_nfc_transact(
-            &sg_reader_nfc,
-            &sg_reader_uart.readable,
-            sg_reader_uart.written.bytes,
-            sg_reader_uart.written.pos);
-
-    sg_led_transact(
-            &sg_reader_led,
-            &sg_reader_uart.readable,
-            sg_reader_uart.written.bytes,
-            sg_reader_uart.written.pos);
-
-    sg_reader_uart.written.pos = 0;
+    /* amdaemon doesn't wait for a response before sending its next request,
+       so a single write can contain any number of frames, and a frame can be
+       split across several writes. */
+
+    while (sg_frame_decoder_next(
+            &sg_reader_decoder,
+            &sg_reader_uart.written,
+            &frame) == S_OK) {
+        sg_nfc_transact(
+                &sg_reader_nfc,
+                &sg_reader_uart.readable,
+                frame.bytes,
+                frame.nbytes);
+
+        sg_led_transact(
+                &sg_reader_led,
+                &sg_reader_uart.readable,
+                frame.bytes,
+                frame.nbytes);
+    }
 
     return hr;
 }
@@ -9,9 +9,10 @@
 
 #include "hook/iobuf.h"
 
+#include "util/bytestuff.h"
+
 static void slider_frame_sync(struct iobuf *src);
 static HRESULT slider_frame_accept(const struct iobuf *dest);
-static HRESULT slider_frame_encode_byte(struct iobuf *dest, uint8_t byte);
 
 /* Frame structure:
 
@@ -37,20 +38,11 @@ static void slider_frame_sync(struct iobuf *src)
 
 static HRESULT slider_frame_accept(const struct iobuf *dest)
 {
-    uint8_t checksum;
-    size_t i;
-
-    if (dest->pos < 2 || dest->pos != dest->bytes[2] + 4) {
+    if (dest->pos < 3 || dest->pos != dest->bytes[2] + 4) {
         return S_FALSE;
     }
 
-    checksum = 0;
-
-    for (i = 0 ; i < dest->pos ; i++) {
-        checksum += dest->bytes[i];
-    }
-
-    if (checksum != 0) {
+    if (bytestuff_sum(dest->bytes, dest->pos) != 0) {
         return HRESULT_FROM_WIN32(ERROR_CRC);
     }
 
@@ -125,8 +117,6 @@ HRESULT slider_frame_encode(
 {
     const uint8_t *src;
     uint8_t checksum;
-    uint8_t byte;
-    size_t i;
     HRESULT hr;
 
     assert(dest != NULL);
@@ -143,38 +133,13 @@ HRESULT slider_frame_encode(
     }
 
     dest->bytes[dest->pos++] = 0xFF;
-    checksum = 0xFF;
+    checksum = -bytestuff_sum(src, nbytes);
 
-    for (i = 1 ; i < nbytes ; i++) {
-        byte = src[i];
-        checksum += byte;
+    hr = bytestuff_encode(dest, &src[1], nbytes - 1, 0xFF, 0xFD);
 
-        hr = slider_frame_encode_byte(dest, byte);
-
-        if (FAILED(hr)) {
-            return hr;
-        }
+    if (FAILED(hr)) {
+        return hr;
     }
 
-    return slider_frame_encode_byte(dest, -checksum);
-}
-
-static HRESULT slider_frame_encode_byte(struct iobuf *dest, uint8_t byte)
-{
-    if (byte == 0xFF || byte == 0xFD) {
-        if (dest->pos + 2 > dest->nbytes) {
-            return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
-        }
-
-        dest->bytes[dest->pos++] = 0xFD;
-        dest->bytes[dest->pos++] = byte - 1;
-    } else {
-        if (dest->pos + 1 > dest->nbytes) {
-            return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
-        }
-
-        dest->bytes[dest->pos++] = byte;
-    }
-
-    return S_OK;
+    return bytestuff_encode(dest, &checksum, sizeof(checksum), 0xFF, 0xFD);
 }
@@ -16,6 +16,7 @@
 
 #include "hook/iohook.h"
 
+#include "hooklib/iostat.h"
 #include "hooklib/uart.h"
 
 #include "util/dprintf.h"
@@ -35,7 +36,7 @@ HRESULT vfd_hook_init(unsigned int port_no)
     vfd_uart.readable.bytes = vfd_readable;
     vfd_uart.readable.nbytes = sizeof(vfd_readable);
 
-    return iohook_push_handler(vfd_handle_irp);
+    return iostat_push_handler("vfd", vfd_handle_irp);
 }
 
 static HRESULT vfd_handle_irp(struct irp *irp)
@@ -18,12 +18,15 @@
 #include "platform/config.h"
 #include "platform/platform.h"
 
+#include "util/config.h"
+
 void slider_config_load(struct slider_config *cfg, const wchar_t *filename)
 {
     assert(cfg != NULL);
     assert(filename != NULL);
 
     cfg->enable = GetPrivateProfileIntW(L"slider", L"enable", 1, filename);
+    cfg->backlog = GetPrivateProfileIntW(L"slider", L"backlog", 1, filename);
 }
 
 void chuni_hook_config_load(
@@ -40,4 +43,6 @@ void chuni_hook_config_load(
     aime_config_load(&cfg->aime, filename);
     gfx_config_load(&cfg->gfx, filename);
     slider_config_load(&cfg->slider, filename);
+    dprintf_config_load(&cfg->dprintf, filename);
+    iostat_config_load(&cfg->iostat, filename);
 }
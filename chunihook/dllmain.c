@@ -16,6 +16,7 @@
 #include "hook/process.h"
 
 #include "hooklib/gfx.h"
+#include "hooklib/iostat.h"
 #include "hooklib/serial.h"
 #include "hooklib/spike.h"
 
@@ -58,6 +59,8 @@ static DWORD CALLBACK chuni_pre_startup(void)
     /* Config load */
 
     chuni_hook_config_load(&chuni_hook_cfg, L".\\segatools.ini");
+    dprintf_init(&chuni_hook_cfg.dprintf);
+    iostat_init(&chuni_hook_cfg.iostat);
 
     /* Hook Win32 APIs */
 
@@ -16,6 +16,7 @@
 #include "hook/iobuf.h"
 #include "hook/iohook.h"
 
+#include "hooklib/iostat.h"
 #include "hooklib/uart.h"
 
 #include "util/dprintf.h"
@@ -32,11 +33,43 @@ static HRESULT slider_req_auto_scan_stop(void);
 static HRESULT slider_req_set_led(const struct slider_req_set_led *req);
 
 static void slider_res_auto_scan(const uint8_t *state);
+static void slider_scan_retire_locked(void);
+static void slider_scan_flush_locked(void);
+static HRESULT slider_scan_send_locked(const uint8_t *state);
+
+/* The IO DLL calls slider_res_auto_scan() every millisecond or so, whether or
+   not the game is keeping up. Rather than letting stale reports pile up in
+   the UART buffer, at most `backlog' of them are allowed to sit there
+   unread. Beyond that, the latest sample waits in a single-entry mailbox and
+   gets overwritten by newer samples until the game reads enough to make
+   room for it.
+
+   Queued reports are tracked by the absolute stream offset of their last
+   byte, so that we can tell when the game has read them no matter what else
+   got queued in between. */
+
+enum {
+    SLIDER_SCAN_BACKLOG_MAX = 16,
+};
+
+struct slider_scan_stats {
+    uint32_t sent;
+    uint32_t coalesced;
+    uint32_t overflows;
+};
 
 static CRITICAL_SECTION slider_lock;
 static struct uart slider_uart;
 static uint8_t slider_written_bytes[520];
 static uint8_t slider_readable_bytes[520];
+static unsigned int slider_scan_backlog;
+static uint64_t slider_nread;
+static uint64_t slider_scan_ends[SLIDER_SCAN_BACKLOG_MAX];
+static unsigned int slider_scan_head;
+static unsigned int slider_scan_count;
+static uint8_t slider_scan_mailbox[32];
+static bool slider_scan_pending;
+static struct slider_scan_stats slider_scan_stats;
 
 HRESULT slider_hook_init(const struct slider_config *cfg)
 {
@@ -46,6 +79,14 @@ HRESULT slider_hook_init(const struct slider_config *cfg)
         return S_FALSE;
     }
 
+    slider_scan_backlog = cfg->backlog;
+
+    if (slider_scan_backlog < 1) {
+        slider_scan_backlog = 1;
+    } else if (slider_scan_backlog > SLIDER_SCAN_BACKLOG_MAX) {
+        slider_scan_backlog = SLIDER_SCAN_BACKLOG_MAX;
+    }
+
     InitializeCriticalSection(&slider_lock);
 
     uart_init(&slider_uart, 1);
@@ -54,7 +95,7 @@ HRESULT slider_hook_init(const struct slider_config *cfg)
     slider_uart.readable.bytes = slider_readable_bytes;
     slider_uart.readable.nbytes = sizeof(slider_readable_bytes);
 
-    return iohook_push_handler(slider_handle_irp);
+    return iostat_push_handler("slider", slider_handle_irp);
 }
 
 static HRESULT slider_handle_irp(struct irp *irp)
@@ -78,30 +119,40 @@ static HRESULT slider_handle_irp_locked(struct irp *irp)
 {
     union slider_req_any req;
     struct iobuf req_iobuf;
+    size_t readable_pos;
     HRESULT hr;
 
     if (irp->op == IRP_OP_OPEN) {
-        dprintf("Chunithm slider: Starting backend DLL\n");
+        dprintfc(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_INFO,
+                "Chunithm slider: Starting backend DLL\n");
         hr = chuni_io_slider_init();
 
         if (FAILED(hr)) {
-            dprintf("Chunithm slider: Backend DLL error: %x\n", (int) hr);
+            dprintfc(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_ERROR,
+                    "Chunithm slider: Backend DLL error: %x\n", (int) hr);
 
             return hr;
         }
     }
 
+    readable_pos = slider_uart.readable.pos;
     hr = uart_handle_irp(&slider_uart, irp);
 
+    if (SUCCEEDED(hr) && irp->op == IRP_OP_READ) {
+        slider_nread += readable_pos - slider_uart.readable.pos;
+        slider_scan_retire_locked();
+        slider_scan_flush_locked();
+    }
+
     if (FAILED(hr) || irp->op != IRP_OP_WRITE) {
         return hr;
     }
 
     for (;;) {
-#if 0
-        dprintf("TX Buffer:\n");
-        dump_iobuf(&slider_uart.written);
-#endif
+        if (dprintf_enabled(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_TRACE)) {
+            dprintf("TX Buffer:\n");
+            dump_iobuf(&slider_uart.written);
+        }
 
         req_iobuf.bytes = req.bytes;
         req_iobuf.nbytes = sizeof(req.bytes);
@@ -111,21 +162,23 @@ static HRESULT slider_handle_irp_locked(struct irp *irp)
 
         if (hr != S_OK) {
             if (FAILED(hr)) {
-                dprintf("Chunithm slider: Deframe error: %x\n", (int) hr);
+                dprintfc(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_ERROR,
+                        "Chunithm slider: Deframe error: %x\n", (int) hr);
             }
 
             return hr;
         }
 
-#if 0
-        dprintf("Deframe Buffer:\n");
-        dump_iobuf(&req_iobuf);
-#endif
+        if (dprintf_enabled(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_TRACE)) {
+            dprintf("Deframe Buffer:\n");
+            dump_iobuf(&req_iobuf);
+        }
 
         hr = slider_req_dispatch(&req);
 
         if (FAILED(hr)) {
-            dprintf("Chunithm slider: Processing error: %x\n", (int) hr);
+            dprintfc(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_ERROR,
+                    "Chunithm slider: Processing error: %x\n", (int) hr);
         }
     }
 }
@@ -149,7 +202,8 @@ static HRESULT slider_req_dispatch(const union slider_req_any *req)
         return slider_req_auto_scan_stop();
 
     default:
-        dprintf("Unhandled command %02x\n", req->hdr.cmd);
+        dprintfc(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_ERROR,
+                "Unhandled command %02x\n", req->hdr.cmd);
 
         return S_OK;
     }
@@ -159,7 +213,8 @@ static HRESULT slider_req_reset(void)
 {
     struct slider_hdr resp;
 
-    dprintf("Chunithm slider: Reset\n");
+    dprintfc(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_INFO,
+            "Chunithm slider: Reset\n");
 
     resp.sync = 0xFF;
     resp.cmd = SLIDER_CMD_RESET;
@@ -172,7 +227,8 @@ static HRESULT slider_req_get_board_info(void)
 {
     struct slider_resp_get_board_info resp;
 
-    dprintf("Chunithm slider: Get firmware version\n");
+    dprintfc(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_INFO,
+            "Chunithm slider: Get firmware version\n");
 
     memset(&resp, 0, sizeof(resp));
     resp.hdr.sync = SLIDER_FRAME_SYNC;
@@ -189,7 +245,13 @@ static HRESULT slider_req_get_board_info(void)
 
 static HRESULT slider_req_auto_scan_start(void)
 {
-    dprintf("Chunithm slider: Start slider notifications\n");
+    dprintfc(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_INFO,
+            "Chunithm slider: Start slider notifications\n");
+
+    /* Count from here, so that the summary logged when notifications stop
+       describes this session only. */
+
+    memset(&slider_scan_stats, 0, sizeof(slider_scan_stats));
     chuni_io_slider_start(slider_res_auto_scan);
 
     /* This message is not acknowledged */
@@ -201,7 +263,8 @@ static HRESULT slider_req_auto_scan_stop(void)
 {
     struct slider_hdr resp;
 
-    dprintf("Chunithm slider: Stop slider notifications\n");
+    dprintfc(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_INFO,
+            "Chunithm slider: Stop slider notifications\n");
 
     /* IO DLL worker thread might attempt to invoke the callback (which needs
        to take slider_lock, which we are currently holding) before noticing that
@@ -212,6 +275,17 @@ static HRESULT slider_req_auto_scan_stop(void)
     chuni_io_slider_stop();
     EnterCriticalSection(&slider_lock);
 
+    /* Nobody wants whatever was still waiting to go out */
+
+    slider_scan_pending = false;
+
+    dprintfc(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_INFO,
+            "Chunithm slider: Since start: %u reports sent, %u coalesced, "
+                    "%u overflowed\n",
+            slider_scan_stats.sent,
+            slider_scan_stats.coalesced,
+            slider_scan_stats.overflows);
+
     resp.sync = SLIDER_FRAME_SYNC;
     resp.cmd = SLIDER_CMD_AUTO_SCAN_STOP;
     resp.nbytes = 0;
@@ -229,15 +303,84 @@ static HRESULT slider_req_set_led(const struct slider_req_set_led *req)
 }
 
 static void slider_res_auto_scan(const uint8_t *state)
+{
+    EnterCriticalSection(&slider_lock);
+
+    slider_scan_retire_locked();
+
+    if (slider_scan_pending) {
+        /* Whatever was waiting in the mailbox is stale now */
+        slider_scan_pending = false;
+        slider_scan_stats.coalesced++;
+    }
+
+    if (slider_scan_count < slider_scan_backlog) {
+        if (SUCCEEDED(slider_scan_send_locked(state))) {
+            LeaveCriticalSection(&slider_lock);
+
+            return;
+        }
+
+        slider_scan_stats.overflows++;
+    }
+
+    memcpy(slider_scan_mailbox, state, sizeof(slider_scan_mailbox));
+    slider_scan_pending = true;
+
+    LeaveCriticalSection(&slider_lock);
+}
+
+static void slider_scan_retire_locked(void)
+{
+    /* Forget about queued reports that the game has read in full */
+
+    while (     slider_scan_count > 0 &&
+                slider_scan_ends[slider_scan_head] <= slider_nread) {
+        slider_scan_head = (slider_scan_head + 1) % SLIDER_SCAN_BACKLOG_MAX;
+        slider_scan_count--;
+    }
+}
+
+static void slider_scan_flush_locked(void)
+{
+    if (!slider_scan_pending || slider_scan_count >= slider_scan_backlog) {
+        return;
+    }
+
+    if (SUCCEEDED(slider_scan_send_locked(slider_scan_mailbox))) {
+        slider_scan_pending = false;
+    } else {
+        slider_scan_stats.overflows++;
+    }
+}
+
+static HRESULT slider_scan_send_locked(const uint8_t *state)
 {
     struct slider_resp_auto_scan resp;
+    unsigned int tail;
+    size_t pos;
+    HRESULT hr;
 
     resp.hdr.sync = SLIDER_FRAME_SYNC;
     resp.hdr.cmd = SLIDER_CMD_AUTO_SCAN;
     resp.hdr.nbytes = sizeof(resp.pressure);
     memcpy(resp.pressure, state, sizeof(resp.pressure));
 
-    EnterCriticalSection(&slider_lock);
-    slider_frame_encode(&slider_uart.readable, &resp, sizeof(resp));
-    LeaveCriticalSection(&slider_lock);
+    /* Don't leave half a frame behind if it doesn't fit */
+
+    pos = slider_uart.readable.pos;
+    hr = slider_frame_encode(&slider_uart.readable, &resp, sizeof(resp));
+
+    if (FAILED(hr)) {
+        slider_uart.readable.pos = pos;
+
+        return hr;
+    }
+
+    tail = (slider_scan_head + slider_scan_count) % SLIDER_SCAN_BACKLOG_MAX;
+    slider_scan_ends[tail] = slider_nread + slider_uart.readable.pos;
+    slider_scan_count++;
+    slider_scan_stats.sent++;
+
+    return S_OK;
 }
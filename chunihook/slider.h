@@ -6,6 +6,11 @@
 
 struct slider_config {
     bool enable;
+
+    /* Maximum number of unread auto-scan reports to queue up for the game.
+       Anything that arrives beyond that replaces the newest pending report
+       instead of queueing behind the older ones. */
+    unsigned int backlog;
 };
 
 HRESULT slider_hook_init(const struct slider_config *cfg);
@@ -6,30 +6,71 @@
 
 #include "chuniio/chuniio.h"
 #include "chuniio/config.h"
+#include "chuniio/keys.h"
+#include "chuniio/pace.h"
 
 static unsigned int __stdcall chuni_io_slider_thread_proc(void *ctx);
 
 static bool chuni_io_coin;
 static uint16_t chuni_io_coins;
+static uint32_t chuni_io_coin_presses;
 static uint8_t chuni_io_hand_pos;
 static HANDLE chuni_io_slider_thread;
 static bool chuni_io_slider_stop_flag;
+static struct chuni_io_pace chuni_io_slider_pace;
 static struct chuni_io_config chuni_io_cfg;
 
 HRESULT chuni_io_jvs_init(void)
 {
+    uint8_t vks[4 + _countof(chuni_io_cfg.vk_cell)];
+    HRESULT hr;
+    size_t i;
+
     chuni_io_config_load(&chuni_io_cfg, L".\\segatools.ini");
 
+    vks[0] = chuni_io_cfg.vk_test;
+    vks[1] = chuni_io_cfg.vk_service;
+    vks[2] = chuni_io_cfg.vk_coin;
+    vks[3] = chuni_io_cfg.vk_ir;
+
+    for (i = 0 ; i < _countof(chuni_io_cfg.vk_cell) ; i++) {
+        vks[4 + i] = chuni_io_cfg.vk_cell[i];
+    }
+
+    hr = chuni_io_keys_init(chuni_io_cfg.raw_input, vks, _countof(vks));
+
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    /* Don't turn a coin key that is being held during startup into a coin */
+
+    chuni_io_coin_presses = chuni_io_keys_presses(chuni_io_cfg.vk_coin);
+
     return S_OK;
 }
 
 void chuni_io_jvs_read_coin_counter(uint16_t *out)
 {
+    struct chuni_io_keys keys;
+    uint32_t presses;
+
     if (out == NULL) {
         return;
     }
 
-    if (GetAsyncKeyState(chuni_io_cfg.vk_coin)) {
+    /* Read the press counter after the snapshot: any press that shows up as
+       held in the snapshot has then been counted already, so it can't be
+       counted twice below. */
+
+    chuni_io_keys_snapshot(&keys);
+    presses = chuni_io_keys_presses(chuni_io_cfg.vk_coin);
+
+    if (presses != chuni_io_coin_presses) {
+        chuni_io_coins += (uint16_t) (presses - chuni_io_coin_presses);
+        chuni_io_coin_presses = presses;
+        chuni_io_coin = true;
+    } else if (chuni_io_keys_test(&keys, chuni_io_cfg.vk_coin)) {
         if (!chuni_io_coin) {
             chuni_io_coin = true;
             chuni_io_coins++;
@@ -43,17 +84,20 @@ void chuni_io_jvs_read_coin_counter(uint16_t *out)
 
 void chuni_io_jvs_poll(uint8_t *opbtn, uint8_t *beams)
 {
+    struct chuni_io_keys keys;
     size_t i;
 
-    if (GetAsyncKeyState(chuni_io_cfg.vk_test)) {
+    chuni_io_keys_snapshot(&keys);
+
+    if (chuni_io_keys_test(&keys, chuni_io_cfg.vk_test)) {
         *opbtn |= 0x01; /* Test */
     }
 
-    if (GetAsyncKeyState(chuni_io_cfg.vk_service)) {
+    if (chuni_io_keys_test(&keys, chuni_io_cfg.vk_service)) {
         *opbtn |= 0x02; /* Service */
     }
 
-    if (GetAsyncKeyState(chuni_io_cfg.vk_ir)) {
+    if (chuni_io_keys_test(&keys, chuni_io_cfg.vk_ir)) {
         if (chuni_io_hand_pos < 6) {
             chuni_io_hand_pos++;
         }
@@ -114,22 +158,55 @@ void chuni_io_slider_set_leds(const uint8_t *rgb)
 static unsigned int __stdcall chuni_io_slider_thread_proc(void *ctx)
 {
     chuni_io_slider_callback_t callback;
+    struct chuni_io_keys keys;
+    uint32_t presses[32];
+    uint32_t npresses;
     uint8_t pressure[32];
+    HRESULT hr;
     size_t i;
 
     callback = ctx;
 
+    hr = chuni_io_pace_init(
+            &chuni_io_slider_pace,
+            chuni_io_cfg.slider_rate,
+            chuni_io_cfg.slider_spin);
+
+    for (i = 0 ; i < _countof(presses) ; i++) {
+        presses[i] = chuni_io_keys_presses(chuni_io_cfg.vk_cell[i]);
+    }
+
     while (!chuni_io_slider_stop_flag) {
+        chuni_io_keys_snapshot(&keys);
+
         for (i = 0 ; i < _countof(pressure) ; i++) {
-            if (GetAsyncKeyState(chuni_io_cfg.vk_cell[i]) & 0x8000) {
+            /* A tap that came and went since the last scan still gets
+               reported as pressed for this one scan. */
+
+            npresses = chuni_io_keys_presses(chuni_io_cfg.vk_cell[i]);
+
+            if (    chuni_io_keys_test(&keys, chuni_io_cfg.vk_cell[i]) ||
+                    npresses != presses[i]) {
                 pressure[i] = 128;
             } else {
                 pressure[i] = 0;
             }
+
+            presses[i] = npresses;
         }
 
         callback(pressure);
-        Sleep(1);
+
+        if (SUCCEEDED(hr)) {
+            chuni_io_pace_wait(&chuni_io_slider_pace);
+        } else {
+            Sleep(1);
+        }
+    }
+
+    if (SUCCEEDED(hr)) {
+        chuni_io_pace_dump(&chuni_io_slider_pace, "slider");
+        chuni_io_pace_fini(&chuni_io_slider_pace);
     }
 
     return 0;
@@ -31,6 +31,7 @@ void chuni_io_config_load(
     cfg->vk_service = GetPrivateProfileIntW(L"io3", L"service", '2', filename);
     cfg->vk_coin = GetPrivateProfileIntW(L"io3", L"coin", '3', filename);
     cfg->vk_ir = GetPrivateProfileIntW(L"io3", L"ir", VK_SPACE, filename);
+    cfg->raw_input = GetPrivateProfileIntW(L"io3", L"rawinput", 1, filename);
 
     for (i = 0 ; i < 32 ; i++) {
         swprintf_s(key, _countof(key), L"cell%i", i + 1);
@@ -40,4 +41,21 @@ void chuni_io_config_load(
                 chuni_io_default_cells[i],
                 filename);
     }
+
+    cfg->slider_rate = GetPrivateProfileIntW(
+            L"slider",
+            L"rate",
+            1000,
+            filename);
+    cfg->slider_spin = GetPrivateProfileIntW(
+            L"slider",
+            L"spin",
+            0,
+            filename);
+
+    /* Anything faster than this just floods the game with reports */
+
+    if (cfg->slider_rate > 8000) {
+        cfg->slider_rate = 8000;
+    }
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -9,6 +10,9 @@ struct chuni_io_config {
     uint8_t vk_coin;
     uint8_t vk_ir;
     uint8_t vk_cell[32];
+    bool raw_input;
+    unsigned int slider_rate;
+    unsigned int slider_spin;
 };
 
 void chuni_io_config_load(
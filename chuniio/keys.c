@@ -0,0 +1,475 @@
+#include <windows.h>
+
+#include <assert.h>
+#include <process.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chuniio/keys.h"
+
+/* The down bitmap is written by the input thread only and published with a
+   sequence counter: the counter is odd while an update is in progress, so
+   readers retry if it was odd or if it changed while they were copying. This
+   gives every poller a consistent snapshot of all 256 keys without anybody
+   ever having to take a lock.
+
+   Raw Input registrations are per process, and only one window can receive
+   a given device class. If something else in the game registers for
+   keyboard input later on then our window silently stops hearing about it,
+   so the input thread checks on its registration every now and then and
+   falls back to polling if it has been taken over. */
+
+#define CHUNI_IO_KEYS_CHECK_TIMER   1
+#define CHUNI_IO_KEYS_CHECK_MS      1000
+
+static unsigned int __stdcall chuni_io_keys_thread_proc(void *ctx);
+static LRESULT CALLBACK chuni_io_keys_wnd_proc(
+        HWND hwnd,
+        UINT msg,
+        WPARAM wparam,
+        LPARAM lparam);
+static void chuni_io_keys_handle_raw(const RAWKEYBOARD *kb);
+static void chuni_io_keys_check_registration(HWND hwnd);
+static bool chuni_io_keys_is_mouse(uint8_t vk);
+static bool chuni_io_keys_is_down(uint8_t vk);
+static void chuni_io_keys_set(uint8_t vk, bool down);
+static void chuni_io_keys_poll(
+        struct chuni_io_keys *keys,
+        const uint8_t *vks,
+        size_t nvks);
+
+static bool chuni_io_keys_initted;
+static volatile bool chuni_io_keys_raw;
+static uint8_t chuni_io_keys_vks[256];
+static size_t chuni_io_keys_nvks;
+static uint8_t chuni_io_keys_mouse_vks[256];
+static size_t chuni_io_keys_nmouse_vks;
+static HANDLE chuni_io_keys_ready;
+static HRESULT chuni_io_keys_thread_hr;
+
+static volatile LONG chuni_io_keys_seq;
+static volatile LONG chuni_io_keys_down[8];
+static volatile LONGLONG chuni_io_keys_qpc;
+static volatile LONG chuni_io_keys_npresses[256];
+
+HRESULT chuni_io_keys_init(bool raw_input, const uint8_t *vks, size_t nvks)
+{
+    HANDLE thread;
+    size_t i;
+
+    assert(vks != NULL || nvks == 0);
+
+    if (chuni_io_keys_initted) {
+        return S_FALSE;
+    }
+
+    chuni_io_keys_initted = true;
+
+    if (nvks > _countof(chuni_io_keys_vks)) {
+        nvks = _countof(chuni_io_keys_vks);
+    }
+
+    memcpy(chuni_io_keys_vks, vks, nvks);
+    chuni_io_keys_nvks = nvks;
+
+    /* We only register for keyboard Raw Input, mouse buttons keep being
+       polled even while that is working. */
+
+    for (i = 0 ; i < nvks ; i++) {
+        if (chuni_io_keys_is_mouse(vks[i])) {
+            chuni_io_keys_mouse_vks[chuni_io_keys_nmouse_vks++] = vks[i];
+        }
+    }
+
+    if (!raw_input) {
+        return S_OK;
+    }
+
+    chuni_io_keys_ready = CreateEventW(NULL, TRUE, FALSE, NULL);
+
+    if (chuni_io_keys_ready == NULL) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    /* Raw Input only reports changes, so pick up whatever is being held
+       down right now before it starts. */
+
+    for (i = 0 ; i < chuni_io_keys_nvks ; i++) {
+        if (GetAsyncKeyState(chuni_io_keys_vks[i]) & 0x8000) {
+            chuni_io_keys_set(chuni_io_keys_vks[i], true);
+        }
+    }
+
+    thread = (HANDLE) _beginthreadex(
+            NULL,
+            0,
+            chuni_io_keys_thread_proc,
+            NULL,
+            0,
+            NULL);
+
+    if (thread == NULL) {
+        return S_OK;
+    }
+
+    /* The thread runs for the rest of the process's lifetime */
+
+    CloseHandle(thread);
+    WaitForSingleObject(chuni_io_keys_ready, INFINITE);
+
+    if (SUCCEEDED(chuni_io_keys_thread_hr)) {
+        chuni_io_keys_raw = true;
+    }
+
+    return S_OK;
+}
+
+void chuni_io_keys_snapshot(struct chuni_io_keys *keys)
+{
+    LARGE_INTEGER qpc;
+    LONG seq;
+    size_t i;
+
+    assert(keys != NULL);
+
+    if (!chuni_io_keys_raw) {
+        memset(keys->down, 0, sizeof(keys->down));
+        chuni_io_keys_poll(keys, chuni_io_keys_vks, chuni_io_keys_nvks);
+
+        QueryPerformanceCounter(&qpc);
+        keys->qpc = qpc.QuadPart;
+
+        return;
+    }
+
+    for (;;) {
+        seq = chuni_io_keys_seq;
+
+        if (seq & 1) {
+            YieldProcessor();
+
+            continue;
+        }
+
+        MemoryBarrier();
+
+        for (i = 0 ; i < _countof(keys->down) ; i++) {
+            keys->down[i] = (uint32_t) chuni_io_keys_down[i];
+        }
+
+        keys->qpc = chuni_io_keys_qpc;
+
+        MemoryBarrier();
+
+        if (chuni_io_keys_seq == seq) {
+            break;
+        }
+    }
+
+    chuni_io_keys_poll(
+            keys,
+            chuni_io_keys_mouse_vks,
+            chuni_io_keys_nmouse_vks);
+}
+
+uint32_t chuni_io_keys_presses(uint8_t vk)
+{
+    /* Without Raw Input there are no events to count, so this never moves
+       and pollers just go by the down state. */
+
+    return (uint32_t) chuni_io_keys_npresses[vk];
+}
+
+static unsigned int __stdcall chuni_io_keys_thread_proc(void *ctx)
+{
+    RAWINPUTDEVICE rid;
+    WNDCLASSEXW wcx;
+    HINSTANCE inst;
+    HWND hwnd;
+    MSG msg;
+
+    inst = GetModuleHandleW(NULL);
+
+    memset(&wcx, 0, sizeof(wcx));
+    wcx.cbSize = sizeof(wcx);
+    wcx.lpfnWndProc = chuni_io_keys_wnd_proc;
+    wcx.hInstance = inst;
+    wcx.lpszClassName = L"chuniio_keys";
+
+    if (!RegisterClassExW(&wcx)) {
+        chuni_io_keys_thread_hr = HRESULT_FROM_WIN32(GetLastError());
+        SetEvent(chuni_io_keys_ready);
+
+        return 0;
+    }
+
+    hwnd = CreateWindowExW(
+            0,
+            wcx.lpszClassName,
+            L"",
+            0,
+            0,
+            0,
+            0,
+            0,
+            HWND_MESSAGE,
+            NULL,
+            inst,
+            NULL);
+
+    if (hwnd == NULL) {
+        chuni_io_keys_thread_hr = HRESULT_FROM_WIN32(GetLastError());
+        SetEvent(chuni_io_keys_ready);
+
+        return 0;
+    }
+
+    /* Generic desktop page, keyboard usage. INPUTSINK delivers events even
+       while some other window (i.e. the game) has the focus. */
+
+    rid.usUsagePage = 0x01;
+    rid.usUsage = 0x06;
+    rid.dwFlags = RIDEV_INPUTSINK;
+    rid.hwndTarget = hwnd;
+
+    if (!RegisterRawInputDevices(&rid, 1, sizeof(rid))) {
+        chuni_io_keys_thread_hr = HRESULT_FROM_WIN32(GetLastError());
+        DestroyWindow(hwnd);
+        SetEvent(chuni_io_keys_ready);
+
+        return 0;
+    }
+
+    SetTimer(hwnd, CHUNI_IO_KEYS_CHECK_TIMER, CHUNI_IO_KEYS_CHECK_MS, NULL);
+
+    chuni_io_keys_thread_hr = S_OK;
+    SetEvent(chuni_io_keys_ready);
+
+    while (GetMessageW(&msg, NULL, 0, 0) > 0) {
+        DispatchMessageW(&msg);
+    }
+
+    return 0;
+}
+
+static LRESULT CALLBACK chuni_io_keys_wnd_proc(
+        HWND hwnd,
+        UINT msg,
+        WPARAM wparam,
+        LPARAM lparam)
+{
+    RAWINPUT ri;
+    UINT size;
+
+    if (msg == WM_INPUT) {
+        size = sizeof(ri);
+
+        if (    GetRawInputData(
+                    (HRAWINPUT) lparam,
+                    RID_INPUT,
+                    &ri,
+                    &size,
+                    sizeof(RAWINPUTHEADER)) != (UINT) -1 &&
+                ri.header.dwType == RIM_TYPEKEYBOARD) {
+            chuni_io_keys_handle_raw(&ri.data.keyboard);
+        }
+    } else if (msg == WM_TIMER && wparam == CHUNI_IO_KEYS_CHECK_TIMER) {
+        chuni_io_keys_check_registration(hwnd);
+
+        return 0;
+    }
+
+    /* DefWindowProc has to see WM_INPUT too so that it can clean up */
+
+    return DefWindowProcW(hwnd, msg, wparam, lparam);
+}
+
+static void chuni_io_keys_handle_raw(const RAWKEYBOARD *kb)
+{
+    LARGE_INTEGER qpc;
+    uint8_t vk;
+    bool down;
+
+    /* 0xFF is sent for the fake prefix keys of some escape sequences */
+
+    if (kb->VKey == 0 || kb->VKey >= 0xFF) {
+        return;
+    }
+
+    vk = (uint8_t) kb->VKey;
+    down = !(kb->Flags & RI_KEY_BREAK);
+
+    QueryPerformanceCounter(&qpc);
+
+    InterlockedIncrement(&chuni_io_keys_seq);
+
+    /* Raw Input only ever reports the generic modifier keys, but users may
+       well have bound the left- or right-hand one specifically. Track both,
+       and derive the generic key from them so that releasing one side while
+       the other is still held doesn't release the generic key as well. */
+
+    switch (vk) {
+    case VK_SHIFT:
+        chuni_io_keys_set(
+                (uint8_t) MapVirtualKeyW(kb->MakeCode, MAPVK_VSC_TO_VK_EX),
+                down);
+        chuni_io_keys_set(
+                VK_SHIFT,
+                chuni_io_keys_is_down(VK_LSHIFT) ||
+                chuni_io_keys_is_down(VK_RSHIFT));
+
+        break;
+
+    case VK_CONTROL:
+        chuni_io_keys_set(
+                (kb->Flags & RI_KEY_E0) ? VK_RCONTROL : VK_LCONTROL,
+                down);
+        chuni_io_keys_set(
+                VK_CONTROL,
+                chuni_io_keys_is_down(VK_LCONTROL) ||
+                chuni_io_keys_is_down(VK_RCONTROL));
+
+        break;
+
+    case VK_MENU:
+        chuni_io_keys_set((kb->Flags & RI_KEY_E0) ? VK_RMENU : VK_LMENU, down);
+        chuni_io_keys_set(
+                VK_MENU,
+                chuni_io_keys_is_down(VK_LMENU) ||
+                chuni_io_keys_is_down(VK_RMENU));
+
+        break;
+
+    default:
+        chuni_io_keys_set(vk, down);
+
+        break;
+    }
+
+    chuni_io_keys_qpc = qpc.QuadPart;
+
+    InterlockedIncrement(&chuni_io_keys_seq);
+}
+
+static void chuni_io_keys_check_registration(HWND hwnd)
+{
+    RAWINPUTDEVICE *rids;
+    UINT nrids;
+    UINT i;
+    bool ours;
+
+    /* Passing a NULL buffer just returns the number of registrations */
+
+    nrids = 0;
+    GetRegisteredRawInputDevices(NULL, &nrids, sizeof(*rids));
+    ours = false;
+
+    if (nrids > 0) {
+        rids = calloc(nrids, sizeof(*rids));
+
+        if (rids == NULL) {
+            /* Can't tell right now, try again next time */
+
+            return;
+        }
+
+        nrids = GetRegisteredRawInputDevices(rids, &nrids, sizeof(*rids));
+
+        if (nrids == (UINT) -1) {
+            /* Somebody registered something in the meantime, same again */
+
+            free(rids);
+
+            return;
+        }
+
+        for (i = 0 ; i < nrids ; i++) {
+            if (    rids[i].usUsagePage == 0x01 &&
+                    rids[i].usUsage == 0x06 &&
+                    rids[i].hwndTarget == hwnd) {
+                ours = true;
+            }
+        }
+
+        free(rids);
+    }
+
+    if (ours) {
+        return;
+    }
+
+    /* Stealing the registration back would only break whoever took it, so
+       leave it to them and poll from now on. */
+
+    OutputDebugStringA(
+            "chuniio: Keyboard Raw Input was taken over by another window, "
+            "falling back to polling\n");
+
+    KillTimer(hwnd, CHUNI_IO_KEYS_CHECK_TIMER);
+    chuni_io_keys_raw = false;
+}
+
+static bool chuni_io_keys_is_mouse(uint8_t vk)
+{
+    switch (vk) {
+    case VK_LBUTTON:
+    case VK_RBUTTON:
+    case VK_MBUTTON:
+    case VK_XBUTTON1:
+    case VK_XBUTTON2:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+static bool chuni_io_keys_is_down(uint8_t vk)
+{
+    return (chuni_io_keys_down[vk >> 5] >> (vk & 31)) & 1;
+}
+
+static void chuni_io_keys_set(uint8_t vk, bool down)
+{
+    LONG bit;
+    LONG old;
+
+    /* Only ever called from one thread at a time, the interlocked operations
+       below are for the benefit of the readers. */
+
+    bit = (LONG) (1UL << (vk & 31));
+    old = chuni_io_keys_down[vk >> 5];
+
+    if (down) {
+        if (!(old & bit)) {
+            chuni_io_keys_down[vk >> 5] = old | bit;
+            InterlockedIncrement(&chuni_io_keys_npresses[vk]);
+        }
+    } else {
+        chuni_io_keys_down[vk >> 5] = old & ~bit;
+    }
+}
+
+static void chuni_io_keys_poll(
+        struct chuni_io_keys *keys,
+        const uint8_t *vks,
+        size_t nvks)
+{
+    uint32_t bit;
+    uint8_t vk;
+    size_t i;
+
+    for (i = 0 ; i < nvks ; i++) {
+        vk = vks[i];
+        bit = 1UL << (vk & 31);
+
+        if (GetAsyncKeyState(vk) & 0x8000) {
+            keys->down[vk >> 5] |= bit;
+        } else {
+            keys->down[vk >> 5] &= ~bit;
+        }
+    }
+}
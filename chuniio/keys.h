@@ -0,0 +1,37 @@
+#pragma once
+
+#include <windows.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Keyboard state tracker. A background thread receives Raw Input (WM_INPUT)
+   keyboard events on a message-only window and keeps a bitmap of which
+   virtual keys are held down, so that a whole poll costs one snapshot read
+   instead of a GetAsyncKeyState() system call per key.
+
+   Each key also has a press counter, which lets pollers notice presses that
+   started and ended in between two polls. If Raw Input is unavailable (or
+   disabled, or another window takes the keyboard registration over later on),
+   snapshots fall back to calling GetAsyncKeyState() for each of the keys
+   passed to chuni_io_keys_init(). Mouse buttons are always polled that way,
+   since only the keyboard is registered for Raw Input. */
+
+struct chuni_io_keys {
+    uint32_t down[8];
+    int64_t qpc;            /* QueryPerformanceCounter() of the last event */
+};
+
+HRESULT chuni_io_keys_init(bool raw_input, const uint8_t *vks, size_t nvks);
+
+void chuni_io_keys_snapshot(struct chuni_io_keys *keys);
+
+uint32_t chuni_io_keys_presses(uint8_t vk);
+
+static inline bool chuni_io_keys_test(
+        const struct chuni_io_keys *keys,
+        uint8_t vk)
+{
+    return (keys->down[vk >> 5] >> (vk & 31)) & 1;
+}
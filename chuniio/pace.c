@@ -0,0 +1,268 @@
+#include <windows.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "chuniio/pace.h"
+
+/* Older SDK headers don't have this yet */
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+static int64_t chuni_io_pace_now(void);
+static void chuni_io_pace_sleep(struct chuni_io_pace *pace, int64_t ticks);
+static void chuni_io_pace_record(struct chuni_io_pace *pace, int64_t now);
+
+HRESULT chuni_io_pace_init(
+        struct chuni_io_pace *pace,
+        unsigned int rate_hz,
+        unsigned int spin_us)
+{
+    LARGE_INTEGER freq;
+    int64_t period_us;
+
+    assert(pace != NULL);
+
+    if (rate_hz == 0) {
+        return E_INVALIDARG;
+    }
+
+    memset(pace, 0, sizeof(*pace));
+
+    QueryPerformanceFrequency(&freq);
+
+    pace->freq = freq.QuadPart;
+    pace->period = pace->freq / rate_hz;
+
+    if (pace->period == 0) {
+        return E_INVALIDARG;
+    }
+
+    pace->spin = pace->freq * spin_us / 1000000;
+
+    if (pace->spin > pace->period) {
+        pace->spin = pace->period;
+    }
+
+    period_us = pace->period * 1000000 / pace->freq;
+    pace->stats.bucket_us = period_us >= 8 ? (uint32_t) (period_us / 8) : 1;
+
+    /* High-resolution timers are refused with ERROR_INVALID_PARAMETER on
+       anything older than Windows 10 1803. An ordinary waitable timer is
+       still no worse than Sleep(), so settle for one of those instead. */
+
+    pace->timer = CreateWaitableTimerExW(
+            NULL,
+            NULL,
+            CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+            TIMER_ALL_ACCESS);
+
+    if (pace->timer != NULL) {
+        pace->high_res = true;
+    } else {
+        pace->timer = CreateWaitableTimerExW(
+                NULL,
+                NULL,
+                0,
+                TIMER_ALL_ACCESS);
+    }
+
+    if (pace->timer == NULL) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    InitializeCriticalSection(&pace->lock);
+    pace->deadline = chuni_io_pace_now();
+
+    return S_OK;
+}
+
+void chuni_io_pace_wait(struct chuni_io_pace *pace)
+{
+    int64_t now;
+
+    assert(pace != NULL);
+
+    pace->deadline += pace->period;
+    now = chuni_io_pace_now();
+
+    /* If we have fallen more than a whole interval behind (debugger, heavy
+       system load) then start over from here instead of running a burst of
+       back-to-back iterations to catch up. */
+
+    if (now - pace->deadline > pace->period) {
+        pace->deadline = now;
+    }
+
+    if (pace->deadline - now > pace->spin) {
+        chuni_io_pace_sleep(pace, pace->deadline - now - pace->spin);
+    }
+
+    if (pace->spin > 0) {
+        do {
+            YieldProcessor();
+            now = chuni_io_pace_now();
+        } while (now < pace->deadline);
+    } else {
+        now = chuni_io_pace_now();
+    }
+
+    chuni_io_pace_record(pace, now);
+}
+
+void chuni_io_pace_fini(struct chuni_io_pace *pace)
+{
+    assert(pace != NULL);
+
+    if (pace->timer != NULL) {
+        CloseHandle(pace->timer);
+        pace->timer = NULL;
+        DeleteCriticalSection(&pace->lock);
+    }
+}
+
+void chuni_io_pace_get_stats(
+        struct chuni_io_pace *pace,
+        struct chuni_io_pace_stats *out)
+{
+    assert(pace != NULL);
+    assert(out != NULL);
+
+    EnterCriticalSection(&pace->lock);
+    memcpy(out, &pace->stats, sizeof(*out));
+    LeaveCriticalSection(&pace->lock);
+}
+
+void chuni_io_pace_dump(struct chuni_io_pace *pace, const char *name)
+{
+    struct chuni_io_pace_stats copy;
+    const struct chuni_io_pace_stats *stats;
+    char line[128];
+    unsigned int lo;
+    size_t i;
+
+    assert(pace != NULL);
+    assert(name != NULL);
+
+    chuni_io_pace_get_stats(pace, &copy);
+    stats = &copy;
+
+    if (stats->count == 0) {
+        return;
+    }
+
+    sprintf_s(
+            line,
+            sizeof(line),
+            "chuniio: %s: %u intervals (%s timer), "
+            "min %u us, avg %u us, max %u us\n",
+            name,
+            stats->count,
+            pace->high_res ? "high-res" : "standard",
+            stats->min_us,
+            (unsigned int) (stats->total_us / stats->count),
+            stats->max_us);
+
+    OutputDebugStringA(line);
+
+    for (i = 0 ; i < CHUNI_IO_PACE_NBUCKETS ; i++) {
+        if (stats->hist[i] == 0) {
+            continue;
+        }
+
+        lo = (unsigned int) i * stats->bucket_us;
+
+        if (i + 1 < CHUNI_IO_PACE_NBUCKETS) {
+            sprintf_s(
+                    line,
+                    sizeof(line),
+                    "chuniio: %s: %5u-%5u us: %u\n",
+                    name,
+                    lo,
+                    lo + stats->bucket_us - 1,
+                    stats->hist[i]);
+        } else {
+            sprintf_s(
+                    line,
+                    sizeof(line),
+                    "chuniio: %s: %5u+      us: %u\n",
+                    name,
+                    lo,
+                    stats->hist[i]);
+        }
+
+        OutputDebugStringA(line);
+    }
+}
+
+static int64_t chuni_io_pace_now(void)
+{
+    LARGE_INTEGER now;
+
+    QueryPerformanceCounter(&now);
+
+    return now.QuadPart;
+}
+
+static void chuni_io_pace_sleep(struct chuni_io_pace *pace, int64_t ticks)
+{
+    LARGE_INTEGER due;
+
+    /* Negative due times are relative, in units of 100 ns */
+
+    due.QuadPart = -(ticks * 10000000 / pace->freq);
+
+    if (due.QuadPart == 0) {
+        return;
+    }
+
+    if (!SetWaitableTimer(pace->timer, &due, 0, NULL, NULL, FALSE)) {
+        Sleep(1);
+
+        return;
+    }
+
+    WaitForSingleObject(pace->timer, INFINITE);
+}
+
+static void chuni_io_pace_record(struct chuni_io_pace *pace, int64_t now)
+{
+    struct chuni_io_pace_stats *stats;
+    uint32_t us;
+    size_t bucket;
+
+    stats = &pace->stats;
+
+    if (pace->last != 0) {
+        us = (uint32_t) ((now - pace->last) * 1000000 / pace->freq);
+        bucket = us / stats->bucket_us;
+
+        if (bucket >= CHUNI_IO_PACE_NBUCKETS) {
+            bucket = CHUNI_IO_PACE_NBUCKETS - 1;
+        }
+
+        EnterCriticalSection(&pace->lock);
+
+        stats->hist[bucket]++;
+
+        if (stats->count == 0 || us < stats->min_us) {
+            stats->min_us = us;
+        }
+
+        if (us > stats->max_us) {
+            stats->max_us = us;
+        }
+
+        stats->total_us += us;
+        stats->count++;
+
+        LeaveCriticalSection(&pace->lock);
+    }
+
+    pace->last = now;
+}
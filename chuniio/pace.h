@@ -0,0 +1,64 @@
+#pragma once
+
+#include <windows.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Fixed-rate loop pacing. Each interval is slept off on a high-resolution
+   waitable timer where the OS has one (Windows 10 1803 and later), which
+   unlike Sleep() does not depend on the system timer resolution that happens
+   to be in effect. Optionally the last part of each interval is spent
+   spinning on QueryPerformanceCounter() to take out the remaining wakeup
+   jitter, at the cost of keeping a core busy for that long.
+
+   The interval actually achieved between consecutive wakeups is recorded in
+   a histogram of CHUNI_IO_PACE_NBUCKETS buckets, each an eighth of the
+   target interval wide (but at least a microsecond), so that the histogram
+   covers four whole intervals whatever the rate. The last bucket also
+   collects everything longer than that. */
+
+#define CHUNI_IO_PACE_NBUCKETS 32
+
+struct chuni_io_pace_stats {
+    uint32_t bucket_us;
+    uint32_t hist[CHUNI_IO_PACE_NBUCKETS];
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t total_us;
+};
+
+struct chuni_io_pace {
+    CRITICAL_SECTION lock;  /* Protects stats */
+    HANDLE timer;
+    bool high_res;
+    int64_t freq;
+    int64_t period;         /* QPC ticks */
+    int64_t spin;           /* QPC ticks */
+    int64_t deadline;
+    int64_t last;
+    struct chuni_io_pace_stats stats;
+};
+
+HRESULT chuni_io_pace_init(
+        struct chuni_io_pace *pace,
+        unsigned int rate_hz,
+        unsigned int spin_us);
+
+void chuni_io_pace_wait(struct chuni_io_pace *pace);
+
+void chuni_io_pace_fini(struct chuni_io_pace *pace);
+
+/* Copies out the intervals recorded so far. Safe to call from any thread
+   while another one is inside chuni_io_pace_wait(), as long as the pace has
+   been initialized successfully and not yet finalized. */
+
+void chuni_io_pace_get_stats(
+        struct chuni_io_pace *pace,
+        struct chuni_io_pace_stats *out);
+
+/* Writes a summary of the recorded intervals to OutputDebugString(), each
+   line prefixed with the given name. */
+
+void chuni_io_pace_dump(struct chuni_io_pace *pace, const char *name);
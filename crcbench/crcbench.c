@@ -0,0 +1,270 @@
+/* Checks the CRC-32 kernels in util/crc.c against the original bit-at-a-time
+   implementation, then measures the throughput of each kernel across a range
+   of buffer sizes.
+
+   Usage: crcbench */
+
+#include <windows.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/crc.h"
+
+typedef uint32_t (*crc_kernel_t)(uint32_t crc, const void *src, size_t nbytes);
+
+struct crc_impl {
+    const char *name;
+    crc_kernel_t fn;
+};
+
+enum {
+    CRC_BUF_SIZE        = 1 << 20,
+    CRC_CHECK_MAX_LEN   = 600,
+    CRC_BENCH_BYTES     = 256 << 20,
+};
+
+static uint32_t crc_reference(uint32_t crc, const void *src, size_t nbytes);
+static uint32_t crc_random(void);
+static bool crc_check(const struct crc_impl *impl);
+static bool crc_check_api(void);
+static double crc_bench(const struct crc_impl *impl, size_t size);
+
+static const size_t crc_bench_sizes[] = {
+    64,
+    256,
+    1024,
+    4096,
+    16384,
+    65536,
+    262144,
+    1048576,
+};
+
+static struct crc_impl crc_impls[] = {
+    { "slice8", crc32_update_slice8 },
+    { "clmul",  crc32_update_clmul },
+};
+
+static uint8_t *crc_buf;
+static uint32_t crc_seed = 0x12345678;
+static volatile uint32_t crc_sink;
+
+int main(int argc, char **argv)
+{
+    size_t nimpls;
+    size_t i;
+    size_t j;
+    bool ok;
+
+    crc_buf = malloc(CRC_BUF_SIZE + 16);
+
+    if (crc_buf == NULL) {
+        fprintf(stderr, "Out of memory\n");
+
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0 ; i < CRC_BUF_SIZE + 16 ; i++) {
+        crc_buf[i] = (uint8_t) crc_random();
+    }
+
+    nimpls = _countof(crc_impls);
+
+    if (!crc32_clmul_supported()) {
+        printf("PCLMULQDQ not supported, only testing slice8\n");
+        nimpls--;
+    }
+
+    ok = crc_check_api();
+
+    for (i = 0 ; i < nimpls ; i++) {
+        ok = crc_check(&crc_impls[i]) && ok;
+    }
+
+    if (!ok) {
+        return EXIT_FAILURE;
+    }
+
+    printf("\n%10s", "Size");
+
+    for (j = 0 ; j < nimpls ; j++) {
+        printf("  %8s GB/s", crc_impls[j].name);
+    }
+
+    printf("\n");
+
+    for (i = 0 ; i < _countof(crc_bench_sizes) ; i++) {
+        printf("%10u", (unsigned int) crc_bench_sizes[i]);
+
+        for (j = 0 ; j < nimpls ; j++) {
+            printf("  %13.2f", crc_bench(&crc_impls[j], crc_bench_sizes[i]));
+        }
+
+        printf("\n");
+    }
+
+    free(crc_buf);
+
+    return EXIT_SUCCESS;
+}
+
+/* What util/crc.c used to be, working on the raw register like the kernels
+   do. Slow but obviously correct. */
+
+static uint32_t crc_reference(uint32_t crc, const void *src, size_t nbytes)
+{
+    const uint8_t *bytes;
+    size_t i;
+
+    bytes = src;
+
+    for (i = 0 ; i < nbytes * 8 ; i++) {
+        if (i % 8 == 0) {
+            crc ^= *bytes++;
+        }
+
+        if (crc & 1) {
+            crc = (crc >> 1) ^ 0xEDB88320;
+        } else {
+            crc = (crc >> 1);
+        }
+    }
+
+    return crc;
+}
+
+static uint32_t crc_random(void)
+{
+    /* xorshift32, deterministic so that failures can be reproduced */
+
+    crc_seed ^= crc_seed << 13;
+    crc_seed ^= crc_seed >> 17;
+    crc_seed ^= crc_seed << 5;
+
+    return crc_seed;
+}
+
+static bool crc_check(const struct crc_impl *impl)
+{
+    uint32_t expected;
+    uint32_t actual;
+    uint32_t init;
+    size_t align;
+    size_t len;
+
+    /* Every length up to a few hundred bytes at every alignment covers all
+       of the head, body and tail combinations of both kernels. */
+
+    for (len = 0 ; len <= CRC_CHECK_MAX_LEN ; len++) {
+        for (align = 0 ; align < 16 ; align++) {
+            init = crc_random();
+            expected = crc_reference(init, crc_buf + align, len);
+            actual = impl->fn(init, crc_buf + align, len);
+
+            if (actual != expected) {
+                printf("%s: FAIL len %u align %u init %08x: "
+                        "got %08x, expected %08x\n",
+                        impl->name,
+                        (unsigned int) len,
+                        (unsigned int) align,
+                        init,
+                        actual,
+                        expected);
+
+                return false;
+            }
+        }
+    }
+
+    /* Plus one big odd-sized buffer for the main loops */
+
+    len = CRC_BUF_SIZE - 13;
+    expected = crc_reference(0xFFFFFFFF, crc_buf + 3, len);
+    actual = impl->fn(0xFFFFFFFF, crc_buf + 3, len);
+
+    if (actual != expected) {
+        printf("%s: FAIL len %u: got %08x, expected %08x\n",
+                impl->name,
+                (unsigned int) len,
+                actual,
+                expected);
+
+        return false;
+    }
+
+    printf("%s: OK\n", impl->name);
+
+    return true;
+}
+
+static bool crc_check_api(void)
+{
+    struct crc32_stream s;
+    uint32_t expected;
+    size_t split;
+
+    /* The well-known check value for "123456789" */
+
+    if (crc32("123456789", 9, 0) != 0xCBF43926) {
+        printf("crc32: FAIL check value\n");
+
+        return false;
+    }
+
+    expected = crc32(crc_buf, 4096, 0);
+
+    for (split = 0 ; split <= 4096 ; split += 97) {
+        crc32_stream_init(&s);
+        crc32_stream_update(&s, crc_buf, split);
+        crc32_stream_update(&s, crc_buf + split, 4096 - split);
+
+        if (    crc32_stream_finish(&s) != expected ||
+                crc32(crc_buf + split, 4096 - split,
+                        crc32(crc_buf, split, 0)) != expected) {
+            printf("crc32_stream: FAIL split at %u\n", (unsigned int) split);
+
+            return false;
+        }
+    }
+
+    printf("crc32/crc32_stream: OK\n");
+
+    return true;
+}
+
+static double crc_bench(const struct crc_impl *impl, size_t size)
+{
+    LARGE_INTEGER freq;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    uint32_t crc;
+    size_t niters;
+    size_t i;
+    double secs;
+
+    niters = CRC_BENCH_BYTES / size;
+    crc = 0xFFFFFFFF;
+
+    /* Warm up the caches (and the tables) first */
+
+    crc = impl->fn(crc, crc_buf, size);
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    for (i = 0 ; i < niters ; i++) {
+        crc = impl->fn(crc, crc_buf, size);
+    }
+
+    QueryPerformanceCounter(&end);
+
+    crc_sink = crc;
+    secs = (double) (end.QuadPart - start.QuadPart) / (double) freq.QuadPart;
+
+    return (double) niters * (double) size / secs / 1e9;
+}
@@ -9,9 +9,13 @@
 
 #include "divahook/config.h"
 
+#include "hooklib/config.h"
+
 #include "platform/config.h"
 #include "platform/platform.h"
 
+#include "util/config.h"
+
 void slider_config_load(struct slider_config *cfg, const wchar_t *filename)
 {
     assert(cfg != NULL);
@@ -31,4 +35,6 @@ void diva_hook_config_load(
     amex_config_load(&cfg->amex, filename);
     aime_config_load(&cfg->aime, filename);
     slider_config_load(&cfg->slider, filename);
+    dprintf_config_load(&cfg->dprintf, filename);
+    iostat_config_load(&cfg->iostat, filename);
 }
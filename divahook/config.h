@@ -8,13 +8,19 @@
 
 #include "divahook/slider.h"
 
+#include "hooklib/iostat.h"
+
 #include "platform/platform.h"
 
+#include "util/dprintf.h"
+
 struct diva_hook_config {
     struct platform_config platform;
     struct amex_config amex;
     struct aime_config aime;
     struct slider_config slider;
+    struct dprintf_config dprintf;
+    struct iostat_config iostat;
 };
 
 void slider_config_load(struct slider_config *cfg, const wchar_t *filename);
@@ -14,6 +14,7 @@
 #include "hook/process.h"
 
 #include "hooklib/gfx.h"
+#include "hooklib/iostat.h"
 #include "hooklib/serial.h"
 #include "hooklib/spike.h"
 
@@ -34,6 +35,8 @@ static DWORD CALLBACK diva_pre_startup(void)
     /* Config load */
 
     diva_hook_config_load(&diva_hook_cfg, L".\\segatools.ini");
+    dprintf_init(&diva_hook_cfg.dprintf);
+    iostat_init(&diva_hook_cfg.iostat);
 
     /* Hook Win32 APIs */
 
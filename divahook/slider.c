@@ -15,6 +15,7 @@
 #include "hook/iobuf.h"
 #include "hook/iohook.h"
 
+#include "hooklib/iostat.h"
 #include "hooklib/uart.h"
 
 #include "util/dprintf.h"
@@ -54,7 +55,7 @@ HRESULT slider_hook_init(const struct slider_config *cfg)
     slider_uart.readable.bytes = slider_readable_bytes;
     slider_uart.readable.nbytes = sizeof(slider_readable_bytes);
 
-    return iohook_push_handler(slider_handle_irp);
+    return iostat_push_handler("slider", slider_handle_irp);
 }
 
 static HRESULT slider_handle_irp(struct irp *irp)
@@ -81,11 +82,13 @@ static HRESULT slider_handle_irp_locked(struct irp *irp)
     HRESULT hr;
 
     if (irp->op == IRP_OP_OPEN) {
-        dprintf("Diva slider: Starting backend DLL\n");
+        dprintfc(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_INFO,
+                "Diva slider: Starting backend DLL\n");
         hr = diva_io_jvs_init();
 
         if (FAILED(hr)) {
-            dprintf("Diva slider: Backend DLL error: %x\n", (int) hr);
+            dprintfc(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_ERROR,
+                    "Diva slider: Backend DLL error: %x\n", (int) hr);
 
             return hr;
         }
@@ -98,10 +101,10 @@ static HRESULT slider_handle_irp_locked(struct irp *irp)
     }
 
     for (;;) {
-#if 0
-        dprintf("TX Buffer:\n");
-        dump_iobuf(&slider_uart.written);
-#endif
+        if (dprintf_enabled(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_TRACE)) {
+            dprintf("TX Buffer:\n");
+            dump_iobuf(&slider_uart.written);
+        }
 
         req_iobuf.bytes = req.bytes;
         req_iobuf.nbytes = sizeof(req.bytes);
@@ -111,21 +114,23 @@ static HRESULT slider_handle_irp_locked(struct irp *irp)
 
         if (hr != S_OK) {
             if (FAILED(hr)) {
-                dprintf("Diva slider: Deframe error: %x\n", (int) hr);
+                dprintfc(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_ERROR,
+                        "Diva slider: Deframe error: %x\n", (int) hr);
             }
 
             return hr;
         }
 
-#if 0
-        dprintf("Deframe Buffer:\n");
-        dump_iobuf(&req_iobuf);
-#endif
+        if (dprintf_enabled(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_TRACE)) {
+            dprintf("Deframe Buffer:\n");
+            dump_iobuf(&req_iobuf);
+        }
 
         hr = slider_req_dispatch(&req);
 
         if (FAILED(hr)) {
-            dprintf("Diva slider: Processing error: %x\n", (int) hr);
+            dprintfc(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_ERROR,
+                    "Diva slider: Processing error: %x\n", (int) hr);
         }
     }
 }
@@ -153,7 +158,8 @@ static HRESULT slider_req_dispatch(const union slider_req_any *req)
         return slider_req_nop(req->hdr.cmd);
 
     default:
-        dprintf("Unhandled command %02x\n", req->hdr.cmd);
+        dprintfc(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_ERROR,
+                "Unhandled command %02x\n", req->hdr.cmd);
 
         return S_OK;
     }
@@ -163,7 +169,8 @@ static HRESULT slider_req_nop(uint8_t cmd)
 {
     struct slider_hdr resp;
 
-    dprintf("Diva slider: No-op cmd 0x%#02x\n", cmd);
+    dprintfc(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_DEBUG,
+            "Diva slider: No-op cmd 0x%#02x\n", cmd);
 
     resp.sync = SLIDER_FRAME_SYNC;
     resp.cmd = cmd;
@@ -176,7 +183,7 @@ static HRESULT slider_req_reset(void)
 {
     struct slider_hdr resp;
 
-    dprintf("Diva slider: Reset\n");
+    dprintfc(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_INFO, "Diva slider: Reset\n");
 
     resp.sync = 0xFF;
     resp.cmd = SLIDER_CMD_RESET;
@@ -189,7 +196,8 @@ static HRESULT slider_req_get_board_info(void)
 {
     struct slider_resp_get_board_info resp;
 
-    dprintf("Diva slider: Get firmware version\n");
+    dprintfc(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_INFO,
+            "Diva slider: Get firmware version\n");
 
     memset(&resp, 0, sizeof(resp));
     resp.hdr.sync = SLIDER_FRAME_SYNC;
@@ -207,7 +215,8 @@ static HRESULT slider_req_get_board_info(void)
 
 static HRESULT slider_req_auto_scan_start(void)
 {
-    dprintf("Diva slider: Start slider thread\n");
+    dprintfc(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_INFO,
+            "Diva slider: Start slider thread\n");
     diva_io_slider_start(slider_res_auto_scan);
 
     /* This message is not acknowledged */
@@ -219,7 +228,8 @@ static HRESULT slider_req_auto_scan_stop(void)
 {
     struct slider_hdr resp;
 
-    dprintf("Diva slider: Stop slider thread\n");
+    dprintfc(DPRINTF_CAT_SLIDER, DPRINTF_LEVEL_INFO,
+            "Diva slider: Stop slider thread\n");
 
     /* IO DLL worker thread might attempt to invoke the callback (which needs
        to take slider_lock, which we are currently holding) before noticing that
@@ -0,0 +1,153 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fdsharkdump/cap.h"
+
+#include "hooklib/fdshark-cap.h"
+
+static bool cap_chain_ends_at(int64_t off, int64_t end);
+
+static struct fdshark_cap_header cap_hdr;
+static uint8_t *cap_ring;
+
+bool cap_load(const char *filename)
+{
+    FILE *f;
+    size_t nread;
+
+    f = fopen(filename, "rb");
+
+    if (f == NULL) {
+        perror(filename);
+
+        return false;
+    }
+
+    nread = fread(&cap_hdr, sizeof(cap_hdr), 1, f);
+
+    if (    nread != 1 ||
+            cap_hdr.magic != FDSHARK_CAP_MAGIC ||
+            cap_hdr.version != FDSHARK_CAP_VERSION ||
+            cap_hdr.header_size != sizeof(cap_hdr) ||
+            cap_hdr.ring_size == 0 ||
+            (cap_hdr.ring_size & (cap_hdr.ring_size - 1)) != 0 ||
+            cap_hdr.head < 0) {
+        fprintf(stderr, "%s: Not an FdShark capture\n", filename);
+        fclose(f);
+
+        return false;
+    }
+
+    cap_ring = malloc(cap_hdr.ring_size);
+
+    if (cap_ring == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        fclose(f);
+
+        return false;
+    }
+
+    nread = fread(cap_ring, 1, cap_hdr.ring_size, f);
+    fclose(f);
+
+    if (nread != cap_hdr.ring_size) {
+        fprintf(stderr, "%s: Truncated capture\n", filename);
+
+        return false;
+    }
+
+    return true;
+}
+
+const struct fdshark_cap_header *cap_header(void)
+{
+    return &cap_hdr;
+}
+
+int64_t cap_first_record(void)
+{
+    struct fdshark_cap_record rec;
+    int64_t start;
+    int64_t off;
+
+    if (cap_hdr.head <= (int64_t) cap_hdr.ring_size) {
+        return 0;
+    }
+
+    /* The ring has wrapped, so the oldest surviving bytes are probably the
+       tail end of an overwritten record. Pick the first record boundary
+       whose chain of records runs exactly up to the head. */
+
+    start = (cap_hdr.head - cap_hdr.ring_size + 7) & ~(int64_t) 7;
+
+    for (off = start ; off < cap_hdr.head ; off += 8) {
+        if (cap_chain_ends_at(off, cap_hdr.head)) {
+            return off;
+        }
+    }
+
+    /* Torn capture, so settle for the first plausible record */
+
+    for (off = start ; off < cap_hdr.head ; off += 8) {
+        if (cap_record_get(off, &rec)) {
+            break;
+        }
+    }
+
+    return off;
+}
+
+void cap_read(void *dst, int64_t off, size_t nbytes)
+{
+    size_t pos;
+    size_t chunk;
+
+    pos = (size_t) (off & (cap_hdr.ring_size - 1));
+    chunk = cap_hdr.ring_size - pos;
+
+    if (chunk > nbytes) {
+        chunk = nbytes;
+    }
+
+    memcpy(dst, &cap_ring[pos], chunk);
+    memcpy((uint8_t *) dst + chunk, &cap_ring[0], nbytes - chunk);
+}
+
+bool cap_record_get(int64_t off, struct fdshark_cap_record *rec)
+{
+    int64_t end;
+
+    end = cap_hdr.head;
+
+    if (end - off < (int64_t) sizeof(*rec)) {
+        return false;
+    }
+
+    cap_read(rec, off, sizeof(*rec));
+
+    return  rec->magic == FDSHARK_CAP_RECORD_MAGIC &&
+            rec->size >= sizeof(*rec) &&
+            rec->size % 8 == 0 &&
+            rec->size <= end - off &&
+            rec->payload_size <= FDSHARK_CAP_PAYLOAD_MAX &&
+            rec->payload_size <= rec->size - sizeof(*rec);
+}
+
+static bool cap_chain_ends_at(int64_t off, int64_t end)
+{
+    struct fdshark_cap_record rec;
+
+    while (off < end) {
+        if (!cap_record_get(off, &rec)) {
+            return false;
+        }
+
+        off += rec.size;
+    }
+
+    return off == end;
+}
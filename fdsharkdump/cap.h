@@ -0,0 +1,29 @@
+#pragma once
+
+/* Reader for FdShark capture files (see hooklib/fdshark-cap.h), shared by
+   fdsharkdump and replay. Only one capture can be loaded at a time. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hooklib/fdshark-cap.h"
+
+/* Loads the whole capture into memory, printing a message to stderr and
+   returning false if the file is unreadable or not a capture. */
+
+bool cap_load(const char *filename);
+
+const struct fdshark_cap_header *cap_header(void);
+
+/* Returns the ring offset of the oldest record that can be read back. Unless
+   the ring has wrapped this is simply zero. */
+
+int64_t cap_first_record(void);
+
+/* Reads the header of the record at the given ring offset, returning false
+   if there isn't a plausible record there. */
+
+bool cap_record_get(int64_t off, struct fdshark_cap_record *rec);
+
+void cap_read(void *dst, int64_t off, size_t nbytes);
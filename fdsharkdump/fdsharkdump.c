@@ -0,0 +1,140 @@
+/* Renders an FdShark capture file (see hooklib/fdshark-cap.h) as text.
+
+   Usage: fdsharkdump <capture file> */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fdsharkdump/cap.h"
+
+#include "hooklib/fdshark-cap.h"
+
+#include "util/dump.h"
+
+static void cap_print_record(
+        const struct fdshark_cap_record *rec,
+        int64_t off);
+static void cap_print_payload(const uint8_t *bytes, size_t nbytes);
+
+static const char *cap_kind_names[] = {
+    [FDSHARK_CAP_OPEN]  = "Open",
+    [FDSHARK_CAP_CLOSE] = "Close",
+    [FDSHARK_CAP_READ]  = "Read",
+    [FDSHARK_CAP_WRITE] = "Write",
+    [FDSHARK_CAP_IOCTL] = "Ioctl",
+};
+
+int main(int argc, char **argv)
+{
+    const struct fdshark_cap_header *hdr;
+    struct fdshark_cap_record rec;
+    int64_t off;
+    size_t i;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <capture file>\n", argv[0]);
+
+        return EXIT_FAILURE;
+    }
+
+    if (!cap_load(argv[1])) {
+        return EXIT_FAILURE;
+    }
+
+    hdr = cap_header();
+
+    printf("Path: ");
+
+    for (i = 0 ; i < FDSHARK_CAP_PATH_MAX && hdr->path[i] ; i++) {
+        putchar(hdr->path[i] < 0x80 ? (int) hdr->path[i] : '?');
+    }
+
+    printf("\nRing: %u bytes, %lld bytes written\n\n",
+            (unsigned int) hdr->ring_size,
+            (long long) hdr->head);
+
+    off = cap_first_record();
+
+    if (hdr->head > (int64_t) hdr->ring_size) {
+        printf("(%lld bytes lost to ring wrap)\n\n",
+                (long long) (off - (hdr->head - hdr->ring_size)));
+    }
+
+    while (cap_record_get(off, &rec)) {
+        cap_print_record(&rec, off);
+        off += rec.size;
+    }
+
+    if (off != hdr->head) {
+        printf("(Capture ends with %lld unreadable bytes)\n",
+                (long long) (hdr->head - off));
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void cap_print_record(
+        const struct fdshark_cap_record *rec,
+        int64_t off)
+{
+    uint8_t payload[FDSHARK_CAP_PAYLOAD_MAX];
+    const char *kind;
+    double time;
+
+    if (rec->kind < sizeof(cap_kind_names) / sizeof(cap_kind_names[0])) {
+        kind = cap_kind_names[rec->kind];
+    } else {
+        kind = "???";
+    }
+
+    time = (double) rec->time / (double) cap_header()->qpc_freq;
+
+    printf("%12.6f [%5u] fd %08x %-5s %s",
+            time,
+            (unsigned int) rec->thread,
+            (unsigned int) rec->fd,
+            kind,
+            rec->phase == FDSHARK_CAP_SUBMIT ? "->" : "<-");
+
+    if (rec->kind == FDSHARK_CAP_IOCTL) {
+        printf(" %08x", (unsigned int) rec->ioctl);
+    }
+
+    if (    rec->kind == FDSHARK_CAP_READ ||
+            rec->kind == FDSHARK_CAP_WRITE ||
+            rec->kind == FDSHARK_CAP_IOCTL) {
+        printf(" %u/%u", (unsigned int) rec->pos, (unsigned int) rec->nbytes);
+    }
+
+    if (rec->hr < 0) {
+        printf(" FAILED: %x", (unsigned int) rec->hr);
+    }
+
+    printf("\n");
+
+    if (rec->payload_size > 0) {
+        cap_read(payload, off + sizeof(*rec), rec->payload_size);
+        cap_print_payload(payload, rec->payload_size);
+    }
+}
+
+static void cap_print_payload(const uint8_t *bytes, size_t nbytes)
+{
+    char *text;
+    size_t size;
+
+    size = dump_format(NULL, 0, bytes, nbytes) + 1;
+    text = malloc(size);
+
+    if (text == NULL) {
+        return;
+    }
+
+    dump_format(text, size, bytes, nbytes);
+    fputs(text, stdout);
+    free(text);
+}
@@ -6,6 +6,8 @@
 
 #include "hooklib/config.h"
 #include "hooklib/gfx.h"
+#include "hooklib/iostat.h"
+#include "hooklib/regfile.h"
 
 void gfx_config_load(struct gfx_config *cfg, const wchar_t *filename)
 {
@@ -17,3 +19,25 @@ void gfx_config_load(struct gfx_config *cfg, const wchar_t *filename)
     cfg->framed = GetPrivateProfileIntW(L"gfx", L"framed", 1, filename);
     cfg->monitor = GetPrivateProfileIntW(L"gfx", L"monitor", 0, filename);
 }
+
+void iostat_config_load(struct iostat_config *cfg, const wchar_t *filename)
+{
+    assert(cfg != NULL);
+    assert(filename != NULL);
+
+    cfg->enable = GetPrivateProfileIntW(L"iostat", L"enable", 0, filename);
+}
+
+void regfile_config_load(struct regfile_config *cfg, const wchar_t *filename)
+{
+    assert(cfg != NULL);
+    assert(filename != NULL);
+
+    GetPrivateProfileStringW(
+            L"reg",
+            L"path",
+            L"",
+            cfg->path,
+            _countof(cfg->path),
+            filename);
+}
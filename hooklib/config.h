@@ -4,5 +4,9 @@
 #include <stddef.h>
 
 #include "hooklib/gfx.h"
+#include "hooklib/iostat.h"
+#include "hooklib/regfile.h"
 
 void gfx_config_load(struct gfx_config *cfg, const wchar_t *filename);
+void iostat_config_load(struct iostat_config *cfg, const wchar_t *filename);
+void regfile_config_load(struct regfile_config *cfg, const wchar_t *filename);
@@ -6,23 +6,58 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <wctype.h>
 
 #include "hook/table.h"
 
 #include "hooklib/dll.h"
 
+/* Registrations are linked into two fixed-size hash tables: one keyed on the
+   case-folded module name for GetModuleHandle and LoadLibrary, and one keyed
+   on the redirect module handle for GetProcAddress. Entries are appended
+   under dll_hook_lock and never removed, so lookups walk the chains without
+   taking the lock at all. Unity titles call these APIs constantly while mono
+   starts up, so this matters more than it looks.
+
+   Each registration also gets an open-addressed index of its symbol names,
+   built once at push time, so that resolving an export by name does not
+   strcmp its way through the whole symbol table every time. */
+
+enum {
+    DLL_HOOK_NBUCKETS   = 32,
+};
+
 struct dll_hook_reg {
+    struct dll_hook_reg *volatile next_name;
+    struct dll_hook_reg *volatile next_mod;
+    uint32_t hash;
     const wchar_t *name;
     HMODULE redir_mod;
     const struct hook_symbol *syms;
     size_t nsyms;
+    const struct hook_symbol **index;
+    size_t index_mask;
 };
 
 /* Helper functions */
 
 static void dll_hook_init(void);
+static uint32_t dll_hook_hash_name(const wchar_t *name);
+static uint32_t dll_hook_hash_sym(const char *name);
+static uint32_t dll_hook_hash_mod(HMODULE mod);
+static HRESULT dll_hook_index_syms(struct dll_hook_reg *reg);
 static HMODULE dll_hook_search_dll(const wchar_t *name);
+static const struct dll_hook_reg *dll_hook_search_mod(HMODULE mod);
+static const struct hook_symbol *dll_hook_search_sym(
+        const struct dll_hook_reg *reg,
+        const char *name);
+static wchar_t *dll_hook_widen(
+        const char *name,
+        wchar_t *buf,
+        size_t nchars);
 
 /* Hook functions */
 
@@ -66,8 +101,8 @@ static const struct hook_symbol dll_loader_syms[] = {
 
 static bool dll_hook_initted;
 static CRITICAL_SECTION dll_hook_lock;
-static struct dll_hook_reg *dll_hook_list;
-static size_t dll_hook_count;
+static struct dll_hook_reg *volatile dll_hook_names[DLL_HOOK_NBUCKETS];
+static struct dll_hook_reg *volatile dll_hook_mods[DLL_HOOK_NBUCKETS];
 
 HRESULT dll_hook_push(
         HMODULE redir_mod,
@@ -75,8 +110,8 @@ HRESULT dll_hook_push(
         const struct hook_symbol *syms,
         size_t nsyms)
 {
+    struct dll_hook_reg *volatile *pos;
     struct dll_hook_reg *new_item;
-    struct dll_hook_reg *new_mem;
     HRESULT hr;
 
     assert(name != NULL);
@@ -84,31 +119,60 @@ HRESULT dll_hook_push(
 
     dll_hook_init();
 
-    EnterCriticalSection(&dll_hook_lock);
-
-    new_mem = realloc(
-            dll_hook_list,
-            (dll_hook_count + 1) * sizeof(struct dll_hook_reg));
-
-    if (new_mem == NULL) {
-        hr = E_OUTOFMEMORY;
+    new_item = calloc(1, sizeof(*new_item));
 
-        goto end;
+    if (new_item == NULL) {
+        return E_OUTOFMEMORY;
     }
 
-    new_item = &new_mem[dll_hook_count];
+    new_item->hash = dll_hook_hash_name(name);
     new_item->name = name;
+    new_item->redir_mod = redir_mod;
     new_item->syms = syms;
     new_item->nsyms = nsyms;
 
-    dll_hook_list = new_mem;
-    dll_hook_count++;
-    hr = S_OK;
+    hr = dll_hook_index_syms(new_item);
+
+    if (FAILED(hr)) {
+        free(new_item);
+
+        return hr;
+    }
+
+    /* Append rather than prepend so that the first registration for a given
+       name keeps winning, as it did when this was a flat list. The entry is
+       fully initialized before the barrier, and becomes visible to lock-free
+       readers with the single pointer store that follows it. */
+
+    EnterCriticalSection(&dll_hook_lock);
+
+    MemoryBarrier();
+
+    pos = &dll_hook_names[new_item->hash % DLL_HOOK_NBUCKETS];
+
+    while (*pos != NULL) {
+        pos = &(*pos)->next_name;
+    }
+
+    *pos = new_item;
+
+    /* Some registrations (e.g. gfx) only want to be found by name and have no
+       redirect module to speak of. GetProcAddress(NULL, ...) looks up exports
+       of the main executable, so don't let those capture it. */
+
+    if (redir_mod != NULL) {
+        pos = &dll_hook_mods[dll_hook_hash_mod(redir_mod) % DLL_HOOK_NBUCKETS];
+
+        while (*pos != NULL) {
+            pos = &(*pos)->next_mod;
+        }
+
+        *pos = new_item;
+    }
 
-end:
     LeaveCriticalSection(&dll_hook_lock);
 
-    return hr;
+    return S_OK;
 }
 
 static void dll_hook_init(void)
@@ -144,40 +208,207 @@ static void dll_hook_init(void)
             _countof(dll_loader_syms));
 }
 
+static uint32_t dll_hook_hash_name(const wchar_t *name)
+{
+    uint32_t hash;
+
+    hash = 0x811c9dc5;
+
+    while (*name != L'\0') {
+        hash = (hash ^ (uint16_t) towlower(*name++)) * 0x01000193;
+    }
+
+    return hash;
+}
+
+static uint32_t dll_hook_hash_sym(const char *name)
+{
+    uint32_t hash;
+
+    hash = 0x811c9dc5;
+
+    while (*name != '\0') {
+        hash = (hash ^ (uint8_t) *name++) * 0x01000193;
+    }
+
+    return hash;
+}
+
+static uint32_t dll_hook_hash_mod(HMODULE mod)
+{
+    uintptr_t bits;
+
+    /* Module handles are 64 KiB aligned, so the low bits are all zero */
+
+    bits = (uintptr_t) mod >> 16;
+
+    return (uint32_t) (bits ^ (bits >> 7));
+}
+
+static HRESULT dll_hook_index_syms(struct dll_hook_reg *reg)
+{
+    const struct hook_symbol *sym;
+    size_t nslots;
+    size_t slot;
+    size_t i;
+
+    /* Keep the index at most half full so that probe sequences stay short.
+       Symbols registered without a name can only be imported by ordinal and
+       are not indexed. */
+
+    nslots = 4;
+
+    while (nslots < reg->nsyms * 2) {
+        nslots *= 2;
+    }
+
+    reg->index = calloc(nslots, sizeof(*reg->index));
+
+    if (reg->index == NULL) {
+        return E_OUTOFMEMORY;
+    }
+
+    reg->index_mask = nslots - 1;
+
+    for (i = 0 ; i < reg->nsyms ; i++) {
+        sym = &reg->syms[i];
+
+        if (sym->name == NULL) {
+            continue;
+        }
+
+        slot = dll_hook_hash_sym(sym->name) & reg->index_mask;
+
+        while (reg->index[slot] != NULL) {
+            if (strcmp(reg->index[slot]->name, sym->name) == 0) {
+                /* Duplicate: the first one wins, same as the linear scan */
+                break;
+            }
+
+            slot = (slot + 1) & reg->index_mask;
+        }
+
+        if (reg->index[slot] == NULL) {
+            reg->index[slot] = sym;
+        }
+    }
+
+    return S_OK;
+}
+
 static HMODULE dll_hook_search_dll(const wchar_t *name)
 {
-    HMODULE result;
+    const struct dll_hook_reg *reg;
+    uint32_t hash;
+
+    hash = dll_hook_hash_name(name);
+
+    for (   reg = dll_hook_names[hash % DLL_HOOK_NBUCKETS] ;
+            reg != NULL ;
+            reg = reg->next_name) {
+        if (reg->hash == hash && wcsicmp(name, reg->name) == 0) {
+            return reg->redir_mod;
+        }
+    }
+
+    return NULL;
+}
+
+static const struct dll_hook_reg *dll_hook_search_mod(HMODULE mod)
+{
+    const struct dll_hook_reg *reg;
+    uint32_t hash;
+
+    hash = dll_hook_hash_mod(mod);
+
+    for (   reg = dll_hook_mods[hash % DLL_HOOK_NBUCKETS] ;
+            reg != NULL ;
+            reg = reg->next_mod) {
+        if (reg->redir_mod == mod) {
+            return reg;
+        }
+    }
+
+    return NULL;
+}
+
+static const struct hook_symbol *dll_hook_search_sym(
+        const struct dll_hook_reg *reg,
+        const char *name)
+{
+    const struct hook_symbol *sym;
+    uintptr_t ordinal;
+    size_t slot;
     size_t i;
 
-    result = NULL;
+    ordinal = (uintptr_t) name;
 
-    EnterCriticalSection(&dll_hook_lock);
+    if (ordinal > 0xFFFF) {
+        /* Import by name */
+
+        slot = dll_hook_hash_sym(name) & reg->index_mask;
+
+        while ((sym = reg->index[slot]) != NULL) {
+            if (strcmp(name, sym->name) == 0) {
+                return sym;
+            }
 
-    for (i = 0 ; i < dll_hook_count ; i++) {
-        if (wcsicmp(name, dll_hook_list[i].name) == 0) {
-            result = dll_hook_list[i].redir_mod;
+            slot = (slot + 1) & reg->index_mask;
+        }
+    } else {
+        /* Import by ordinal (and name != NULL so ordinal != 0). This is rare
+           enough that a linear scan is fine. */
 
-            break;
+        for (i = 0 ; i < reg->nsyms ; i++) {
+            if (ordinal == reg->syms[i].ordinal) {
+                return &reg->syms[i];
+            }
         }
     }
 
-    LeaveCriticalSection(&dll_hook_lock);
+    return NULL;
+}
 
-    return result;
+static wchar_t *dll_hook_widen(
+        const char *name,
+        wchar_t *buf,
+        size_t nchars)
+{
+    wchar_t *name_w;
+    size_t name_c;
+
+    /* Module names practically always fit in MAX_PATH, so convert them on the
+       caller's stack and only touch the heap for the odd long path. Caller
+       must free() the result if it is not buf. */
+
+    mbstowcs_s(&name_c, NULL, 0, name, 0);
+
+    if (name_c <= nchars) {
+        name_w = buf;
+    } else {
+        name_w = malloc(name_c * sizeof(wchar_t));
+
+        if (name_w == NULL) {
+            return NULL;
+        }
+    }
+
+    mbstowcs_s(NULL, name_w, name_c, name, name_c - 1);
+
+    return name_w;
 }
 
 static HMODULE WINAPI hook_GetModuleHandleA(const char *name)
 {
+    wchar_t buf[MAX_PATH];
     HMODULE result;
     wchar_t *name_w;
-    size_t name_c;
 
     if (name == NULL) {
         return next_GetModuleHandleA(NULL);
     }
 
-    mbstowcs_s(&name_c, NULL, 0, name, 0);
-    name_w = malloc(name_c * sizeof(wchar_t));
+    name_w = dll_hook_widen(name, buf, _countof(buf));
 
     if (name_w == NULL) {
         SetLastError(ERROR_OUTOFMEMORY);
@@ -185,9 +416,11 @@ static HMODULE WINAPI hook_GetModuleHandleA(const char *name)
         return NULL;
     }
 
-    mbstowcs_s(NULL, name_w, name_c, name, name_c - 1);
     result = hook_GetModuleHandleW(name_w);
-    free(name_w);
+
+    if (name_w != buf) {
+        free(name_w);
+    }
 
     return result;
 }
@@ -213,9 +446,9 @@ static HMODULE WINAPI hook_GetModuleHandleW(const wchar_t *name)
 
 static HMODULE WINAPI hook_LoadLibraryA(const char *name)
 {
+    wchar_t buf[MAX_PATH];
     HMODULE result;
     wchar_t *name_w;
-    size_t name_c;
 
     if (name == NULL) {
         SetLastError(ERROR_INVALID_PARAMETER);
@@ -223,8 +456,7 @@ static HMODULE WINAPI hook_LoadLibraryA(const char *name)
         return NULL;
     }
 
-    mbstowcs_s(&name_c, NULL, 0, name, 0);
-    name_w = malloc(name_c * sizeof(wchar_t));
+    name_w = dll_hook_widen(name, buf, _countof(buf));
 
     if (name_w == NULL) {
         SetLastError(ERROR_OUTOFMEMORY);
@@ -232,9 +464,11 @@ static HMODULE WINAPI hook_LoadLibraryA(const char *name)
         return NULL;
     }
 
-    mbstowcs_s(NULL, name_w, name_c, name, name_c - 1);
     result = hook_LoadLibraryW(name_w);
-    free(name_w);
+
+    if (name_w != buf) {
+        free(name_w);
+    }
 
     return result;
 }
@@ -264,10 +498,8 @@ static HMODULE WINAPI hook_LoadLibraryW(const wchar_t *name)
 
 static void * WINAPI hook_GetProcAddress(HMODULE mod, const char *name)
 {
-    const struct hook_symbol *syms;
-    uintptr_t ordinal;
-    size_t nsyms;
-    size_t i;
+    const struct dll_hook_reg *reg;
+    const struct hook_symbol *sym;
 
     if (name == NULL) {
         SetLastError(ERROR_INVALID_PARAMETER);
@@ -275,50 +507,18 @@ static void * WINAPI hook_GetProcAddress(HMODULE mod, const char *name)
         return NULL;
     }
 
-    syms = NULL;
-    nsyms = 0;
+    reg = dll_hook_search_mod(mod);
 
-    EnterCriticalSection(&dll_hook_lock);
-
-    for (i = 0 ; i < dll_hook_count ; i++) {
-        if (dll_hook_list[i].redir_mod == mod) {
-            syms = dll_hook_list[i].syms;
-            nsyms = dll_hook_list[i].nsyms;
-
-            break;
-        }
-    }
-
-    LeaveCriticalSection(&dll_hook_lock);
-
-    if (syms == NULL) {
+    if (reg == NULL) {
         return next_GetProcAddress(mod, name);
     }
 
-    ordinal = (uintptr_t) name;
-
-    if (ordinal > 0xFFFF) {
-        /* Import by name */
-
-        for (i = 0 ; i < nsyms ; i++) {
-            if (strcmp(name, syms[i].name) == 0) {
-                break;
-            }
-        }
-    } else {
-        /* Import by ordinal (and name != NULL so ordinal != 0) */
-
-        for (i = 0 ; i < nsyms ; i++) {
-            if (ordinal == syms[i].ordinal) {
-                break;
-            }
-        }
-    }
+    sym = dll_hook_search_sym(reg, name);
 
-    if (i < nsyms) {
+    if (sym != NULL) {
         SetLastError(ERROR_SUCCESS);
 
-        return syms[i].patch;
+        return sym->patch;
     } else {
         /* GetProcAddress sets this error on failure, although of course MSDN
            does not see fit to document the exact error code. */
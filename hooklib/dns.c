@@ -6,10 +6,11 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include "hook/hr.h"
 #include "hook/table.h"
 
 #include "hooklib/dns.h"
@@ -32,11 +33,83 @@ typedef struct POLYFILL_DNS_QUERY_REQUEST {
     PVOID pQueryContext;
 } POLYFILL_DNS_QUERY_REQUEST;
 
+/* Redirection rules live in a hash table keyed on the ASCII case-folded
+   source name (DNS names are only case-insensitive in the ASCII range). Each
+   rule carries both a wide and a narrow copy of its names, so that the ANSI
+   hooks never need to convert anything.
+
+   Rules whose target is an IPv4 literal are answered directly, without
+   calling the real resolver at all. Rules whose target is a host name remember
+   the first IPv4 address that name resolved to for DNS_HOOK_TTL_MS and answer
+   from that in the meantime. If the target fails to resolve once that time is
+   up, the expired address is used anyway, so that a flaky uplink doesn't take
+   the title servers down with it.
+
+   Only A queries and IPv4-compatible getaddrinfo calls are answered this way,
+   everything else is merely redirected. */
+
+enum {
+    DNS_HOOK_NBUCKETS   = 64,
+    DNS_HOOK_TTL_MS     = 5 * 60 * 1000,
+};
+
 struct dns_hook_entry {
+    struct dns_hook_entry *next_w;
+    struct dns_hook_entry *next_a;
+    uint32_t hash_w;
+    uint32_t hash_a;
     wchar_t *from;
-    wchar_t *to;
+    char *from_a;
+    wchar_t *to;            /* NULL if lookups must fail */
+    char *to_a;
+    bool literal;           /* to is an IPv4 address, addr never expires */
+    bool cached;            /* addr holds something, even if expired */
+    uint8_t addr[4];
+    ULONGLONG expires;
 };
 
+typedef DNS_RECORD *(WINAPI *dns_hook_record_copy_t)(
+        DNS_RECORD *pRecord,
+        DNS_CHARSET CharSetIn,
+        DNS_CHARSET CharSetOut);
+
+/* Helpers */
+
+static uint32_t dns_hook_hash_w(const wchar_t *name);
+
+static uint32_t dns_hook_hash_a(const char *name);
+
+static char *dns_hook_narrow(const wchar_t *src);
+
+static bool dns_hook_parse_ipv4(const char *str, uint8_t *addr);
+
+static struct dns_hook_entry *dns_hook_match_w_locked(const wchar_t *name);
+
+static struct dns_hook_entry *dns_hook_match_a_locked(const char *name);
+
+static bool dns_hook_lookup_locked(
+        struct dns_hook_entry *entry,
+        bool allow_stale,
+        uint8_t *addr);
+
+static void dns_hook_store(struct dns_hook_entry *entry, const uint8_t *addr);
+
+static bool dns_hook_synth_record(
+        const void *name,
+        DNS_CHARSET charset,
+        const uint8_t *addr,
+        DNS_RECORD **out);
+
+static void dns_hook_harvest(
+        struct dns_hook_entry *entry,
+        const DNS_RECORD *records);
+
+static int dns_hook_synth_addrinfo(
+        const uint8_t *addr,
+        const char *pServiceName,
+        const ADDRINFOA *pHints,
+        ADDRINFOA **ppResult);
+
 /* Hook funcs */
 
 static DNS_STATUS WINAPI hook_DnsQuery_A(
@@ -122,8 +195,9 @@ static const struct hook_symbol dns_hook_syms_ws2[] = {
 
 static bool dns_hook_initted;
 static CRITICAL_SECTION dns_hook_lock;
-static struct dns_hook_entry *dns_hook_entries;
-static size_t dns_hook_nentries;
+static struct dns_hook_entry *dns_hook_buckets_w[DNS_HOOK_NBUCKETS];
+static struct dns_hook_entry *dns_hook_buckets_a[DNS_HOOK_NBUCKETS];
+static struct dns_hook_stats dns_hook_stats;
 
 static void dns_hook_init(void)
 {
@@ -149,149 +223,432 @@ static void dns_hook_init(void)
 
 HRESULT dns_hook_push(const wchar_t *from_src, const wchar_t *to_src)
 {
-    HRESULT hr;
-    struct dns_hook_entry *newmem;
-    struct dns_hook_entry *newitem;
-    wchar_t *from;
-    wchar_t *to;
+    struct dns_hook_entry *entry;
+    struct dns_hook_entry **pos;
 
     assert(from_src != NULL);
 
-    to = NULL;
-    from = NULL;
     dns_hook_init();
 
+    entry = calloc(1, sizeof(*entry));
+
+    if (entry == NULL) {
+        return E_OUTOFMEMORY;
+    }
+
+    entry->from = _wcsdup(from_src);
+    entry->from_a = dns_hook_narrow(from_src);
+
+    if (entry->from == NULL || entry->from_a == NULL) {
+        goto fail;
+    }
+
+    if (to_src != NULL) {
+        entry->to = _wcsdup(to_src);
+        entry->to_a = dns_hook_narrow(to_src);
+
+        if (entry->to == NULL || entry->to_a == NULL) {
+            goto fail;
+        }
+
+        entry->literal = dns_hook_parse_ipv4(entry->to_a, entry->addr);
+        entry->cached = entry->literal;
+    }
+
+    entry->hash_w = dns_hook_hash_w(entry->from);
+    entry->hash_a = dns_hook_hash_a(entry->from_a);
+
     EnterCriticalSection(&dns_hook_lock);
 
-    from = _wcsdup(from_src);
+    /* Append, so that the first rule pushed for a name keeps winning */
+
+    pos = &dns_hook_buckets_w[entry->hash_w % DNS_HOOK_NBUCKETS];
+
+    while (*pos != NULL) {
+        pos = &(*pos)->next_w;
+    }
+
+    *pos = entry;
+    pos = &dns_hook_buckets_a[entry->hash_a % DNS_HOOK_NBUCKETS];
+
+    while (*pos != NULL) {
+        pos = &(*pos)->next_a;
+    }
+
+    *pos = entry;
+
+    LeaveCriticalSection(&dns_hook_lock);
+
+    return S_OK;
+
+fail:
+    free(entry->to_a);
+    free(entry->to);
+    free(entry->from_a);
+    free(entry->from);
+    free(entry);
 
-    if (from == NULL) {
-        hr = E_OUTOFMEMORY;
+    return E_OUTOFMEMORY;
+}
 
-        goto end;
+void dns_hook_get_stats(struct dns_hook_stats *stats)
+{
+    assert(stats != NULL);
+
+    if (!dns_hook_initted) {
+        memset(stats, 0, sizeof(*stats));
+
+        return;
     }
 
-    if(to_src != NULL) {
-        to = _wcsdup(to_src);
+    EnterCriticalSection(&dns_hook_lock);
+    memcpy(stats, &dns_hook_stats, sizeof(*stats));
+    LeaveCriticalSection(&dns_hook_lock);
+}
 
-        if (to == NULL) {
-            hr = E_OUTOFMEMORY;
+static uint32_t dns_hook_hash_w(const wchar_t *name)
+{
+    uint32_t hash;
+    wchar_t c;
 
-            goto end;
+    hash = 0x811c9dc5;
+
+    for ( ; *name != L'\0' ; name++) {
+        c = *name;
+
+        if (c >= L'A' && c <= L'Z') {
+            c += L'a' - L'A';
         }
+
+        hash = (hash ^ (uint16_t) c) * 0x01000193;
     }
 
-    newmem = realloc(
-            dns_hook_entries,
-            (dns_hook_nentries + 1) * sizeof(struct dns_hook_entry));
+    return hash;
+}
+
+static uint32_t dns_hook_hash_a(const char *name)
+{
+    uint32_t hash;
+    char c;
+
+    hash = 0x811c9dc5;
 
-    if (newmem == NULL) {
-        hr = E_OUTOFMEMORY;
+    for ( ; *name != '\0' ; name++) {
+        c = *name;
 
-        goto end;
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+
+        hash = (hash ^ (uint8_t) c) * 0x01000193;
     }
 
-    dns_hook_entries = newmem;
-    newitem = &newmem[dns_hook_nentries++];
-    newitem->from = from;
-    newitem->to = to;
+    return hash;
+}
+
+static char *dns_hook_narrow(const wchar_t *src)
+{
+    size_t dest_c;
+    char *dest;
 
-    from = NULL;
-    to = NULL;
-    hr = S_OK;
+    wcstombs_s(&dest_c, NULL, 0, src, 0);
+    dest = malloc(dest_c * sizeof(char));
 
-end:
-    LeaveCriticalSection(&dns_hook_lock);
+    if (dest == NULL) {
+        return NULL;
+    }
 
-    free(to);
-    free(from);
+    wcstombs_s(NULL, dest, dest_c, src, dest_c - 1);
 
-    return hr;
+    return dest;
 }
 
-static DNS_STATUS WINAPI hook_DnsQuery_A(
-        const char *pszName,
-        WORD wType,
-        DWORD Options,
-        void *pExtra,
-        DNS_RECORD **ppQueryResults,
-        void *pReserved)
+/* Strict dotted quad only; anything else is treated as a host name. */
+
+static bool dns_hook_parse_ipv4(const char *str, uint8_t *addr)
 {
-    const struct dns_hook_entry *pos;
+    unsigned int value;
+    size_t ndigits;
     size_t i;
-    size_t wstr_c;
-    wchar_t *wstr;
-    size_t str_c;
-    char *str;
-    DNS_STATUS code;
-    HRESULT hr;
 
-    wstr = NULL;
-    str = NULL;
+    for (i = 0 ; i < 4 ; i++) {
+        value = 0;
+        ndigits = 0;
 
-    if (pszName == NULL) {
-        hr = HRESULT_FROM_WIN32(ERROR_INVALID_PARAMETER);
+        while (str[ndigits] >= '0' && str[ndigits] <= '9') {
+            value = value * 10 + (str[ndigits++] - '0');
+
+            if (ndigits > 3 || value > 255) {
+                return false;
+            }
+        }
+
+        if (ndigits == 0 || str[ndigits] != (i < 3 ? '.' : '\0')) {
+            return false;
+        }
+
+        addr[i] = (uint8_t) value;
+        str += ndigits + 1;
+    }
 
-        goto end;
+    return true;
+}
+
+static struct dns_hook_entry *dns_hook_match_w_locked(const wchar_t *name)
+{
+    struct dns_hook_entry *entry;
+    uint32_t hash;
+
+    hash = dns_hook_hash_w(name);
+
+    for (   entry = dns_hook_buckets_w[hash % DNS_HOOK_NBUCKETS] ;
+            entry != NULL ;
+            entry = entry->next_w) {
+        if (entry->hash_w == hash && _wcsicmp(entry->from, name) == 0) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static struct dns_hook_entry *dns_hook_match_a_locked(const char *name)
+{
+    struct dns_hook_entry *entry;
+    uint32_t hash;
+
+    hash = dns_hook_hash_a(name);
+
+    for (   entry = dns_hook_buckets_a[hash % DNS_HOOK_NBUCKETS] ;
+            entry != NULL ;
+            entry = entry->next_a) {
+        if (entry->hash_a == hash && _stricmp(entry->from_a, name) == 0) {
+            return entry;
+        }
     }
 
-    mbstowcs_s(&wstr_c, NULL, 0, pszName, 0);
-    wstr = malloc(wstr_c * sizeof(wchar_t));
+    return NULL;
+}
+
+/* Fetches the address to answer with, if there is one. Expired addresses are
+   only returned if allow_stale is set, which callers do once the real
+   resolver has already failed them. */
+
+static bool dns_hook_lookup_locked(
+        struct dns_hook_entry *entry,
+        bool allow_stale,
+        uint8_t *addr)
+{
+    if (!entry->cached) {
+        if (!allow_stale) {
+            dns_hook_stats.misses++;
+        }
+
+        return false;
+    }
 
-    if (wstr == NULL) {
-        hr = HRESULT_FROM_WIN32(ERROR_OUTOFMEMORY);
+    if (allow_stale) {
+        dns_hook_stats.stale++;
+    } else if (entry->literal || GetTickCount64() < entry->expires) {
+        dns_hook_stats.hits++;
+    } else {
+        dns_hook_stats.misses++;
 
-        goto end;
+        return false;
     }
 
-    mbstowcs_s(NULL, wstr, wstr_c, pszName, wstr_c - 1);
+    memcpy(addr, entry->addr, sizeof(entry->addr));
+
+    return true;
+}
+
+static void dns_hook_store(struct dns_hook_entry *entry, const uint8_t *addr)
+{
     EnterCriticalSection(&dns_hook_lock);
 
-    for (i = 0 ; i < dns_hook_nentries ; i++) {
-        pos = &dns_hook_entries[i];
+    memcpy(entry->addr, addr, sizeof(entry->addr));
+    entry->cached = true;
+    entry->expires = GetTickCount64() + DNS_HOOK_TTL_MS;
 
-        if (_wcsicmp(wstr, pos->from) == 0) {
-            if(pos->to == NULL) {
-                LeaveCriticalSection(&dns_hook_lock);
-                hr = HRESULT_FROM_WIN32(DNS_ERROR_RCODE_NAME_ERROR);
+    LeaveCriticalSection(&dns_hook_lock);
+}
 
-                goto end;
-            }
+static bool dns_hook_synth_record(
+        const void *name,
+        DNS_CHARSET charset,
+        const uint8_t *addr,
+        DNS_RECORD **out)
+{
+    dns_hook_record_copy_t record_copy;
+    DNS_RECORD record;
+    HMODULE dnsapi;
+
+    if (out == NULL) {
+        return false;
+    }
 
-            wcstombs_s(&str_c, NULL, 0, pos->to, 0);
-            str = malloc(str_c * sizeof(char));
+    /* The caller frees our answer with DnsRecordListFree(), so it has to come
+       from dnsapi's own allocator. dnsapi is necessarily loaded if we are
+       being called from it. */
 
-            if (str == NULL) {
-                LeaveCriticalSection(&dns_hook_lock);
-                hr = HRESULT_FROM_WIN32(ERROR_OUTOFMEMORY);
+    dnsapi = GetModuleHandleW(L"dnsapi.dll");
 
-                goto end;
-            }
+    if (dnsapi == NULL) {
+        return false;
+    }
+
+    record_copy = (dns_hook_record_copy_t) GetProcAddress(
+            dnsapi,
+            "DnsRecordCopyEx");
+
+    if (record_copy == NULL) {
+        return false;
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.pName = (void *) name;
+    record.wType = DNS_TYPE_A;
+    record.wDataLength = sizeof(DNS_A_DATA);
+    record.Flags.S.Section = DnsSectionAnswer;
+    record.Flags.S.CharSet = charset;
+    record.dwTtl = DNS_HOOK_TTL_MS / 1000;
+    memcpy(&record.Data.A.IpAddress, addr, sizeof(record.Data.A.IpAddress));
+
+    *out = record_copy(&record, charset, charset);
+
+    return *out != NULL;
+}
+
+static void dns_hook_harvest(
+        struct dns_hook_entry *entry,
+        const DNS_RECORD *records)
+{
+    const DNS_RECORD *record;
 
-            wcstombs_s(NULL, str, str_c, pos->to, str_c - 1);
-            pszName = str;
+    /* Only the record layout matters here, not the name's character set */
 
-            break;
+    for (record = records ; record != NULL ; record = record->pNext) {
+        if (    record->wType == DNS_TYPE_A &&
+                record->Flags.S.Section == DnsSectionAnswer) {
+            dns_hook_store(entry, (const uint8_t *) &record->Data.A.IpAddress);
+
+            return;
         }
     }
+}
+
+static int dns_hook_synth_addrinfo(
+        const uint8_t *addr,
+        const char *pServiceName,
+        const ADDRINFOA *pHints,
+        ADDRINFOA **ppResult)
+{
+    ADDRINFOA hints;
+    char str[16];
+
+    /* Let the real getaddrinfo build the answer so that the caller can free
+       it normally, but make sure it doesn't go anywhere near the network. */
+
+    if (pHints != NULL) {
+        memcpy(&hints, pHints, sizeof(hints));
+    } else {
+        memset(&hints, 0, sizeof(hints));
+    }
+
+    hints.ai_flags |= AI_NUMERICHOST;
+    sprintf_s(
+            str,
+            sizeof(str),
+            "%u.%u.%u.%u",
+            addr[0],
+            addr[1],
+            addr[2],
+            addr[3]);
+
+    return next_getaddrinfo(str, pServiceName, &hints, ppResult);
+}
+
+static DNS_STATUS WINAPI hook_DnsQuery_A(
+        const char *pszName,
+        WORD wType,
+        DWORD Options,
+        void *pExtra,
+        DNS_RECORD **ppQueryResults,
+        void *pReserved)
+{
+    struct dns_hook_entry *entry;
+    uint8_t addr[4];
+    DNS_STATUS code;
+    bool hit;
+
+    if (pszName == NULL) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    EnterCriticalSection(&dns_hook_lock);
+
+    entry = dns_hook_match_a_locked(pszName);
+    hit = false;
+
+    if (entry != NULL && entry->to != NULL && wType == DNS_TYPE_A) {
+        hit = dns_hook_lookup_locked(entry, false, addr);
+    }
 
     LeaveCriticalSection(&dns_hook_lock);
 
-    code = next_DnsQuery_A(
+    if (entry == NULL) {
+        return next_DnsQuery_A(
+                pszName,
+                wType,
+                Options,
+                pExtra,
+                ppQueryResults,
+                pReserved);
+    }
+
+    if (entry->to == NULL) {
+        return DNS_ERROR_RCODE_NAME_ERROR;
+    }
+
+    if (hit && dns_hook_synth_record(
             pszName,
+            DnsCharSetAnsi,
+            addr,
+            ppQueryResults)) {
+        return ERROR_SUCCESS;
+    }
+
+    code = next_DnsQuery_A(
+            entry->to_a,
             wType,
             Options,
             pExtra,
             ppQueryResults,
             pReserved);
 
-    hr = HRESULT_FROM_WIN32(code);
+    if (wType != DNS_TYPE_A || ppQueryResults == NULL) {
+        return code;
+    }
+
+    if (code == ERROR_SUCCESS) {
+        dns_hook_harvest(entry, *ppQueryResults);
+
+        return code;
+    }
 
-end:
-    free(str);
-    free(wstr);
+    EnterCriticalSection(&dns_hook_lock);
+    hit = dns_hook_lookup_locked(entry, true, addr);
+    LeaveCriticalSection(&dns_hook_lock);
 
-    return hr_to_win32_error(hr);
+    if (hit && dns_hook_synth_record(
+            pszName,
+            DnsCharSetAnsi,
+            addr,
+            ppQueryResults)) {
+        return ERROR_SUCCESS;
+    }
+
+    return code;
 }
 
 static DNS_STATUS WINAPI hook_DnsQuery_W(
@@ -302,8 +659,10 @@ static DNS_STATUS WINAPI hook_DnsQuery_W(
         DNS_RECORD **ppQueryResults,
         void *pReserved)
 {
-    const struct dns_hook_entry *pos;
-    size_t i;
+    struct dns_hook_entry *entry;
+    uint8_t addr[4];
+    DNS_STATUS code;
+    bool hit;
 
     if (pszName == NULL) {
         return ERROR_INVALID_PARAMETER;
@@ -311,31 +670,68 @@ static DNS_STATUS WINAPI hook_DnsQuery_W(
 
     EnterCriticalSection(&dns_hook_lock);
 
-    for (i = 0 ; i < dns_hook_nentries ; i++) {
-        pos = &dns_hook_entries[i];
+    entry = dns_hook_match_w_locked(pszName);
+    hit = false;
 
-        if (_wcsicmp(pszName, pos->from) == 0) {
-            if(pos->to == NULL) {
-                LeaveCriticalSection(&dns_hook_lock);
-                return HRESULT_FROM_WIN32(DNS_ERROR_RCODE_NAME_ERROR);
-            }
+    if (entry != NULL && entry->to != NULL && wType == DNS_TYPE_A) {
+        hit = dns_hook_lookup_locked(entry, false, addr);
+    }
 
-            pszName = pos->to;
+    LeaveCriticalSection(&dns_hook_lock);
 
-            break;
-        }
+    if (entry == NULL) {
+        return next_DnsQuery_W(
+                pszName,
+                wType,
+                Options,
+                pExtra,
+                ppQueryResults,
+                pReserved);
     }
 
-    LeaveCriticalSection(&dns_hook_lock);
+    if (entry->to == NULL) {
+        return HRESULT_FROM_WIN32(DNS_ERROR_RCODE_NAME_ERROR);
+    }
 
-    return next_DnsQuery_W(
+    if (hit && dns_hook_synth_record(
             pszName,
+            DnsCharSetUnicode,
+            addr,
+            ppQueryResults)) {
+        return ERROR_SUCCESS;
+    }
+
+    code = next_DnsQuery_W(
+            entry->to,
             wType,
             Options,
             pExtra,
             ppQueryResults,
             pReserved);
 
+    if (wType != DNS_TYPE_A || ppQueryResults == NULL) {
+        return code;
+    }
+
+    if (code == ERROR_SUCCESS) {
+        dns_hook_harvest(entry, *ppQueryResults);
+
+        return code;
+    }
+
+    EnterCriticalSection(&dns_hook_lock);
+    hit = dns_hook_lookup_locked(entry, true, addr);
+    LeaveCriticalSection(&dns_hook_lock);
+
+    if (hit && dns_hook_synth_record(
+            pszName,
+            DnsCharSetUnicode,
+            addr,
+            ppQueryResults)) {
+        return ERROR_SUCCESS;
+    }
+
+    return code;
 }
 
 static DNS_STATUS WINAPI hook_DnsQueryEx(
@@ -343,35 +739,33 @@ static DNS_STATUS WINAPI hook_DnsQueryEx(
         void *pQueryResults,
         void *pCancelHandle)
 {
+    const struct dns_hook_entry *entry;
     const wchar_t *orig;
-    const struct dns_hook_entry *pos;
     DNS_STATUS code;
-    size_t i;
 
     if (pRequest == NULL) {
         return ERROR_INVALID_PARAMETER;
     }
 
+    /* Results are returned through a structure we'd rather not have to
+       polyfill too, so this one only ever redirects. */
+
     orig = pRequest->QueryName;
-    EnterCriticalSection(&dns_hook_lock);
 
-    for (i = 0 ; i < dns_hook_nentries ; i++) {
-        pos = &dns_hook_entries[i];
+    if (orig != NULL) {
+        EnterCriticalSection(&dns_hook_lock);
+        entry = dns_hook_match_w_locked(orig);
+        LeaveCriticalSection(&dns_hook_lock);
 
-        if (_wcsicmp(pRequest->QueryName, pos->from) == 0) {
-            if(pos->to == NULL) {
-                LeaveCriticalSection(&dns_hook_lock);
+        if (entry != NULL) {
+            if (entry->to == NULL) {
                 return HRESULT_FROM_WIN32(DNS_ERROR_RCODE_NAME_ERROR);
             }
 
-            pRequest->QueryName = pos->to;
-
-            break;
+            pRequest->QueryName = entry->to;
         }
     }
 
-    LeaveCriticalSection(&dns_hook_lock);
-
     code = next_DnsQueryEx(pRequest, pQueryResults, pCancelHandle);
 
     /* Caller might not appreciate QueryName changing under its feet. It is
@@ -393,70 +787,73 @@ static int WSAAPI hook_getaddrinfo(
         const ADDRINFOA *pHints,
         ADDRINFOA **ppResult)
 {
-    const struct dns_hook_entry *pos;
-    char *str;
-    size_t str_c;
-    wchar_t *wstr;
-    size_t wstr_c;
+    struct dns_hook_entry *entry;
+    const struct sockaddr_in *sin;
+    const ADDRINFOA *ai;
+    uint8_t addr[4];
+    bool cacheable;
+    bool hit;
     int result;
-    size_t i;
-
-    str = NULL;
-    wstr = NULL;
 
     if (pNodeName == NULL) {
-        result = WSA_INVALID_PARAMETER;
-
-        goto end;
+        return WSA_INVALID_PARAMETER;
     }
 
-    mbstowcs_s(&wstr_c, NULL, 0, pNodeName, 0);
-    wstr = malloc(wstr_c * sizeof(wchar_t));
+    /* We only ever remember IPv4 addresses */
 
-    if (wstr == NULL) {
-        result = WSA_NOT_ENOUGH_MEMORY;
+    cacheable = pHints == NULL
+            || pHints->ai_family == AF_UNSPEC
+            || pHints->ai_family == AF_INET;
 
-        goto end;
-    }
-
-    mbstowcs_s(NULL, wstr, wstr_c, pNodeName, wstr_c - 1);
     EnterCriticalSection(&dns_hook_lock);
 
-    for (i = 0 ; i < dns_hook_nentries ; i++) {
-        pos = &dns_hook_entries[i];
+    entry = dns_hook_match_a_locked(pNodeName);
+    hit = false;
+
+    if (entry != NULL && entry->to != NULL && cacheable) {
+        hit = dns_hook_lookup_locked(entry, false, addr);
+    }
 
-        if (_wcsicmp(wstr, pos->from) == 0) {
-            if(pos->to == NULL) {
-                LeaveCriticalSection(&dns_hook_lock);
-                result = EAI_NONAME;
+    LeaveCriticalSection(&dns_hook_lock);
 
-                goto end;
-            }
+    if (entry == NULL) {
+        return next_getaddrinfo(pNodeName, pServiceName, pHints, ppResult);
+    }
 
-            wcstombs_s(&str_c, NULL, 0, pos->to, 0);
-            str = malloc(str_c * sizeof(char));
+    if (entry->to == NULL) {
+        return EAI_NONAME;
+    }
 
-            if (str == NULL) {
-                LeaveCriticalSection(&dns_hook_lock);
-                result = WSA_NOT_ENOUGH_MEMORY;
+    if (hit) {
+        return dns_hook_synth_addrinfo(addr, pServiceName, pHints, ppResult);
+    }
 
-                goto end;
-            }
+    result = next_getaddrinfo(entry->to_a, pServiceName, pHints, ppResult);
 
-            wcstombs_s(NULL, str, str_c, pos->to, str_c - 1);
-            pNodeName = str;
+    if (!cacheable || ppResult == NULL) {
+        return result;
+    }
+
+    if (result == 0) {
+        for (ai = *ppResult ; ai != NULL ; ai = ai->ai_next) {
+            if (ai->ai_family == AF_INET && ai->ai_addr != NULL) {
+                sin = (const struct sockaddr_in *) ai->ai_addr;
+                dns_hook_store(entry, (const uint8_t *) &sin->sin_addr);
 
-            break;
+                break;
+            }
         }
+
+        return result;
     }
 
+    EnterCriticalSection(&dns_hook_lock);
+    hit = dns_hook_lookup_locked(entry, true, addr);
     LeaveCriticalSection(&dns_hook_lock);
 
-    result = next_getaddrinfo(pNodeName, pServiceName, pHints, ppResult);
-
-end:
-    free(wstr);
-    free(str);
+    if (hit) {
+        return dns_hook_synth_addrinfo(addr, pServiceName, pHints, ppResult);
+    }
 
     return result;
 }
@@ -3,7 +3,20 @@
 #include <windows.h>
 
 #include <stddef.h>
+#include <stdint.h>
+
+/* Counters for the answers served without asking the real resolver. A hit is
+   a lookup answered from a literal IP target or an unexpired cached address, a
+   miss is one that had to go to the real resolver. stale counts expired
+   addresses that were used because the real resolver failed. */
+
+struct dns_hook_stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t stale;
+};
 
 // if to_src is NULL, all lookups for from_src will fail
 HRESULT dns_hook_push(const wchar_t *from_src, const wchar_t *to_src);
 
+void dns_hook_get_stats(struct dns_hook_stats *stats);
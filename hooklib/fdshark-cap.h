@@ -0,0 +1,62 @@
+#pragma once
+
+/* On-disk layout of an FdShark capture file, shared with the offline
+   decoder (fdsharkdump) so this header must stay free of Win32 types.
+
+   A capture file consists of a fixed header followed by a ring of
+   variable-length records. `head' counts every byte ever reserved in the
+   ring, so the live data is the final min(head, ring_size) bytes that end at
+   (head % ring_size). Records are 8-byte aligned and may wrap around the end
+   of the ring. Once the ring has wrapped, the oldest surviving record has to
+   be found by scanning for FDSHARK_CAP_RECORD_MAGIC. */
+
+#include <stdint.h>
+
+#define FDSHARK_CAP_MAGIC           0x4b534446 /* "FDSK" */
+#define FDSHARK_CAP_RECORD_MAGIC    0x43455246 /* "FREC" */
+
+enum {
+    FDSHARK_CAP_VERSION         = 1,
+    FDSHARK_CAP_PATH_MAX        = 64,
+    FDSHARK_CAP_PAYLOAD_MAX     = 4096,
+};
+
+enum {
+    FDSHARK_CAP_OPEN            = 0,
+    FDSHARK_CAP_CLOSE           = 1,
+    FDSHARK_CAP_READ            = 2,
+    FDSHARK_CAP_WRITE           = 3,
+    FDSHARK_CAP_IOCTL           = 4,
+};
+
+enum {
+    FDSHARK_CAP_SUBMIT          = 0,
+    FDSHARK_CAP_COMPLETE        = 1,
+};
+
+struct fdshark_cap_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t ring_size;
+    int64_t qpc_freq;
+    int64_t qpc_start;
+    int64_t head;
+    uint16_t path[FDSHARK_CAP_PATH_MAX];
+};
+
+struct fdshark_cap_record {
+    uint32_t magic;
+    uint32_t size;          /* Including this header, multiple of 8 */
+    int64_t time;           /* QPC ticks since qpc_start */
+    uint8_t kind;
+    uint8_t phase;
+    uint16_t reserved;
+    uint32_t thread;
+    uint32_t fd;
+    uint32_t ioctl;
+    int32_t hr;
+    uint32_t pos;
+    uint32_t nbytes;
+    uint32_t payload_size;  /* Payload bytes stored, may be truncated */
+};
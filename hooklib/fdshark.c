@@ -3,12 +3,15 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 
 #include "hook/iobuf.h"
 #include "hook/iohook.h"
 
+#include "hooklib/fdshark-cap.h"
 #include "hooklib/fdshark.h"
+#include "hooklib/iostat.h"
 
 #include "util/dprintf.h"
 #include "util/dump.h"
@@ -16,6 +19,8 @@
 static const wchar_t *fdshark_path;
 static HANDLE fdshark_target_fd;
 static int fdshark_flags;
+static struct fdshark_cap_header *fdshark_cap;
+static uint8_t *fdshark_cap_ring;
 
 static HRESULT fdshark_handle_irp(struct irp *irp);
 static HRESULT fdshark_handle_open(struct irp *irp);
@@ -24,6 +29,11 @@ static HRESULT fdshark_handle_read(struct irp *irp);
 static HRESULT fdshark_handle_write(struct irp *irp);
 static HRESULT fdshark_handle_ioctl(struct irp *irp);
 static bool fdshark_force_sync(struct irp *irp, HRESULT hr);
+static void fdshark_capture(
+        const struct irp *irp,
+        uint8_t phase,
+        HRESULT hr);
+static void fdshark_capture_copy(int64_t off, const void *src, size_t nbytes);
 
 HRESULT fdshark_hook_init(const wchar_t *path, int flags)
 {
@@ -33,7 +43,100 @@ HRESULT fdshark_hook_init(const wchar_t *path, int flags)
     fdshark_path = path;
     fdshark_flags = flags;
 
-    return iohook_push_handler(fdshark_handle_irp);
+    return iostat_push_handler("fdshark", fdshark_handle_irp);
+}
+
+HRESULT fdshark_capture_init(const wchar_t *filename, uint32_t ring_size)
+{
+    struct fdshark_cap_header *hdr;
+    LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    HANDLE file;
+    HANDLE mapping;
+    DWORD total;
+    HRESULT hr;
+    size_t i;
+
+    assert(filename != NULL);
+    assert(fdshark_path != NULL);
+    assert(fdshark_cap == NULL);
+
+    if (ring_size == 0) {
+        ring_size = FDSHARK_CAP_DEFAULT_SIZE;
+    }
+
+    assert(ring_size >= FDSHARK_CAP_MIN_SIZE);
+    assert((ring_size & (ring_size - 1)) == 0);
+
+    total = sizeof(*hdr) + ring_size;
+
+    file = CreateFileW(
+            filename,
+            GENERIC_READ | GENERIC_WRITE,
+            FILE_SHARE_READ,
+            NULL,
+            CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL,
+            NULL);
+
+    if (file == INVALID_HANDLE_VALUE) {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        dprintf("FdShark: Failed to create %S: %x\n", filename, (int) hr);
+
+        return hr;
+    }
+
+    /* The mapping and the view each keep the file open, so our handles can
+       go straight away. The view is never unmapped; the OS writes it back to
+       disk even if the process dies abnormally. */
+
+    mapping = CreateFileMappingW(file, NULL, PAGE_READWRITE, 0, total, NULL);
+    CloseHandle(file);
+
+    if (mapping == NULL) {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        dprintf("FdShark: CreateFileMapping failed: %x\n", (int) hr);
+
+        return hr;
+    }
+
+    hdr = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, total);
+    CloseHandle(mapping);
+
+    if (hdr == NULL) {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        dprintf("FdShark: MapViewOfFile failed: %x\n", (int) hr);
+
+        return hr;
+    }
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+
+    hdr->magic = FDSHARK_CAP_MAGIC;
+    hdr->version = FDSHARK_CAP_VERSION;
+    hdr->header_size = sizeof(*hdr);
+    hdr->ring_size = ring_size;
+    hdr->qpc_freq = freq.QuadPart;
+    hdr->qpc_start = now.QuadPart;
+    hdr->head = 0;
+
+    for (i = 0 ; i < FDSHARK_CAP_PATH_MAX - 1 && fdshark_path[i] ; i++) {
+        hdr->path[i] = fdshark_path[i];
+    }
+
+    fdshark_cap_ring = (uint8_t *) (hdr + 1);
+
+    /* Publish the ring pointer before the header pointer */
+
+    MemoryBarrier();
+    fdshark_cap = hdr;
+
+    dprintf("FdShark: Capturing to %S (%u bytes)\n",
+            filename,
+            (unsigned int) ring_size);
+
+    return S_OK;
 }
 
 static HRESULT fdshark_handle_irp(struct irp *irp)
@@ -71,6 +174,10 @@ static HRESULT fdshark_handle_open(struct irp *irp)
     dprintf("FdShark: Opened %S\n", fdshark_path);
     fdshark_target_fd = irp->fd;
 
+    if (fdshark_cap != NULL) {
+        fdshark_capture(irp, FDSHARK_CAP_COMPLETE, hr);
+    }
+
     return hr;
 }
 
@@ -79,6 +186,10 @@ static HRESULT fdshark_handle_close(struct irp *irp)
     dprintf("FdShark: Closed %S\n", fdshark_path);
     fdshark_target_fd = NULL;
 
+    if (fdshark_cap != NULL) {
+        fdshark_capture(irp, FDSHARK_CAP_SUBMIT, S_OK);
+    }
+
     return iohook_invoke_next(irp);
 }
 
@@ -90,15 +201,25 @@ static HRESULT fdshark_handle_read(struct irp *irp)
         return iohook_invoke_next(irp);
     }
 
-    dprintf("FdShark: Read %p:%i/%i\n",
-            irp->read.bytes,
-            (int) irp->read.pos,
-            (int) irp->read.nbytes);
+    if (fdshark_cap != NULL) {
+        fdshark_capture(irp, FDSHARK_CAP_SUBMIT, S_OK);
+    } else {
+        dprintf("FdShark: Read %p:%i/%i\n",
+                irp->read.bytes,
+                (int) irp->read.pos,
+                (int) irp->read.nbytes);
+    }
 
     hr = iohook_invoke_next(irp);
 
     if (FAILED(hr) && !fdshark_force_sync(irp, hr)) {
-        dprintf("FdShark: FAILED: %x\n", (int) hr);
+        if (fdshark_cap != NULL) {
+            fdshark_capture(irp, FDSHARK_CAP_COMPLETE, hr);
+        } else {
+            dprintf("FdShark: FAILED: %x\n", (int) hr);
+        }
+    } else if (fdshark_cap != NULL) {
+        fdshark_capture(irp, FDSHARK_CAP_COMPLETE, S_OK);
     } else {
         dprintf("FdShark: Read %p:%i/%i OK\n",
                 irp->read.bytes,
@@ -118,16 +239,26 @@ static HRESULT fdshark_handle_write(struct irp *irp)
         return iohook_invoke_next(irp);
     }
 
-    dprintf("FdShark: Write %p:%i/%i\n",
-            irp->write.bytes,
-            (int) irp->write.pos,
-            (int) irp->write.nbytes);
-    dump_const_iobuf(&irp->write);
+    if (fdshark_cap != NULL) {
+        fdshark_capture(irp, FDSHARK_CAP_SUBMIT, S_OK);
+    } else {
+        dprintf("FdShark: Write %p:%i/%i\n",
+                irp->write.bytes,
+                (int) irp->write.pos,
+                (int) irp->write.nbytes);
+        dump_const_iobuf(&irp->write);
+    }
 
     hr = iohook_invoke_next(irp);
 
     if (FAILED(hr) && !fdshark_force_sync(irp, hr)) {
-        dprintf("FdShark: FAILED: %x\n", (int) hr);
+        if (fdshark_cap != NULL) {
+            fdshark_capture(irp, FDSHARK_CAP_COMPLETE, hr);
+        } else {
+            dprintf("FdShark: FAILED: %x\n", (int) hr);
+        }
+    } else if (fdshark_cap != NULL) {
+        fdshark_capture(irp, FDSHARK_CAP_COMPLETE, S_OK);
     } else {
         dprintf("FdShark: Write %p:%i/%i OK\n",
                 irp->write.bytes,
@@ -146,20 +277,30 @@ static HRESULT fdshark_handle_ioctl(struct irp *irp)
         return iohook_invoke_next(irp);
     }
 
-    dprintf("FdShark: Ioctl %08x w:%p:%i/%i r:%p:%i/%i\n",
-            irp->ioctl,
-            irp->write.bytes,
-            (int) irp->write.pos,
-            (int) irp->write.nbytes,
-            irp->read.bytes,
-            (int) irp->read.pos,
-            (int) irp->read.nbytes);
-    dump_const_iobuf(&irp->write);
+    if (fdshark_cap != NULL) {
+        fdshark_capture(irp, FDSHARK_CAP_SUBMIT, S_OK);
+    } else {
+        dprintf("FdShark: Ioctl %08x w:%p:%i/%i r:%p:%i/%i\n",
+                irp->ioctl,
+                irp->write.bytes,
+                (int) irp->write.pos,
+                (int) irp->write.nbytes,
+                irp->read.bytes,
+                (int) irp->read.pos,
+                (int) irp->read.nbytes);
+        dump_const_iobuf(&irp->write);
+    }
 
     hr = iohook_invoke_next(irp);
 
     if (FAILED(hr) && !fdshark_force_sync(irp, hr)) {
-        dprintf("FdShark: FAILED: %x\n", (int) hr);
+        if (fdshark_cap != NULL) {
+            fdshark_capture(irp, FDSHARK_CAP_COMPLETE, hr);
+        } else {
+            dprintf("FdShark: FAILED: %x\n", (int) hr);
+        }
+    } else if (fdshark_cap != NULL) {
+        fdshark_capture(irp, FDSHARK_CAP_COMPLETE, S_OK);
     } else {
         dprintf("FdShark: Ioctl %08x w:%p:%i/%i r:%p:%i/%i OK\n",
                 irp->ioctl,
@@ -216,3 +357,126 @@ static bool fdshark_force_sync(struct irp *irp, HRESULT hr)
 
     return true;
 }
+
+static void fdshark_capture(
+        const struct irp *irp,
+        uint8_t phase,
+        HRESULT hr)
+{
+    struct fdshark_cap_record rec;
+    const uint8_t *payload;
+    size_t payload_size;
+    LARGE_INTEGER now;
+    int64_t off;
+
+    QueryPerformanceCounter(&now);
+    memset(&rec, 0, sizeof(rec));
+
+    payload = NULL;
+    payload_size = 0;
+
+    /* Requests carry the bytes being written, completions carry the bytes
+       that were read back (and only if the operation actually finished). */
+
+    switch (irp->op) {
+    case IRP_OP_OPEN:
+        rec.kind = FDSHARK_CAP_OPEN;
+
+        break;
+
+    case IRP_OP_CLOSE:
+        rec.kind = FDSHARK_CAP_CLOSE;
+
+        break;
+
+    case IRP_OP_READ:
+        rec.kind = FDSHARK_CAP_READ;
+        rec.pos = (uint32_t) irp->read.pos;
+        rec.nbytes = (uint32_t) irp->read.nbytes;
+
+        if (phase == FDSHARK_CAP_COMPLETE && SUCCEEDED(hr)) {
+            payload = irp->read.bytes;
+            payload_size = irp->read.pos;
+        }
+
+        break;
+
+    case IRP_OP_WRITE:
+        rec.kind = FDSHARK_CAP_WRITE;
+        rec.pos = (uint32_t) irp->write.pos;
+        rec.nbytes = (uint32_t) irp->write.nbytes;
+
+        if (phase == FDSHARK_CAP_SUBMIT) {
+            payload = &irp->write.bytes[irp->write.pos];
+            payload_size = irp->write.nbytes - irp->write.pos;
+        }
+
+        break;
+
+    case IRP_OP_IOCTL:
+        rec.kind = FDSHARK_CAP_IOCTL;
+        rec.ioctl = irp->ioctl;
+
+        if (phase == FDSHARK_CAP_SUBMIT) {
+            rec.pos = (uint32_t) irp->write.pos;
+            rec.nbytes = (uint32_t) irp->write.nbytes;
+            payload = &irp->write.bytes[irp->write.pos];
+            payload_size = irp->write.nbytes - irp->write.pos;
+        } else {
+            rec.pos = (uint32_t) irp->read.pos;
+            rec.nbytes = (uint32_t) irp->read.nbytes;
+
+            if (SUCCEEDED(hr)) {
+                payload = irp->read.bytes;
+                payload_size = irp->read.pos;
+            }
+        }
+
+        break;
+
+    default:
+        return;
+    }
+
+    if (payload_size > FDSHARK_CAP_PAYLOAD_MAX) {
+        payload_size = FDSHARK_CAP_PAYLOAD_MAX;
+    }
+
+    rec.magic = FDSHARK_CAP_RECORD_MAGIC;
+    rec.size = (uint32_t) ((sizeof(rec) + payload_size + 7) & ~7);
+    rec.time = now.QuadPart - fdshark_cap->qpc_start;
+    rec.phase = phase;
+    rec.thread = GetCurrentThreadId();
+    rec.fd = (uint32_t) (uintptr_t) irp->fd;
+    rec.hr = hr;
+    rec.payload_size = (uint32_t) payload_size;
+
+    /* Reserving space is the only synchronization between writers. */
+
+    off = InterlockedExchangeAdd64(
+            (volatile LONG64 *) &fdshark_cap->head,
+            rec.size);
+
+    fdshark_capture_copy(off, &rec, sizeof(rec));
+    fdshark_capture_copy(off + sizeof(rec), payload, payload_size);
+}
+
+static void fdshark_capture_copy(int64_t off, const void *src, size_t nbytes)
+{
+    size_t pos;
+    size_t chunk;
+
+    if (nbytes == 0) {
+        return;
+    }
+
+    pos = (size_t) (off & (fdshark_cap->ring_size - 1));
+    chunk = fdshark_cap->ring_size - pos;
+
+    if (chunk > nbytes) {
+        chunk = nbytes;
+    }
+
+    memcpy(&fdshark_cap_ring[pos], src, chunk);
+    memcpy(&fdshark_cap_ring[0], (const uint8_t *) src + chunk, nbytes - chunk);
+}
@@ -4,6 +4,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 enum {
     FDSHARK_FORCE_SYNC = 0x1,
@@ -13,4 +14,16 @@ enum {
     FDSHARK_ALL_FLAGS_ = 0xF,
 };
 
+enum {
+    FDSHARK_CAP_DEFAULT_SIZE = 16 * 1024 * 1024,
+    FDSHARK_CAP_MIN_SIZE = 64 * 1024,
+};
+
 HRESULT fdshark_hook_init(const wchar_t *filename, int flags);
+
+/* Write traced IRPs to a binary capture file (see hooklib/fdshark-cap.h and
+   fdsharkdump) instead of hex dumping them through dprintf. Call this after
+   fdshark_hook_init(). ring_size must be a power of two no smaller than
+   FDSHARK_CAP_MIN_SIZE, or zero for FDSHARK_CAP_DEFAULT_SIZE. */
+
+HRESULT fdshark_capture_init(const wchar_t *filename, uint32_t ring_size);
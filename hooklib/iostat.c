@@ -0,0 +1,288 @@
+#include <windows.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hook/iohook.h"
+
+#include "hooklib/iostat.h"
+
+#include "util/dprintf.h"
+
+/* capnhook handlers take no context pointer, so every instrumented handler
+   is registered through a thunk that knows its own slot number. */
+
+#define IOSTAT_THUNK(n) \
+        static HRESULT iostat_thunk_##n(struct irp *irp) \
+        { \
+            return iostat_invoke(n, irp); \
+        }
+
+/* Timing frame for each instrumented handler currently on this thread's
+   stack. A handler's clock stops while a nested handler is running. */
+
+struct iostat_frame {
+    struct iostat_frame *prev;
+    int64_t resume;
+    int64_t self;
+};
+
+static HRESULT iostat_invoke(size_t slot, struct irp *irp);
+static void iostat_record(struct iostat_hist *hist, int64_t ticks);
+static size_t iostat_bucket(uint32_t ns);
+
+IOSTAT_THUNK(0)
+IOSTAT_THUNK(1)
+IOSTAT_THUNK(2)
+IOSTAT_THUNK(3)
+IOSTAT_THUNK(4)
+IOSTAT_THUNK(5)
+IOSTAT_THUNK(6)
+IOSTAT_THUNK(7)
+IOSTAT_THUNK(8)
+IOSTAT_THUNK(9)
+IOSTAT_THUNK(10)
+IOSTAT_THUNK(11)
+IOSTAT_THUNK(12)
+IOSTAT_THUNK(13)
+IOSTAT_THUNK(14)
+IOSTAT_THUNK(15)
+
+static const iohook_fn_t iostat_thunks[IOSTAT_MAX_HANDLERS] = {
+    iostat_thunk_0,
+    iostat_thunk_1,
+    iostat_thunk_2,
+    iostat_thunk_3,
+    iostat_thunk_4,
+    iostat_thunk_5,
+    iostat_thunk_6,
+    iostat_thunk_7,
+    iostat_thunk_8,
+    iostat_thunk_9,
+    iostat_thunk_10,
+    iostat_thunk_11,
+    iostat_thunk_12,
+    iostat_thunk_13,
+    iostat_thunk_14,
+    iostat_thunk_15,
+};
+
+static iohook_fn_t iostat_fns[IOSTAT_MAX_HANDLERS];
+static struct iostat_section *iostat_section;
+static DWORD iostat_tls = TLS_OUT_OF_INDEXES;
+static int64_t iostat_freq;
+
+void iostat_init(const struct iostat_config *cfg)
+{
+    struct iostat_section *section;
+    wchar_t name[64];
+    LARGE_INTEGER freq;
+    HANDLE mapping;
+    HRESULT hr;
+
+    assert(cfg != NULL);
+
+    if (!cfg->enable) {
+        return;
+    }
+
+    iostat_tls = TlsAlloc();
+
+    if (iostat_tls == TLS_OUT_OF_INDEXES) {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        dprintf("IoStat: TlsAlloc failed: %x\n", (int) hr);
+
+        return;
+    }
+
+    swprintf_s(
+            name,
+            _countof(name),
+            L"%s%u",
+            IOSTAT_SECTION_PREFIX,
+            (unsigned int) GetCurrentProcessId());
+
+    /* Deliberately leaked; the section lives as long as the process does. */
+
+    mapping = CreateFileMappingW(
+            INVALID_HANDLE_VALUE,
+            NULL,
+            PAGE_READWRITE,
+            0,
+            sizeof(*section),
+            name);
+
+    if (mapping == NULL) {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        dprintf("IoStat: CreateFileMapping failed: %x\n", (int) hr);
+
+        return;
+    }
+
+    /* Somebody else's section (a viewer that got in first, say, or a stale
+       one left behind by an earlier process with the same PID). Whatever it
+       is, don't wipe it and start scribbling into it. */
+
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        dprintf("IoStat: %S already exists, statistics disabled\n", name);
+        CloseHandle(mapping);
+
+        return;
+    }
+
+    section = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, sizeof(*section));
+
+    if (section == NULL) {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        dprintf("IoStat: MapViewOfFile failed: %x\n", (int) hr);
+        CloseHandle(mapping);
+
+        return;
+    }
+
+    QueryPerformanceFrequency(&freq);
+    iostat_freq = freq.QuadPart;
+
+    memset(section, 0, sizeof(*section));
+    section->version = IOSTAT_VERSION;
+    section->nops = IOSTAT_NOPS_;
+    section->nbuckets = IOSTAT_NBUCKETS;
+
+    /* Viewers check the magic number last */
+
+    MemoryBarrier();
+    section->magic = IOSTAT_MAGIC;
+    iostat_section = section;
+
+    dprintf("IoStat: Publishing IRP statistics as %S\n", name);
+}
+
+HRESULT iostat_push_handler(const char *name, iohook_fn_t fn)
+{
+    struct iostat_handler *handler;
+    HRESULT hr;
+    size_t slot;
+
+    assert(name != NULL);
+    assert(fn != NULL);
+
+    if (iostat_section == NULL) {
+        return iohook_push_handler(fn);
+    }
+
+    slot = iostat_section->nhandlers;
+
+    if (slot >= IOSTAT_MAX_HANDLERS) {
+        dprintf("IoStat: Out of slots, not instrumenting %s\n", name);
+
+        return iohook_push_handler(fn);
+    }
+
+    iostat_fns[slot] = fn;
+    hr = iohook_push_handler(iostat_thunks[slot]);
+
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    handler = &iostat_section->handlers[slot];
+    strncpy(handler->name, name, sizeof(handler->name) - 1);
+
+    /* Publish the name before the slot becomes visible */
+
+    MemoryBarrier();
+    iostat_section->nhandlers = (LONG) slot + 1;
+
+    return S_OK;
+}
+
+static HRESULT iostat_invoke(size_t slot, struct irp *irp)
+{
+    struct iostat_frame frame;
+    struct iostat_frame *parent;
+    LARGE_INTEGER now;
+    enum iostat_op iop;
+    enum irp_op op;
+    HRESULT hr;
+
+    op = irp->op;
+    parent = TlsGetValue(iostat_tls);
+    QueryPerformanceCounter(&now);
+
+    if (parent != NULL) {
+        parent->self += now.QuadPart - parent->resume;
+    }
+
+    frame.prev = parent;
+    frame.resume = now.QuadPart;
+    frame.self = 0;
+    TlsSetValue(iostat_tls, &frame);
+
+    hr = iostat_fns[slot](irp);
+
+    QueryPerformanceCounter(&now);
+    frame.self += now.QuadPart - frame.resume;
+    TlsSetValue(iostat_tls, parent);
+
+    if (parent != NULL) {
+        parent->resume = now.QuadPart;
+    }
+
+    switch (op) {
+    case IRP_OP_OPEN:   iop = IOSTAT_OP_OPEN; break;
+    case IRP_OP_CLOSE:  iop = IOSTAT_OP_CLOSE; break;
+    case IRP_OP_READ:   iop = IOSTAT_OP_READ; break;
+    case IRP_OP_WRITE:  iop = IOSTAT_OP_WRITE; break;
+    case IRP_OP_IOCTL:  iop = IOSTAT_OP_IOCTL; break;
+    default:            return hr;
+    }
+
+    iostat_record(&iostat_section->handlers[slot].ops[iop], frame.self);
+
+    return hr;
+}
+
+static void iostat_record(struct iostat_hist *hist, int64_t ticks)
+{
+    int64_t ns;
+    LONG prev;
+
+    ns = ticks * 1000000000 / iostat_freq;
+
+    if (ns > INT32_MAX) {
+        ns = INT32_MAX;
+    } else if (ns < 0) {
+        ns = 0;
+    }
+
+    InterlockedIncrement(&hist->count);
+    InterlockedExchangeAdd64(&hist->total_ns, ns);
+    InterlockedIncrement(&hist->buckets[iostat_bucket((uint32_t) ns)]);
+
+    do {
+        prev = hist->max_ns;
+
+        if (ns <= prev) {
+            break;
+        }
+    } while (InterlockedCompareExchange(&hist->max_ns, (LONG) ns, prev)
+            != prev);
+}
+
+static size_t iostat_bucket(uint32_t ns)
+{
+    unsigned long msb;
+    unsigned int shift;
+
+    if (ns < 32) {
+        return ns;
+    }
+
+    BitScanReverse(&msb, ns);
+    shift = msb - 4;
+
+    return shift * 16 + (ns >> shift);
+}
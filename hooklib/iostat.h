@@ -0,0 +1,83 @@
+#pragma once
+
+#include <windows.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hook/iohook.h"
+
+/* Per-handler IRP latency statistics.
+
+   Handlers registered through iostat_push_handler() are timed on every call.
+   Only the time spent in the handler itself is counted: time spent further
+   down the chain in other instrumented handlers is attributed to those
+   handlers instead. Asynchronous IRPs are timed up to the point where the
+   handler returns, not until the OVERLAPPED completes.
+
+   The results live in a named shared memory section (struct iostat_section)
+   which an external viewer can map read-only and poll at any time. Several
+   processes of one game usually get injected with the same configuration, so
+   each gets a section of its own, named IOSTAT_SECTION_PREFIX followed by the
+   process ID in decimal; viewers need to be told which PID to look at.
+   Counters are updated with interlocked operations but the section as a whole
+   is not a consistent snapshot.
+
+   Latencies are in nanoseconds and bucketed log-linearly, HDR histogram
+   style: values below 32 get a bucket each, above that every power of two is
+   split into 16 equal sub-buckets. Bucket i covers values starting at i for
+   i < 32, or at (16 + i % 16) << (i / 16 - 1) otherwise. Latencies are capped
+   at 2^31 - 1 ns. */
+
+#define IOSTAT_SECTION_PREFIX L"Local\\segatools-iostat-"
+#define IOSTAT_MAGIC        0x54534f49 /* "IOST" */
+
+enum {
+    IOSTAT_VERSION      = 1,
+    IOSTAT_MAX_HANDLERS = 16,
+    IOSTAT_NAME_MAX     = 16,
+    IOSTAT_NBUCKETS     = 448,
+};
+
+enum iostat_op {
+    IOSTAT_OP_OPEN,
+    IOSTAT_OP_CLOSE,
+    IOSTAT_OP_READ,
+    IOSTAT_OP_WRITE,
+    IOSTAT_OP_IOCTL,
+
+    IOSTAT_NOPS_,
+};
+
+struct iostat_hist {
+    volatile LONG count;
+    volatile LONG max_ns;
+    volatile LONG64 total_ns;
+    volatile LONG buckets[IOSTAT_NBUCKETS];
+};
+
+struct iostat_handler {
+    char name[IOSTAT_NAME_MAX];
+    struct iostat_hist ops[IOSTAT_NOPS_];
+};
+
+struct iostat_section {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nops;
+    uint32_t nbuckets;
+    volatile LONG nhandlers;
+    uint32_t reserved;
+    struct iostat_handler handlers[IOSTAT_MAX_HANDLERS];
+};
+
+struct iostat_config {
+    bool enable;
+};
+
+void iostat_init(const struct iostat_config *cfg);
+
+/* Drop-in replacement for iohook_push_handler(). If statistics are disabled
+   (or every slot is in use) this just pushes fn directly. */
+
+HRESULT iostat_push_handler(const char *name, iohook_fn_t fn);
@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -14,8 +15,18 @@
 /* Helpers */
 
 static void path_hook_init(void);
-static BOOL path_transform_a(char **out, const char *src);
+static BOOL path_transform_a(
+        char **out,
+        char *buf,
+        size_t buf_s,
+        const char *src);
+static void path_release_a(char *trans, const char *buf);
 static BOOL path_transform_w(wchar_t **out, const wchar_t *src);
+static BOOL path_transform_w_buf(
+        wchar_t **out,
+        wchar_t *buf,
+        size_t buf_c,
+        const wchar_t *src);
 
 /* API hooks */
 
@@ -231,10 +242,72 @@ static const struct hook_symbol path_hook_syms[] = {
     }
 };
 
+/* Mount points live in a trie keyed on case-folded path characters, so
+   matching a path costs at most one step per character of the longest
+   matching prefix. The trie and the list of callback hooks are bundled into
+   a table which gets rebuilt from scratch whenever a mount or hook is added,
+   then swapped in atomically. Apart from its cache (see below) a table never
+   changes once published, so path lookups never take a lock. Superseded
+   tables are leaked, since another thread could still be looking at them;
+   mounts and hooks are only added during startup anyway.
+
+   Each table also carries a small direct-mapped cache of directories that
+   are known not to be redirected, indexed by a 64-bit hash of the case-folded
+   directory (everything up to and including the last separator). A hit skips
+   both the trie walk and the callback hooks. Since the cache belongs to the
+   table, adding a mount or hook starts over with an empty one. Slots hold
+   nothing but the hash, so two directories whose hashes collide would be
+   confused with each other; at 64 bits we accept that risk. */
+
+enum {
+    PATH_CACHE_SIZE = 256,
+};
+
+struct path_mount {
+    wchar_t *prefix;
+    wchar_t *target;
+    size_t target_len;
+    bool sep;
+};
+
+struct path_node {
+    struct path_node *child;
+    struct path_node *next;
+    const struct path_mount *mount;
+    wchar_t c;
+};
+
+struct path_table {
+    struct path_node *root;
+    path_hook_t *hooks;
+    size_t nhooks;
+    volatile LONG64 cache[PATH_CACHE_SIZE];
+};
+
+static HRESULT path_table_rebuild(void);
+static HRESULT path_node_insert(
+        struct path_node **pos,
+        const struct path_mount *mount);
+static void path_node_free(struct path_node *node);
+static const struct path_mount *path_mount_match(
+        const struct path_node *node,
+        const wchar_t *src,
+        size_t *matched,
+        size_t *walked);
+static size_t path_dir_len(const wchar_t *src);
+static LONG64 path_cache_key(const wchar_t *src, size_t nchars);
+static wchar_t path_fold_w(wchar_t c);
+
 static bool path_hook_initted;
 static CRITICAL_SECTION path_hook_lock;
 static path_hook_t *path_hook_list;
 static size_t path_hook_count;
+static struct path_mount *path_mount_list;
+static size_t path_mount_count;
+static struct path_table *volatile path_table;
+static volatile LONG path_cache_hits;
+static volatile LONG path_cache_misses;
+static volatile LONG path_cache_evictions;
 
 HRESULT path_hook_push(path_hook_t hook)
 {
@@ -260,7 +333,11 @@ HRESULT path_hook_push(path_hook_t hook)
     path_hook_list = tmp;
     path_hook_list[path_hook_count++] = hook;
 
-    hr = S_OK;
+    hr = path_table_rebuild();
+
+    if (FAILED(hr)) {
+        path_hook_count--;
+    }
 
 end:
     LeaveCriticalSection(&path_hook_lock);
@@ -268,6 +345,183 @@ end:
     return hr;
 }
 
+HRESULT path_mount_push(const wchar_t *prefix, const wchar_t *target)
+{
+    struct path_mount *tmp;
+    struct path_mount mount;
+    size_t prefix_len;
+    HRESULT hr;
+
+    assert(prefix != NULL);
+    assert(target != NULL);
+
+    prefix_len = wcslen(prefix);
+
+    if (prefix_len == 0) {
+        return E_INVALIDARG;
+    }
+
+    path_hook_init();
+
+    mount.prefix = _wcsdup(prefix);
+    mount.target = _wcsdup(target);
+    mount.target_len = wcslen(target);
+    mount.sep = path_is_separator_w(prefix[prefix_len - 1]);
+
+    EnterCriticalSection(&path_hook_lock);
+
+    if (mount.prefix == NULL || mount.target == NULL) {
+        hr = E_OUTOFMEMORY;
+
+        goto fail;
+    }
+
+    tmp = realloc(
+            path_mount_list,
+            (path_mount_count + 1) * sizeof(struct path_mount));
+
+    if (tmp == NULL) {
+        hr = E_OUTOFMEMORY;
+
+        goto fail;
+    }
+
+    path_mount_list = tmp;
+    path_mount_list[path_mount_count++] = mount;
+
+    hr = path_table_rebuild();
+
+    if (FAILED(hr)) {
+        path_mount_count--;
+
+        goto fail;
+    }
+
+    LeaveCriticalSection(&path_hook_lock);
+
+    return S_OK;
+
+fail:
+    LeaveCriticalSection(&path_hook_lock);
+
+    free(mount.prefix);
+    free(mount.target);
+
+    return hr;
+}
+
+static HRESULT path_table_rebuild(void)
+{
+    struct path_table *table;
+    HRESULT hr;
+    size_t i;
+
+    /* Caller holds path_hook_lock. Mount records are only ever appended and
+       never move once a table refers to them, so the trie points at copies
+       owned by the table rather than into path_mount_list. */
+
+    table = calloc(1, sizeof(*table));
+
+    if (table == NULL) {
+        return E_OUTOFMEMORY;
+    }
+
+    if (path_hook_count > 0) {
+        table->hooks = malloc(path_hook_count * sizeof(path_hook_t));
+
+        if (table->hooks == NULL) {
+            hr = E_OUTOFMEMORY;
+
+            goto fail;
+        }
+
+        memcpy(table->hooks,
+                path_hook_list,
+                path_hook_count * sizeof(path_hook_t));
+        table->nhooks = path_hook_count;
+    }
+
+    for (i = 0 ; i < path_mount_count ; i++) {
+        hr = path_node_insert(&table->root, &path_mount_list[i]);
+
+        if (FAILED(hr)) {
+            goto fail;
+        }
+    }
+
+    InterlockedExchangePointer((void *volatile *) &path_table, table);
+
+    return S_OK;
+
+fail:
+    path_node_free(table->root);
+    free(table->hooks);
+    free(table);
+
+    return hr;
+}
+
+static HRESULT path_node_insert(
+        struct path_node **pos,
+        const struct path_mount *mount)
+{
+    struct path_mount *copy;
+    struct path_node *node;
+    const wchar_t *c;
+
+    copy = malloc(sizeof(*copy));
+
+    if (copy == NULL) {
+        return E_OUTOFMEMORY;
+    }
+
+    memcpy(copy, mount, sizeof(*copy));
+    node = NULL;
+
+    for (c = mount->prefix ; *c != L'\0' ; c++) {
+        for (node = *pos ; node != NULL ; node = node->next) {
+            if (node->c == path_fold_w(*c)) {
+                break;
+            }
+        }
+
+        if (node == NULL) {
+            node = calloc(1, sizeof(*node));
+
+            if (node == NULL) {
+                free(copy);
+
+                return E_OUTOFMEMORY;
+            }
+
+            node->c = path_fold_w(*c);
+            node->next = *pos;
+            *pos = node;
+        }
+
+        pos = &node->child;
+    }
+
+    /* Later registrations of the same prefix win */
+
+    node->mount = copy;
+
+    return S_OK;
+}
+
+static void path_node_free(struct path_node *node)
+{
+    struct path_node *next;
+
+    while (node != NULL) {
+        next = node->next;
+        path_node_free(node->child);
+        free((void *) node->mount);
+        free(node);
+        node = next;
+    }
+}
+
 static void path_hook_init(void)
 {
     /* Init is not thread safe because API hook init is not thread safe blah
@@ -292,46 +546,67 @@ void path_hook_insert_hooks(HMODULE target)
             _countof(path_hook_syms));
 }
 
-static BOOL path_transform_a(char **out, const char *src)
+/* The ANSI hooks get hammered by things like the D3D shader compiler and
+   dbghelp probing for files, so we try to do the whole round trip through
+   UTF-16 and back in stack buffers and only go to the heap for paths that are
+   too long to fit. The result is either buf or a heap block, so callers must
+   release it with path_release_a(). */
+
+static BOOL path_transform_a(
+        char **out,
+        char *buf,
+        size_t buf_s,
+        const char *src)
 {
+    wchar_t src_buf[MAX_PATH];
+    wchar_t dest_buf[MAX_PATH];
     wchar_t *src_w;
     size_t src_c;
     wchar_t *dest_w;
     char *dest_a;
     size_t dest_s;
+    errno_t err;
     BOOL ok;
 
     assert(out != NULL);
+    assert(buf != NULL);
 
-    src_w = NULL;
+    src_w = src_buf;
     dest_w = NULL;
-    dest_a = NULL;
     *out = NULL;
 
     if (src == NULL) {
         SetLastError(ERROR_INVALID_PARAMETER);
-        ok = FALSE;
 
-        goto end;
+        return FALSE;
     }
 
     /* Widen the path */
 
-    mbstowcs_s(&src_c, NULL, 0, src, 0);
-    src_w = malloc(src_c * sizeof(wchar_t));
+    err = mbstowcs_s(&src_c, src_buf, _countof(src_buf), src, _TRUNCATE);
 
-    if (src_w == NULL) {
-        SetLastError(ERROR_OUTOFMEMORY);
-        ok = FALSE;
+    if (err == STRUNCATE) {
+        mbstowcs_s(&src_c, NULL, 0, src, 0);
+        src_w = malloc(src_c * sizeof(wchar_t));
+
+        if (src_w == NULL) {
+            SetLastError(ERROR_OUTOFMEMORY);
+            ok = FALSE;
+
+            goto end;
+        }
+
+        mbstowcs_s(NULL, src_w, src_c, src, src_c - 1);
+    } else if (err != 0) {
+        /* Not something we can make sense of, so leave it alone */
+        ok = TRUE;
 
         goto end;
     }
 
-    mbstowcs_s(NULL, src_w, src_c, src, src_c - 1);
-
     /* Try applying a path transform */
 
-    ok = path_transform_w(&dest_w, src_w); /* Take ownership! */
+    ok = path_transform_w_buf(&dest_w, dest_buf, _countof(dest_buf), src_w);
 
     if (!ok || dest_w == NULL) {
         goto end;
@@ -339,6 +614,14 @@ static BOOL path_transform_a(char **out, const char *src)
 
     /* Narrow the transformed path */
 
+    err = wcstombs_s(&dest_s, buf, buf_s, dest_w, _TRUNCATE);
+
+    if (err == 0) {
+        *out = buf;
+
+        goto end;
+    }
+
     wcstombs_s(&dest_s, NULL, 0, dest_w, 0);
     dest_a = malloc(dest_s * sizeof(char));
 
@@ -352,32 +635,118 @@ static BOOL path_transform_a(char **out, const char *src)
     wcstombs_s(NULL, dest_a, dest_s, dest_w, dest_s - 1);
 
     *out = dest_a; /* Relinquish ownership to caller! */
-    ok = TRUE;
 
 end:
-    free(dest_w);
-    free(src_w);
+    if (dest_w != dest_buf) {
+        free(dest_w);
+    }
+
+    if (src_w != src_buf) {
+        free(src_w);
+    }
 
     return ok;
 }
 
+static void path_release_a(char *trans, const char *buf)
+{
+    if (trans != buf) {
+        free(trans);
+    }
+}
+
 static BOOL path_transform_w(wchar_t **out, const wchar_t *src)
 {
+    return path_transform_w_buf(out, NULL, 0, src);
+}
+
+/* Writes the transformed path to buf if it fits, otherwise to a new heap
+   block. *out is NULL if no transform applies. */
+
+static BOOL path_transform_w_buf(
+        wchar_t **out,
+        wchar_t *buf,
+        size_t buf_c,
+        const wchar_t *src)
+{
+    struct path_table *table;
+    const struct path_mount *mount;
+    volatile LONG64 *slot;
+    LONG64 key;
     BOOL ok;
     HRESULT hr;
     wchar_t *dest;
     size_t dest_c;
+    size_t dir_len;
+    size_t matched;
+    size_t walked;
     size_t i;
 
     assert(out != NULL);
 
     dest = NULL;
+    slot = NULL;
+    key = 0;
     *out = NULL;
+    table = path_table;
 
-    EnterCriticalSection(&path_hook_lock);
+    if (table == NULL || src == NULL) {
+        return TRUE;
+    }
+
+    /* Skip everything if we've already seen this directory go unmatched */
+
+    dir_len = path_dir_len(src);
+
+    if (dir_len > 0) {
+        key = path_cache_key(src, dir_len);
+        slot = &table->cache[key & (PATH_CACHE_SIZE - 1)];
+
+        /* A torn read on 32-bit builds just looks like a miss */
+
+        if (*slot == key) {
+            InterlockedIncrement(&path_cache_hits);
+
+            return TRUE;
+        }
+
+        InterlockedIncrement(&path_cache_misses);
+    }
+
+    /* Mount points first: one walk to match, one allocation to rewrite */
+
+    mount = path_mount_match(table->root, src, &matched, &walked);
 
-    for (i = 0 ; i < path_hook_count ; i++) {
-        hr = path_hook_list[i](src, NULL, &dest_c);
+    if (mount != NULL) {
+        dest_c = mount->target_len + wcslen(src + matched) + 1;
+
+        if (dest_c <= buf_c) {
+            dest = buf;
+        } else {
+            dest = malloc(dest_c * sizeof(wchar_t));
+        }
+
+        if (dest == NULL) {
+            SetLastError(ERROR_OUTOFMEMORY);
+
+            return FALSE;
+        }
+
+        memcpy(dest, mount->target, mount->target_len * sizeof(wchar_t));
+        wcscpy_s(
+                dest + mount->target_len,
+                dest_c - mount->target_len,
+                src + matched);
+
+        *out = dest;
+
+        return TRUE;
+    }
+
+    /* Then any free-form hooks */
+
+    for (i = 0 ; i < table->nhooks ; i++) {
+        hr = table->hooks[i](src, NULL, &dest_c);
 
         if (FAILED(hr)) {
             ok = hr_propagate_win32(hr, FALSE);
@@ -389,7 +758,11 @@ static BOOL path_transform_w(wchar_t **out, const wchar_t *src)
             continue;
         }
 
-        dest = malloc(dest_c * sizeof(wchar_t));
+        if (dest_c <= buf_c) {
+            dest = buf;
+        } else {
+            dest = malloc(dest_c * sizeof(wchar_t));
+        }
 
         if (dest == NULL) {
             SetLastError(ERROR_OUTOFMEMORY);
@@ -398,7 +771,7 @@ static BOOL path_transform_w(wchar_t **out, const wchar_t *src)
             goto end;
         }
 
-        hr = path_hook_list[i](src, dest, &dest_c);
+        hr = table->hooks[i](src, dest, &dest_c);
 
         if (FAILED(hr)) {
             ok = hr_propagate_win32(hr, FALSE);
@@ -409,38 +782,147 @@ static BOOL path_transform_w(wchar_t **out, const wchar_t *src)
         break;
     }
 
+    /* Only remember the directory if the trie walk gave up before reaching
+       the end of it. Otherwise a longer mount prefix might still match some
+       other file in the same directory. */
+
+    if (dest == NULL && slot != NULL && walked < dir_len) {
+        if (InterlockedExchange64(slot, key) != 0) {
+            InterlockedIncrement(&path_cache_evictions);
+        }
+    }
+
     *out = dest;
     dest = NULL;
     ok = TRUE;
 
 end:
-    LeaveCriticalSection(&path_hook_lock);
-
-    free(dest);
+    if (dest != buf) {
+        free(dest);
+    }
 
     return ok;
 }
 
-int path_compare_w(const wchar_t *string1, const wchar_t *string2, size_t count)
+/* *walked receives the number of characters consumed before the walk ran
+   out of trie: no mount prefix starts with the first *walked + 1 characters
+   of src. */
+
+static const struct path_mount *path_mount_match(
+        const struct path_node *node,
+        const wchar_t *src,
+        size_t *matched,
+        size_t *walked)
 {
+    const struct path_mount *best;
+    wchar_t c;
     size_t i;
-    wchar_t c1, c2;
 
-    assert(string1 != NULL);
-    assert(string2 != NULL);
+    best = NULL;
 
-    for (i = 0; i < count && string1[i] && string2[i]; i++) {
-        c1 = towlower(string1[i]);
+    for (i = 0 ; node != NULL && src[i] != L'\0' ; node = node->child) {
+        c = path_fold_w(src[i]);
 
-        if (c1 == '/') {
-            c1 = '\\';
+        while (node != NULL && node->c != c) {
+            node = node->next;
         }
 
-        c2 = towlower(string2[i]);
+        if (node == NULL) {
+            break;
+        }
+
+        i++;
+
+        if (node->mount == NULL) {
+            continue;
+        }
+
+        /* A prefix that doesn't end in a separator has to be followed by one
+           (which gets swallowed) or by the end of the path. */
+
+        if (node->mount->sep) {
+            best = node->mount;
+            *matched = i;
+        } else if (src[i] == L'\0') {
+            best = node->mount;
+            *matched = i;
+        } else if (path_is_separator_w(src[i])) {
+            best = node->mount;
+            *matched = i + 1;
+        }
+    }
+
+    *walked = i;
+
+    return best;
+}
+
+static size_t path_dir_len(const wchar_t *src)
+{
+    size_t dir_len;
+    size_t i;
 
-        if (c2 == '/') {
-            c2 = '\\';
+    dir_len = 0;
+
+    for (i = 0 ; src[i] != L'\0' ; i++) {
+        if (path_is_separator_w(src[i])) {
+            dir_len = i + 1;
         }
+    }
+
+    return dir_len;
+}
+
+static LONG64 path_cache_key(const wchar_t *src, size_t nchars)
+{
+    uint64_t hash;
+    size_t i;
+
+    /* FNV-1a. Zero marks an empty slot, so never hand that out. */
+
+    hash = 0xcbf29ce484222325ULL;
+
+    for (i = 0 ; i < nchars ; i++) {
+        hash ^= (uint16_t) path_fold_w(src[i]);
+        hash *= 0x100000001b3ULL;
+    }
+
+    if (hash == 0) {
+        hash = 1;
+    }
+
+    return (LONG64) hash;
+}
+
+void path_cache_get_stats(struct path_cache_stats *stats)
+{
+    assert(stats != NULL);
+
+    stats->hits = path_cache_hits;
+    stats->misses = path_cache_misses;
+    stats->evictions = path_cache_evictions;
+}
+
+static wchar_t path_fold_w(wchar_t c)
+{
+    if (c == L'/') {
+        return L'\\';
+    }
+
+    return towlower(c);
+}
+
+int path_compare_w(const wchar_t *string1, const wchar_t *string2, size_t count)
+{
+    size_t i;
+    wchar_t c1, c2;
+
+    assert(string1 != NULL);
+    assert(string2 != NULL);
+
+    for (i = 0; i < count && string1[i] && string2[i]; i++) {
+        c1 = path_fold_w(string1[i]);
+        c2 = path_fold_w(string2[i]);
 
         if (c1 != c2) {
             break;
@@ -458,10 +940,11 @@ static BOOL WINAPI hook_CreateDirectoryA(
         const char *lpFileName,
         SECURITY_ATTRIBUTES *lpSecurityAttributes)
 {
+    char buf[MAX_PATH];
     char *trans;
     BOOL ok;
 
-    ok = path_transform_a(&trans, lpFileName);
+    ok = path_transform_a(&trans, buf, _countof(buf), lpFileName);
 
     if (!ok) {
         return FALSE;
@@ -471,7 +954,7 @@ static BOOL WINAPI hook_CreateDirectoryA(
             trans ? trans : lpFileName,
             lpSecurityAttributes);
 
-    free(trans);
+    path_release_a(trans, buf);
 
     return ok;
 }
@@ -503,10 +986,11 @@ static BOOL WINAPI hook_CreateDirectoryExA(
         const char *lpNewDirectory,
         SECURITY_ATTRIBUTES *lpSecurityAttributes)
 {
+    char buf[MAX_PATH];
     char *trans;
     BOOL ok;
 
-    ok = path_transform_a(&trans, lpNewDirectory);
+    ok = path_transform_a(&trans, buf, _countof(buf), lpNewDirectory);
 
     if (!ok) {
         return FALSE;
@@ -517,7 +1001,7 @@ static BOOL WINAPI hook_CreateDirectoryExA(
             trans ? trans : lpNewDirectory,
             lpSecurityAttributes);
 
-    free(trans);
+    path_release_a(trans, buf);
 
     return ok;
 }
@@ -557,11 +1041,12 @@ static HANDLE WINAPI hook_CreateFileA(
         uint32_t dwFlagsAndAttributes,
         HANDLE hTemplateFile)
 {
+    char buf[MAX_PATH];
     char *trans;
     HANDLE result;
     BOOL ok;
 
-    ok = path_transform_a(&trans, lpFileName);
+    ok = path_transform_a(&trans, buf, _countof(buf), lpFileName);
 
     if (!ok) {
         return INVALID_HANDLE_VALUE;
@@ -576,7 +1061,7 @@ static HANDLE WINAPI hook_CreateFileA(
             dwFlagsAndAttributes,
             hTemplateFile);
 
-    free(trans);
+    path_release_a(trans, buf);
 
     return result;
 }
@@ -618,11 +1103,12 @@ static HANDLE WINAPI hook_FindFirstFileA(
         const char *lpFileName,
         LPWIN32_FIND_DATAA lpFindFileData)
 {
+    char buf[MAX_PATH];
     char *trans;
     HANDLE result;
     BOOL ok;
 
-    ok = path_transform_a(&trans, lpFileName);
+    ok = path_transform_a(&trans, buf, _countof(buf), lpFileName);
 
     if (!ok) {
         return INVALID_HANDLE_VALUE;
@@ -630,7 +1116,7 @@ static HANDLE WINAPI hook_FindFirstFileA(
 
     result = next_FindFirstFileA(trans ? trans : lpFileName, lpFindFileData);
 
-    free(trans);
+    path_release_a(trans, buf);
 
     return result;
 }
@@ -664,11 +1150,12 @@ static HANDLE WINAPI hook_FindFirstFileExA(
         void *lpSearchFilter,
         DWORD dwAdditionalFlags)
 {
+    char buf[MAX_PATH];
     char *trans;
     HANDLE result;
     BOOL ok;
 
-    ok = path_transform_a(&trans, lpFileName);
+    ok = path_transform_a(&trans, buf, _countof(buf), lpFileName);
 
     if (!ok) {
         return INVALID_HANDLE_VALUE;
@@ -682,7 +1169,7 @@ static HANDLE WINAPI hook_FindFirstFileExA(
             lpSearchFilter,
             dwAdditionalFlags);
 
-    free(trans);
+    path_release_a(trans, buf);
 
     return result;
 }
@@ -720,18 +1207,19 @@ static HANDLE WINAPI hook_FindFirstFileExW(
 
 static DWORD WINAPI hook_GetFileAttributesA(const char *lpFileName)
 {
+    char buf[MAX_PATH];
     char *trans;
     DWORD result;
     BOOL ok;
 
-    ok = path_transform_a(&trans, lpFileName);
+    ok = path_transform_a(&trans, buf, _countof(buf), lpFileName);
 
     if (!ok) {
         return INVALID_FILE_ATTRIBUTES;
     }
 
     result = next_GetFileAttributesA(trans ? trans : lpFileName);
-    free(trans);
+    path_release_a(trans, buf);
 
     return result;
 }
@@ -760,10 +1248,11 @@ static BOOL WINAPI hook_GetFileAttributesExA(
         GET_FILEEX_INFO_LEVELS fInfoLevelId,
         void *lpFileInformation)
 {
+    char buf[MAX_PATH];
     char *trans;
     BOOL ok;
 
-    ok = path_transform_a(&trans, lpFileName);
+    ok = path_transform_a(&trans, buf, _countof(buf), lpFileName);
 
     if (!ok) {
         return INVALID_FILE_ATTRIBUTES;
@@ -774,7 +1263,7 @@ static BOOL WINAPI hook_GetFileAttributesExA(
             fInfoLevelId,
             lpFileInformation);
 
-    free(trans);
+    path_release_a(trans, buf);
 
     return ok;
 }
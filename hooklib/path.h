@@ -4,16 +4,42 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 typedef HRESULT (*path_hook_t)(
         const wchar_t *src,
         wchar_t *dest,
         size_t *count);
 
+struct path_cache_stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+};
+
+/* Redirects every path that begins with prefix to target. Prefixes are
+   compared case-insensitively with / and \ treated as equivalent. Unless the
+   prefix itself ends in a separator it only matches whole path components,
+   and the separator that follows it is dropped, so target should normally
+   end in a separator. The longest matching prefix wins, and mounts take
+   priority over path_hook_t callbacks. */
+
+HRESULT path_mount_push(const wchar_t *prefix, const wchar_t *target);
+
+/* Paths in a directory that no mount or hook redirects are remembered, and
+   later paths in the same directory are passed through without consulting
+   the hooks at all. A hook that returns S_FALSE for one path must therefore
+   return S_FALSE for every other path in the same directory. */
+
 HRESULT path_hook_push(path_hook_t hook);
 void path_hook_insert_hooks(HMODULE target);
 int path_compare_w(const wchar_t *string1, const wchar_t *string2, size_t count);
 
+/* Counters for the unredirected directory cache. Evictions count cache slots
+   that were overwritten by a different directory. */
+
+void path_cache_get_stats(struct path_cache_stats *stats);
+
 static inline bool path_is_separator_w(wchar_t c)
 {
     return c == L'\\' || c == L'/';
@@ -2,7 +2,9 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "hook/table.h"
 
@@ -11,12 +13,97 @@
 #include "util/dprintf.h"
 #include "util/str.h"
 
+/* The virtual registry is a tree of keys. Keys get into the tree either from
+   C code (reg_hook_push_key(), whose values are backed by callbacks) or from
+   .reg files (reg_hook_hive_push_val(), whose values are plain data held in
+   memory). A key registered both ways has both kinds of value, with the
+   callbacks taking priority.
+
+   Only keys that were registered explicitly are virtual. Their ancestors exist
+   in the tree purely so that the path can be walked and are otherwise left to
+   the real registry: registering SYSTEM\SEGA\Foo must not hide the real
+   HKLM\SYSTEM from the game. Keys from .reg files additionally shadow their
+   whole subtree, so that the file describes everything underneath them and
+   anything the game creates there stays in memory. Subkeys of keys that were
+   only registered from C that are not themselves registered still go to the
+   real registry, which is where users may have imported them to.
+
+   Keys are found by walking the path one component at a time through a hash
+   table keyed on the parent key and the case-folded component name. Tree
+   nodes and hive data are carved out of an arena and never freed, since the
+   tree only ever grows.
+
+   Opening a virtual key never touches the real registry. Instead we hand out
+   a synthetic HKEY that refers to a slot in our own handle table, so any
+   number of handles to the same key can be open at once. Synthetic handles
+   carry REG_HOOK_HANDLE_TAG in their top byte, which keeps them clear of the
+   predefined root keys and of real kernel handles (which never exceed 2^24).
+   The rest of the value holds the slot index plus a per-slot generation
+   count, so that a handle which gets used again after being closed is
+   rejected instead of aliasing whatever reused its slot.
+
+   Only the game's own imports from advapi32 are hooked. Functions that call
+   other registry functions internally (the ANSI variants, RegGetValue) do so
+   inside kernelbase where we can't intercept them, so every entry point that
+   can be handed one of our handles has to be hooked in its own right. Any
+   that isn't will fail with ERROR_INVALID_HANDLE from the real registry. */
+
+#define REG_HOOK_HANDLE_TAG     0x52000000 /* "R" */
+
+enum {
+    REG_HOOK_NBUCKETS       = 256,
+    REG_HOOK_ARENA_CHUNK    = 0x10000,
+    REG_HOOK_SLOT_BITS      = 12,
+    REG_HOOK_MAX_HANDLES    = 1 << REG_HOOK_SLOT_BITS,
+    REG_HOOK_GEN_MASK       = 0xfff,
+};
+
+/* Rendered content of a value. bytes_a holds the narrow form of a string
+   value (REG_SZ, REG_EXPAND_SZ or REG_MULTI_SZ), as seen through
+   RegQueryValueExA. */
+
+struct reg_hook_blob {
+    void *bytes;
+    uint32_t nbytes;
+    char *bytes_a;
+    uint32_t nbytes_a;
+};
+
+struct reg_hook_val_state {
+    char *name_a;
+    bool memoized;
+    struct reg_hook_blob blob;
+};
+
+struct reg_hook_hive_val {
+    struct reg_hook_hive_val *next;
+    const wchar_t *name;
+    const char *name_a;
+    uint32_t type;
+    struct reg_hook_blob blob;
+};
+
 struct reg_hook_key {
+    struct reg_hook_key *next;      /* Hash chain */
+    struct reg_hook_key *parent;
+    struct reg_hook_key *child;
+    struct reg_hook_key *sibling;
     HKEY root;
-    const wchar_t *name;
+    const wchar_t *name;            /* Full path */
+    const wchar_t *leaf;            /* Final component of the full path */
     const struct reg_hook_val *vals;
+    struct reg_hook_val_state *states;
     size_t nvals;
-    HKEY handle;
+    struct reg_hook_hive_val *hive_vals;
+    uint32_t hash;
+    bool present;                   /* Registered explicitly */
+    bool shadow;                    /* Hides the real subtree (.reg files) */
+};
+
+struct reg_hook_handle {
+    struct reg_hook_key *key; /* NULL if this slot is free */
+    size_t next_free;
+    uint32_t gen;
 };
 
 /* Helper functions */
@@ -25,16 +112,131 @@ static void reg_hook_init(void);
 
 static LRESULT reg_hook_propagate_hr(HRESULT hr);
 
+static void *reg_hook_alloc(size_t nbytes);
+
+static uint32_t reg_hook_hash_root(HKEY root);
+
+static uint32_t reg_hook_hash_step(uint32_t hash, wchar_t c);
+
+static struct reg_hook_key *reg_hook_child_locked(
+        HKEY root,
+        struct reg_hook_key *parent,
+        const wchar_t *comp,
+        size_t len);
+
+static struct reg_hook_key *reg_hook_walk_locked(
+        HKEY root,
+        struct reg_hook_key *start,
+        const wchar_t **path);
+
+static struct reg_hook_key *reg_hook_create_locked(
+        HKEY root,
+        struct reg_hook_key *parent,
+        const wchar_t *path);
+
+static struct reg_hook_key *reg_hook_key_new_locked(
+        HKEY root,
+        struct reg_hook_key *parent,
+        const wchar_t *comp,
+        size_t len);
+
+static struct reg_hook_key *reg_hook_resolve_locked(
+        HKEY root,
+        const wchar_t *name);
+
+static bool reg_hook_is_shadowed(const struct reg_hook_key *key);
+
+static bool reg_hook_is_virtual(const struct reg_hook_key *key);
+
+static wchar_t *reg_hook_real_path(
+        const struct reg_hook_key *key,
+        const wchar_t *rest);
+
+static bool reg_hook_is_synthetic(HKEY handle);
+
+static LSTATUS reg_hook_bad_handle(HKEY handle, const char *func);
+
+static LSTATUS reg_hook_handle_alloc_locked(
+        struct reg_hook_key *key,
+        HKEY *out);
+
+static struct reg_hook_handle *reg_hook_handle_lookup_locked(HKEY handle);
+
 static struct reg_hook_key *reg_hook_match_key_locked(HKEY handle);
 
 static const struct reg_hook_val *reg_hook_match_val_locked(
         struct reg_hook_key *key,
         const wchar_t *name);
 
+static const struct reg_hook_val *reg_hook_match_val_a_locked(
+        struct reg_hook_key *key,
+        const char *name);
+
+static struct reg_hook_hive_val *reg_hook_match_hive_val_locked(
+        struct reg_hook_key *key,
+        const wchar_t *name);
+
+static struct reg_hook_hive_val *reg_hook_match_hive_val_a_locked(
+        struct reg_hook_key *key,
+        const char *name);
+
+static struct reg_hook_hive_val *reg_hook_enum_hive_val_locked(
+        struct reg_hook_key *key,
+        size_t index);
+
+static HRESULT reg_hook_hive_set_locked(
+        struct reg_hook_key *key,
+        const wchar_t *name,
+        uint32_t type,
+        const void *bytes,
+        uint32_t nbytes);
+
+static char *reg_hook_narrow(const wchar_t *src, void *(*alloc)(size_t));
+
+static bool reg_hook_is_string(uint32_t type);
+
+static bool reg_hook_narrow_blob(
+        struct reg_hook_blob *blob,
+        uint32_t type,
+        void *(*alloc)(size_t));
+
+static LSTATUS reg_hook_widen(const char *src, wchar_t **out);
+
+static LSTATUS reg_hook_render(
+        const struct reg_hook_val *val,
+        struct reg_hook_blob *blob);
+
+static void reg_hook_blob_free(struct reg_hook_blob *blob);
+
+static LSTATUS reg_hook_memoize_locked(
+        struct reg_hook_key *key,
+        const struct reg_hook_val *val,
+        const struct reg_hook_blob **out);
+
 static LSTATUS reg_hook_open_locked(
         HKEY parent,
         const wchar_t *name,
-        HKEY *out);
+        bool create,
+        bool *created,
+        HKEY *out,
+        HKEY *real_parent,
+        wchar_t **real_name);
+
+static LSTATUS reg_hook_copy_name(
+        const wchar_t *src,
+        wchar_t *dest,
+        uint32_t *dest_c);
+
+static LSTATUS reg_hook_copy_name_a(
+        const char *src,
+        char *dest,
+        uint32_t *dest_c);
+
+static LSTATUS reg_hook_read_val_locked(
+        struct reg_hook_key *key,
+        const struct reg_hook_val *val,
+        void *bytes,
+        uint32_t *nbytes);
 
 static LSTATUS reg_hook_query_val_locked(
         struct reg_hook_key *key,
@@ -43,6 +245,15 @@ static LSTATUS reg_hook_query_val_locked(
         void *bytes,
         uint32_t *nbytes);
 
+static LSTATUS reg_hook_read_val_a_locked(
+        struct reg_hook_key *key,
+        const struct reg_hook_val *val,
+        const struct reg_hook_hive_val *hive_val,
+        void *bytes,
+        uint32_t *nbytes);
+
+static LSTATUS reg_hook_check_type(uint32_t flags, uint32_t type);
+
 /* API hooks */
 
 static LSTATUS WINAPI hook_RegOpenKeyExW(
@@ -52,6 +263,13 @@ static LSTATUS WINAPI hook_RegOpenKeyExW(
         uint32_t access,
         HKEY *out);
 
+static LSTATUS WINAPI hook_RegOpenKeyExA(
+        HKEY parent,
+        const char *name,
+        uint32_t flags,
+        uint32_t access,
+        HKEY *out);
+
 static LSTATUS WINAPI hook_RegCreateKeyExW(
         HKEY parent,
         const wchar_t *name,
@@ -63,8 +281,77 @@ static LSTATUS WINAPI hook_RegCreateKeyExW(
         HKEY *out,
         uint32_t *disposition);
 
+static LSTATUS WINAPI hook_RegCreateKeyExA(
+        HKEY parent,
+        const char *name,
+        uint32_t reserved,
+        const char *class_,
+        uint32_t options,
+        uint32_t access,
+        const SECURITY_ATTRIBUTES *sa,
+        HKEY *out,
+        uint32_t *disposition);
+
 static LSTATUS WINAPI hook_RegCloseKey(HKEY handle);
 
+static LSTATUS WINAPI hook_RegEnumKeyExW(
+        HKEY handle,
+        uint32_t index,
+        wchar_t *name,
+        uint32_t *name_c,
+        uint32_t *reserved,
+        wchar_t *class_,
+        uint32_t *class_c,
+        FILETIME *last_write_time);
+
+static LSTATUS WINAPI hook_RegEnumValueW(
+        HKEY handle,
+        uint32_t index,
+        wchar_t *name,
+        uint32_t *name_c,
+        uint32_t *reserved,
+        uint32_t *type,
+        void *bytes,
+        uint32_t *nbytes);
+
+static LSTATUS WINAPI hook_RegEnumValueA(
+        HKEY handle,
+        uint32_t index,
+        char *name,
+        uint32_t *name_c,
+        uint32_t *reserved,
+        uint32_t *type,
+        void *bytes,
+        uint32_t *nbytes);
+
+static LSTATUS WINAPI hook_RegQueryInfoKeyW(
+        HKEY handle,
+        wchar_t *class_,
+        uint32_t *class_c,
+        uint32_t *reserved,
+        uint32_t *nsubkeys,
+        uint32_t *max_subkey_len,
+        uint32_t *max_class_len,
+        uint32_t *nvals,
+        uint32_t *max_val_name_len,
+        uint32_t *max_val_len,
+        uint32_t *sd_len,
+        FILETIME *last_write_time);
+
+static LSTATUS WINAPI hook_RegQueryInfoKeyA(
+        HKEY handle,
+        char *class_,
+        uint32_t *class_c,
+        uint32_t *reserved,
+        uint32_t *nsubkeys,
+        uint32_t *max_subkey_len,
+        uint32_t *max_class_len,
+        uint32_t *nvals,
+        uint32_t *max_val_name_len,
+        uint32_t *max_val_len,
+        uint32_t *sd_len,
+        FILETIME *last_write_time);
+
 static LSTATUS WINAPI hook_RegQueryValueExA(
         HKEY handle,
         const char *name,
@@ -89,6 +376,33 @@ static LSTATUS WINAPI hook_RegSetValueExW(
         const void *bytes,
         uint32_t nbytes);
 
+static LSTATUS WINAPI hook_RegGetValueA(
+        HKEY handle,
+        const char *subkey,
+        const char *name,
+        uint32_t flags,
+        uint32_t *type,
+        void *bytes,
+        uint32_t *nbytes);
+
+static LSTATUS WINAPI hook_RegGetValueW(
+        HKEY handle,
+        const wchar_t *subkey,
+        const wchar_t *name,
+        uint32_t flags,
+        uint32_t *type,
+        void *bytes,
+        uint32_t *nbytes);
+
+static LSTATUS WINAPI hook_RegNotifyChangeKeyValue(
+        HKEY handle,
+        BOOL subtree,
+        uint32_t filter,
+        HANDLE event,
+        BOOL async);
+
+static LSTATUS WINAPI hook_RegFlushKey(HKEY handle);
+
 /* Link pointers */
 
 static LSTATUS (WINAPI *next_RegOpenKeyExW)(
@@ -98,6 +412,13 @@ static LSTATUS (WINAPI *next_RegOpenKeyExW)(
         uint32_t access,
         HKEY *out);
 
+static LSTATUS (WINAPI *next_RegOpenKeyExA)(
+        HKEY parent,
+        const char *name,
+        uint32_t flags,
+        uint32_t access,
+        HKEY *out);
+
 static LSTATUS (WINAPI *next_RegCreateKeyExW)(
         HKEY parent,
         const wchar_t *name,
@@ -109,8 +430,77 @@ static LSTATUS (WINAPI *next_RegCreateKeyExW)(
         HKEY *out,
         uint32_t *disposition);
 
+static LSTATUS (WINAPI *next_RegCreateKeyExA)(
+        HKEY parent,
+        const char *name,
+        uint32_t reserved,
+        const char *class_,
+        uint32_t options,
+        uint32_t access,
+        const SECURITY_ATTRIBUTES *sa,
+        HKEY *out,
+        uint32_t *disposition);
+
 static LSTATUS (WINAPI *next_RegCloseKey)(HKEY handle);
 
+static LSTATUS (WINAPI *next_RegEnumKeyExW)(
+        HKEY handle,
+        uint32_t index,
+        wchar_t *name,
+        uint32_t *name_c,
+        uint32_t *reserved,
+        wchar_t *class_,
+        uint32_t *class_c,
+        FILETIME *last_write_time);
+
+static LSTATUS (WINAPI *next_RegEnumValueW)(
+        HKEY handle,
+        uint32_t index,
+        wchar_t *name,
+        uint32_t *name_c,
+        uint32_t *reserved,
+        uint32_t *type,
+        void *bytes,
+        uint32_t *nbytes);
+
+static LSTATUS (WINAPI *next_RegEnumValueA)(
+        HKEY handle,
+        uint32_t index,
+        char *name,
+        uint32_t *name_c,
+        uint32_t *reserved,
+        uint32_t *type,
+        void *bytes,
+        uint32_t *nbytes);
+
+static LSTATUS (WINAPI *next_RegQueryInfoKeyW)(
+        HKEY handle,
+        wchar_t *class_,
+        uint32_t *class_c,
+        uint32_t *reserved,
+        uint32_t *nsubkeys,
+        uint32_t *max_subkey_len,
+        uint32_t *max_class_len,
+        uint32_t *nvals,
+        uint32_t *max_val_name_len,
+        uint32_t *max_val_len,
+        uint32_t *sd_len,
+        FILETIME *last_write_time);
+
+static LSTATUS (WINAPI *next_RegQueryInfoKeyA)(
+        HKEY handle,
+        char *class_,
+        uint32_t *class_c,
+        uint32_t *reserved,
+        uint32_t *nsubkeys,
+        uint32_t *max_subkey_len,
+        uint32_t *max_class_len,
+        uint32_t *nvals,
+        uint32_t *max_val_name_len,
+        uint32_t *max_val_len,
+        uint32_t *sd_len,
+        FILETIME *last_write_time);
+
 static LSTATUS (WINAPI *next_RegQueryValueExA)(
         HKEY handle,
         const char *name,
@@ -135,19 +525,74 @@ static LSTATUS (WINAPI *next_RegSetValueExW)(
         const void *bytes,
         uint32_t nbytes);
 
+static LSTATUS (WINAPI *next_RegGetValueA)(
+        HKEY handle,
+        const char *subkey,
+        const char *name,
+        uint32_t flags,
+        uint32_t *type,
+        void *bytes,
+        uint32_t *nbytes);
+
+static LSTATUS (WINAPI *next_RegGetValueW)(
+        HKEY handle,
+        const wchar_t *subkey,
+        const wchar_t *name,
+        uint32_t flags,
+        uint32_t *type,
+        void *bytes,
+        uint32_t *nbytes);
+
+static LSTATUS (WINAPI *next_RegNotifyChangeKeyValue)(
+        HKEY handle,
+        BOOL subtree,
+        uint32_t filter,
+        HANDLE event,
+        BOOL async);
+
+static LSTATUS (WINAPI *next_RegFlushKey)(HKEY handle);
+
 static const struct hook_symbol reg_hook_syms[] = {
     {
         .name   = "RegOpenKeyExW",
         .patch  = hook_RegOpenKeyExW,
         .link   = (void **) &next_RegOpenKeyExW,
+    }, {
+        .name   = "RegOpenKeyExA",
+        .patch  = hook_RegOpenKeyExA,
+        .link   = (void **) &next_RegOpenKeyExA,
     }, {
         .name   = "RegCreateKeyExW",
         .patch  = hook_RegCreateKeyExW,
         .link   = (void **) &next_RegCreateKeyExW,
+    }, {
+        .name   = "RegCreateKeyExA",
+        .patch  = hook_RegCreateKeyExA,
+        .link   = (void **) &next_RegCreateKeyExA,
     }, {
         .name   = "RegCloseKey",
         .patch  = hook_RegCloseKey,
         .link   = (void **) &next_RegCloseKey,
+    }, {
+        .name   = "RegEnumKeyExW",
+        .patch  = hook_RegEnumKeyExW,
+        .link   = (void **) &next_RegEnumKeyExW,
+    }, {
+        .name   = "RegEnumValueW",
+        .patch  = hook_RegEnumValueW,
+        .link   = (void **) &next_RegEnumValueW,
+    }, {
+        .name   = "RegEnumValueA",
+        .patch  = hook_RegEnumValueA,
+        .link   = (void **) &next_RegEnumValueA,
+    }, {
+        .name   = "RegQueryInfoKeyW",
+        .patch  = hook_RegQueryInfoKeyW,
+        .link   = (void **) &next_RegQueryInfoKeyW,
+    }, {
+        .name   = "RegQueryInfoKeyA",
+        .patch  = hook_RegQueryInfoKeyA,
+        .link   = (void **) &next_RegQueryInfoKeyA,
     }, {
         .name   = "RegQueryValueExA",
         .patch  = hook_RegQueryValueExA,
@@ -160,13 +605,33 @@ static const struct hook_symbol reg_hook_syms[] = {
         .name   = "RegSetValueExW",
         .patch  = hook_RegSetValueExW,
         .link   = (void **) &next_RegSetValueExW,
+    }, {
+        .name   = "RegGetValueA",
+        .patch  = hook_RegGetValueA,
+        .link   = (void **) &next_RegGetValueA,
+    }, {
+        .name   = "RegGetValueW",
+        .patch  = hook_RegGetValueW,
+        .link   = (void **) &next_RegGetValueW,
+    }, {
+        .name   = "RegNotifyChangeKeyValue",
+        .patch  = hook_RegNotifyChangeKeyValue,
+        .link   = (void **) &next_RegNotifyChangeKeyValue,
+    }, {
+        .name   = "RegFlushKey",
+        .patch  = hook_RegFlushKey,
+        .link   = (void **) &next_RegFlushKey,
     }
 };
 
 static bool reg_hook_initted;
 static CRITICAL_SECTION reg_hook_lock;
-static struct reg_hook_key *reg_hook_keys;
-static size_t reg_hook_nkeys;
+static struct reg_hook_key *reg_hook_buckets[REG_HOOK_NBUCKETS];
+static uint8_t *reg_hook_arena_pos;
+static uint8_t *reg_hook_arena_end;
+static struct reg_hook_handle *reg_hook_handles;
+static size_t reg_hook_nhandles;
+static size_t reg_hook_free_handle = REG_HOOK_MAX_HANDLES;
 
 HRESULT reg_hook_push_key(
         HKEY root,
@@ -174,9 +639,10 @@ HRESULT reg_hook_push_key(
         const struct reg_hook_val *vals,
         size_t nvals)
 {
-    struct reg_hook_key *new_mem;
-    struct reg_hook_key *new_key;
+    struct reg_hook_val_state *states;
+    struct reg_hook_key *key;
     HRESULT hr;
+    size_t i;
 
     assert(root != NULL);
     assert(name != NULL);
@@ -186,25 +652,46 @@ HRESULT reg_hook_push_key(
 
     EnterCriticalSection(&reg_hook_lock);
 
-    new_mem = realloc(
-            reg_hook_keys,
-            (reg_hook_nkeys + 1) * sizeof(struct reg_hook_key));
+    key = reg_hook_resolve_locked(root, name);
+
+    if (key == NULL) {
+        hr = E_OUTOFMEMORY;
+
+        goto end;
+    }
+
+    /* The first set of callbacks registered for a key keeps winning */
+
+    if (key->vals != NULL || nvals == 0) {
+        hr = S_OK;
+
+        goto end;
+    }
+
+    /* Narrow the value names now so that RegQueryValueExA doesn't have to
+       widen its argument on every call */
 
-    if (new_mem == NULL) {
+    states = reg_hook_alloc(nvals * sizeof(*states));
+
+    if (states == NULL) {
         hr = E_OUTOFMEMORY;
 
         goto end;
     }
 
-    new_key = &new_mem[reg_hook_nkeys];
-    memset(new_key, 0, sizeof(*new_key));
-    new_key->root = root;
-    new_key->name = name; /* Expect this to be statically allocated */
-    new_key->vals = vals;
-    new_key->nvals = nvals;
+    for (i = 0 ; i < nvals ; i++) {
+        states[i].name_a = reg_hook_narrow(vals[i].name, reg_hook_alloc);
+
+        if (states[i].name_a == NULL) {
+            hr = E_OUTOFMEMORY;
 
-    reg_hook_keys = new_mem;
-    reg_hook_nkeys++;
+            goto end;
+        }
+    }
+
+    key->vals = vals;
+    key->states = states;
+    key->nvals = nvals;
 
     hr = S_OK;
 
@@ -214,6 +701,60 @@ end:
     return hr;
 }
 
+HRESULT reg_hook_hive_push_key(HKEY root, const wchar_t *name)
+{
+    struct reg_hook_key *key;
+
+    assert(root != NULL);
+    assert(name != NULL);
+
+    reg_hook_init();
+
+    EnterCriticalSection(&reg_hook_lock);
+    key = reg_hook_resolve_locked(root, name);
+
+    if (key != NULL) {
+        key->shadow = true;
+    }
+
+    LeaveCriticalSection(&reg_hook_lock);
+
+    return key != NULL ? S_OK : E_OUTOFMEMORY;
+}
+
+HRESULT reg_hook_hive_push_val(
+        HKEY root,
+        const wchar_t *key_name,
+        const wchar_t *name,
+        uint32_t type,
+        const void *bytes,
+        uint32_t nbytes)
+{
+    struct reg_hook_key *key;
+    HRESULT hr;
+
+    assert(root != NULL);
+    assert(key_name != NULL);
+    assert(bytes != NULL || nbytes == 0);
+
+    reg_hook_init();
+
+    EnterCriticalSection(&reg_hook_lock);
+
+    key = reg_hook_resolve_locked(root, key_name);
+
+    if (key != NULL) {
+        key->shadow = true;
+        hr = reg_hook_hive_set_locked(key, name, type, bytes, nbytes);
+    } else {
+        hr = E_OUTOFMEMORY;
+    }
+
+    LeaveCriticalSection(&reg_hook_lock);
+
+    return hr;
+}
+
 static void reg_hook_init(void)
 {
     if (reg_hook_initted) {
@@ -241,32 +782,409 @@ static LRESULT reg_hook_propagate_hr(HRESULT hr)
     }
 }
 
-static struct reg_hook_key *reg_hook_match_key_locked(HKEY handle)
+/* Returns zeroed memory that is never freed. Caller holds reg_hook_lock. */
+
+static void *reg_hook_alloc(size_t nbytes)
 {
-    struct reg_hook_key *key;
-    size_t i;
+    uint8_t *chunk;
+    void *result;
 
-    if (handle == NULL || handle == INVALID_HANDLE_VALUE) {
-        return NULL;
-    }
+    nbytes = (nbytes + 7) & ~(size_t) 7;
 
-    for (i = 0 ; i < reg_hook_nkeys ; i++) {
-        key = &reg_hook_keys[i];
+    if (nbytes > (size_t) (reg_hook_arena_end - reg_hook_arena_pos)) {
+        /* Don't throw away the rest of the current chunk for a big block */
 
-        if (key->handle == handle) {
-            return key;
+        if (nbytes > REG_HOOK_ARENA_CHUNK / 4) {
+            return calloc(1, nbytes);
         }
+
+        chunk = malloc(REG_HOOK_ARENA_CHUNK);
+
+        if (chunk == NULL) {
+            return NULL;
+        }
+
+        reg_hook_arena_pos = chunk;
+        reg_hook_arena_end = chunk + REG_HOOK_ARENA_CHUNK;
     }
 
-    return NULL;
+    result = reg_hook_arena_pos;
+    reg_hook_arena_pos += nbytes;
+    memset(result, 0, nbytes);
+
+    return result;
 }
 
-static const struct reg_hook_val *reg_hook_match_val_locked(
-        struct reg_hook_key *key,
-        const wchar_t *name)
-{
-    const struct reg_hook_val *val;
-    size_t i;
+/* FNV-1a over the root handle and the case-folded path, so that a key's hash
+   can be extended one character at a time to get the hash of a child. */
+
+static uint32_t reg_hook_hash_root(HKEY root)
+{
+    return (0x811c9dc5 ^ (uint32_t) (uintptr_t) root) * 0x01000193;
+}
+
+static uint32_t reg_hook_hash_step(uint32_t hash, wchar_t c)
+{
+    return (hash ^ (uint16_t) towlower(c)) * 0x01000193;
+}
+
+static struct reg_hook_key *reg_hook_child_locked(
+        HKEY root,
+        struct reg_hook_key *parent,
+        const wchar_t *comp,
+        size_t len)
+{
+    struct reg_hook_key *key;
+    uint32_t hash;
+    size_t i;
+
+    if (parent != NULL) {
+        hash = reg_hook_hash_step(parent->hash, L'\\');
+    } else {
+        hash = reg_hook_hash_root(root);
+    }
+
+    for (i = 0 ; i < len ; i++) {
+        hash = reg_hook_hash_step(hash, comp[i]);
+    }
+
+    for (   key = reg_hook_buckets[hash % REG_HOOK_NBUCKETS] ;
+            key != NULL ;
+            key = key->next) {
+        if (    key->hash == hash &&
+                key->parent == parent &&
+                key->root == root &&
+                _wcsnicmp(key->leaf, comp, len) == 0 &&
+                key->leaf[len] == L'\0') {
+            return key;
+        }
+    }
+
+    return NULL;
+}
+
+/* Follows path down from start (or from the root if start is NULL) for as
+   long as matching keys exist. Returns the deepest key reached and advances
+   *path past the components consumed, so the whole path matched if **path
+   is L'\0' afterwards. Empty path components are ignored. */
+
+static struct reg_hook_key *reg_hook_walk_locked(
+        HKEY root,
+        struct reg_hook_key *start,
+        const wchar_t **path)
+{
+    struct reg_hook_key *key;
+    struct reg_hook_key *child;
+    const wchar_t *pos;
+    const wchar_t *end;
+
+    key = start;
+    pos = *path;
+
+    for (;;) {
+        while (*pos == L'\\') {
+            pos++;
+        }
+
+        if (*pos == L'\0') {
+            break;
+        }
+
+        for (end = pos ; *end != L'\0' && *end != L'\\' ; end++);
+
+        child = reg_hook_child_locked(root, key, pos, end - pos);
+
+        if (child == NULL) {
+            break;
+        }
+
+        key = child;
+        pos = end;
+    }
+
+    *path = pos;
+
+    return key;
+}
+
+static struct reg_hook_key *reg_hook_create_locked(
+        HKEY root,
+        struct reg_hook_key *parent,
+        const wchar_t *path)
+{
+    struct reg_hook_key *key;
+    const wchar_t *pos;
+    const wchar_t *end;
+
+    key = parent;
+
+    for (pos = path ; ; pos = end) {
+        while (*pos == L'\\') {
+            pos++;
+        }
+
+        if (*pos == L'\0') {
+            break;
+        }
+
+        for (end = pos ; *end != L'\0' && *end != L'\\' ; end++);
+
+        key = reg_hook_key_new_locked(root, key, pos, end - pos);
+
+        if (key == NULL) {
+            return NULL;
+        }
+    }
+
+    return key;
+}
+
+static struct reg_hook_key *reg_hook_key_new_locked(
+        HKEY root,
+        struct reg_hook_key *parent,
+        const wchar_t *comp,
+        size_t len)
+{
+    struct reg_hook_key *key;
+    struct reg_hook_key **pos;
+    wchar_t *name;
+    size_t prefix_len;
+    size_t i;
+
+    key = reg_hook_alloc(sizeof(*key));
+    prefix_len = parent != NULL ? wcslen(parent->name) + 1 : 0;
+    name = reg_hook_alloc((prefix_len + len + 1) * sizeof(wchar_t));
+
+    if (key == NULL || name == NULL) {
+        return NULL;
+    }
+
+    if (parent != NULL) {
+        memcpy(name, parent->name, (prefix_len - 1) * sizeof(wchar_t));
+        name[prefix_len - 1] = L'\\';
+        key->hash = reg_hook_hash_step(parent->hash, L'\\');
+    } else {
+        key->hash = reg_hook_hash_root(root);
+    }
+
+    memcpy(name + prefix_len, comp, len * sizeof(wchar_t));
+
+    for (i = 0 ; i < len ; i++) {
+        key->hash = reg_hook_hash_step(key->hash, comp[i]);
+    }
+
+    key->root = root;
+    key->parent = parent;
+    key->name = name;
+    key->leaf = name + prefix_len;
+
+    /* Subkeys enumerate in the order they were added */
+
+    if (parent != NULL) {
+        for (pos = &parent->child ; *pos != NULL ; pos = &(*pos)->sibling);
+
+        *pos = key;
+    }
+
+    key->next = reg_hook_buckets[key->hash % REG_HOOK_NBUCKETS];
+    reg_hook_buckets[key->hash % REG_HOOK_NBUCKETS] = key;
+
+    return key;
+}
+
+/* Finds or creates the key at the given absolute path and marks it as
+   virtual. */
+
+static struct reg_hook_key *reg_hook_resolve_locked(
+        HKEY root,
+        const wchar_t *name)
+{
+    struct reg_hook_key *key;
+    const wchar_t *pos;
+
+    pos = name;
+    key = reg_hook_walk_locked(root, NULL, &pos);
+
+    if (*pos != L'\0') {
+        key = reg_hook_create_locked(root, key, pos);
+    }
+
+    if (key != NULL) {
+        key->present = true;
+    }
+
+    return key;
+}
+
+static bool reg_hook_is_shadowed(const struct reg_hook_key *key)
+{
+    for ( ; key != NULL ; key = key->parent) {
+        if (key->shadow) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool reg_hook_is_virtual(const struct reg_hook_key *key)
+{
+    return key != NULL && (key->present || reg_hook_is_shadowed(key));
+}
+
+/* Absolute path (relative to key->root) of the real key that sits at rest
+   underneath key. Used to pass opens relative to one of our handles on to
+   the real registry, which has no idea what our handles are. Returns NULL if
+   out of memory; the caller frees the result. */
+
+static wchar_t *reg_hook_real_path(
+        const struct reg_hook_key *key,
+        const wchar_t *rest)
+{
+    wchar_t *path;
+    size_t key_len;
+    size_t rest_len;
+
+    key_len = wcslen(key->name);
+    rest_len = wcslen(rest);
+    path = malloc((key_len + 1 + rest_len + 1) * sizeof(wchar_t));
+
+    if (path == NULL) {
+        return NULL;
+    }
+
+    memcpy(path, key->name, key_len * sizeof(wchar_t));
+
+    if (rest_len > 0) {
+        path[key_len++] = L'\\';
+        memcpy(path + key_len, rest, rest_len * sizeof(wchar_t));
+    }
+
+    path[key_len + rest_len] = L'\0';
+
+    return path;
+}
+
+static bool reg_hook_is_synthetic(HKEY handle)
+{
+    return ((uintptr_t) handle >> 24) == (REG_HOOK_HANDLE_TAG >> 24);
+}
+
+/* Our handles mean nothing to the real registry, so one that we can't match
+   must never be passed on. Only handles that have already been closed get
+   here, since we hook every call that a live one can reach. */
+
+static LSTATUS reg_hook_bad_handle(HKEY handle, const char *func)
+{
+    dprintfc(DPRINTF_CAT_REG, DPRINTF_LEVEL_ERROR,
+            "Registry: %s: Stale virtual key handle %p\n",
+            func,
+            handle);
+
+    return ERROR_INVALID_HANDLE;
+}
+
+static LSTATUS reg_hook_handle_alloc_locked(
+        struct reg_hook_key *key,
+        HKEY *out)
+{
+    struct reg_hook_handle *new_mem;
+    struct reg_hook_handle *handle;
+    size_t new_count;
+    size_t slot;
+    size_t i;
+
+    if (reg_hook_free_handle == REG_HOOK_MAX_HANDLES) {
+        if (reg_hook_nhandles == REG_HOOK_MAX_HANDLES) {
+            dprintfc(DPRINTF_CAT_REG, DPRINTF_LEVEL_ERROR,
+                    "Registry: Out of virtual key handles\n");
+
+            return ERROR_NO_SYSTEM_RESOURCES;
+        }
+
+        new_count = reg_hook_nhandles ? reg_hook_nhandles * 2 : 16;
+
+        if (new_count > REG_HOOK_MAX_HANDLES) {
+            new_count = REG_HOOK_MAX_HANDLES;
+        }
+
+        new_mem = realloc(
+                reg_hook_handles,
+                new_count * sizeof(struct reg_hook_handle));
+
+        if (new_mem == NULL) {
+            return ERROR_OUTOFMEMORY;
+        }
+
+        /* Thread the new slots onto the free list in ascending order */
+
+        for (i = reg_hook_nhandles ; i < new_count ; i++) {
+            new_mem[i].key = NULL;
+            new_mem[i].next_free = i + 1 < new_count
+                    ? i + 1
+                    : REG_HOOK_MAX_HANDLES;
+            new_mem[i].gen = 0;
+        }
+
+        reg_hook_handles = new_mem;
+        reg_hook_free_handle = reg_hook_nhandles;
+        reg_hook_nhandles = new_count;
+    }
+
+    slot = reg_hook_free_handle;
+    handle = &reg_hook_handles[slot];
+    reg_hook_free_handle = handle->next_free;
+    handle->key = key;
+
+    *out = (HKEY) (uintptr_t) (REG_HOOK_HANDLE_TAG
+            | (handle->gen << REG_HOOK_SLOT_BITS)
+            | slot);
+
+    return ERROR_SUCCESS;
+}
+
+static struct reg_hook_handle *reg_hook_handle_lookup_locked(HKEY handle)
+{
+    struct reg_hook_handle *entry;
+    uintptr_t bits;
+    size_t slot;
+
+    if (!reg_hook_is_synthetic(handle)) {
+        return NULL;
+    }
+
+    bits = (uintptr_t) handle;
+    slot = bits & (REG_HOOK_MAX_HANDLES - 1);
+
+    if (slot >= reg_hook_nhandles) {
+        return NULL;
+    }
+
+    entry = &reg_hook_handles[slot];
+
+    if (    entry->key == NULL ||
+            entry->gen != ((bits >> REG_HOOK_SLOT_BITS) & REG_HOOK_GEN_MASK)) {
+        return NULL;
+    }
+
+    return entry;
+}
+
+static struct reg_hook_key *reg_hook_match_key_locked(HKEY handle)
+{
+    struct reg_hook_handle *entry;
+
+    entry = reg_hook_handle_lookup_locked(handle);
+
+    return entry != NULL ? entry->key : NULL;
+}
+
+static const struct reg_hook_val *reg_hook_match_val_locked(
+        struct reg_hook_key *key,
+        const wchar_t *name)
+{
+    const struct reg_hook_val *val;
+    size_t i;
 
     /* Watch out for accesses to the key's default value */
 
@@ -285,147 +1203,1235 @@ static const struct reg_hook_val *reg_hook_match_val_locked(
     return NULL;
 }
 
-static LSTATUS reg_hook_open_locked(
-        HKEY parent,
-        const wchar_t *name,
-        HKEY *out)
+static const struct reg_hook_val *reg_hook_match_val_a_locked(
+        struct reg_hook_key *key,
+        const char *name)
 {
-    struct reg_hook_key *key;
-    LSTATUS err;
     size_t i;
 
-    *out = NULL;
-
-    for (i = 0 ; i < reg_hook_nkeys ; i++) {
-        /* Assume reg keys are referenced from a root key and not from some
-           intermediary key */
-        key = &reg_hook_keys[i];
+    if (name == NULL) {
+        name = "";
+    }
 
-        if (key->root == parent && wstr_ieq(key->name, name)) {
-            break;
+    for (i = 0 ; i < key->nvals ; i++) {
+        if (str_ieq(key->states[i].name_a, name)) {
+            return &key->vals[i];
         }
     }
 
-    /* (Bail out if we didn't find anything; this causes the open/create call
-       to be passed onward down the hook chain) */
+    return NULL;
+}
 
-    if (i >= reg_hook_nkeys) {
-        return ERROR_SUCCESS;
+static struct reg_hook_hive_val *reg_hook_match_hive_val_locked(
+        struct reg_hook_key *key,
+        const wchar_t *name)
+{
+    struct reg_hook_hive_val *val;
+
+    if (name == NULL) {
+        name = L"";
+    }
+
+    for (val = key->hive_vals ; val != NULL ; val = val->next) {
+        if (wstr_ieq(val->name, name)) {
+            return val;
+        }
     }
 
-    /* Assume only one handle will be open at a time */
+    return NULL;
+}
+
+static struct reg_hook_hive_val *reg_hook_match_hive_val_a_locked(
+        struct reg_hook_key *key,
+        const char *name)
+{
+    struct reg_hook_hive_val *val;
+
+    if (name == NULL) {
+        name = "";
+    }
 
-    if (key->handle != NULL) {
-        return ERROR_SHARING_VIOLATION;
+    for (val = key->hive_vals ; val != NULL ; val = val->next) {
+        if (str_ieq(val->name_a, name)) {
+            return val;
+        }
     }
 
-    /* Open a unique HKEY handle that we can use to identify accesses to
-       this virtual registry key. We open a read-only handle to an arbitrary
-       registry key that we can reliably assume exists and isn't one of the
-       hardcoded root handles. HKLM\SOFTWARE will suffice for this purpose. */
+    return NULL;
+}
 
-    err = next_RegOpenKeyExW(
-            HKEY_LOCAL_MACHINE,
-            L"SOFTWARE",
-            0,
-            KEY_READ,
-            out);
+/* Returns the index'th hive value that isn't hidden behind a callback value
+   of the same name. */
 
-    if (err == ERROR_SUCCESS) {
-        key->handle = *out;
+static struct reg_hook_hive_val *reg_hook_enum_hive_val_locked(
+        struct reg_hook_key *key,
+        size_t index)
+{
+    struct reg_hook_hive_val *val;
+
+    for (val = key->hive_vals ; val != NULL ; val = val->next) {
+        if (reg_hook_match_val_locked(key, val->name) != NULL) {
+            continue;
+        }
+
+        if (index-- == 0) {
+            return val;
+        }
     }
 
-    return err;
+    return NULL;
 }
 
-static LSTATUS WINAPI hook_RegOpenKeyExW(
-        HKEY parent,
+/* Adds or replaces a hive value. Replaced data is leaked, which only matters
+   if the game rewrites the same value over and over. */
+
+static HRESULT reg_hook_hive_set_locked(
+        struct reg_hook_key *key,
         const wchar_t *name,
-        uint32_t flags,
-        uint32_t access,
-        HKEY *out)
+        uint32_t type,
+        const void *bytes,
+        uint32_t nbytes)
 {
-    LSTATUS err;
+    struct reg_hook_hive_val *val;
+    struct reg_hook_hive_val **pos;
+    struct reg_hook_blob blob;
+    wchar_t *name_copy;
+    size_t name_c;
 
-    if (out == NULL) {
-        return ERROR_INVALID_PARAMETER;
+    if (name == NULL) {
+        name = L"";
     }
 
-    EnterCriticalSection(&reg_hook_lock);
-    err = reg_hook_open_locked(parent, name, out);
-    LeaveCriticalSection(&reg_hook_lock);
+    /* Leave room for a terminator so that string values can always be
+       narrowed safely, whatever the caller handed us. */
 
-    if (err == ERROR_SUCCESS) {
-        if (*out != NULL) {
-            //dprintf("Registry: Opened virtual key %S\n", name);
-        } else {
-            err = next_RegOpenKeyExW(parent, name, flags, access, out);
-        }
+    memset(&blob, 0, sizeof(blob));
+    blob.bytes = reg_hook_alloc(nbytes + sizeof(wchar_t));
+
+    if (blob.bytes == NULL) {
+        return E_OUTOFMEMORY;
+    }
+
+    memcpy(blob.bytes, bytes, nbytes);
+    blob.nbytes = nbytes;
+
+    if (!reg_hook_narrow_blob(&blob, type, reg_hook_alloc)) {
+        return E_OUTOFMEMORY;
+    }
+
+    val = reg_hook_match_hive_val_locked(key, name);
+
+    if (val == NULL) {
+        val = reg_hook_alloc(sizeof(*val));
+        name_c = wcslen(name) + 1;
+        name_copy = reg_hook_alloc(name_c * sizeof(wchar_t));
+
+        if (val == NULL || name_copy == NULL) {
+            return E_OUTOFMEMORY;
+        }
+
+        memcpy(name_copy, name, name_c * sizeof(wchar_t));
+        val->name = name_copy;
+        val->name_a = reg_hook_narrow(name_copy, reg_hook_alloc);
+
+        if (val->name_a == NULL) {
+            return E_OUTOFMEMORY;
+        }
+
+        /* Values enumerate in the order they were added */
+
+        for (pos = &key->hive_vals ; *pos != NULL ; pos = &(*pos)->next);
+
+        *pos = val;
+    }
+
+    val->type = type;
+    val->blob = blob;
+
+    return S_OK;
+}
+
+static char *reg_hook_narrow(const wchar_t *src, void *(*alloc)(size_t))
+{
+    size_t dest_c;
+    char *dest;
+
+    wcstombs_s(&dest_c, NULL, 0, src, 0);
+    dest = alloc(dest_c * sizeof(char));
+
+    if (dest == NULL) {
+        return NULL;
+    }
+
+    wcstombs_s(NULL, dest, dest_c, src, dest_c - 1);
+
+    return dest;
+}
+
+static bool reg_hook_is_string(uint32_t type)
+{
+    return type == REG_SZ || type == REG_EXPAND_SZ || type == REG_MULTI_SZ;
+}
+
+/* Fills in the narrow form of a string value; other types are left alone.
+   Like RegQueryValueExA we convert the data's whole length rather than
+   stopping at the first NUL, which keeps every terminator in a REG_MULTI_SZ
+   list (and doesn't invent one for a REG_SZ that lacks it). Returns false if
+   out of memory. */
+
+static bool reg_hook_narrow_blob(
+        struct reg_hook_blob *blob,
+        uint32_t type,
+        void *(*alloc)(size_t))
+{
+    int nchars;
+    int nbytes_a;
+
+    if (!reg_hook_is_string(type)) {
+        return true;
+    }
+
+    nchars = blob->nbytes / sizeof(wchar_t);
+
+    if (nchars > 0) {
+        nbytes_a = WideCharToMultiByte(
+                CP_ACP,
+                0,
+                blob->bytes,
+                nchars,
+                NULL,
+                0,
+                NULL,
+                NULL);
+    } else {
+        nbytes_a = 0;
+    }
+
+    blob->bytes_a = alloc(nbytes_a + 1);
+
+    if (blob->bytes_a == NULL) {
+        return false;
+    }
+
+    if (nbytes_a > 0) {
+        WideCharToMultiByte(
+                CP_ACP,
+                0,
+                blob->bytes,
+                nchars,
+                blob->bytes_a,
+                nbytes_a,
+                NULL,
+                NULL);
+    }
+
+    blob->bytes_a[nbytes_a] = '\0';
+    blob->nbytes_a = nbytes_a;
+
+    return true;
+}
+
+/* Widens an argument to one of the ANSI APIs. NULL stays NULL. The caller
+   frees the result. */
+
+static LSTATUS reg_hook_widen(const char *src, wchar_t **out)
+{
+    size_t dest_c;
+    wchar_t *dest;
+
+    *out = NULL;
+
+    if (src == NULL) {
+        return ERROR_SUCCESS;
+    }
+
+    mbstowcs_s(&dest_c, NULL, 0, src, 0);
+    dest = malloc(dest_c * sizeof(wchar_t));
+
+    if (dest == NULL) {
+        return ERROR_OUTOFMEMORY;
+    }
+
+    mbstowcs_s(NULL, dest, dest_c, src, dest_c - 1);
+    *out = dest;
+
+    return ERROR_SUCCESS;
+}
+
+/* Runs a value's read callback and captures the result, along with its
+   narrow form if it is a string. */
+
+static LSTATUS reg_hook_render(
+        const struct reg_hook_val *val,
+        struct reg_hook_blob *blob)
+{
+    uint32_t nbytes;
+    HRESULT hr;
+
+    memset(blob, 0, sizeof(*blob));
+
+    hr = val->read(NULL, &nbytes);
+
+    if (FAILED(hr)) {
+        return reg_hook_propagate_hr(hr);
+    }
+
+    /* Leave room for a terminator in case the callback didn't supply one */
+
+    blob->bytes = calloc(1, nbytes + sizeof(wchar_t));
+
+    if (blob->bytes == NULL) {
+        return ERROR_OUTOFMEMORY;
+    }
+
+    hr = val->read(blob->bytes, &nbytes);
+
+    if (FAILED(hr)) {
+        reg_hook_blob_free(blob);
+
+        return reg_hook_propagate_hr(hr);
+    }
+
+    blob->nbytes = nbytes;
+
+    if (!reg_hook_narrow_blob(blob, val->type, malloc)) {
+        reg_hook_blob_free(blob);
+
+        return ERROR_OUTOFMEMORY;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+static void reg_hook_blob_free(struct reg_hook_blob *blob)
+{
+    free(blob->bytes);
+    free(blob->bytes_a);
+    memset(blob, 0, sizeof(*blob));
+}
+
+/* Renders an immutable value on first use and returns the stored result from
+   then on. Failures are not remembered, so the next query tries again. */
+
+static LSTATUS reg_hook_memoize_locked(
+        struct reg_hook_key *key,
+        const struct reg_hook_val *val,
+        const struct reg_hook_blob **out)
+{
+    struct reg_hook_val_state *state;
+    LSTATUS err;
+
+    state = &key->states[val - key->vals];
+
+    if (!state->memoized) {
+        err = reg_hook_render(val, &state->blob);
+
+        if (err != ERROR_SUCCESS) {
+            return err;
+        }
+
+        state->memoized = true;
+    }
+
+    *out = &state->blob;
+
+    return ERROR_SUCCESS;
+}
+
+static LSTATUS reg_hook_open_locked(
+        HKEY parent,
+        const wchar_t *name,
+        bool create,
+        bool *created,
+        HKEY *out,
+        HKEY *real_parent,
+        wchar_t **real_name)
+{
+    struct reg_hook_key *parent_key;
+    struct reg_hook_key *key;
+    const wchar_t *pos;
+    HKEY root;
+
+    *out = NULL;
+    *created = false;
+    *real_parent = parent;
+    *real_name = NULL;
+
+    /* Keys can also be opened relative to another virtual key, in which case
+       the path is looked up relative to that key's path. The real registry
+       has no idea what to do with our handles, so never pass those on. */
+
+    parent_key = reg_hook_match_key_locked(parent);
+
+    if (parent_key != NULL) {
+        root = parent_key->root;
+    } else if (reg_hook_is_synthetic(parent)) {
+        return reg_hook_bad_handle(parent, "Open");
+    } else if (name != NULL) {
+        root = parent;
+    } else {
+        return ERROR_SUCCESS;
+    }
+
+    pos = name != NULL ? name : L"";
+    key = reg_hook_walk_locked(root, parent_key, &pos);
+
+    /* Keys from .reg files shadow the real registry completely, so anything
+       missing underneath one of them does not exist, or gets created in
+       memory. */
+
+    if (*pos != L'\0' && reg_hook_is_shadowed(key)) {
+        if (!create) {
+            return ERROR_FILE_NOT_FOUND;
+        }
+
+        key = reg_hook_create_locked(root, key, pos);
+
+        if (key == NULL) {
+            return ERROR_OUTOFMEMORY;
+        }
+
+        key->present = true;
+        *created = true;
+
+        return reg_hook_handle_alloc_locked(key, out);
+    }
+
+    if (*pos == L'\0' && reg_hook_is_virtual(key)) {
+        return reg_hook_handle_alloc_locked(key, out);
+    }
+
+    /* Otherwise bail out with *out == NULL; this causes the open/create call
+       to be passed onward down the hook chain. If the call was relative to
+       one of our handles then it has to be turned into an absolute path
+       first. */
+
+    if (parent_key != NULL) {
+        *real_parent = root;
+        *real_name = reg_hook_real_path(key, pos);
+
+        if (*real_name == NULL) {
+            return ERROR_OUTOFMEMORY;
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+
+static LSTATUS WINAPI hook_RegOpenKeyExW(
+        HKEY parent,
+        const wchar_t *name,
+        uint32_t flags,
+        uint32_t access,
+        HKEY *out)
+{
+    wchar_t *real_name;
+    HKEY real_parent;
+    LSTATUS err;
+    bool created;
+
+    if (out == NULL) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    EnterCriticalSection(&reg_hook_lock);
+    err = reg_hook_open_locked(
+            parent,
+            name,
+            false,
+            &created,
+            out,
+            &real_parent,
+            &real_name);
+    LeaveCriticalSection(&reg_hook_lock);
+
+    if (err == ERROR_SUCCESS) {
+        if (*out != NULL) {
+            dprintfc(DPRINTF_CAT_REG, DPRINTF_LEVEL_DEBUG,
+                    "Registry: Opened virtual key %S\n", name);
+        } else {
+            err = next_RegOpenKeyExW(
+                    real_parent,
+                    real_name != NULL ? real_name : name,
+                    flags,
+                    access,
+                    out);
+        }
+    }
+
+    free(real_name);
+
+    return err;
+}
+
+static LSTATUS WINAPI hook_RegCreateKeyExW(
+        HKEY parent,
+        const wchar_t *name,
+        uint32_t reserved,
+        const wchar_t *class_,
+        uint32_t options,
+        uint32_t access,
+        const SECURITY_ATTRIBUTES *sa,
+        HKEY *out,
+        uint32_t *disposition)
+{
+    wchar_t *real_name;
+    HKEY real_parent;
+    LSTATUS err;
+    bool created;
+
+    if (out == NULL) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    EnterCriticalSection(&reg_hook_lock);
+    err = reg_hook_open_locked(
+            parent,
+            name,
+            true,
+            &created,
+            out,
+            &real_parent,
+            &real_name);
+    LeaveCriticalSection(&reg_hook_lock);
+
+    if (err == ERROR_SUCCESS) {
+        if (*out != NULL) {
+            dprintfc(DPRINTF_CAT_REG, DPRINTF_LEVEL_DEBUG,
+                    "Registry: Created virtual key %S\n", name);
+
+            if (disposition != NULL) {
+                *disposition = created
+                        ? REG_CREATED_NEW_KEY
+                        : REG_OPENED_EXISTING_KEY;
+            }
+        } else {
+            err = next_RegCreateKeyExW(
+                    real_parent,
+                    real_name != NULL ? real_name : name,
+                    reserved,
+                    class_,
+                    options,
+                    access,
+                    sa,
+                    out,
+                    disposition);
+        }
+    }
+
+    free(real_name);
+
+    return err;
+}
+
+/* The ANSI entry points in advapi32 go straight to the wide ones inside
+   kernelbase, where our hooks can't see them, so they need hooks of their
+   own. Anything that is not virtual gets passed on as ANSI. */
+
+static LSTATUS WINAPI hook_RegOpenKeyExA(
+        HKEY parent,
+        const char *name,
+        uint32_t flags,
+        uint32_t access,
+        HKEY *out)
+{
+    wchar_t *name_w;
+    wchar_t *real_name;
+    char *real_name_a;
+    HKEY real_parent;
+    LSTATUS err;
+    bool created;
+
+    if (out == NULL) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    err = reg_hook_widen(name, &name_w);
+
+    if (err != ERROR_SUCCESS) {
+        return err;
+    }
+
+    EnterCriticalSection(&reg_hook_lock);
+    err = reg_hook_open_locked(
+            parent,
+            name_w,
+            false,
+            &created,
+            out,
+            &real_parent,
+            &real_name);
+    LeaveCriticalSection(&reg_hook_lock);
+
+    free(name_w);
+
+    if (err != ERROR_SUCCESS) {
+        return err;
+    }
+
+    if (*out != NULL) {
+        dprintfc(DPRINTF_CAT_REG, DPRINTF_LEVEL_DEBUG,
+                "Registry: Opened virtual key %s\n", name);
+
+        return ERROR_SUCCESS;
+    }
+
+    if (real_name == NULL) {
+        return next_RegOpenKeyExA(parent, name, flags, access, out);
+    }
+
+    real_name_a = reg_hook_narrow(real_name, malloc);
+    free(real_name);
+
+    if (real_name_a == NULL) {
+        return ERROR_OUTOFMEMORY;
+    }
+
+    err = next_RegOpenKeyExA(real_parent, real_name_a, flags, access, out);
+    free(real_name_a);
+
+    return err;
+}
+
+static LSTATUS WINAPI hook_RegCreateKeyExA(
+        HKEY parent,
+        const char *name,
+        uint32_t reserved,
+        const char *class_,
+        uint32_t options,
+        uint32_t access,
+        const SECURITY_ATTRIBUTES *sa,
+        HKEY *out,
+        uint32_t *disposition)
+{
+    wchar_t *name_w;
+    wchar_t *real_name;
+    char *real_name_a;
+    HKEY real_parent;
+    LSTATUS err;
+    bool created;
+
+    if (out == NULL) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    err = reg_hook_widen(name, &name_w);
+
+    if (err != ERROR_SUCCESS) {
+        return err;
+    }
+
+    EnterCriticalSection(&reg_hook_lock);
+    err = reg_hook_open_locked(
+            parent,
+            name_w,
+            true,
+            &created,
+            out,
+            &real_parent,
+            &real_name);
+    LeaveCriticalSection(&reg_hook_lock);
+
+    free(name_w);
+
+    if (err != ERROR_SUCCESS) {
+        return err;
+    }
+
+    if (*out != NULL) {
+        dprintfc(DPRINTF_CAT_REG, DPRINTF_LEVEL_DEBUG,
+                "Registry: Created virtual key %s\n", name);
+
+        if (disposition != NULL) {
+            *disposition = created
+                    ? REG_CREATED_NEW_KEY
+                    : REG_OPENED_EXISTING_KEY;
+        }
+
+        return ERROR_SUCCESS;
+    }
+
+    if (real_name == NULL) {
+        return next_RegCreateKeyExA(
+                parent,
+                name,
+                reserved,
+                class_,
+                options,
+                access,
+                sa,
+                out,
+                disposition);
+    }
+
+    real_name_a = reg_hook_narrow(real_name, malloc);
+    free(real_name);
+
+    if (real_name_a == NULL) {
+        return ERROR_OUTOFMEMORY;
+    }
+
+    err = next_RegCreateKeyExA(
+            real_parent,
+            real_name_a,
+            reserved,
+            class_,
+            options,
+            access,
+            sa,
+            out,
+            disposition);
+    free(real_name_a);
+
+    return err;
+}
+
+static LSTATUS WINAPI hook_RegCloseKey(HKEY handle)
+{
+    struct reg_hook_handle *entry;
+    size_t slot;
+
+    if (!reg_hook_is_synthetic(handle)) {
+        return next_RegCloseKey(handle);
+    }
+
+    EnterCriticalSection(&reg_hook_lock);
+
+    entry = reg_hook_handle_lookup_locked(handle);
+
+    if (entry == NULL) {
+        LeaveCriticalSection(&reg_hook_lock);
+
+        return reg_hook_bad_handle(handle, "RegCloseKey");
+    }
+
+    dprintfc(DPRINTF_CAT_REG, DPRINTF_LEVEL_DEBUG,
+            "Registry: Closed virtual key %S\n", entry->key->name);
+
+    slot = entry - reg_hook_handles;
+    entry->key = NULL;
+    entry->gen = (entry->gen + 1) & REG_HOOK_GEN_MASK;
+    entry->next_free = reg_hook_free_handle;
+    reg_hook_free_handle = slot;
+
+    LeaveCriticalSection(&reg_hook_lock);
+
+    return ERROR_SUCCESS;
+}
+
+static LSTATUS reg_hook_copy_name(
+        const wchar_t *src,
+        wchar_t *dest,
+        uint32_t *dest_c)
+{
+    size_t len;
+
+    if (dest == NULL || dest_c == NULL) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    len = wcslen(src);
+
+    if (*dest_c <= len) {
+        return ERROR_MORE_DATA;
+    }
+
+    memcpy(dest, src, (len + 1) * sizeof(wchar_t));
+    *dest_c = len;
+
+    return ERROR_SUCCESS;
+}
+
+static LSTATUS reg_hook_copy_name_a(
+        const char *src,
+        char *dest,
+        uint32_t *dest_c)
+{
+    size_t len;
+
+    if (dest == NULL || dest_c == NULL) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    len = strlen(src);
+
+    if (*dest_c <= len) {
+        return ERROR_MORE_DATA;
+    }
+
+    memcpy(dest, src, len + 1);
+    *dest_c = len;
+
+    return ERROR_SUCCESS;
+}
+
+static LSTATUS WINAPI hook_RegEnumKeyExW(
+        HKEY handle,
+        uint32_t index,
+        wchar_t *name,
+        uint32_t *name_c,
+        uint32_t *reserved,
+        wchar_t *class_,
+        uint32_t *class_c,
+        FILETIME *last_write_time)
+{
+    struct reg_hook_key *key;
+    struct reg_hook_key *child;
+    LSTATUS err;
+
+    EnterCriticalSection(&reg_hook_lock);
+
+    key = reg_hook_match_key_locked(handle);
+
+    if (key == NULL) {
+        LeaveCriticalSection(&reg_hook_lock);
+
+        if (reg_hook_is_synthetic(handle)) {
+            return reg_hook_bad_handle(handle, "RegEnumKeyExW");
+        }
+
+        return next_RegEnumKeyExW(
+                handle,
+                index,
+                name,
+                name_c,
+                reserved,
+                class_,
+                class_c,
+                last_write_time);
+    }
+
+    for (   child = key->child ;
+            child != NULL && index > 0 ;
+            child = child->sibling, index--);
+
+    if (child == NULL) {
+        err = ERROR_NO_MORE_ITEMS;
+
+        goto end;
+    }
+
+    err = reg_hook_copy_name(child->leaf, name, name_c);
+
+    if (err != ERROR_SUCCESS) {
+        goto end;
+    }
+
+    /* Virtual keys don't have classes or timestamps */
+
+    if (class_ != NULL && class_c != NULL && *class_c > 0) {
+        class_[0] = L'\0';
+        *class_c = 0;
+    }
+
+    if (last_write_time != NULL) {
+        memset(last_write_time, 0, sizeof(*last_write_time));
+    }
+
+end:
+    LeaveCriticalSection(&reg_hook_lock);
+
+    return err;
+}
+
+static LSTATUS WINAPI hook_RegEnumValueW(
+        HKEY handle,
+        uint32_t index,
+        wchar_t *name,
+        uint32_t *name_c,
+        uint32_t *reserved,
+        uint32_t *type,
+        void *bytes,
+        uint32_t *nbytes)
+{
+    struct reg_hook_key *key;
+    const struct reg_hook_val *val;
+    struct reg_hook_hive_val *hive_val;
+    LSTATUS err;
+    HRESULT hr;
+
+    EnterCriticalSection(&reg_hook_lock);
+
+    key = reg_hook_match_key_locked(handle);
+
+    if (key == NULL) {
+        LeaveCriticalSection(&reg_hook_lock);
+
+        if (reg_hook_is_synthetic(handle)) {
+            return reg_hook_bad_handle(handle, "RegEnumValueW");
+        }
+
+        return next_RegEnumValueW(
+                handle,
+                index,
+                name,
+                name_c,
+                reserved,
+                type,
+                bytes,
+                nbytes);
+    }
+
+    /* Callback values first, then any hive values they don't override */
+
+    if (index < key->nvals) {
+        val = &key->vals[index];
+        err = reg_hook_copy_name(val->name, name, name_c);
+
+        if (err != ERROR_SUCCESS) {
+            goto end;
+        }
+
+        if (type != NULL) {
+            *type = val->type;
+        }
+
+        if (bytes == NULL && nbytes == NULL) {
+            err = ERROR_SUCCESS;
+        } else if (val->read == NULL) {
+            /* Write-only black hole, looks empty from the outside */
+
+            hr = reg_hook_read_bin(bytes, nbytes, NULL, 0);
+            err = reg_hook_propagate_hr(hr);
+        } else {
+            err = reg_hook_read_val_locked(key, val, bytes, nbytes);
+        }
+
+        goto end;
+    }
+
+    hive_val = reg_hook_enum_hive_val_locked(key, index - key->nvals);
+
+    if (hive_val == NULL) {
+        err = ERROR_NO_MORE_ITEMS;
+
+        goto end;
+    }
+
+    err = reg_hook_copy_name(hive_val->name, name, name_c);
+
+    if (err != ERROR_SUCCESS) {
+        goto end;
+    }
+
+    if (type != NULL) {
+        *type = hive_val->type;
+    }
+
+    hr = reg_hook_read_bin(
+            bytes,
+            nbytes,
+            hive_val->blob.bytes,
+            hive_val->blob.nbytes);
+    err = reg_hook_propagate_hr(hr);
+
+end:
+    LeaveCriticalSection(&reg_hook_lock);
+
+    return err;
+}
+
+static LSTATUS WINAPI hook_RegEnumValueA(
+        HKEY handle,
+        uint32_t index,
+        char *name,
+        uint32_t *name_c,
+        uint32_t *reserved,
+        uint32_t *type,
+        void *bytes,
+        uint32_t *nbytes)
+{
+    struct reg_hook_key *key;
+    const struct reg_hook_val *val;
+    struct reg_hook_hive_val *hive_val;
+    const char *name_a;
+    uint32_t val_type;
+    LSTATUS err;
+    HRESULT hr;
+
+    EnterCriticalSection(&reg_hook_lock);
+
+    key = reg_hook_match_key_locked(handle);
+
+    if (key == NULL) {
+        LeaveCriticalSection(&reg_hook_lock);
+
+        if (reg_hook_is_synthetic(handle)) {
+            return reg_hook_bad_handle(handle, "RegEnumValueA");
+        }
+
+        return next_RegEnumValueA(
+                handle,
+                index,
+                name,
+                name_c,
+                reserved,
+                type,
+                bytes,
+                nbytes);
+    }
+
+    /* Same order as RegEnumValueW */
+
+    val = NULL;
+    hive_val = NULL;
+
+    if (index < key->nvals) {
+        val = &key->vals[index];
+        name_a = key->states[index].name_a;
+        val_type = val->type;
+    } else {
+        hive_val = reg_hook_enum_hive_val_locked(key, index - key->nvals);
+
+        if (hive_val == NULL) {
+            err = ERROR_NO_MORE_ITEMS;
+
+            goto end;
+        }
+
+        name_a = hive_val->name_a;
+        val_type = hive_val->type;
+    }
+
+    err = reg_hook_copy_name_a(name_a, name, name_c);
+
+    if (err != ERROR_SUCCESS) {
+        goto end;
+    }
+
+    if (type != NULL) {
+        *type = val_type;
+    }
+
+    if (bytes == NULL && nbytes == NULL) {
+        err = ERROR_SUCCESS;
+    } else if (val != NULL && val->read == NULL) {
+        hr = reg_hook_read_bin(bytes, nbytes, NULL, 0);
+        err = reg_hook_propagate_hr(hr);
+    } else {
+        err = reg_hook_read_val_a_locked(key, val, hive_val, bytes, nbytes);
+    }
+
+end:
+    LeaveCriticalSection(&reg_hook_lock);
+
+    return err;
+}
+
+static LSTATUS WINAPI hook_RegQueryInfoKeyW(
+        HKEY handle,
+        wchar_t *class_,
+        uint32_t *class_c,
+        uint32_t *reserved,
+        uint32_t *nsubkeys,
+        uint32_t *max_subkey_len,
+        uint32_t *max_class_len,
+        uint32_t *nvals,
+        uint32_t *max_val_name_len,
+        uint32_t *max_val_len,
+        uint32_t *sd_len,
+        FILETIME *last_write_time)
+{
+    struct reg_hook_key *key;
+    struct reg_hook_key *child;
+    const struct reg_hook_val *val;
+    const struct reg_hook_blob *blob;
+    struct reg_hook_hive_val *hive_val;
+    uint32_t key_count;
+    uint32_t key_len;
+    uint32_t val_count;
+    uint32_t val_name_len;
+    uint32_t val_len;
+    uint32_t nbytes;
+    size_t i;
+
+    EnterCriticalSection(&reg_hook_lock);
+
+    key = reg_hook_match_key_locked(handle);
+
+    if (key == NULL) {
+        LeaveCriticalSection(&reg_hook_lock);
+
+        if (reg_hook_is_synthetic(handle)) {
+            return reg_hook_bad_handle(handle, "RegQueryInfoKeyW");
+        }
+
+        return next_RegQueryInfoKeyW(
+                handle,
+                class_,
+                class_c,
+                reserved,
+                nsubkeys,
+                max_subkey_len,
+                max_class_len,
+                nvals,
+                max_val_name_len,
+                max_val_len,
+                sd_len,
+                last_write_time);
+    }
+
+    /* Name lengths are in characters and exclude the terminator */
+
+    key_count = 0;
+    key_len = 0;
+    val_count = 0;
+    val_name_len = 0;
+    val_len = 0;
+
+    for (child = key->child ; child != NULL ; child = child->sibling) {
+        key_count++;
+
+        if (key_len < wcslen(child->leaf)) {
+            key_len = wcslen(child->leaf);
+        }
+    }
+
+    for (i = 0 ; i < key->nvals ; i++) {
+        val = &key->vals[i];
+        val_count++;
+
+        if (val_name_len < wcslen(val->name)) {
+            val_name_len = wcslen(val->name);
+        }
+
+        /* Sizing a value means running its callback, so only do it if the
+           caller actually asked. */
+
+        if (max_val_len == NULL || val->read == NULL) {
+            continue;
+        }
+
+        if (val->flags & REG_HOOK_VAL_IMMUTABLE) {
+            if (reg_hook_memoize_locked(key, val, &blob) == ERROR_SUCCESS) {
+                nbytes = blob->nbytes;
+            } else {
+                nbytes = 0;
+            }
+        } else if (FAILED(val->read(NULL, &nbytes))) {
+            nbytes = 0;
+        }
+
+        if (val_len < nbytes) {
+            val_len = nbytes;
+        }
+    }
+
+    for (   i = 0 ;
+            (hive_val = reg_hook_enum_hive_val_locked(key, i)) != NULL ;
+            i++) {
+        val_count++;
+
+        if (val_name_len < wcslen(hive_val->name)) {
+            val_name_len = wcslen(hive_val->name);
+        }
+
+        if (val_len < hive_val->blob.nbytes) {
+            val_len = hive_val->blob.nbytes;
+        }
+    }
+
+    LeaveCriticalSection(&reg_hook_lock);
+
+    if (class_ != NULL && class_c != NULL && *class_c > 0) {
+        class_[0] = L'\0';
+        *class_c = 0;
+    }
+
+    if (nsubkeys != NULL) {
+        *nsubkeys = key_count;
+    }
+
+    if (max_subkey_len != NULL) {
+        *max_subkey_len = key_len;
     }
 
-    return err;
-}
+    if (max_class_len != NULL) {
+        *max_class_len = 0;
+    }
 
-static LSTATUS WINAPI hook_RegCreateKeyExW(
-        HKEY parent,
-        const wchar_t *name,
-        uint32_t reserved,
-        const wchar_t *class_,
-        uint32_t options,
-        uint32_t access,
-        const SECURITY_ATTRIBUTES *sa,
-        HKEY *out,
-        uint32_t *disposition)
-{
-    LSTATUS err;
+    if (nvals != NULL) {
+        *nvals = val_count;
+    }
 
-    if (out == NULL) {
-        return ERROR_INVALID_PARAMETER;
+    if (max_val_name_len != NULL) {
+        *max_val_name_len = val_name_len;
     }
 
-    EnterCriticalSection(&reg_hook_lock);
-    err = reg_hook_open_locked(parent, name, out);
-    LeaveCriticalSection(&reg_hook_lock);
+    if (max_val_len != NULL) {
+        *max_val_len = val_len;
+    }
 
-    if (err == ERROR_SUCCESS) {
-        if (*out != NULL) {
-            //dprintf("Registry: Created virtual key %S\n", name);
-        } else {
-            err = next_RegCreateKeyExW(
-                    parent,
-                    name,
-                    reserved,
-                    class_,
-                    options,
-                    access,
-                    sa,
-                    out,
-                    disposition);
-        }
+    if (sd_len != NULL) {
+        *sd_len = 0;
     }
 
-    return err;
+    if (last_write_time != NULL) {
+        memset(last_write_time, 0, sizeof(*last_write_time));
+    }
+
+    return ERROR_SUCCESS;
 }
 
-static LSTATUS WINAPI hook_RegCloseKey(HKEY handle)
+static LSTATUS WINAPI hook_RegQueryInfoKeyA(
+        HKEY handle,
+        char *class_,
+        uint32_t *class_c,
+        uint32_t *reserved,
+        uint32_t *nsubkeys,
+        uint32_t *max_subkey_len,
+        uint32_t *max_class_len,
+        uint32_t *nvals,
+        uint32_t *max_val_name_len,
+        uint32_t *max_val_len,
+        uint32_t *sd_len,
+        FILETIME *last_write_time)
 {
-    struct reg_hook_key *key;
-    size_t i;
+    LSTATUS err;
 
-    EnterCriticalSection(&reg_hook_lock);
+    if (!reg_hook_is_synthetic(handle)) {
+        return next_RegQueryInfoKeyA(
+                handle,
+                class_,
+                class_c,
+                reserved,
+                nsubkeys,
+                max_subkey_len,
+                max_class_len,
+                nvals,
+                max_val_name_len,
+                max_val_len,
+                sd_len,
+                last_write_time);
+    }
 
-    for (i = 0 ; i < reg_hook_nkeys ; i++) {
-        key = &reg_hook_keys[i];
+    /* Names of virtual keys and values are ASCII in practice, so their wide
+       lengths hold for the ANSI API too, and no narrowed string value is
+       longer than its wide form. Virtual keys don't have classes. */
 
-        if (key->handle == handle) {
-            //dprintf("Registry: Closed virtual key %S\n", key->name);
-            key->handle = NULL;
-        }
+    err = hook_RegQueryInfoKeyW(
+            handle,
+            NULL,
+            NULL,
+            reserved,
+            nsubkeys,
+            max_subkey_len,
+            max_class_len,
+            nvals,
+            max_val_name_len,
+            max_val_len,
+            sd_len,
+            last_write_time);
+
+    if (    err == ERROR_SUCCESS &&
+            class_ != NULL &&
+            class_c != NULL &&
+            *class_c > 0) {
+        class_[0] = '\0';
+        *class_c = 0;
     }
 
-    LeaveCriticalSection(&reg_hook_lock);
-
-    return next_RegCloseKey(handle);
+    return err;
 }
 
 static LSTATUS WINAPI hook_RegQueryValueExW(
@@ -448,6 +2454,10 @@ static LSTATUS WINAPI hook_RegQueryValueExW(
     if (key == NULL) {
         LeaveCriticalSection(&reg_hook_lock);
 
+        if (reg_hook_is_synthetic(handle)) {
+            return reg_hook_bad_handle(handle, "RegQueryValueExW");
+        }
+
         return next_RegQueryValueExW(
                 handle,
                 name,
@@ -477,30 +2487,18 @@ static LSTATUS WINAPI hook_RegQueryValueExA(
         void *bytes,
         uint32_t *nbytes)
 {
-    /* _s: sizeof, _c: _countof(), _w: widened */
-
     struct reg_hook_key *key;
-    wchar_t *name_w;
-    size_t name_c;
-    wchar_t *content;
-    uint32_t content_s;
-    size_t content_c;
-    uint32_t type_site;
+    const struct reg_hook_val *val;
+    struct reg_hook_hive_val *hive_val;
+    uint32_t val_type;
     LSTATUS err;
 
-    name_w = NULL;
-    content = NULL;
-
     /* Normalize inconvenient inputs */
 
     if (name == NULL) {
         name = "";
     }
 
-    if (type == NULL) {
-        type = &type_site;
-    }
-
     /* Look up key handle, early exit if no match */
 
     EnterCriticalSection(&reg_hook_lock);
@@ -509,6 +2507,10 @@ static LSTATUS WINAPI hook_RegQueryValueExA(
     if (key == NULL) {
         LeaveCriticalSection(&reg_hook_lock);
 
+        if (reg_hook_is_synthetic(handle)) {
+            return reg_hook_bad_handle(handle, "RegQueryValueExA");
+        }
+
         return next_RegQueryValueExA(
                 handle,
                 name,
@@ -518,111 +2520,135 @@ static LSTATUS WINAPI hook_RegQueryValueExA(
                 nbytes);
     }
 
-    /* OK, first off we need to widen the name. This requires a temporary
-       buffer allocation. */
-
-    mbstowcs_s(&name_c, NULL, 0, name, 0);
-    name_w = malloc(name_c * sizeof(wchar_t));
+    /* Value names were narrowed when they were registered, so we can compare
+       against the caller's string directly. */
 
-    if (name_w == NULL) {
-        err = ERROR_OUTOFMEMORY;
+    val = reg_hook_match_val_a_locked(key, name);
+    hive_val = NULL;
 
-        goto end;
+    if (val == NULL) {
+        hive_val = reg_hook_match_hive_val_a_locked(key, name);
     }
 
-    mbstowcs_s(NULL, name_w, name_c, name, name_c - 1);
-
-    /* Next, check to see if the caller even cares about the content. We can
-       pass through if they don't. */
-
-    if (bytes == NULL && nbytes == NULL) {
-        err = reg_hook_query_val_locked(key, name_w, type, NULL, NULL);
+    if (val == NULL && hive_val == NULL) {
+        dprintfc(DPRINTF_CAT_REG, DPRINTF_LEVEL_ERROR,
+                "Registry: Key %S: Val %s not found\n", key->name, name);
+        err = ERROR_FILE_NOT_FOUND;
 
         goto end;
     }
 
-    /* Next, we need to check the key type to see if it's REG_SZ. */
-
-    err = reg_hook_query_val_locked(key, name_w, type, NULL, NULL);
+    val_type = val != NULL ? val->type : hive_val->type;
 
-    if (err != ERROR_SUCCESS) {
-        goto end;
+    if (type != NULL) {
+        *type = val_type;
     }
 
-    /* If it is not REG_SZ then pass the content directly.
-       (We ignore the REG_MULTI_SZ case here). */
+    if (val != NULL && val->read == NULL) {
+        dprintfc(DPRINTF_CAT_REG, DPRINTF_LEVEL_ERROR,
+                "Registry: %S: Val %s has no read handler\n",
+                key->name,
+                name);
 
-    assert(*type != REG_MULTI_SZ);
-
-    if (*type != REG_SZ) {
-        err = reg_hook_query_val_locked(key, name_w, type, bytes, nbytes);
+        err = ERROR_ACCESS_DENIED;
 
         goto end;
     }
 
-    /* Otherwise things get more complicated. First we must measure the wide-
-       character length of the value (hopefully said value does not change
-       under our feet, of course). */
+    /* Check to see if the caller even cares about the content */
 
-    err = reg_hook_query_val_locked(key, name_w, type, NULL, &content_s);
+    if (bytes == NULL && nbytes == NULL) {
+        err = ERROR_SUCCESS;
 
-    if (err != ERROR_SUCCESS) {
         goto end;
     }
 
-    /* Next, allocate a scratch buffer. Even if the caller doesn't supply an
-       output buffer we need to know the actual content to be able to size the
-       narrow version. */
-
-    content = malloc(content_s);
+    err = reg_hook_read_val_a_locked(key, val, hive_val, bytes, nbytes);
 
-    if (content == NULL) {
-        err = ERROR_OUTOFMEMORY;
-
-        goto end;
-    }
+end:
+    LeaveCriticalSection(&reg_hook_lock);
 
-    /* Get the data... */
+    return err;
+}
 
-    err = reg_hook_query_val_locked(key, name_w, type, content, &content_s);
+/* Reads a value as seen through the ANSI API, where strings come out narrow.
+   Exactly one of val and hive_val is set. */
 
-    if (err != ERROR_SUCCESS) {
-        goto end;
-    }
+static LSTATUS reg_hook_read_val_a_locked(
+        struct reg_hook_key *key,
+        const struct reg_hook_val *val,
+        const struct reg_hook_hive_val *hive_val,
+        void *bytes,
+        uint32_t *nbytes)
+{
+    const struct reg_hook_blob *blob;
+    struct reg_hook_blob scratch;
+    uint32_t val_type;
+    LSTATUS err;
+    HRESULT hr;
 
-    /* Now size the corresponding narrow form and return it to the caller */
+    memset(&scratch, 0, sizeof(scratch));
 
-    wcstombs_s(&content_c, NULL, 0, content, 0);
+    /* Render the value once: strings need their full wide content before we
+       can even size the narrow version. Immutable values come straight out of
+       the memo and hive values are stored pre-rendered. */
 
-    if (bytes != NULL) {
-        if (nbytes == NULL) {
-            err = ERROR_INVALID_PARAMETER;
+    if (hive_val != NULL) {
+        blob = &hive_val->blob;
+        val_type = hive_val->type;
+    } else if (val->flags & REG_HOOK_VAL_IMMUTABLE) {
+        err = reg_hook_memoize_locked(key, val, &blob);
 
-            goto end;
+        if (err != ERROR_SUCCESS) {
+            return err;
         }
 
-        if (*nbytes < content_c) {
-            err = ERROR_MORE_DATA;
+        val_type = val->type;
+    } else {
+        err = reg_hook_render(val, &scratch);
 
-            goto end;
+        if (err != ERROR_SUCCESS) {
+            return err;
         }
 
-        wcstombs_s(NULL, bytes, *nbytes, content, content_c - 1);
+        blob = &scratch;
+        val_type = val->type;
     }
 
-    if (nbytes != NULL) { /* It really should be, based on earlier checks ... */
-        *nbytes = content_c;
+    if (reg_hook_is_string(val_type)) {
+        hr = reg_hook_read_bin(bytes, nbytes, blob->bytes_a, blob->nbytes_a);
+    } else {
+        hr = reg_hook_read_bin(bytes, nbytes, blob->bytes, blob->nbytes);
     }
 
-    err = ERROR_SUCCESS;
+    reg_hook_blob_free(&scratch);
 
-end:
-    LeaveCriticalSection(&reg_hook_lock);
+    return reg_hook_propagate_hr(hr);
+}
 
-    free(content);
-    free(name_w);
+static LSTATUS reg_hook_read_val_locked(
+        struct reg_hook_key *key,
+        const struct reg_hook_val *val,
+        void *bytes,
+        uint32_t *nbytes)
+{
+    const struct reg_hook_blob *blob;
+    LSTATUS err;
+    HRESULT hr;
 
-    return err;
+    if (val->flags & REG_HOOK_VAL_IMMUTABLE) {
+        err = reg_hook_memoize_locked(key, val, &blob);
+
+        if (err != ERROR_SUCCESS) {
+            return err;
+        }
+
+        hr = reg_hook_read_bin(bytes, nbytes, blob->bytes, blob->nbytes);
+    } else {
+        hr = val->read(bytes, nbytes);
+    }
+
+    return reg_hook_propagate_hr(hr);
 }
 
 static LSTATUS reg_hook_query_val_locked(
@@ -633,7 +2659,7 @@ static LSTATUS reg_hook_query_val_locked(
         uint32_t *nbytes)
 {
     const struct reg_hook_val *val;
-    LSTATUS err;
+    struct reg_hook_hive_val *hive_val;
     HRESULT hr;
 
     val = reg_hook_match_val_locked(key, name);
@@ -643,22 +2669,38 @@ static LSTATUS reg_hook_query_val_locked(
             *type = val->type;
         }
 
-        if (val->read != NULL) {
-            hr = val->read(bytes, nbytes);
-            err = reg_hook_propagate_hr(hr);
-        } else {
-            dprintf("Registry: %S: Val %S has no read handler\n",
+        if (val->read == NULL) {
+            dprintfc(DPRINTF_CAT_REG, DPRINTF_LEVEL_ERROR,
+                    "Registry: %S: Val %S has no read handler\n",
                     key->name,
                     name);
 
-            err = ERROR_ACCESS_DENIED;
+            return ERROR_ACCESS_DENIED;
         }
-    } else {
-        dprintf("Registry: Key %S: Val %S not found\n", key->name, name);
-        err = ERROR_FILE_NOT_FOUND;
+
+        return reg_hook_read_val_locked(key, val, bytes, nbytes);
     }
 
-    return err;
+    hive_val = reg_hook_match_hive_val_locked(key, name);
+
+    if (hive_val != NULL) {
+        if (type != NULL) {
+            *type = hive_val->type;
+        }
+
+        hr = reg_hook_read_bin(
+                bytes,
+                nbytes,
+                hive_val->blob.bytes,
+                hive_val->blob.nbytes);
+
+        return reg_hook_propagate_hr(hr);
+    }
+
+    dprintfc(DPRINTF_CAT_REG, DPRINTF_LEVEL_ERROR,
+            "Registry: Key %S: Val %S not found\n", key->name, name);
+
+    return ERROR_FILE_NOT_FOUND;
 }
 
 static LSTATUS WINAPI hook_RegSetValueExW(
@@ -681,6 +2723,10 @@ static LSTATUS WINAPI hook_RegSetValueExW(
     if (key == NULL) {
         LeaveCriticalSection(&reg_hook_lock);
 
+        if (reg_hook_is_synthetic(handle)) {
+            return reg_hook_bad_handle(handle, "RegSetValueExW");
+        }
+
         return next_RegSetValueExW(
                 handle,
                 name,
@@ -695,7 +2741,8 @@ static LSTATUS WINAPI hook_RegSetValueExW(
     if (val != NULL) {
         if (val->write != NULL) {
             if (type != val->type) {
-                dprintf(        "Registry: Key %S: Val %S: Type mismatch "
+                dprintfc(DPRINTF_CAT_REG, DPRINTF_LEVEL_ERROR,
+                        "Registry: Key %S: Val %S: Type mismatch "
                                 "(expected %i got %i)\n",
                         key->name,
                         name,
@@ -704,12 +2751,18 @@ static LSTATUS WINAPI hook_RegSetValueExW(
 
                 err = ERROR_ACCESS_DENIED;
             } else {
-                dprintf("Registry: Write virtual key %S value %S\n",
+                dprintfc(DPRINTF_CAT_REG, DPRINTF_LEVEL_INFO,
+                        "Registry: Write virtual key %S value %S\n",
                         key->name,
                         val->name);
 
                 hr = val->write(bytes, nbytes);
                 err = reg_hook_propagate_hr(hr);
+
+                /* Forget any memoized copy of what we just overwrote */
+
+                reg_hook_blob_free(&key->states[val - key->vals].blob);
+                key->states[val - key->vals].memoized = false;
             }
         } else {
             /* No write handler (the common case), black-hole whatever gets
@@ -717,16 +2770,262 @@ static LSTATUS WINAPI hook_RegSetValueExW(
 
             err = ERROR_SUCCESS;
         }
+    } else if (bytes == NULL && nbytes > 0) {
+        err = ERROR_INVALID_PARAMETER;
     } else {
-        dprintf("Registry: Key %S: Val %S not found\n", key->name, name);
-        err = ERROR_FILE_NOT_FOUND;
+        /* Anything else lives in the in-memory hive until we exit */
+
+        dprintfc(DPRINTF_CAT_REG, DPRINTF_LEVEL_INFO,
+                "Registry: Write virtual key %S value %S (in memory)\n",
+                key->name,
+                name);
+
+        hr = reg_hook_hive_set_locked(key, name, type, bytes, nbytes);
+        err = reg_hook_propagate_hr(hr);
+    }
+
+    LeaveCriticalSection(&reg_hook_lock);
+
+    return err;
+}
+
+/* RegGetValue() opens a subkey and queries it internally, where our other
+   hooks can't see it, so both halves are redone here. */
+
+static LSTATUS WINAPI hook_RegGetValueA(
+        HKEY handle,
+        const char *subkey,
+        const char *name,
+        uint32_t flags,
+        uint32_t *type,
+        void *bytes,
+        uint32_t *nbytes)
+{
+    wchar_t *subkey_w;
+    wchar_t *real_name;
+    char *real_name_a;
+    HKEY real_parent;
+    HKEY key;
+    uint32_t val_type;
+    LSTATUS err;
+    bool created;
+
+    err = reg_hook_widen(subkey, &subkey_w);
+
+    if (err != ERROR_SUCCESS) {
+        return err;
+    }
+
+    EnterCriticalSection(&reg_hook_lock);
+    err = reg_hook_open_locked(
+            handle,
+            subkey_w,
+            false,
+            &created,
+            &key,
+            &real_parent,
+            &real_name);
+    LeaveCriticalSection(&reg_hook_lock);
+
+    free(subkey_w);
+
+    if (err != ERROR_SUCCESS) {
+        return err;
+    }
+
+    if (key == NULL) {
+        if (real_name == NULL) {
+            return next_RegGetValueA(
+                    handle,
+                    subkey,
+                    name,
+                    flags,
+                    type,
+                    bytes,
+                    nbytes);
+        }
+
+        real_name_a = reg_hook_narrow(real_name, malloc);
+        free(real_name);
+
+        if (real_name_a == NULL) {
+            return ERROR_OUTOFMEMORY;
+        }
+
+        err = next_RegGetValueA(
+                real_parent,
+                real_name_a,
+                name,
+                flags,
+                type,
+                bytes,
+                nbytes);
+        free(real_name_a);
+
+        return err;
+    }
+
+    err = hook_RegQueryValueExA(key, name, NULL, &val_type, bytes, nbytes);
+    hook_RegCloseKey(key);
+
+    if (err == ERROR_SUCCESS) {
+        err = reg_hook_check_type(flags, val_type);
+    }
+
+    if (err == ERROR_SUCCESS && type != NULL) {
+        *type = val_type;
     }
 
+    return err;
+}
+
+static LSTATUS WINAPI hook_RegGetValueW(
+        HKEY handle,
+        const wchar_t *subkey,
+        const wchar_t *name,
+        uint32_t flags,
+        uint32_t *type,
+        void *bytes,
+        uint32_t *nbytes)
+{
+    wchar_t *real_name;
+    HKEY real_parent;
+    HKEY key;
+    uint32_t val_type;
+    LSTATUS err;
+    bool created;
+
+    EnterCriticalSection(&reg_hook_lock);
+    err = reg_hook_open_locked(
+            handle,
+            subkey,
+            false,
+            &created,
+            &key,
+            &real_parent,
+            &real_name);
     LeaveCriticalSection(&reg_hook_lock);
 
+    if (err != ERROR_SUCCESS) {
+        return err;
+    }
+
+    if (key == NULL) {
+        err = next_RegGetValueW(
+                real_parent,
+                real_name != NULL ? real_name : subkey,
+                name,
+                flags,
+                type,
+                bytes,
+                nbytes);
+        free(real_name);
+
+        return err;
+    }
+
+    err = hook_RegQueryValueExW(key, name, NULL, &val_type, bytes, nbytes);
+    hook_RegCloseKey(key);
+
+    if (err == ERROR_SUCCESS) {
+        err = reg_hook_check_type(flags, val_type);
+    }
+
+    if (err == ERROR_SUCCESS && type != NULL) {
+        *type = val_type;
+    }
+
     return err;
 }
 
+/* Applies RegGetValue()'s RRF_RT_* type restriction. We never expand
+   REG_EXPAND_SZ data (nothing we emulate stores any), so those values behave
+   as if RRF_NOEXPAND had been given. */
+
+static LSTATUS reg_hook_check_type(uint32_t flags, uint32_t type)
+{
+    uint32_t mask;
+
+    switch (type) {
+    case REG_NONE:      mask = RRF_RT_REG_NONE; break;
+    case REG_SZ:        mask = RRF_RT_REG_SZ; break;
+    case REG_EXPAND_SZ: mask = RRF_RT_REG_EXPAND_SZ; break;
+    case REG_BINARY:    mask = RRF_RT_REG_BINARY; break;
+    case REG_DWORD:     mask = RRF_RT_REG_DWORD; break;
+    case REG_MULTI_SZ:  mask = RRF_RT_REG_MULTI_SZ; break;
+    case REG_QWORD:     mask = RRF_RT_REG_QWORD; break;
+    default:            mask = RRF_RT_ANY; break;
+    }
+
+    if (!(flags & mask)) {
+        return ERROR_UNSUPPORTED_TYPE;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+/* Nothing outside this process can change a virtual key, so there is nothing
+   to wait for. Asynchronous watches are accepted and simply never fire; a
+   synchronous one would block forever, so refuse it instead. */
+
+static LSTATUS WINAPI hook_RegNotifyChangeKeyValue(
+        HKEY handle,
+        BOOL subtree,
+        uint32_t filter,
+        HANDLE event,
+        BOOL async)
+{
+    struct reg_hook_key *key;
+
+    if (!reg_hook_is_synthetic(handle)) {
+        return next_RegNotifyChangeKeyValue(
+                handle,
+                subtree,
+                filter,
+                event,
+                async);
+    }
+
+    EnterCriticalSection(&reg_hook_lock);
+    key = reg_hook_match_key_locked(handle);
+    LeaveCriticalSection(&reg_hook_lock);
+
+    if (key == NULL) {
+        return reg_hook_bad_handle(handle, "RegNotifyChangeKeyValue");
+    }
+
+    if (!async) {
+        dprintfc(DPRINTF_CAT_REG, DPRINTF_LEVEL_INFO,
+                "Registry: Key %S: Refusing synchronous change notification\n",
+                key->name);
+
+        return ERROR_NOT_SUPPORTED;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+static LSTATUS WINAPI hook_RegFlushKey(HKEY handle)
+{
+    struct reg_hook_key *key;
+
+    if (!reg_hook_is_synthetic(handle)) {
+        return next_RegFlushKey(handle);
+    }
+
+    EnterCriticalSection(&reg_hook_lock);
+    key = reg_hook_match_key_locked(handle);
+    LeaveCriticalSection(&reg_hook_lock);
+
+    if (key == NULL) {
+        return reg_hook_bad_handle(handle, "RegFlushKey");
+    }
+
+    /* Virtual keys live in memory, there is nothing to flush */
+
+    return ERROR_SUCCESS;
+}
+
 HRESULT reg_hook_read_bin(
         void *bytes,
         uint32_t *nbytes,
@@ -5,11 +5,22 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/* Values flagged REG_HOOK_VAL_IMMUTABLE have their read callback invoked
+   once, on first access; after that queries are served from a copy of the
+   result (plus a narrow copy for string values queried through the ANSI
+   API). Only set this on values whose content can no longer change by the
+   time the game first reads them. */
+
+enum {
+    REG_HOOK_VAL_IMMUTABLE = 0x1,
+};
+
 struct reg_hook_val {
     const wchar_t *name;
     HRESULT (*read)(void *bytes, uint32_t *nbytes);
     HRESULT (*write)(const void *bytes, uint32_t nbytes);
     uint32_t type;
+    uint32_t flags;
 };
 
 HRESULT reg_hook_push_key(
@@ -18,6 +29,21 @@ HRESULT reg_hook_push_key(
         const struct reg_hook_val *vals,
         size_t nvals);
 
+/* Static data loaded from .reg files. Both functions create the key (and any
+   missing parents) if necessary; pushing a value that already exists
+   replaces it. The data is copied. Unlike keys pushed from C, keys pushed
+   this way hide the real registry's subkeys as well as the key itself. */
+
+HRESULT reg_hook_hive_push_key(HKEY root, const wchar_t *name);
+
+HRESULT reg_hook_hive_push_val(
+        HKEY root,
+        const wchar_t *key_name,
+        const wchar_t *name,
+        uint32_t type,
+        const void *bytes,
+        uint32_t nbytes);
+
 HRESULT reg_hook_read_bin(
         void *bytes,
         uint32_t *nbytes,
@@ -0,0 +1,719 @@
+#include <windows.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hooklib/reg.h"
+#include "hooklib/regfile.h"
+
+#include "util/dprintf.h"
+
+struct regfile_root {
+    const wchar_t *name;
+    HKEY key;
+};
+
+struct regfile_parser {
+    const wchar_t *path;
+    unsigned int line_no;
+    bool regedit4;
+    HKEY root;
+    wchar_t *key;           /* NULL if values should be skipped */
+    size_t nkeys;
+    size_t nvals;
+    size_t nerrors;
+};
+
+static HRESULT regfile_read(const wchar_t *path, wchar_t **out);
+static void regfile_parse_line(struct regfile_parser *p, wchar_t *line);
+static void regfile_parse_key(struct regfile_parser *p, wchar_t *line);
+static void regfile_parse_val(struct regfile_parser *p, wchar_t *line);
+static HRESULT regfile_parse_data(
+        struct regfile_parser *p,
+        wchar_t *pos,
+        uint32_t *type,
+        void **bytes,
+        uint32_t *nbytes);
+static wchar_t *regfile_parse_string(wchar_t **pos);
+static HRESULT regfile_parse_hex(
+        const wchar_t *pos,
+        uint8_t *bytes,
+        uint32_t *nbytes);
+static int regfile_hex_digit(wchar_t c);
+static wchar_t *regfile_skip_space(const wchar_t *pos);
+static void regfile_error(struct regfile_parser *p, const char *msg);
+
+static const struct regfile_root regfile_roots[] = {
+    {
+        .name   = L"HKEY_LOCAL_MACHINE",
+        .key    = HKEY_LOCAL_MACHINE,
+    }, {
+        .name   = L"HKLM",
+        .key    = HKEY_LOCAL_MACHINE,
+    }, {
+        .name   = L"HKEY_CURRENT_USER",
+        .key    = HKEY_CURRENT_USER,
+    }, {
+        .name   = L"HKCU",
+        .key    = HKEY_CURRENT_USER,
+    }, {
+        .name   = L"HKEY_CLASSES_ROOT",
+        .key    = HKEY_CLASSES_ROOT,
+    }, {
+        .name   = L"HKCR",
+        .key    = HKEY_CLASSES_ROOT,
+    }, {
+        .name   = L"HKEY_USERS",
+        .key    = HKEY_USERS,
+    }, {
+        .name   = L"HKU",
+        .key    = HKEY_USERS,
+    }, {
+        .name   = L"HKEY_CURRENT_CONFIG",
+        .key    = HKEY_CURRENT_CONFIG,
+    }, {
+        .name   = L"HKCC",
+        .key    = HKEY_CURRENT_CONFIG,
+    },
+};
+
+HRESULT regfile_hook_init(const struct regfile_config *cfg)
+{
+    assert(cfg != NULL);
+
+    if (cfg->path[0] == L'\0') {
+        return S_FALSE;
+    }
+
+    return regfile_load(cfg->path);
+}
+
+HRESULT regfile_load(const wchar_t *path)
+{
+    struct regfile_parser p;
+    wchar_t *text;
+    wchar_t *line;
+    wchar_t *pos;
+    wchar_t *end;
+    size_t line_len;
+    size_t len;
+    bool header;
+    HRESULT hr;
+
+    assert(path != NULL);
+
+    hr = regfile_read(path, &text);
+
+    if (FAILED(hr)) {
+        dprintfc(DPRINTF_CAT_REG, DPRINTF_LEVEL_ERROR,
+                "RegFile: Error reading %S: %x\n", path, (int) hr);
+
+        return hr;
+    }
+
+    /* Logical lines are never longer than the whole file */
+
+    line = malloc((wcslen(text) + 1) * sizeof(wchar_t));
+
+    if (line == NULL) {
+        free(text);
+
+        return E_OUTOFMEMORY;
+    }
+
+    memset(&p, 0, sizeof(p));
+    p.path = path;
+    header = false;
+    line_len = 0;
+    hr = S_OK;
+
+    for (pos = text ; *pos != L'\0' ; pos = end) {
+        for (end = pos ; *end != L'\0' && *end != L'\n' ; end++);
+
+        len = end - pos;
+
+        if (*end == L'\n') {
+            end++;
+        }
+
+        p.line_no++;
+
+        if (len > 0 && pos[len - 1] == L'\r') {
+            len--;
+        }
+
+        /* Long hex values are wrapped with a trailing backslash, and the
+           continuation lines are indented. */
+
+        if (line_len > 0) {
+            while (len > 0 && (*pos == L' ' || *pos == L'\t')) {
+                pos++;
+                len--;
+            }
+        }
+
+        memcpy(line + line_len, pos, len * sizeof(wchar_t));
+        line_len += len;
+
+        if (line_len > 0 && line[line_len - 1] == L'\\' && *end != L'\0') {
+            line_len--;
+
+            continue;
+        }
+
+        line[line_len] = L'\0';
+        line_len = 0;
+
+        if (!header) {
+            if (line[0] == L'\0') {
+                continue;
+            }
+
+            if (wcscmp(line, L"REGEDIT4") == 0) {
+                p.regedit4 = true;
+            } else if (wcscmp(
+                    line,
+                    L"Windows Registry Editor Version 5.00") != 0) {
+                dprintfc(DPRINTF_CAT_REG, DPRINTF_LEVEL_ERROR,
+                        "RegFile: %S is not a registry file\n", path);
+                hr = HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+
+                break;
+            }
+
+            header = true;
+
+            continue;
+        }
+
+        regfile_parse_line(&p, line);
+    }
+
+    free(p.key);
+    free(line);
+    free(text);
+
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    dprintfc(DPRINTF_CAT_REG, DPRINTF_LEVEL_INFO,
+            "RegFile: Loaded %u keys and %u values from %S (%u errors)\n",
+            (unsigned int) p.nkeys,
+            (unsigned int) p.nvals,
+            path,
+            (unsigned int) p.nerrors);
+
+    return S_OK;
+}
+
+/* Reads the whole file into a NUL-terminated wide string. */
+
+static HRESULT regfile_read(const wchar_t *path, wchar_t **out)
+{
+    uint8_t *bytes;
+    wchar_t *text;
+    size_t nbytes;
+    size_t nchars;
+    long size;
+    UINT cp;
+    HRESULT hr;
+    FILE *f;
+
+    *out = NULL;
+    bytes = NULL;
+    text = NULL;
+
+    f = _wfopen(path, L"rb");
+
+    if (f == NULL) {
+        return HRESULT_FROM_WIN32(
+                errno == ENOENT ? ERROR_FILE_NOT_FOUND : ERROR_OPEN_FAILED);
+    }
+
+    if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0) {
+        hr = HRESULT_FROM_WIN32(ERROR_READ_FAULT);
+
+        goto end;
+    }
+
+    rewind(f);
+    nbytes = (size_t) size;
+    bytes = malloc(nbytes + 1);
+
+    if (bytes == NULL) {
+        hr = E_OUTOFMEMORY;
+
+        goto end;
+    }
+
+    if (fread(bytes, 1, nbytes, f) != nbytes) {
+        hr = HRESULT_FROM_WIN32(ERROR_READ_FAULT);
+
+        goto end;
+    }
+
+    if (nbytes >= 2 && bytes[0] == 0xFF && bytes[1] == 0xFE) {
+        /* UTF-16LE, which is what regedit writes these days */
+
+        nchars = (nbytes - 2) / sizeof(wchar_t);
+        text = malloc((nchars + 1) * sizeof(wchar_t));
+
+        if (text == NULL) {
+            hr = E_OUTOFMEMORY;
+
+            goto end;
+        }
+
+        memcpy(text, bytes + 2, nchars * sizeof(wchar_t));
+    } else {
+        if (nbytes >= 3 && memcmp(bytes, "\xEF\xBB\xBF", 3) == 0) {
+            memmove(bytes, bytes + 3, nbytes - 3);
+            nbytes -= 3;
+            cp = CP_UTF8;
+        } else {
+            cp = CP_ACP;
+        }
+
+        nchars = nbytes > 0
+                ? MultiByteToWideChar(cp, 0, (char *) bytes, nbytes, NULL, 0)
+                : 0;
+
+        if (nbytes > 0 && nchars == 0) {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+
+            goto end;
+        }
+
+        text = malloc((nchars + 1) * sizeof(wchar_t));
+
+        if (text == NULL) {
+            hr = E_OUTOFMEMORY;
+
+            goto end;
+        }
+
+        if (nchars > 0) {
+            MultiByteToWideChar(cp, 0, (char *) bytes, nbytes, text, nchars);
+        }
+    }
+
+    text[nchars] = L'\0';
+    *out = text;
+    text = NULL;
+    hr = S_OK;
+
+end:
+    free(text);
+    free(bytes);
+    fclose(f);
+
+    return hr;
+}
+
+static void regfile_parse_line(struct regfile_parser *p, wchar_t *line)
+{
+    line = regfile_skip_space(line);
+
+    switch (line[0]) {
+    case L'\0':
+    case L';':
+        break;
+
+    case L'[':
+        regfile_parse_key(p, line);
+
+        break;
+
+    case L'"':
+    case L'@':
+        regfile_parse_val(p, line);
+
+        break;
+
+    default:
+        regfile_error(p, "Unrecognized line");
+
+        break;
+    }
+}
+
+static void regfile_parse_key(struct regfile_parser *p, wchar_t *line)
+{
+    wchar_t *name;
+    wchar_t *end;
+    wchar_t *sep;
+    HRESULT hr;
+    size_t i;
+
+    free(p->key);
+    p->key = NULL;
+
+    end = wcsrchr(line, L']');
+
+    if (end == NULL) {
+        regfile_error(p, "Missing ']'");
+
+        return;
+    }
+
+    *end = L'\0';
+    name = line + 1;
+
+    if (name[0] == L'-') {
+        dprintfc(DPRINTF_CAT_REG, DPRINTF_LEVEL_DEBUG,
+                "RegFile: %S:%u: Ignoring key deletion\n",
+                p->path,
+                p->line_no);
+
+        return;
+    }
+
+    sep = wcschr(name, L'\\');
+
+    if (sep == NULL || sep[1] == L'\0') {
+        regfile_error(p, "Root keys cannot be loaded");
+
+        return;
+    }
+
+    *sep = L'\0';
+
+    for (i = 0 ; i < _countof(regfile_roots) ; i++) {
+        if (_wcsicmp(regfile_roots[i].name, name) == 0) {
+            break;
+        }
+    }
+
+    if (i == _countof(regfile_roots)) {
+        regfile_error(p, "Unknown root key");
+
+        return;
+    }
+
+    hr = reg_hook_hive_push_key(regfile_roots[i].key, sep + 1);
+
+    if (FAILED(hr)) {
+        regfile_error(p, "Failed to create key");
+
+        return;
+    }
+
+    p->root = regfile_roots[i].key;
+    p->key = _wcsdup(sep + 1);
+    p->nkeys++;
+}
+
+static void regfile_parse_val(struct regfile_parser *p, wchar_t *line)
+{
+    wchar_t *name;
+    wchar_t *pos;
+    uint32_t type;
+    uint32_t nbytes;
+    void *bytes;
+    HRESULT hr;
+
+    if (p->key == NULL) {
+        /* Error (if any) was already reported for the key line itself */
+
+        return;
+    }
+
+    pos = line;
+
+    if (*pos == L'@') {
+        name = L"";
+        pos++;
+    } else {
+        name = regfile_parse_string(&pos);
+
+        if (name == NULL) {
+            regfile_error(p, "Unterminated value name");
+
+            return;
+        }
+    }
+
+    pos = regfile_skip_space(pos);
+
+    if (*pos != L'=') {
+        regfile_error(p, "Expected '='");
+
+        return;
+    }
+
+    pos = regfile_skip_space(pos + 1);
+
+    if (*pos == L'-') {
+        dprintfc(DPRINTF_CAT_REG, DPRINTF_LEVEL_DEBUG,
+                "RegFile: %S:%u: Ignoring value deletion\n",
+                p->path,
+                p->line_no);
+
+        return;
+    }
+
+    hr = regfile_parse_data(p, pos, &type, &bytes, &nbytes);
+
+    if (FAILED(hr)) {
+        return;
+    }
+
+    hr = reg_hook_hive_push_val(p->root, p->key, name, type, bytes, nbytes);
+    free(bytes);
+
+    if (FAILED(hr)) {
+        regfile_error(p, "Failed to store value");
+
+        return;
+    }
+
+    p->nvals++;
+}
+
+static HRESULT regfile_parse_data(
+        struct regfile_parser *p,
+        wchar_t *pos,
+        uint32_t *type,
+        void **bytes,
+        uint32_t *nbytes)
+{
+    wchar_t *str;
+    wchar_t *end;
+    uint32_t value;
+    uint8_t *raw;
+    wchar_t *wide;
+    int nchars;
+    int digit;
+    int i;
+    HRESULT hr;
+
+    *bytes = NULL;
+    *nbytes = 0;
+
+    if (*pos == L'"') {
+        str = regfile_parse_string(&pos);
+
+        if (str == NULL || *regfile_skip_space(pos) != L'\0') {
+            regfile_error(p, "Malformed string value");
+
+            return E_INVALIDARG;
+        }
+
+        *type = REG_SZ;
+        *nbytes = (wcslen(str) + 1) * sizeof(wchar_t);
+        *bytes = malloc(*nbytes);
+
+        if (*bytes == NULL) {
+            return E_OUTOFMEMORY;
+        }
+
+        memcpy(*bytes, str, *nbytes);
+
+        return S_OK;
+    }
+
+    if (_wcsnicmp(pos, L"dword:", 6) == 0) {
+        pos += 6;
+        value = 0;
+
+        for (i = 0 ; (digit = regfile_hex_digit(pos[i])) >= 0 ; i++) {
+            value = (value << 4) | digit;
+        }
+
+        if (i == 0 || i > 8 || *regfile_skip_space(pos + i) != L'\0') {
+            regfile_error(p, "Malformed dword value");
+
+            return E_INVALIDARG;
+        }
+
+        *type = REG_DWORD;
+        *nbytes = sizeof(value);
+        *bytes = malloc(sizeof(value));
+
+        if (*bytes == NULL) {
+            return E_OUTOFMEMORY;
+        }
+
+        memcpy(*bytes, &value, sizeof(value));
+
+        return S_OK;
+    }
+
+    if (_wcsnicmp(pos, L"hex:", 4) == 0) {
+        *type = REG_BINARY;
+        pos += 4;
+    } else if (_wcsnicmp(pos, L"hex(", 4) == 0) {
+        *type = wcstoul(pos + 4, &end, 16);
+
+        if (end == pos + 4 || end[0] != L')' || end[1] != L':') {
+            regfile_error(p, "Malformed value type");
+
+            return E_INVALIDARG;
+        }
+
+        pos = end + 2;
+    } else {
+        regfile_error(p, "Unrecognized value type");
+
+        return E_INVALIDARG;
+    }
+
+    /* Every byte takes at least two characters */
+
+    raw = malloc(wcslen(pos) / 2 + 1);
+
+    if (raw == NULL) {
+        return E_OUTOFMEMORY;
+    }
+
+    hr = regfile_parse_hex(pos, raw, nbytes);
+
+    if (FAILED(hr)) {
+        regfile_error(p, "Malformed hex value");
+        free(raw);
+
+        return hr;
+    }
+
+    /* REGEDIT4 files store string data in the ANSI code page, but we only
+       ever hand out UTF-16 strings through the W APIs. */
+
+    if (    p->regedit4 &&
+            *nbytes > 0 &&
+            (   *type == REG_SZ ||
+                *type == REG_EXPAND_SZ ||
+                *type == REG_MULTI_SZ)) {
+        nchars = MultiByteToWideChar(
+                CP_ACP,
+                0,
+                (char *) raw,
+                *nbytes,
+                NULL,
+                0);
+        wide = malloc(nchars * sizeof(wchar_t));
+
+        if (nchars == 0 || wide == NULL) {
+            regfile_error(p, "Failed to convert string value");
+            free(wide);
+            free(raw);
+
+            return E_FAIL;
+        }
+
+        MultiByteToWideChar(CP_ACP, 0, (char *) raw, *nbytes, wide, nchars);
+        free(raw);
+        raw = (uint8_t *) wide;
+        *nbytes = nchars * sizeof(wchar_t);
+    }
+
+    *bytes = raw;
+
+    return S_OK;
+}
+
+/* Unescapes a quoted string in place. On entry *pos points at the opening
+   quote, on exit it points past the closing quote. Returns NULL if the
+   string is not terminated. */
+
+static wchar_t *regfile_parse_string(wchar_t **pos)
+{
+    wchar_t *src;
+    wchar_t *dest;
+    wchar_t *result;
+
+    src = *pos + 1;
+    dest = src;
+    result = src;
+
+    for (;;) {
+        if (*src == L'\0') {
+            return NULL;
+        }
+
+        if (*src == L'"') {
+            break;
+        }
+
+        if (*src == L'\\' && src[1] != L'\0') {
+            src++;
+        }
+
+        *dest++ = *src++;
+    }
+
+    *pos = src + 1;
+    *dest = L'\0';
+
+    return result;
+}
+
+static HRESULT regfile_parse_hex(
+        const wchar_t *pos,
+        uint8_t *bytes,
+        uint32_t *nbytes)
+{
+    int hi;
+    int lo;
+
+    *nbytes = 0;
+
+    for (;;) {
+        pos = regfile_skip_space(pos);
+
+        if (*pos == L'\0') {
+            return S_OK;
+        }
+
+        hi = regfile_hex_digit(pos[0]);
+        lo = regfile_hex_digit(pos[1]);
+
+        if (hi < 0 || lo < 0) {
+            return E_INVALIDARG;
+        }
+
+        bytes[(*nbytes)++] = (hi << 4) | lo;
+        pos = regfile_skip_space(pos + 2);
+
+        if (*pos == L',') {
+            pos++;
+        } else if (*pos != L'\0') {
+            return E_INVALIDARG;
+        }
+    }
+}
+
+static int regfile_hex_digit(wchar_t c)
+{
+    if (c >= L'0' && c <= L'9') {
+        return c - L'0';
+    } else if (c >= L'a' && c <= L'f') {
+        return c - L'a' + 10;
+    } else if (c >= L'A' && c <= L'F') {
+        return c - L'A' + 10;
+    } else {
+        return -1;
+    }
+}
+
+static wchar_t *regfile_skip_space(const wchar_t *pos)
+{
+    while (*pos == L' ' || *pos == L'\t') {
+        pos++;
+    }
+
+    return (wchar_t *) pos;
+}
+
+static void regfile_error(struct regfile_parser *p, const char *msg)
+{
+    dprintfc(DPRINTF_CAT_REG, DPRINTF_LEVEL_ERROR,
+            "RegFile: %S:%u: %s\n", p->path, p->line_no, msg);
+    p->nerrors++;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <windows.h>
+
+/* Loads a regedit export (.reg file) into the virtual registry at startup.
+
+   Both the "Windows Registry Editor Version 5.00" (UTF-16 or ANSI) and the
+   older "REGEDIT4" formats are understood. Supported value types are
+   strings, dword: and hex: / hex(N):, which covers everything regedit
+   emits. Deletion entries ([-KEY] and "name"=-) are ignored, since there is
+   nothing underneath the virtual registry for them to delete.
+
+   Keys loaded this way become virtual in their entirety: they shadow the
+   real registry, and values the game writes to them are kept in memory and
+   discarded on exit. Values registered from C through reg_hook_push_key()
+   take priority over values of the same name loaded from a file. */
+
+struct regfile_config {
+    wchar_t path[MAX_PATH];
+};
+
+HRESULT regfile_hook_init(const struct regfile_config *cfg);
+
+HRESULT regfile_load(const wchar_t *path);
@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -13,14 +14,49 @@
 
 #include "util/dprintf.h"
 
+/* Phantom devices are grouped by interface class. Each class can hold any
+   number of devices, which are enumerated in registration order ahead of
+   whatever real devices the system has for that class. Every device gets its
+   SP_DEVICE_INTERFACE_DETAIL_DATA_W built once when it is registered, so
+   answering a detail query is a single memcpy.
+
+   Each HDEVINFO the system hands out for one of our classes is recorded in a
+   small hash table, so mapping a handle back to its class doesn't depend on
+   how many classes or open handles there are. Several handles for the same
+   class can be open at once. */
+
+enum {
+    SETUPAPI_NBUCKETS   = 16,
+};
+
+struct setupapi_dev {
+    const wchar_t *path;
+    SP_DEVICE_INTERFACE_DETAIL_DATA_W *detail;
+    DWORD detail_size;
+};
+
 struct setupapi_class {
     const GUID *guid;
-    const wchar_t *path;
-    HDEVINFO cur_handle;
+    struct setupapi_dev **devs;
+    size_t ndevs;
+};
+
+struct setupapi_set {
+    struct setupapi_set *next;
+    HDEVINFO handle;
+    struct setupapi_class *class_;
 };
 
 static void setupapi_hook_init(void);
 
+static size_t setupapi_hash(HDEVINFO handle);
+
+static struct setupapi_class *setupapi_class_find_locked(const GUID *guid);
+
+static struct setupapi_class *setupapi_set_find_locked(HDEVINFO handle);
+
+static struct setupapi_dev *setupapi_dev_new(const wchar_t *path);
+
 /* API hooks */
 
 static HDEVINFO WINAPI my_SetupDiGetClassDevsW(
@@ -95,13 +131,16 @@ static const struct hook_symbol setupapi_syms[] = {
 
 static bool setupapi_initted;
 static CRITICAL_SECTION setupapi_lock;
-static struct setupapi_class *setupapi_classes;
+static struct setupapi_class **setupapi_classes;
 static size_t setupapi_nclasses;
+static struct setupapi_set *setupapi_sets[SETUPAPI_NBUCKETS];
 
 HRESULT setupapi_add_phantom_dev(const GUID *iface_class, const wchar_t *path)
 {
     struct setupapi_class *class_;
-    struct setupapi_class *new_array;
+    struct setupapi_class **new_classes;
+    struct setupapi_dev **new_devs;
+    struct setupapi_dev *dev;
     HRESULT hr;
 
     assert(iface_class != NULL);
@@ -109,28 +148,64 @@ HRESULT setupapi_add_phantom_dev(const GUID *iface_class, const wchar_t *path)
 
     setupapi_hook_init();
 
+    dev = setupapi_dev_new(path);
+
+    if (dev == NULL) {
+        return E_OUTOFMEMORY;
+    }
+
     EnterCriticalSection(&setupapi_lock);
 
-    new_array = realloc(
-            setupapi_classes,
-            (setupapi_nclasses + 1) * sizeof(struct setupapi_class));
+    class_ = setupapi_class_find_locked(iface_class);
+
+    if (class_ == NULL) {
+        class_ = calloc(1, sizeof(*class_));
+
+        if (class_ == NULL) {
+            hr = E_OUTOFMEMORY;
+
+            goto end;
+        }
+
+        new_classes = realloc(
+                setupapi_classes,
+                (setupapi_nclasses + 1) * sizeof(*setupapi_classes));
 
-    if (new_array == NULL) {
+        if (new_classes == NULL) {
+            free(class_);
+            hr = E_OUTOFMEMORY;
+
+            goto end;
+        }
+
+        class_->guid = iface_class;
+        setupapi_classes = new_classes;
+        setupapi_classes[setupapi_nclasses++] = class_;
+    }
+
+    new_devs = realloc(
+            class_->devs,
+            (class_->ndevs + 1) * sizeof(*class_->devs));
+
+    if (new_devs == NULL) {
         hr = E_OUTOFMEMORY;
 
         goto end;
     }
 
-    setupapi_classes = new_array;
-
-    class_ = &setupapi_classes[setupapi_nclasses++];
-    class_->guid = iface_class;
-    class_->path = path;
+    class_->devs = new_devs;
+    class_->devs[class_->ndevs++] = dev;
+    dev = NULL;
     hr = S_OK;
 
 end:
     LeaveCriticalSection(&setupapi_lock);
 
+    if (dev != NULL) {
+        free(dev->detail);
+        free(dev);
+    }
+
     return hr;
 }
 
@@ -150,6 +225,77 @@ static void setupapi_hook_init(void)
     setupapi_initted = true;
 }
 
+static size_t setupapi_hash(HDEVINFO handle)
+{
+    uintptr_t bits;
+
+    /* Handles are heap pointers, so the low bits carry no information */
+
+    bits = (uintptr_t) handle >> 4;
+
+    return (size_t) ((bits ^ (bits >> 8)) % SETUPAPI_NBUCKETS);
+}
+
+static struct setupapi_class *setupapi_class_find_locked(const GUID *guid)
+{
+    size_t i;
+
+    for (i = 0 ; i < setupapi_nclasses ; i++) {
+        if (memcmp(guid, setupapi_classes[i]->guid, sizeof(*guid)) == 0) {
+            return setupapi_classes[i];
+        }
+    }
+
+    return NULL;
+}
+
+static struct setupapi_class *setupapi_set_find_locked(HDEVINFO handle)
+{
+    struct setupapi_set *set;
+
+    for (   set = setupapi_sets[setupapi_hash(handle)] ;
+            set != NULL ;
+            set = set->next) {
+        if (set->handle == handle) {
+            return set->class_;
+        }
+    }
+
+    return NULL;
+}
+
+static struct setupapi_dev *setupapi_dev_new(const wchar_t *path)
+{
+    struct setupapi_dev *dev;
+    size_t nbytes_path;
+    size_t nbytes_total;
+
+    nbytes_path = (wcslen(path) + 1) * sizeof(wchar_t);
+    nbytes_total  = offsetof(SP_DEVICE_INTERFACE_DETAIL_DATA_W, DevicePath);
+    nbytes_total += nbytes_path;
+
+    dev = malloc(sizeof(*dev));
+
+    if (dev == NULL) {
+        return NULL;
+    }
+
+    dev->detail = malloc(nbytes_total);
+
+    if (dev->detail == NULL) {
+        free(dev);
+
+        return NULL;
+    }
+
+    dev->path = path;
+    dev->detail->cbSize = sizeof(*dev->detail);
+    memcpy(dev->detail->DevicePath, path, nbytes_path);
+    dev->detail_size = (DWORD) nbytes_total;
+
+    return dev;
+}
+
 static HDEVINFO WINAPI my_SetupDiGetClassDevsW(
         const GUID *ClassGuid,
         wchar_t *Enumerator,
@@ -157,8 +303,9 @@ static HDEVINFO WINAPI my_SetupDiGetClassDevsW(
         DWORD Flags)
 {
     struct setupapi_class *class_;
+    struct setupapi_set *set;
     HDEVINFO result;
-    size_t i;
+    size_t bucket;
 
     result = next_SetupDiGetClassDevsW(
             ClassGuid,
@@ -172,10 +319,20 @@ static HDEVINFO WINAPI my_SetupDiGetClassDevsW(
 
     EnterCriticalSection(&setupapi_lock);
 
-    for (i = 0 ; i < setupapi_nclasses ; i++) {
-        class_ = &setupapi_classes[i];
-        if (memcmp(ClassGuid, class_->guid, sizeof(*ClassGuid)) == 0) {
-            class_->cur_handle = result;
+    class_ = setupapi_class_find_locked(ClassGuid);
+
+    if (class_ != NULL) {
+        set = malloc(sizeof(*set));
+
+        if (set != NULL) {
+            bucket = setupapi_hash(result);
+
+            set->handle = result;
+            set->class_ = class_;
+            set->next = setupapi_sets[bucket];
+            setupapi_sets[bucket] = set;
+        } else {
+            dprintf("SetupAPI: Out of memory, phantom devices hidden\n");
         }
     }
 
@@ -192,7 +349,7 @@ static BOOL WINAPI my_SetupDiEnumDeviceInterfaces(
         SP_DEVICE_INTERFACE_DATA *DeviceInterfaceData)
 {
     const struct setupapi_class *class_;
-    size_t i;
+    const struct setupapi_dev *dev;
 
     if (    DeviceInfoSet == INVALID_HANDLE_VALUE ||
             DeviceInterfaceData == NULL ||
@@ -200,38 +357,36 @@ static BOOL WINAPI my_SetupDiEnumDeviceInterfaces(
         goto pass;
     }
 
-    if (MemberIndex > 0) {
-        MemberIndex--;
-
-        goto pass;
-    }
-
     EnterCriticalSection(&setupapi_lock);
 
-    for (   i = 0, class_ = NULL ;
-            i < setupapi_nclasses && class_ == NULL ;
-            i++) {
-        if (DeviceInfoSet == setupapi_classes[i].cur_handle) {
-            class_ = &setupapi_classes[i];
-
-            dprintf("SetupAPI: Interface {%08lx-...} -> Device node %S\n",
-                    class_->guid->Data1,
-                    class_->path);
-
-            memcpy( &DeviceInterfaceData->InterfaceClassGuid,
-                    class_->guid,
-                    sizeof(GUID));
-            DeviceInterfaceData->Flags = SPINT_ACTIVE;
-            DeviceInterfaceData->Reserved = (ULONG_PTR) class_->path;
+    class_ = setupapi_set_find_locked(DeviceInfoSet);
+    dev = NULL;
+
+    if (class_ != NULL) {
+        if (MemberIndex < class_->ndevs) {
+            dev = class_->devs[MemberIndex];
+        } else {
+            /* Real devices follow on from our phantom ones */
+            MemberIndex -= (DWORD) class_->ndevs;
         }
     }
 
     LeaveCriticalSection(&setupapi_lock);
 
-    if (class_ == NULL) {
+    if (dev == NULL) {
         goto pass;
     }
 
+    dprintf("SetupAPI: Interface {%08lx-...} -> Device node %S\n",
+            class_->guid->Data1,
+            dev->path);
+
+    memcpy( &DeviceInterfaceData->InterfaceClassGuid,
+            class_->guid,
+            sizeof(GUID));
+    DeviceInterfaceData->Flags = SPINT_ACTIVE;
+    DeviceInterfaceData->Reserved = (ULONG_PTR) dev;
+
     SetLastError(ERROR_SUCCESS);
 
     return TRUE;
@@ -253,44 +408,44 @@ static BOOL WINAPI my_SetupDiGetDeviceInterfaceDetailW(
         DWORD *RequiredSize,
         SP_DEVINFO_DATA *DeviceInfoData)
 {
-    const wchar_t *wstr;
-    size_t nbytes_wstr;
-    size_t nbytes_total;
+    const struct setupapi_class *class_;
+    const struct setupapi_dev *dev;
     size_t i;
-    bool match;
 
     if (DeviceInfoSet == INVALID_HANDLE_VALUE || DeviceInterfaceData == NULL) {
         goto pass;
     }
 
+    /* Reserved belongs to SetupAPI for real devices, so only compare it
+       against our own device pointers and never dereference it blindly. */
+
     EnterCriticalSection(&setupapi_lock);
 
-    for (   i = 0, match = false ;
-            i < setupapi_nclasses && !match ;
-            i++) {
-        if (    DeviceInfoSet == setupapi_classes[i].cur_handle &&
-                DeviceInterfaceData->Reserved == (ULONG_PTR) setupapi_classes[i].path) {
-            match = true;
+    class_ = setupapi_set_find_locked(DeviceInfoSet);
+    dev = NULL;
+
+    if (class_ != NULL) {
+        for (i = 0 ; i < class_->ndevs ; i++) {
+            if (DeviceInterfaceData->Reserved == (ULONG_PTR) class_->devs[i]) {
+                dev = class_->devs[i];
+
+                break;
+            }
         }
     }
 
     LeaveCriticalSection(&setupapi_lock);
 
-    if (!match) {
+    if (dev == NULL) {
         goto pass;
     }
 
-    wstr = (const wchar_t *) DeviceInterfaceData->Reserved;
-    nbytes_wstr = (wcslen(wstr) + 1) * sizeof(wchar_t);
-    nbytes_total  = offsetof(SP_DEVICE_INTERFACE_DETAIL_DATA_W, DevicePath);
-    nbytes_total += nbytes_wstr;
-
     if (RequiredSize != NULL) {
-        *RequiredSize = (DWORD) nbytes_total;
+        *RequiredSize = dev->detail_size;
     }
 
-    if (    DeviceInterfaceDetailData == NULL &&
-            DeviceInterfaceDetailDataSize < nbytes_total) {
+    if (    DeviceInterfaceDetailData == NULL ||
+            DeviceInterfaceDetailDataSize < dev->detail_size) {
         SetLastError(ERROR_INSUFFICIENT_BUFFER);
 
         return FALSE;
@@ -302,7 +457,7 @@ static BOOL WINAPI my_SetupDiGetDeviceInterfaceDetailW(
         return FALSE;
     }
 
-    memcpy(DeviceInterfaceDetailData->DevicePath, wstr, nbytes_wstr);
+    memcpy(DeviceInterfaceDetailData, dev->detail, dev->detail_size);
     SetLastError(ERROR_SUCCESS);
 
     return TRUE;
@@ -319,13 +474,20 @@ pass:
 
 static BOOL WINAPI my_SetupDiDestroyDeviceInfoList(HDEVINFO DeviceInfoSet)
 {
-    size_t i;
+    struct setupapi_set **pos;
+    struct setupapi_set *set;
 
     EnterCriticalSection(&setupapi_lock);
 
-    for (i = 0 ; i < setupapi_nclasses ; i++) {
-        if (setupapi_classes[i].cur_handle == DeviceInfoSet) {
-            setupapi_classes[i].cur_handle = NULL;
+    for (   pos = &setupapi_sets[setupapi_hash(DeviceInfoSet)] ;
+            *pos != NULL ;
+            pos = &(*pos)->next) {
+        if ((*pos)->handle == DeviceInfoSet) {
+            set = *pos;
+            *pos = set->next;
+            free(set);
+
+            break;
         }
     }
 
@@ -1,19 +1,72 @@
 #include <windows.h>
 
+#include <assert.h>
+#include <ctype.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wchar.h>
 
-#include "hook/pe.h"
-
 #include "hooklib/spike.h"
 
 #include "util/dprintf.h"
 
+enum spike_kind {
+    SPIKE_JMP,
+    SPIKE_PTR,
+    SPIKE_LEVELS,
+};
+
+struct spike_directive {
+    const char *name;
+    enum spike_kind kind;
+    void *proc;
+};
+
+struct spike_patch {
+    uint32_t rva;
+    uint32_t nbytes;
+    uint32_t count;
+    const struct spike_directive *dir;
+};
+
+/* A spike file compiled down to a flat list of patches. If the file starts
+   with an "image" line then it only applies to the EXE build with that PE
+   timestamp and checksum. */
+
+struct spike_manifest {
+    bool keyed;
+    uint32_t timestamp;
+    uint32_t checksum;
+    struct spike_patch *patches;
+    size_t npatches;
+};
+
+static bool spike_image_key(
+        HMODULE mod,
+        uint32_t *timestamp,
+        uint32_t *checksum,
+        uint32_t *image_size);
+
+static HRESULT spike_manifest_compile(
+        struct spike_manifest *m,
+        const wchar_t *spike_file,
+        uint32_t timestamp,
+        uint32_t checksum,
+        uint32_t image_size);
+
+static void spike_manifest_apply(const struct spike_manifest *m);
+
+static void spike_manifest_fini(struct spike_manifest *m);
+
 static void spike_hook_read_config(const wchar_t *spike_file);
 
+static void spike_hook_read_dir(const wchar_t *spike_dir);
+
 /* Spike functions. Their "style" is named after the libc function they bear
    the closest resemblance to. */
 
@@ -91,46 +144,47 @@ static void spike_fn_perror(
     OutputDebugStringA(line);
 }
 
-/* Spike inserters */
+/* Spike directives. These are matched with a single token comparison per
+   line, so keep the table small. */
+
+static const struct spike_directive spike_directives[] = {
+    { "levels",     SPIKE_LEVELS,   NULL },
+    { "j_vprintf",  SPIKE_JMP,      spike_fn_vprintf },
+    { "j_vwprintf", SPIKE_JMP,      spike_fn_vwprintf },
+    { "j_printf",   SPIKE_JMP,      spike_fn_printf },
+    { "j_puts",     SPIKE_JMP,      spike_fn_puts },
+    { "j_perror",   SPIKE_JMP,      spike_fn_perror },
+    { "c_fputs",    SPIKE_PTR,      spike_fn_fputs }, /* c == "callback" */
+};
+
+/* Spike inserters. These expect the page(s) containing the target to be
+   writable already, see spike_manifest_apply(). */
 
-static void spike_insert_jmp(ptrdiff_t rva, void *proc)
+static void spike_insert_jmp(uint8_t *target, void *proc)
 {
-    uint8_t *base;
-    uint8_t *target;
     uint8_t *func_ptr;
     uint32_t delta;
 
-    base = (uint8_t *) GetModuleHandleW(NULL);
-
-    target = base + rva;
     func_ptr = proc;
     delta = func_ptr - target - 4; /* -4: EIP delta, after end of target insn */
 
-    pe_patch(target, &delta, sizeof(delta));
+    memcpy(target, &delta, sizeof(delta));
 }
 
-static void spike_insert_ptr(ptrdiff_t rva, void *ptr)
+static void spike_insert_ptr(uint8_t *target, void *ptr)
 {
-    uint8_t *base;
-    uint8_t *target;
-
-    base = (uint8_t *) GetModuleHandleW(NULL);
-    target = base + rva;
-
-    pe_patch(target, &ptr, sizeof(ptr));
+    memcpy(target, &ptr, sizeof(ptr));
 }
 
-static void spike_insert_log_levels(ptrdiff_t rva, size_t count)
+static void spike_insert_log_levels(uint8_t *target, size_t count)
 {
-    uint8_t *base;
-    uint32_t *levels;
+    uint32_t level;
     size_t i;
 
-    base = (uint8_t *) GetModuleHandleW(NULL);
-    levels = (uint32_t *) (base + rva);
+    level = 255;
 
     for (i = 0 ; i < count ; i++) {
-        levels[i] = 255;
+        memcpy(target + i * sizeof(level), &level, sizeof(level));
     }
 }
 
@@ -142,6 +196,7 @@ void spike_hook_init(const wchar_t *ini_file)
     wchar_t path[MAX_PATH];
     const wchar_t *basename;
     const wchar_t *slash;
+    DWORD attrs;
 
     assert(ini_file != NULL);
 
@@ -167,7 +222,21 @@ void spike_hook_init(const wchar_t *ini_file)
             _countof(path),
             ini_file);
 
-    if (path[0] != L'\0') {
+    if (path[0] == L'\0') {
+        return;
+    }
+
+    /* This can either name a single spike file or a directory full of them,
+       in which case we pick whichever one was written for this exact build of
+       the EXE. */
+
+    attrs = GetFileAttributesW(path);
+
+    if (    attrs != INVALID_FILE_ATTRIBUTES &&
+            (attrs & FILE_ATTRIBUTE_DIRECTORY)) {
+        dprintf("Spiking %S using configs from %S\n", basename, path);
+        spike_hook_read_dir(path);
+    } else {
         dprintf("Spiking %S using config from %S\n", basename, path);
         spike_hook_read_config(path);
     }
@@ -175,75 +244,463 @@ void spike_hook_init(const wchar_t *ini_file)
 
 static void spike_hook_read_config(const wchar_t *spike_file)
 {
-    int match;
-    int count;
-    int rva;
-    char line[80];
-    char *ret;
+    struct spike_manifest m;
+    uint32_t timestamp;
+    uint32_t checksum;
+    uint32_t image_size;
+    HRESULT hr;
+
+    if (!spike_image_key(
+            GetModuleHandleW(NULL),
+            &timestamp,
+            &checksum,
+            &image_size)) {
+        dprintf("Spike: Host EXE has no valid PE header?\n");
+
+        return;
+    }
+
+    hr = spike_manifest_compile(
+            &m,
+            spike_file,
+            timestamp,
+            checksum,
+            image_size);
+
+    if (hr == S_FALSE) {
+        dprintf("Spike: %S is for a different build of this EXE "
+                "(want image %#08x %#08x), ignoring it\n",
+                spike_file,
+                timestamp,
+                checksum);
+
+        return;
+    }
+
+    if (FAILED(hr)) {
+        return;
+    }
+
+    spike_manifest_apply(&m);
+    spike_manifest_fini(&m);
+}
+
+static void spike_hook_read_dir(const wchar_t *spike_dir)
+{
+    struct spike_manifest m;
+    WIN32_FIND_DATAW fd;
+    wchar_t path[MAX_PATH];
+    uint32_t timestamp;
+    uint32_t checksum;
+    uint32_t image_size;
+    HANDLE find;
+    HRESULT hr;
+
+    if (!spike_image_key(
+            GetModuleHandleW(NULL),
+            &timestamp,
+            &checksum,
+            &image_size)) {
+        dprintf("Spike: Host EXE has no valid PE header?\n");
+
+        return;
+    }
+
+    swprintf_s(path, _countof(path), L"%s\\*.txt", spike_dir);
+    find = FindFirstFileW(path, &fd);
+
+    if (find == INVALID_HANDLE_VALUE) {
+        dprintf("Spike: No spike files found in %S\n", spike_dir);
+
+        return;
+    }
+
+    hr = S_FALSE;
+
+    /* A broken file (or one meant for another build) is no reason to stop
+       looking: keep going until a file that is keyed to this image compiles
+       cleanly. */
+
+    do {
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            continue;
+        }
+
+        swprintf_s(
+                path,
+                _countof(path),
+                L"%s\\%s",
+                spike_dir,
+                fd.cFileName);
+
+        hr = spike_manifest_compile(
+                &m,
+                path,
+                timestamp,
+                checksum,
+                image_size);
+
+        if (FAILED(hr)) {
+            dprintf("Spike: Skipping unusable spike file %S: %08x\n",
+                    path,
+                    (int) hr);
+        } else if (hr == S_OK && !m.keyed) {
+            /* Without an image line there's no telling which build a file
+               belongs to, so don't guess. */
+            spike_manifest_fini(&m);
+            hr = S_FALSE;
+        }
+    } while (hr != S_OK && FindNextFileW(find, &fd));
+
+    FindClose(find);
+
+    if (hr != S_OK) {
+        dprintf("Spike: No spike file in %S matches image %#08x %#08x\n",
+                spike_dir,
+                timestamp,
+                checksum);
+
+        return;
+    }
+
+    dprintf("Spike: Using %S\n", path);
+    spike_manifest_apply(&m);
+    spike_manifest_fini(&m);
+}
+
+static bool spike_image_key(
+        HMODULE mod,
+        uint32_t *timestamp,
+        uint32_t *checksum,
+        uint32_t *image_size)
+{
+    const IMAGE_DOS_HEADER *dos;
+    const IMAGE_NT_HEADERS *nt;
+
+    dos = (const IMAGE_DOS_HEADER *) mod;
+
+    if (dos == NULL || dos->e_magic != IMAGE_DOS_SIGNATURE) {
+        return false;
+    }
+
+    nt = (const IMAGE_NT_HEADERS *) ((const uint8_t *) mod + dos->e_lfanew);
+
+    if (nt->Signature != IMAGE_NT_SIGNATURE) {
+        return false;
+    }
+
+    *timestamp = nt->FileHeader.TimeDateStamp;
+    *checksum = nt->OptionalHeader.CheckSum;
+    *image_size = nt->OptionalHeader.SizeOfImage;
+
+    return true;
+}
+
+static bool spike_parse_uint(char **pos, uint32_t *out)
+{
+    unsigned long value;
+    char *end;
+
+    while (**pos == ' ' || **pos == '\t') {
+        (*pos)++;
+    }
+
+    if (!isdigit((unsigned char) **pos)) {
+        return false;
+    }
+
+    value = strtoul(*pos, &end, 0);
+
+    if (end == *pos || value > UINT32_MAX) {
+        return false;
+    }
+
+    *pos = end;
+    *out = (uint32_t) value;
+
+    return true;
+}
+
+static HRESULT spike_manifest_compile(
+        struct spike_manifest *m,
+        const wchar_t *spike_file,
+        uint32_t timestamp,
+        uint32_t checksum,
+        uint32_t image_size)
+{
+    const struct spike_directive *dir;
+    struct spike_patch *new_mem;
+    struct spike_patch *patch;
+    size_t max_patches;
+    size_t name_len;
+    unsigned int line_no;
+    char line[256];
+    char *pos;
+    char *end;
+    HRESULT hr;
     FILE *f;
+    size_t i;
+
+    assert(m != NULL);
+    assert(spike_file != NULL);
+
+    memset(m, 0, sizeof(*m));
+    max_patches = 0;
 
     f = _wfopen(spike_file, L"r");
 
     if (f == NULL) {
         dprintf("Error opening spike file %S\n", spike_file);
 
-        return;
+        return E_FAIL;
     }
 
-    for (;;) {
-        ret = fgets(line, sizeof(line), f);
+    hr = S_OK;
+    line_no = 0;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line_no++;
 
-        if (ret == NULL) {
-            break;
+        for (pos = line ; *pos == ' ' || *pos == '\t' ; pos++);
+
+        if (*pos == '#' || *pos == '\r' || *pos == '\n' || *pos == '\0') {
+            continue;
         }
 
-        if (line[0] == '#' || line[0] == '\r' || line[0] == '\n') {
+        for (end = pos ; isalnum((unsigned char) *end) || *end == '_' ; end++);
+
+        name_len = end - pos;
+
+        /* Build key: must come before any patches so that a spike file for
+           the wrong build is rejected before we've parsed the rest of it. */
+
+        if (name_len == 5 && memcmp(pos, "image", 5) == 0) {
+            if (m->npatches > 0 || m->keyed) {
+                dprintf("Spike: %S:%u: image must be the first directive\n",
+                        spike_file,
+                        line_no);
+                hr = E_FAIL;
+
+                break;
+            }
+
+            if (    !spike_parse_uint(&end, &m->timestamp) ||
+                    !spike_parse_uint(&end, &m->checksum)) {
+                dprintf("Spike: %S:%u: Expected image TIMESTAMP CHECKSUM\n",
+                        spike_file,
+                        line_no);
+                hr = E_FAIL;
+
+                break;
+            }
+
+            m->keyed = true;
+
+            if (m->timestamp != timestamp || m->checksum != checksum) {
+                hr = S_FALSE;
+
+                break;
+            }
+
             continue;
         }
 
-        match = sscanf(line, "levels %i %i", &rva, &count);
+        dir = NULL;
 
-        if (match == 2) {
-            spike_insert_log_levels((ptrdiff_t) rva, count);
+        for (i = 0 ; i < _countof(spike_directives) ; i++) {
+            if (    strlen(spike_directives[i].name) == name_len &&
+                    memcmp(spike_directives[i].name, pos, name_len) == 0) {
+                dir = &spike_directives[i];
+
+                break;
+            }
         }
 
-        match = sscanf(line, "j_vprintf %i", &rva);
+        if (dir == NULL) {
+            dprintf("Spike: %S:%u: Unknown directive \"%.*s\", skipping\n",
+                    spike_file,
+                    line_no,
+                    (int) name_len,
+                    pos);
 
-        if (match == 1) {
-            spike_insert_jmp((ptrdiff_t) rva, spike_fn_vprintf);
+            continue;
         }
 
-        match = sscanf(line, "j_vwprintf %i", &rva);
+        if (m->npatches == max_patches) {
+            max_patches = max_patches ? max_patches * 2 : 64;
+            new_mem = realloc(m->patches, max_patches * sizeof(*new_mem));
 
-        if (match == 1) {
-            spike_insert_jmp((ptrdiff_t) rva, spike_fn_vwprintf);
+            if (new_mem == NULL) {
+                hr = E_OUTOFMEMORY;
+
+                break;
+            }
+
+            m->patches = new_mem;
         }
 
-        match = sscanf(line, "j_printf %i", &rva);
+        patch = &m->patches[m->npatches];
+        patch->dir = dir;
+        patch->count = 1;
+
+        if (    !spike_parse_uint(&end, &patch->rva) ||
+                (dir->kind == SPIKE_LEVELS &&
+                 !spike_parse_uint(&end, &patch->count))) {
+            dprintf("Spike: %S:%u: Malformed %s directive, skipping\n",
+                    spike_file,
+                    line_no,
+                    dir->name);
 
-        if (match == 1) {
-            spike_insert_jmp((ptrdiff_t) rva, spike_fn_printf);
+            continue;
         }
 
-        match = sscanf(line, "j_puts %i", &rva);
+        switch (dir->kind) {
+        case SPIKE_JMP:     patch->nbytes = sizeof(uint32_t); break;
+        case SPIKE_PTR:     patch->nbytes = sizeof(void *); break;
+        case SPIKE_LEVELS:  patch->nbytes = patch->count * sizeof(uint32_t);
+                            break;
+        }
 
-        if (match == 1) {
-            spike_insert_jmp((ptrdiff_t) rva, spike_fn_puts);
+        if (    patch->count > image_size / sizeof(uint32_t) ||
+                patch->rva > image_size ||
+                patch->nbytes > image_size - patch->rva) {
+            dprintf("Spike: %S:%u: RVA %#x is outside the EXE image\n",
+                    spike_file,
+                    line_no,
+                    patch->rva);
+
+            continue;
         }
 
-        match = sscanf(line, "j_perror %i", &rva);
+        m->npatches++;
+    }
 
-        if (match == 1) {
-            spike_insert_jmp((ptrdiff_t) rva, spike_fn_perror);
+    fclose(f);
+
+    if (hr != S_OK) {
+        spike_manifest_fini(m);
+    }
+
+    return hr;
+}
+
+static int spike_patch_compare(const void *lhs, const void *rhs)
+{
+    const struct spike_patch *a;
+    const struct spike_patch *b;
+
+    a = lhs;
+    b = rhs;
+
+    return a->rva < b->rva ? -1 : a->rva > b->rva;
+}
+
+static void spike_manifest_apply(const struct spike_manifest *m)
+{
+    const struct spike_patch *patch;
+    SYSTEM_INFO si;
+    uintptr_t page_mask;
+    uintptr_t run_begin;
+    uintptr_t run_end;
+    uint8_t *base;
+    uint8_t *target;
+    size_t nruns;
+    size_t first;
+    size_t last;
+    size_t i;
+    DWORD old_prot;
+
+    assert(m != NULL);
+
+    /* Sort by RVA and group patches that share a page into runs, so that
+       each run costs one pair of VirtualProtect calls instead of every single
+       patch costing a pair of its own. Neighbouring pages are not merged just
+       for being adjacent, since they may belong to different sections and
+       restoring a run applies the old protection of its first page to all of
+       it. A patch that straddles a page boundary does extend its run into the
+       next page though, which then gets its first page's protection back. */
+
+    qsort(m->patches, m->npatches, sizeof(*m->patches), spike_patch_compare);
+
+    GetSystemInfo(&si);
+    page_mask = (uintptr_t) si.dwPageSize - 1;
+    base = (uint8_t *) GetModuleHandleW(NULL);
+    nruns = 0;
+
+    for (first = 0 ; first < m->npatches ; first = last) {
+        patch = &m->patches[first];
+        run_begin = ((uintptr_t) base + patch->rva) & ~page_mask;
+        run_end = ((uintptr_t) base + patch->rva + patch->nbytes + page_mask)
+                & ~page_mask;
+
+        for (last = first + 1 ; last < m->npatches ; last++) {
+            patch = &m->patches[last];
+
+            if ((uintptr_t) base + patch->rva >= run_end) {
+                break;
+            }
+
+            if ((uintptr_t) base + patch->rva + patch->nbytes > run_end) {
+                run_end = ((uintptr_t) base + patch->rva + patch->nbytes
+                        + page_mask) & ~page_mask;
+            }
         }
 
-        match = sscanf(line, "c_fputs %i", &rva); /* c == "callback" */
+        if (!VirtualProtect(
+                (void *) run_begin,
+                run_end - run_begin,
+                PAGE_EXECUTE_READWRITE,
+                &old_prot)) {
+            dprintf("Spike: VirtualProtect failed at RVA %#x: %08x\n",
+                    m->patches[first].rva,
+                    (unsigned int) GetLastError());
+
+            continue;
+        }
+
+        for (i = first ; i < last ; i++) {
+            patch = &m->patches[i];
+            target = base + patch->rva;
+
+            switch (patch->dir->kind) {
+            case SPIKE_JMP:
+                spike_insert_jmp(target, patch->dir->proc);
 
-        if (match == 1) {
-            spike_insert_ptr((ptrdiff_t) rva, spike_fn_fputs);
+                break;
+
+            case SPIKE_PTR:
+                spike_insert_ptr(target, patch->dir->proc);
+
+                break;
+
+            case SPIKE_LEVELS:
+                spike_insert_log_levels(target, patch->count);
+
+                break;
+            }
         }
+
+        VirtualProtect(
+                (void *) run_begin,
+                run_end - run_begin,
+                old_prot,
+                &old_prot);
+        FlushInstructionCache(
+                GetCurrentProcess(),
+                (void *) run_begin,
+                run_end - run_begin);
+
+        nruns++;
     }
 
-    dprintf("Spike insertion complete\n");
-    fclose(f);
+    dprintf("Spike insertion complete: %u patches across %u page runs\n",
+            (unsigned int) m->npatches,
+            (unsigned int) nruns);
+}
+
+static void spike_manifest_fini(struct spike_manifest *m)
+{
+    free(m->patches);
+    m->patches = NULL;
+    m->npatches = 0;
 }
@@ -2,4 +2,14 @@
 
 #include <stddef.h>
 
+/* Patches debug logging back into the host EXE, as configured by the [spike]
+   section of ini_file. Each key in that section is an EXE file name, and its
+   value is either a spike file or a directory containing several of them.
+
+   A spike file may begin with an "image TIMESTAMP CHECKSUM" line, giving the
+   PE header timestamp and checksum of the build it was written for. Spike
+   files for any other build are rejected without being applied. When a
+   directory is configured, the spike file whose image line matches the host
+   EXE is used, and spike files without an image line are ignored. */
+
 void spike_hook_init(const wchar_t *ini_file);
@@ -9,9 +9,13 @@
 
 #include "idzhook/config.h"
 
+#include "hooklib/config.h"
+
 #include "platform/config.h"
 #include "platform/platform.h"
 
+#include "util/config.h"
+
 void idz_hook_config_load(
         struct idz_hook_config *cfg,
         const wchar_t *filename)
@@ -23,6 +27,8 @@ void idz_hook_config_load(
     amex_config_load(&cfg->amex, filename);
     aime_config_load(&cfg->aime, filename);
     zinput_config_load(&cfg->zinput, filename);
+    dprintf_config_load(&cfg->dprintf, filename);
+    iostat_config_load(&cfg->iostat, filename);
 }
 
 void zinput_config_load(struct zinput_config *cfg, const wchar_t *filename)
@@ -9,13 +9,19 @@
 
 #include "idzhook/zinput.h"
 
+#include "hooklib/iostat.h"
+
 #include "platform/platform.h"
 
+#include "util/dprintf.h"
+
 struct idz_hook_config {
     struct platform_config platform;
     struct amex_config amex;
     struct aime_config aime;
     struct zinput_config zinput;
+    struct dprintf_config dprintf;
+    struct iostat_config iostat;
 };
 
 void idz_hook_config_load(
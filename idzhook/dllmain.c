@@ -10,6 +10,7 @@
 #include "hook/process.h"
 
 #include "hooklib/gfx.h"
+#include "hooklib/iostat.h"
 #include "hooklib/serial.h"
 #include "hooklib/spike.h"
 
@@ -34,6 +35,8 @@ static DWORD CALLBACK idz_pre_startup(void)
     /* Config load */
 
     idz_hook_config_load(&idz_hook_cfg, L".\\segatools.ini");
+    dprintf_init(&idz_hook_cfg.dprintf);
+    iostat_init(&idz_hook_cfg.iostat);
 
     /* Hook Win32 APIs */
 
@@ -9,10 +9,10 @@
 
 #include "jvs/jvs-frame.h"
 
+#include "util/bytestuff.h"
 #include "util/dprintf.h"
 
 static HRESULT jvs_frame_check_sum(const struct iobuf *dest);
-static HRESULT jvs_frame_encode_byte(struct iobuf *dest, uint8_t byte);
 
 /* Deals in whole frames only for simplicity's sake, since that's all we need
    to emulate the Nu's kernel driver interface. This could of course be
@@ -24,8 +24,7 @@ HRESULT jvs_frame_decode(
         size_t nbytes)
 {
     const uint8_t *bytes;
-    bool escape;
-    size_t i;
+    HRESULT hr;
 
     assert(dest != NULL);
     assert(ptr != NULL);
@@ -33,44 +32,28 @@ HRESULT jvs_frame_decode(
     bytes = ptr;
 
     if (nbytes == 0) {
-        dprintf("JVS Frame: Empty frame\n");
+        dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_ERROR,
+                "JVS Frame: Empty frame\n");
 
         return E_FAIL;
     }
 
     if (bytes[0] != 0xE0) {
-        dprintf("JVS Frame: Sync byte was expected\n");
+        dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_ERROR,
+                "JVS Frame: Sync byte was expected\n");
 
         return E_FAIL;
     }
 
-    escape = false;
-
-    for (i = 1 ; i < nbytes ; i++) {
-        if (bytes[i] == 0xE0) {
-            dprintf("JVS Frame: Unexpected sync byte\n");
-
-            return E_FAIL;
-        } else if (bytes[i] == 0xD0) {
-            if (escape) {
-                dprintf("JVS Frame: Escaping fault\n");
-
-                return E_FAIL;
-            }
-
-            escape = true;
-        } else {
-            if (dest->pos >= dest->nbytes) {
-                return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
-            }
-
-            if (escape) {
-                escape = false;
-                dest->bytes[dest->pos++] = bytes[i] + 1;
-            } else {
-                dest->bytes[dest->pos++] = bytes[i];
-            }
-        }
+    hr = bytestuff_decode(dest, &bytes[1], nbytes - 1, 0xE0, 0xD0);
+
+    if (hr == E_FAIL) {
+        dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_ERROR,
+                "JVS Frame: Unexpected sync byte or escaping fault\n");
+    }
+
+    if (FAILED(hr)) {
+        return hr;
     }
 
     return jvs_frame_check_sum(dest);
@@ -79,16 +62,19 @@ HRESULT jvs_frame_decode(
 static HRESULT jvs_frame_check_sum(const struct iobuf *dest)
 {
     uint8_t checksum;
-    size_t i;
 
-    checksum = 0;
+    if (dest->pos == 0) {
+        dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_ERROR,
+                "JVS Frame: Checksum missing\n");
 
-    for (i = 0 ; i < dest->pos - 1 ; i++) {
-        checksum += dest->bytes[i];
+        return E_FAIL;
     }
 
+    checksum = bytestuff_sum(dest->bytes, dest->pos - 1);
+
     if (checksum != dest->bytes[dest->pos - 1]) {
-        dprintf("JVS Frame: Checksum failure\n");
+        dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_ERROR,
+                "JVS Frame: Checksum failure\n");
 
         return HRESULT_FROM_WIN32(ERROR_CRC);
     }
@@ -101,52 +87,24 @@ HRESULT jvs_frame_encode(
         const void *ptr,
         size_t nbytes)
 {
-    const uint8_t *bytes;
     uint8_t checksum;
-    size_t i;
     HRESULT hr;
 
     assert(dest != NULL);
     assert(ptr != NULL);
 
-    bytes = ptr;
-    checksum = 0;
-
     if (dest->pos + 1 > dest->nbytes) {
         return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
     }
 
     dest->bytes[dest->pos++] = 0xE0;
+    checksum = bytestuff_sum(ptr, nbytes);
 
-    for (i = 0 ; i < nbytes ; i++) {
-        hr = jvs_frame_encode_byte(dest, bytes[i]);
-
-        if (FAILED(hr)) {
-            return hr;
-        }
-
-        checksum += bytes[i];
-    }
-
-    return jvs_frame_encode_byte(dest, checksum);
-}
+    hr = bytestuff_encode(dest, ptr, nbytes, 0xE0, 0xD0);
 
-static HRESULT jvs_frame_encode_byte(struct iobuf *dest, uint8_t byte)
-{
-    if (byte == 0xD0 || byte == 0xE0) {
-        if (dest->pos + 2 > dest->nbytes) {
-            return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
-        }
-
-        dest->bytes[dest->pos++] = 0xD0;
-        dest->bytes[dest->pos++] = byte - 1;
-    } else {
-        if (dest->pos + 1 > dest->nbytes) {
-            return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
-        }
-
-        dest->bytes[dest->pos++] = byte;
+    if (FAILED(hr)) {
+        return hr;
     }
 
-    return S_OK;
+    return bytestuff_encode(dest, &checksum, sizeof(checksum), 0xE0, 0xD0);
 }
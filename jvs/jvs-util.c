@@ -10,6 +10,7 @@
 #include "jvs/jvs-util.h"
 
 #include "util/dprintf.h"
+#include "util/dump.h"
 
 typedef HRESULT (*jvs_dispatch_fn_t)(
         void *ctx,
@@ -46,10 +47,10 @@ void jvs_crack_request(
         return;
     }
 
-#if 0
-    dprintf("Decoded request:\n");
-    dump_iobuf(&decode);
-#endif
+    if (dprintf_enabled(DPRINTF_CAT_JVS, DPRINTF_LEVEL_TRACE)) {
+        dprintf("Decoded request:\n");
+        dump_iobuf(&decode);
+    }
 
     if (req_bytes[0] != jvs_addr && req_bytes[0] != 0xFF) {
         return;
@@ -96,14 +97,15 @@ void jvs_crack_request(
         resp_bytes[2] = 0x01;   /* Status: Success */
     }
 
-#if 0
-    dprintf("Encoding response:\n");
-    dump_iobuf(&encode);
-#endif
+    if (dprintf_enabled(DPRINTF_CAT_JVS, DPRINTF_LEVEL_TRACE)) {
+        dprintf("Encoding response:\n");
+        dump_iobuf(&encode);
+    }
 
     hr = jvs_frame_encode(resp, encode.bytes, encode.pos);
 
     if (FAILED(hr)) {
-        dprintf("JVS Node: Response encode error: %x\n", (int) hr);
+        dprintfc(DPRINTF_CAT_JVS, DPRINTF_LEVEL_ERROR,
+                "JVS Node: Response encode error: %x\n", (int) hr);
     }
 }
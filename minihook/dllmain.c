@@ -11,6 +11,7 @@
 #include "platform/config.h"
 #include "platform/nusec.h"
 
+#include "util/config.h"
 #include "util/dprintf.h"
 
 static process_entry_t app_startup;
@@ -18,16 +19,19 @@ static process_entry_t app_startup;
 static DWORD CALLBACK app_pre_startup(void)
 {
     struct clock_config clock_cfg;
+    struct dprintf_config dprintf_cfg;
     struct ds_config ds_cfg;
     struct nusec_config nusec_cfg;
 
     dprintf("--- Begin %s ---\n", __func__);
 
     clock_config_load(&clock_cfg, L".\\segatools.ini");
+    dprintf_config_load(&dprintf_cfg, L".\\segatools.ini");
     ds_config_load(&ds_cfg, L".\\segatools.ini");
     nusec_config_load(&nusec_cfg, L".\\segatools.ini");
     spike_hook_init(L".\\segatools.ini");
 
+    dprintf_init(&dprintf_cfg);
     clock_hook_init(&clock_cfg);
     nusec_hook_init(&nusec_cfg, "SSSS", "AAV0");
     ds_hook_init(&ds_cfg);
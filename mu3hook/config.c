@@ -10,6 +10,8 @@
 
 #include "platform/config.h"
 
+#include "util/config.h"
+
 void mu3_hook_config_load(
         struct mu3_hook_config *cfg,
         const wchar_t *filename)
@@ -20,4 +22,6 @@ void mu3_hook_config_load(
     platform_config_load(&cfg->platform, filename);
     aime_config_load(&cfg->aime, filename);
     gfx_config_load(&cfg->gfx, filename);
+    dprintf_config_load(&cfg->dprintf, filename);
+    iostat_config_load(&cfg->iostat, filename);
 }
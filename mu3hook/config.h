@@ -5,13 +5,18 @@
 #include "board/config.h"
 
 #include "hooklib/gfx.h"
+#include "hooklib/iostat.h"
 
 #include "platform/config.h"
 
+#include "util/dprintf.h"
+
 struct mu3_hook_config {
     struct platform_config platform;
     struct aime_config aime;
     struct gfx_config gfx;
+    struct dprintf_config dprintf;
+    struct iostat_config iostat;
 };
 
 void mu3_hook_config_load(
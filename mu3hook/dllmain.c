@@ -6,6 +6,7 @@
 
 #include "hook/process.h"
 
+#include "hooklib/iostat.h"
 #include "hooklib/serial.h"
 #include "hooklib/spike.h"
 
@@ -30,6 +31,8 @@ static DWORD CALLBACK mu3_pre_startup(void)
     /* Load config */
 
     mu3_hook_config_load(&mu3_hook_cfg, L".\\segatools.ini");
+    dprintf_init(&mu3_hook_cfg.dprintf);
+    iostat_init(&mu3_hook_cfg.iostat);
 
     /* Hook Win32 APIs */
 
@@ -33,6 +33,7 @@ static const struct reg_hook_val amvideo_reg_vals[] = {
         .name       = L"name",
         .read       = amvideo_reg_read_name,
         .type       = REG_SZ,
+        .flags      = REG_HOOK_VAL_IMMUTABLE,
     }
 };
 
@@ -41,50 +42,62 @@ static const struct reg_hook_val amvideo_reg_mode_vals[] = {
         .name       = L"monitor_setting_1",
         .read       = amvideo_reg_read_setting,
         .type       = REG_SZ,
+        .flags      = REG_HOOK_VAL_IMMUTABLE,
     }, {
         .name       = L"monitor_setting_2",
         .read       = amvideo_reg_read_setting,
         .type       = REG_SZ,
+        .flags      = REG_HOOK_VAL_IMMUTABLE,
     }, {
         .name       = L"port_1",
         .read       = amvideo_reg_read_port_X,
-        .type       = REG_DWORD
+        .type       = REG_DWORD,
+        .flags      = REG_HOOK_VAL_IMMUTABLE,
     }, {
         .name       = L"port_2",
         .read       = amvideo_reg_read_port_X,
-        .type       = REG_DWORD
+        .type       = REG_DWORD,
+        .flags      = REG_HOOK_VAL_IMMUTABLE,
     }, {
         .name       = L"port_3",
         .read       = amvideo_reg_read_port_X,
-        .type       = REG_DWORD
+        .type       = REG_DWORD,
+        .flags      = REG_HOOK_VAL_IMMUTABLE,
     }, {
         .name       = L"port_4",
         .read       = amvideo_reg_read_port_X,
-        .type       = REG_DWORD
+        .type       = REG_DWORD,
+        .flags      = REG_HOOK_VAL_IMMUTABLE,
     }, {
         .name       = L"port_5",
         .read       = amvideo_reg_read_port_X,
-        .type       = REG_DWORD
+        .type       = REG_DWORD,
+        .flags      = REG_HOOK_VAL_IMMUTABLE,
     }, {
         .name       = L"port_6",
         .read       = amvideo_reg_read_port_X,
-        .type       = REG_DWORD
+        .type       = REG_DWORD,
+        .flags      = REG_HOOK_VAL_IMMUTABLE,
     }, {
         .name       = L"port_7",
         .read       = amvideo_reg_read_port_X,
-        .type       = REG_DWORD
+        .type       = REG_DWORD,
+        .flags      = REG_HOOK_VAL_IMMUTABLE,
     }, {
         .name       = L"port_8",
         .read       = amvideo_reg_read_port_X,
-        .type       = REG_DWORD
+        .type       = REG_DWORD,
+        .flags      = REG_HOOK_VAL_IMMUTABLE,
     }, {
         .name       = L"resolution_1",
         .read       = amvideo_reg_read_resolution_1,
         .type       = REG_SZ,
+        .flags      = REG_HOOK_VAL_IMMUTABLE,
     }, {
         .name       = L"use_segatiming",
         .read       = amvideo_reg_read_use_segatiming,
         .type       = REG_DWORD,
+        .flags      = REG_HOOK_VAL_IMMUTABLE,
     }
 };
 
@@ -104,7 +104,8 @@ static void WINAPI my_GetSystemTimeAsFileTime(FILETIME *out)
     /* Debug log */
 
     if (clock_current_day != 0 && clock_current_day != day) {
-        dprintf("\n*** CLOCK JUMP! ***\n\n");
+        dprintfc(DPRINTF_CAT_CLOCK, DPRINTF_LEVEL_INFO,
+                "\n*** CLOCK JUMP! ***\n\n");
     }
 
     clock_current_day = day;
@@ -158,28 +159,29 @@ static BOOL WINAPI my_GetSystemTime(SYSTEMTIME *out)
         return ok;
     }
 
-#if 0
-    static int last_second;
-
-    if (out->wSecond != last_second) {
-        dprintf("%04i/%02i/%02i %02i:%02i:%02i\n",
-                out->wYear,
-                out->wMonth,
-                out->wDay,
-                out->wHour,
-                out->wMinute,
-                out->wSecond);
-    }
+    if (dprintf_enabled(DPRINTF_CAT_CLOCK, DPRINTF_LEVEL_TRACE)) {
+        static int last_second;
+
+        if (out->wSecond != last_second) {
+            dprintf("%04i/%02i/%02i %02i:%02i:%02i\n",
+                    out->wYear,
+                    out->wMonth,
+                    out->wDay,
+                    out->wHour,
+                    out->wMinute,
+                    out->wSecond);
+        }
 
-    last_second = out->wSecond;
-#endif
+        last_second = out->wSecond;
+    }
 
     return TRUE;
 }
 
 static DWORD WINAPI my_GetTimeZoneInformation(TIME_ZONE_INFORMATION *tzinfo)
 {
-    dprintf("Clock: Returning JST timezone\n");
+    dprintfc(DPRINTF_CAT_CLOCK, DPRINTF_LEVEL_INFO,
+            "Clock: Returning JST timezone\n");
 
     if (tzinfo == NULL) {
         SetLastError(ERROR_INVALID_PARAMETER);
@@ -202,21 +204,24 @@ static DWORD WINAPI my_GetTimeZoneInformation(TIME_ZONE_INFORMATION *tzinfo)
 
 static BOOL WINAPI my_SetLocalTime(SYSTEMTIME *in)
 {
-    dprintf("Clock: Blocked local time update\n");
+    dprintfc(DPRINTF_CAT_CLOCK, DPRINTF_LEVEL_INFO,
+            "Clock: Blocked local time update\n");
 
     return TRUE;
 }
 
 static BOOL WINAPI my_SetSystemTime(SYSTEMTIME *in)
 {
-    dprintf("Clock: Blocked system time update\n");
+    dprintfc(DPRINTF_CAT_CLOCK, DPRINTF_LEVEL_INFO,
+            "Clock: Blocked system time update\n");
 
     return TRUE;
 }
 
 static BOOL WINAPI my_SetTimeZoneInformation(TIME_ZONE_INFORMATION *in)
 {
-    dprintf("Clock: Blocked timezone update\n");
+    dprintfc(DPRINTF_CAT_CLOCK, DPRINTF_LEVEL_INFO,
+            "Clock: Blocked timezone update\n");
 
     return TRUE;
 }
@@ -9,6 +9,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "hooklib/config.h"
+
 #include "platform/amvideo.h"
 #include "platform/clock.h"
 #include "platform/config.h"
@@ -32,6 +34,7 @@ void platform_config_load(struct platform_config *cfg, const wchar_t *filename)
     hwmon_config_load(&cfg->hwmon, filename);
     misc_config_load(&cfg->misc, filename);
     pcbid_config_load(&cfg->pcbid, filename);
+    regfile_config_load(&cfg->reg, filename);
     netenv_config_load(&cfg->netenv, filename);
     nusec_config_load(&cfg->nusec, filename);
     vfs_config_load(&cfg->vfs, filename);
@@ -5,6 +5,8 @@
 
 #include "hook/iohook.h"
 
+#include "hooklib/iostat.h"
+
 #include "platform/hwmon.h"
 
 #include "util/dprintf.h"
@@ -39,7 +41,7 @@ HRESULT hwmon_hook_init(const struct hwmon_config *cfg)
         return hr;
     }
 
-    hr = iohook_push_handler(hwmon_handle_irp);
+    hr = iostat_push_handler("hwmon", hwmon_handle_irp);
 
     if (FAILED(hr)) {
         return hr;
@@ -20,6 +20,7 @@ static const struct reg_hook_val misc_root_keys[] = {
         .name   = L"OSVersion",
         .read   = misc_read_os_version,
         .type   = REG_SZ,
+        .flags  = REG_HOOK_VAL_IMMUTABLE,
     }
 };
 
@@ -28,6 +29,7 @@ static const struct reg_hook_val misc_master_keys[] = {
         .name   = L"AppLoaderCount",
         .read   = misc_read_app_loader_count,
         .type   = REG_DWORD,
+        .flags  = REG_HOOK_VAL_IMMUTABLE,
     }, {
         /* Black-hole val, list it here so we don't get a warning msg */
         .name   = L"NextProcess",
@@ -44,14 +46,17 @@ static const struct reg_hook_val misc_static_keys[] = {
         .name   = L"CpuTempError",
         .read   = misc_read_cpu_temp_error,
         .type   = REG_DWORD,
+        .flags  = REG_HOOK_VAL_IMMUTABLE,
     }, {
         .name   = L"CpuTempWarning",
         .read   = misc_read_cpu_temp_warning,
         .type   = REG_DWORD,
+        .flags  = REG_HOOK_VAL_IMMUTABLE,
     }, {
         .name   = L"PlatformId",
         .read   = misc_read_platform_id,
         .type   = REG_SZ,
+        .flags  = REG_HOOK_VAL_IMMUTABLE,
     }
 };
 
@@ -5,6 +5,7 @@
 
 #include "hook/iohook.h"
 
+#include "hooklib/iostat.h"
 #include "hooklib/reg.h"
 
 #include "platform/nusec.h"
@@ -70,34 +71,42 @@ static const struct reg_hook_val nusec_reg_vals[] = {
         .name   = L"gameId",
         .read   = nusec_reg_read_game_id,
         .type   = REG_BINARY,
+        .flags  = REG_HOOK_VAL_IMMUTABLE,
     }, {
         .name   = L"keychipId",
         .read   = nusec_reg_read_keychip_id,
         .type   = REG_BINARY,
+        .flags  = REG_HOOK_VAL_IMMUTABLE,
     }, {
         .name   = L"modelType",
         .read   = nusec_reg_read_model_type,
         .type   = REG_DWORD,
+        .flags  = REG_HOOK_VAL_IMMUTABLE,
     }, {
         .name   = L"platformId",
         .read   = nusec_reg_read_platform_id,
         .type   = REG_BINARY,
+        .flags  = REG_HOOK_VAL_IMMUTABLE,
     }, {
         .name   = L"region",
         .read   = nusec_reg_read_region,
         .type   = REG_DWORD,
+        .flags  = REG_HOOK_VAL_IMMUTABLE,
     }, {
         .name   = L"serverIpIpv4",
         .read   = nusec_reg_read_server_ip_ipv4,
         .type   = REG_BINARY,
+        .flags  = REG_HOOK_VAL_IMMUTABLE,
     }, {
         .name   = L"serverIpIpv6",
         .read   = nusec_reg_read_server_ip_ipv6,
         .type   = REG_BINARY,
+        .flags  = REG_HOOK_VAL_IMMUTABLE,
     }, {
         .name   = L"systemFlag",
         .read   = nusec_reg_read_system_flag,
         .type   = REG_DWORD,
+        .flags  = REG_HOOK_VAL_IMMUTABLE,
     }
 };
 
@@ -145,7 +154,7 @@ HRESULT nusec_hook_init(
         return hr;
     }
 
-    hr = iohook_push_handler(nusec_handle_irp);
+    hr = iostat_push_handler("nusec", nusec_handle_irp);
 
     if (FAILED(hr)) {
         return hr;
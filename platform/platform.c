@@ -2,6 +2,8 @@
 
 #include <assert.h>
 
+#include "hooklib/regfile.h"
+
 #include "platform/amvideo.h"
 #include "platform/clock.h"
 #include "platform/dns.h"
@@ -26,6 +28,12 @@ HRESULT platform_hook_init(
     assert(platform_id != NULL);
     assert(redir_mod != NULL);
 
+    hr = regfile_hook_init(&cfg->reg);
+
+    if (FAILED(hr)) {
+        return hr;
+    }
+
     hr = amvideo_hook_init(&cfg->amvideo, redir_mod);
 
     if (FAILED(hr)) {
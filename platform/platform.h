@@ -2,6 +2,8 @@
 
 #include <windows.h>
 
+#include "hooklib/regfile.h"
+
 #include "platform/amvideo.h"
 #include "platform/clock.h"
 #include "platform/dns.h"
@@ -19,6 +21,7 @@ struct platform_config {
     struct hwmon_config hwmon;
     struct misc_config misc;
     struct pcbid_config pcbid;
+    struct regfile_config reg;
     struct netenv_config netenv;
     struct nusec_config nusec;
     struct vfs_config vfs;
@@ -15,34 +15,24 @@
 
 static void vfs_fixup_path(wchar_t *path, size_t max_count);
 static HRESULT vfs_mkdir_rec(const wchar_t *path);
-static HRESULT vfs_path_hook(const wchar_t *src, wchar_t *dest, size_t *count);
-static HRESULT vfs_path_hook_nthome(
-        const wchar_t *src,
-        wchar_t *dest,
-        size_t *count);
-static HRESULT vfs_path_hook_option(
-        const wchar_t *src,
-        wchar_t *dest,
-        size_t *count);
 static HRESULT vfs_reg_read_amfs(void *bytes, uint32_t *nbytes);
 static HRESULT vfs_reg_read_appdata(void *bytes, uint32_t *nbytes);
 
 static wchar_t vfs_nthome_real[MAX_PATH];
 static const wchar_t vfs_nthome[] = L"C:\\Documents and Settings\\AppUser";
-static const size_t vfs_nthome_len = _countof(vfs_nthome) - 1;
-
 static const wchar_t vfs_option[] = L"C:\\Mount\\Option";
-static const size_t vfs_option_len = _countof(vfs_option) - 1;
 
 static const struct reg_hook_val vfs_reg_vals[] = {
     {
         .name   = L"AMFS",
         .read   = vfs_reg_read_amfs,
         .type   = REG_SZ,
+        .flags  = REG_HOOK_VAL_IMMUTABLE,
     }, {
         .name   = L"APPDATA",
         .read   = vfs_reg_read_appdata,
-        .type   = REG_SZ
+        .type   = REG_SZ,
+        .flags  = REG_HOOK_VAL_IMMUTABLE,
     },
 };
 
@@ -62,19 +52,22 @@ HRESULT vfs_hook_init(const struct vfs_config *config)
     }
 
     if (config->amfs[0] == L'\0') {
-        dprintf("Vfs: FATAL: AMFS path not specified in INI file\n");
+        dprintfc(DPRINTF_CAT_VFS, DPRINTF_LEVEL_ERROR,
+                "Vfs: FATAL: AMFS path not specified in INI file\n");
 
         return E_FAIL;
     }
 
     if (config->appdata[0] == L'\0') {
-        dprintf("Vfs: FATAL: APPDATA path not specified in INI file\n");
+        dprintfc(DPRINTF_CAT_VFS, DPRINTF_LEVEL_ERROR,
+                "Vfs: FATAL: APPDATA path not specified in INI file\n");
 
         return E_FAIL;
     }
 
     if (config->option[0] == L'\0') {
-        dprintf("Vfs: WARNING: OPTION path not specified in INI file\n");
+        dprintfc(DPRINTF_CAT_VFS, DPRINTF_LEVEL_ERROR,
+                "Vfs: WARNING: OPTION path not specified in INI file\n");
     }
 
     home_ok = GetEnvironmentVariableW(
@@ -84,7 +77,8 @@ HRESULT vfs_hook_init(const struct vfs_config *config)
 
     if (!home_ok) {
         hr = HRESULT_FROM_WIN32(GetLastError());
-        dprintf("Vfs: Failed to query %%USERPROFILE%% env var: %x\n",
+        dprintfc(DPRINTF_CAT_VFS, DPRINTF_LEVEL_ERROR,
+                "Vfs: Failed to query %%USERPROFILE%% env var: %x\n",
                 (int) hr);
 
         return hr;
@@ -103,7 +97,8 @@ HRESULT vfs_hook_init(const struct vfs_config *config)
     hr = vfs_mkdir_rec(vfs_config.amfs);
 
     if (FAILED(hr)) {
-        dprintf("Vfs: Failed to create AMFS dir %S: %x\n",
+        dprintfc(DPRINTF_CAT_VFS, DPRINTF_LEVEL_ERROR,
+                "Vfs: Failed to create AMFS dir %S: %x\n",
                 config->amfs,
                 (int) hr);
     }
@@ -111,11 +106,13 @@ HRESULT vfs_hook_init(const struct vfs_config *config)
     hr = vfs_mkdir_rec(vfs_config.appdata);
 
     if (FAILED(hr)) {
-        dprintf("Vfs: Failed to create APPDATA dir %S: %x\n",
+        dprintfc(DPRINTF_CAT_VFS, DPRINTF_LEVEL_ERROR,
+                "Vfs: Failed to create APPDATA dir %S: %x\n",
                 config->appdata,
                 (int) hr);
 
-        dprintf("Vfs: NOTE: SEGA Y: drive APPDATA, not Windows %%APPDATA%%.\n");
+        dprintfc(DPRINTF_CAT_VFS, DPRINTF_LEVEL_INFO,
+                "Vfs: NOTE: SEGA Y: drive APPDATA, not Windows %%APPDATA%%.\n");
     }
 
     /* Need to create the temp subdirectory, not just nthome itself */
@@ -127,25 +124,32 @@ HRESULT vfs_hook_init(const struct vfs_config *config)
     hr = vfs_mkdir_rec(temp);
 
     if (FAILED(hr)) {
-        dprintf("Vfs: Failed to create %S: %x\n", temp, (int) hr);
+        dprintfc(DPRINTF_CAT_VFS, DPRINTF_LEVEL_ERROR,
+                "Vfs: Failed to create %S: %x\n", temp, (int) hr);
     }
 
     /* Not auto-creating option directory as it is normally a read-only mount */
 
-    hr = path_hook_push(vfs_path_hook);
+    hr = path_mount_push(L"E:\\", vfs_config.amfs);
+
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    hr = path_mount_push(L"Y:\\", vfs_config.appdata);
 
     if (FAILED(hr)) {
         return hr;
     }
 
-    hr = path_hook_push(vfs_path_hook_nthome);
+    hr = path_mount_push(vfs_nthome, vfs_nthome_real);
 
     if (FAILED(hr)) {
         return hr;
     }
 
     if (vfs_config.option[0] != L'\0') {
-        hr = path_hook_push(vfs_path_hook_option);
+        hr = path_mount_push(vfs_option, vfs_config.option);
 
         if (FAILED(hr)) {
             return hr;
@@ -203,7 +207,8 @@ static void vfs_fixup_path(wchar_t *path, size_t max_count)
     return;
 
 fail:
-    dprintf("Vfs: FATAL: Path too long: %S\n", path);
+    dprintfc(DPRINTF_CAT_VFS, DPRINTF_LEVEL_ERROR,
+            "Vfs: FATAL: Path too long: %S\n", path);
     abort();
 }
 
@@ -259,149 +264,6 @@ end:
     return hr;
 }
 
-static HRESULT vfs_path_hook(const wchar_t *src, wchar_t *dest, size_t *count)
-{
-    const wchar_t *redir;
-    size_t required;
-    size_t redir_len;
-
-    assert(src != NULL);
-    assert(count != NULL);
-
-    if (src[0] == L'\0' || src[1] != L':' || !path_is_separator_w(src[2])) {
-        return S_FALSE;
-    }
-
-    switch (src[0]) {
-    case L'e':
-    case L'E':
-        redir = vfs_config.amfs;
-
-        break;
-
-    case L'y':
-    case L'Y':
-        redir = vfs_config.appdata;
-
-        break;
-
-    default:
-        return S_FALSE;
-    }
-
-    /* Cut off <prefix>\, replace with redir path, count NUL terminator */
-
-    redir_len = wcslen(redir);
-    required = wcslen(src) - 3 + redir_len + 1;
-
-    if (dest != NULL) {
-        if (required > *count) {
-            return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
-        }
-
-        wcscpy_s(dest, *count, redir);
-        wcscpy_s(dest + redir_len, *count - redir_len, src + 3);
-    }
-
-    *count = required;
-
-    return S_OK;
-}
-
-static HRESULT vfs_path_hook_nthome(
-        const wchar_t *src,
-        wchar_t *dest,
-        size_t *count)
-{
-    size_t required;
-    size_t redir_len;
-    size_t shift;
-
-    assert(src != NULL);
-    assert(count != NULL);
-
-    /* Case-insensitive check to see if src starts with vfs_nthome */
-
-    if (path_compare_w(src, vfs_nthome, vfs_nthome_len) != 0) {
-        return S_FALSE;
-    }
-
-    /* Check if the character after vfs_nthome is a separator or the end of
-       the string */
-
-    if (!path_is_separator_w(src[vfs_nthome_len]) &&
-            src[vfs_nthome_len] != L'\0')
-    {
-        return S_FALSE;
-    }
-
-    /* Cut off the matched <prefix>\, add the replaced prefix, count NUL */
-
-    shift = path_is_separator_w(src[vfs_nthome_len]) ? 1 : 0;
-    redir_len = wcslen(vfs_nthome_real);
-    required = wcslen(src) - vfs_nthome_len - shift + redir_len + 1;
-
-    if (dest != NULL) {
-        if (required > *count) {
-            return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
-        }
-
-        wcscpy_s(dest, *count, vfs_nthome_real);
-        wcscpy_s(dest + redir_len, *count - redir_len, src + vfs_nthome_len + shift);
-    }
-
-    *count = required;
-
-    return S_OK;
-}
-
-static HRESULT vfs_path_hook_option(
-        const wchar_t *src,
-        wchar_t *dest,
-        size_t *count)
-{
-    size_t required;
-    size_t redir_len;
-    size_t shift;
-
-    assert(src != NULL);
-    assert(count != NULL);
-
-    /* Case-insensitive check to see if src starts with vfs_option */
-
-    if (path_compare_w(src, vfs_option, vfs_option_len) != 0) {
-        return S_FALSE;
-    }
-
-    /* Check if the character after vfs_nthome is a separator or the end of
-       the string */
-
-    if (!path_is_separator_w(src[vfs_option_len]) &&
-            src[vfs_option_len] != L'\0')
-    {
-        return S_FALSE;
-    }
-
-    /* Cut off the matched <prefix>\, add the replaced prefix, count NUL */
-
-    shift = path_is_separator_w(src[vfs_option_len]) ? 1 : 0;
-    redir_len = wcslen(vfs_config.option);
-    required = wcslen(src) - vfs_option_len - shift + redir_len + 1;
-
-    if (dest != NULL) {
-        if (required > *count) {
-            return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
-        }
-
-        wcscpy_s(dest, *count, vfs_config.option);
-        wcscpy_s(dest + redir_len, *count - redir_len, src + vfs_option_len + shift);
-    }
-
-    *count = required;
-
-    return S_OK;
-}
-
 static HRESULT vfs_reg_read_amfs(void *bytes, uint32_t *nbytes)
 {
     return reg_hook_read_wstr(bytes, nbytes, vfs_config.amfs);
@@ -0,0 +1,1107 @@
+/* Feeds an FdShark capture (see hooklib/fdshark-cap.h) of one of the emulated
+   boards back through the emulator code that answered it, reports every
+   response that now comes out differently, and measures how quickly the
+   emulator gets through the whole thing.
+
+   Usage: replay <jvs|sg|slider|io4> <capture file> [passes]
+
+   jvs     JVS ioctls go to jvs_bus_transact() with an IO3 on the bus
+   sg      SG reader UART writes are deframed and go to sg_nfc_transact()
+           and sg_led_transact()
+   slider  Chunithm slider UART traffic goes to the slider IRP handler, which
+           deframes it with slider_frame_decode() and dispatches it
+   io4     IO4 HID traffic goes to the IO4 IRP handler, which builds the IN
+           reports
+
+   The capture must have been taken with reads and writes traced (and ioctls
+   for jvs and io4). Only the first pass is checked against the capture, any
+   further passes just add to the timings. The inputs that the emulators
+   report are idle throughout, apart from slider and IO4 input reports, which
+   are lifted from the capture. Record with hands off the controls to get a
+   clean diff of everything else.
+
+   This is a tool for the build machine rather than for the cabinet. It is
+   compiled against the Win32 stand-ins in replay/shim, see meson.build. */
+
+#include <windows.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "board/io3.h"
+#include "board/io4.h"
+#include "board/sg-frame.h"
+#include "board/sg-led.h"
+#include "board/sg-nfc.h"
+#include "board/slider-cmd.h"
+#include "board/slider-frame.h"
+
+#include "chunihook/slider.h"
+
+#include "chuniio/chuniio.h"
+
+#include "fdsharkdump/cap.h"
+
+#include "hook/iobuf.h"
+#include "hook/iohook.h"
+
+#include "hooklib/fdshark-cap.h"
+
+#include "jvs/jvs-bus.h"
+
+#include "replay/stubs.h"
+
+#include "util/dump.h"
+
+/* These are private to amex/jvs.c */
+
+enum {
+    REPLAY_JVS_IOCTL_SENSE      = 0x8000600C,
+    REPLAY_JVS_IOCTL_TRANSACT   = 0x8000E008,
+};
+
+enum {
+    REPLAY_BUF_SIZE     = 4096,
+    REPLAY_MAX_DIFFS    = 10,
+    REPLAY_IO4_REPORT   = 0x40,
+};
+
+/* One IRP, pieced together from its submit and completion records */
+
+struct replay_xact {
+    uint8_t kind;
+    bool complete;
+    uint32_t thread;
+    uint32_t ioctl;
+    uint32_t read_nbytes;
+    HRESULT hr;
+    uint8_t *req;
+    size_t req_nbytes;
+    uint8_t *res;
+    size_t res_nbytes;
+};
+
+struct replay_device {
+    const char *name;
+    void (*init)(void);
+    void (*begin)(void);
+    void (*xact)(size_t index, const struct replay_xact *x, bool check);
+    void (*end)(bool check);
+};
+
+struct replay_range {
+    size_t index;
+    size_t start;
+    size_t end;
+};
+
+struct replay_scan {
+    size_t off;
+    uint8_t pressure[32];
+};
+
+static bool replay_load(void);
+static uint8_t *replay_payload(
+        int64_t off,
+        const struct fdshark_cap_record *rec);
+static struct replay_xact *replay_find_submit(
+        const struct fdshark_cap_record *rec);
+static int64_t replay_clock(void);
+static void replay_time(int64_t start);
+static bool replay_hr_known(HRESULT hr);
+static void replay_diff(
+        size_t index,
+        const char *what,
+        const uint8_t *expected,
+        size_t expected_nbytes,
+        const uint8_t *actual,
+        size_t actual_nbytes);
+static void replay_dump(const uint8_t *bytes, size_t nbytes);
+static void replay_report(unsigned int passes);
+static int replay_cmp_ticks(const void *a, const void *b);
+
+static void replay_jvs_read_switches(
+        void *ctx,
+        struct io3_switch_state *out);
+static void replay_jvs_begin(void);
+static void replay_jvs_xact(
+        size_t index,
+        const struct replay_xact *x,
+        bool check);
+
+static HRESULT replay_sg_nfc_poll(void *ctx);
+static void replay_sg_led_set_color(void *ctx, uint8_t r, uint8_t g, uint8_t b);
+static void replay_sg_begin(void);
+static void replay_sg_xact(
+        size_t index,
+        const struct replay_xact *x,
+        bool check);
+static void replay_sg_end(bool check);
+
+static void replay_slider_init(void);
+static void replay_slider_begin(void);
+static void replay_slider_xact(
+        size_t index,
+        const struct replay_xact *x,
+        bool check);
+
+static HRESULT replay_io4_poll(void *ctx, struct io4_state *state);
+static void replay_io4_begin(void);
+static void replay_io4_xact(
+        size_t index,
+        const struct replay_xact *x,
+        bool check);
+
+static const struct replay_device replay_devices[] = {
+    {
+        .name   = "jvs",
+        .begin  = replay_jvs_begin,
+        .xact   = replay_jvs_xact,
+    }, {
+        .name   = "sg",
+        .begin  = replay_sg_begin,
+        .xact   = replay_sg_xact,
+        .end    = replay_sg_end,
+    }, {
+        .name   = "slider",
+        .init   = replay_slider_init,
+        .begin  = replay_slider_begin,
+        .xact   = replay_slider_xact,
+    }, {
+        .name   = "io4",
+        .begin  = replay_io4_begin,
+        .xact   = replay_io4_xact,
+    },
+};
+
+static const struct io3_ops replay_io3_ops = {
+    .read_switches  = replay_jvs_read_switches,
+};
+
+static const struct sg_nfc_ops replay_sg_nfc_ops = {
+    .poll           = replay_sg_nfc_poll,
+};
+
+static const struct sg_led_ops replay_sg_led_ops = {
+    .set_color      = replay_sg_led_set_color,
+};
+
+static const struct io4_ops replay_io4_ops = {
+    .poll           = replay_io4_poll,
+};
+
+static wchar_t replay_path[FDSHARK_CAP_PATH_MAX];
+static int64_t replay_freq;
+
+static struct replay_xact *replay_xacts;
+static size_t replay_nxacts;
+
+/* Everything that was read back from a UART, in one piece */
+
+static uint8_t *replay_rx;
+static size_t replay_rx_nbytes;
+
+static int64_t *replay_ticks;
+static size_t replay_nticks;
+static size_t replay_max_ticks;
+static size_t replay_nchecked;
+static size_t replay_nmismatches;
+
+static struct io3 replay_io3;
+
+static struct sg_nfc replay_sg_nfc;
+static struct sg_led replay_sg_led;
+static struct sg_frame_decoder replay_sg_decoder;
+static uint8_t replay_sg_written_bytes[520];
+static struct iobuf replay_sg_written;
+static struct iobuf replay_sg_readable;
+static struct replay_range *replay_sg_ranges;
+static size_t replay_sg_nranges;
+static size_t replay_sg_max_ranges;
+
+static struct replay_scan *replay_slider_scans;
+static size_t replay_slider_nscans;
+static size_t replay_slider_next_scan;
+static size_t replay_slider_rx_pos;
+static chuni_io_slider_callback_t replay_slider_callback;
+
+static HANDLE replay_io4_fd;
+static struct io4_state replay_io4_state;
+
+int main(int argc, char **argv)
+{
+    const struct replay_device *dev;
+    unsigned int passes;
+    unsigned int pass;
+    size_t i;
+
+    if (argc < 3 || argc > 4) {
+        fprintf(stderr,
+                "Usage: %s <jvs|sg|slider|io4> <capture file> [passes]\n",
+                argv[0]);
+
+        return EXIT_FAILURE;
+    }
+
+    dev = NULL;
+
+    for (i = 0 ; i < _countof(replay_devices) ; i++) {
+        if (strcmp(argv[1], replay_devices[i].name) == 0) {
+            dev = &replay_devices[i];
+        }
+    }
+
+    if (dev == NULL) {
+        fprintf(stderr, "Unknown device: %s\n", argv[1]);
+
+        return EXIT_FAILURE;
+    }
+
+    passes = argc > 3 ? (unsigned int) strtoul(argv[3], NULL, 10) : 1;
+
+    if (passes == 0) {
+        passes = 1;
+    }
+
+    if (!cap_load(argv[2]) || !replay_load()) {
+        return EXIT_FAILURE;
+    }
+
+    if (dev->init != NULL) {
+        dev->init();
+    }
+
+    for (pass = 0 ; pass < passes ; pass++) {
+        dev->begin();
+
+        for (i = 0 ; i < replay_nxacts ; i++) {
+            dev->xact(i, &replay_xacts[i], pass == 0);
+        }
+
+        if (dev->end != NULL) {
+            dev->end(pass == 0);
+        }
+    }
+
+    replay_report(passes);
+
+    return replay_nmismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static bool replay_load(void)
+{
+    const struct fdshark_cap_header *hdr;
+    struct fdshark_cap_record rec;
+    struct replay_xact *x;
+    LARGE_INTEGER freq;
+    size_t max_xacts;
+    uint8_t *rx;
+    int64_t off;
+    size_t i;
+
+    QueryPerformanceFrequency(&freq);
+    replay_freq = freq.QuadPart;
+
+    hdr = cap_header();
+
+    for (i = 0 ; i < FDSHARK_CAP_PATH_MAX - 1 && hdr->path[i] ; i++) {
+        replay_path[i] = hdr->path[i];
+    }
+
+    /* Every IRP has at least one record of at least the header size */
+
+    max_xacts = hdr->ring_size / sizeof(rec) + 1;
+    replay_xacts = calloc(max_xacts, sizeof(*replay_xacts));
+    rx = malloc(hdr->ring_size);
+
+    if (replay_xacts == NULL || rx == NULL) {
+        fprintf(stderr, "Out of memory\n");
+
+        return false;
+    }
+
+    for (   off = cap_first_record() ;
+            cap_record_get(off, &rec) ;
+            off += rec.size) {
+        if (rec.phase == FDSHARK_CAP_COMPLETE && rec.kind != FDSHARK_CAP_OPEN) {
+            x = replay_find_submit(&rec);
+
+            if (x == NULL) {
+                /* Submitted before the oldest surviving record */
+                continue;
+            }
+        } else {
+            x = &replay_xacts[replay_nxacts++];
+            x->kind = rec.kind;
+            x->thread = rec.thread;
+            x->ioctl = rec.ioctl;
+        }
+
+        if (rec.phase == FDSHARK_CAP_SUBMIT) {
+            x->read_nbytes = rec.kind == FDSHARK_CAP_READ ? rec.nbytes : 0;
+            x->req = replay_payload(off, &rec);
+            x->req_nbytes = rec.payload_size;
+
+            continue;
+        }
+
+        if (rec.kind == FDSHARK_CAP_IOCTL) {
+            x->read_nbytes = rec.nbytes;
+        }
+
+        x->complete = true;
+        x->hr = rec.hr;
+        x->res = replay_payload(off, &rec);
+        x->res_nbytes = rec.payload_size;
+
+        if (rec.kind == FDSHARK_CAP_READ && x->res != NULL) {
+            memcpy(&rx[replay_rx_nbytes], x->res, x->res_nbytes);
+            replay_rx_nbytes += x->res_nbytes;
+        }
+    }
+
+    replay_rx = rx;
+
+    return true;
+}
+
+static uint8_t *replay_payload(
+        int64_t off,
+        const struct fdshark_cap_record *rec)
+{
+    uint8_t *payload;
+
+    if (rec->payload_size == 0) {
+        return NULL;
+    }
+
+    payload = malloc(rec->payload_size);
+
+    if (payload == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    cap_read(payload, off + sizeof(*rec), rec->payload_size);
+
+    return payload;
+}
+
+static struct replay_xact *replay_find_submit(
+        const struct fdshark_cap_record *rec)
+{
+    struct replay_xact *x;
+    size_t i;
+
+    /* An IRP completes on the thread that submitted it, and each thread
+       has at most one IRP in flight through fdshark at a time. */
+
+    for (i = replay_nxacts ; i > 0 ; i--) {
+        x = &replay_xacts[i - 1];
+
+        if (x->thread == rec->thread) {
+            if (x->kind != rec->kind || x->complete) {
+                return NULL;
+            }
+
+            return x;
+        }
+    }
+
+    return NULL;
+}
+
+static int64_t replay_clock(void)
+{
+    LARGE_INTEGER now;
+
+    QueryPerformanceCounter(&now);
+
+    return now.QuadPart;
+}
+
+static void replay_time(int64_t start)
+{
+    int64_t *ticks;
+    size_t max_ticks;
+
+    if (replay_nticks == replay_max_ticks) {
+        max_ticks = replay_max_ticks ? replay_max_ticks * 2 : 1024;
+        ticks = realloc(replay_ticks, max_ticks * sizeof(*ticks));
+
+        if (ticks == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+
+        replay_ticks = ticks;
+        replay_max_ticks = max_ticks;
+    }
+
+    replay_ticks[replay_nticks++] = replay_clock() - start;
+}
+
+static bool replay_hr_known(HRESULT hr)
+{
+    /* Unless fdshark was told to force synchronous I/O, IRPs that went
+       asynchronous were recorded without their outcome. */
+
+    return  hr != HRESULT_FROM_WIN32(ERROR_IO_PENDING) &&
+            hr != (HRESULT) 0x10000103; /* HRESULT_FROM_NT(STATUS_PENDING) */
+}
+
+static void replay_diff(
+        size_t index,
+        const char *what,
+        const uint8_t *expected,
+        size_t expected_nbytes,
+        const uint8_t *actual,
+        size_t actual_nbytes)
+{
+    replay_nchecked++;
+
+    if (    expected_nbytes == actual_nbytes &&
+            (expected_nbytes == 0 ||
+             memcmp(expected, actual, expected_nbytes) == 0)) {
+        return;
+    }
+
+    replay_nmismatches++;
+
+    if (replay_nmismatches > REPLAY_MAX_DIFFS) {
+        return;
+    }
+
+    printf("IRP %u: %s differs. Expected:\n", (unsigned int) index, what);
+    replay_dump(expected, expected_nbytes);
+    printf("Got:\n");
+    replay_dump(actual, actual_nbytes);
+    printf("\n");
+}
+
+static void replay_dump(const uint8_t *bytes, size_t nbytes)
+{
+    char *text;
+    size_t size;
+
+    if (nbytes == 0) {
+        printf("(nothing)\n");
+
+        return;
+    }
+
+    size = dump_format(NULL, 0, bytes, nbytes) + 1;
+    text = malloc(size);
+
+    if (text == NULL) {
+        return;
+    }
+
+    dump_format(text, size, bytes, nbytes);
+    fputs(text, stdout);
+    free(text);
+}
+
+static void replay_report(unsigned int passes)
+{
+    int64_t total;
+    double us;
+    size_t i;
+
+    if (replay_nmismatches > REPLAY_MAX_DIFFS) {
+        printf("(%u more differences not shown)\n\n",
+                (unsigned int) (replay_nmismatches - REPLAY_MAX_DIFFS));
+    }
+
+    printf("%u IRPs in capture, %u transactions per pass, %u pass%s\n",
+            (unsigned int) replay_nxacts,
+            (unsigned int) (replay_nticks / passes),
+            passes,
+            passes == 1 ? "" : "es");
+    printf("%u responses checked, %u differ\n",
+            (unsigned int) replay_nchecked,
+            (unsigned int) replay_nmismatches);
+
+    if (replay_nticks == 0) {
+        return;
+    }
+
+    qsort(replay_ticks, replay_nticks, sizeof(*replay_ticks), replay_cmp_ticks);
+
+    for (i = 0, total = 0 ; i < replay_nticks ; i++) {
+        total += replay_ticks[i];
+    }
+
+    us = 1e6 / (double) replay_freq;
+
+    printf("Latency (us): min %.3f, median %.3f, 99%% %.3f, max %.3f, "
+            "mean %.3f\n",
+            replay_ticks[0] * us,
+            replay_ticks[replay_nticks / 2] * us,
+            replay_ticks[replay_nticks * 99 / 100] * us,
+            replay_ticks[replay_nticks - 1] * us,
+            (double) total / (double) replay_nticks * us);
+    printf("Throughput: %.0f transactions/s\n",
+            (double) replay_nticks / ((double) total * us / 1e6));
+}
+
+static int replay_cmp_ticks(const void *a, const void *b)
+{
+    int64_t lhs;
+    int64_t rhs;
+
+    lhs = *(const int64_t *) a;
+    rhs = *(const int64_t *) b;
+
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static void replay_jvs_read_switches(
+        void *ctx,
+        struct io3_switch_state *out)
+{
+}
+
+static void replay_jvs_begin(void)
+{
+    io3_init(&replay_io3, NULL, &replay_io3_ops, NULL);
+}
+
+static void replay_jvs_xact(
+        size_t index,
+        const struct replay_xact *x,
+        bool check)
+{
+    uint8_t bytes[REPLAY_BUF_SIZE];
+    struct jvs_node *node;
+    struct iobuf resp;
+    int64_t start;
+
+    if (x->kind != FDSHARK_CAP_IOCTL) {
+        return;
+    }
+
+    node = io3_to_jvs_node(&replay_io3);
+    resp.bytes = bytes;
+    resp.nbytes = x->read_nbytes;
+    resp.pos = 0;
+
+    if (resp.nbytes == 0 || resp.nbytes > sizeof(bytes)) {
+        resp.nbytes = sizeof(bytes);
+    }
+
+    switch (x->ioctl) {
+    case REPLAY_JVS_IOCTL_TRANSACT:
+        if (x->req == NULL) {
+            return;
+        }
+
+        start = replay_clock();
+        jvs_bus_transact(node, x->req, x->req_nbytes, &resp);
+        replay_time(start);
+
+        break;
+
+    case REPLAY_JVS_IOCTL_SENSE:
+        /* Same encoding as amex/jvs.c */
+
+        bytes[0] = jvs_node_sense(node) ? 3 : 2;
+        resp.pos = 1;
+
+        break;
+
+    default:
+        return;
+    }
+
+    if (check && x->complete && replay_hr_known(x->hr)) {
+        replay_diff(index, "Response", x->res, x->res_nbytes, bytes, resp.pos);
+    }
+}
+
+static HRESULT replay_sg_nfc_poll(void *ctx)
+{
+    return S_OK;
+}
+
+static void replay_sg_led_set_color(void *ctx, uint8_t r, uint8_t g, uint8_t b)
+{
+}
+
+static void replay_sg_begin(void)
+{
+    uint8_t *bytes;
+    size_t nbytes;
+
+    sg_nfc_init(&replay_sg_nfc, 0x00, &replay_sg_nfc_ops, NULL);
+    sg_led_init(&replay_sg_led, 0x08, &replay_sg_led_ops, NULL);
+    sg_frame_decoder_init(&replay_sg_decoder);
+
+    replay_sg_written.bytes = replay_sg_written_bytes;
+    replay_sg_written.nbytes = sizeof(replay_sg_written_bytes);
+    replay_sg_written.pos = 0;
+
+    /* Responses pile up here for the whole pass instead of being drained by
+       the reads, so that they can be lined up against the read stream. */
+
+    nbytes = replay_rx_nbytes + REPLAY_BUF_SIZE;
+
+    if (replay_sg_readable.nbytes < nbytes) {
+        bytes = realloc(replay_sg_readable.bytes, nbytes);
+
+        if (bytes == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+
+        replay_sg_readable.bytes = bytes;
+        replay_sg_readable.nbytes = nbytes;
+    }
+
+    replay_sg_readable.pos = 0;
+    replay_sg_nranges = 0;
+}
+
+static void replay_sg_xact(
+        size_t index,
+        const struct replay_xact *x,
+        bool check)
+{
+    struct const_iobuf frame;
+    struct replay_range *ranges;
+    size_t max_ranges;
+    size_t start_pos;
+    int64_t start;
+
+    if (x->kind == FDSHARK_CAP_OPEN) {
+        /* Same as board/sg-reader.c */
+
+        replay_sg_written.pos = 0;
+        sg_frame_decoder_init(&replay_sg_decoder);
+
+        return;
+    }
+
+    if (x->kind != FDSHARK_CAP_WRITE || x->req == NULL) {
+        return;
+    }
+
+    if (FAILED(iobuf_write(&replay_sg_written, x->req, x->req_nbytes))) {
+        fprintf(stderr, "IRP %u: SG reader write buffer overflow\n",
+                (unsigned int) index);
+
+        return;
+    }
+
+    for (;;) {
+        start_pos = replay_sg_readable.pos;
+        start = replay_clock();
+
+        if (sg_frame_decoder_next(
+                &replay_sg_decoder,
+                &replay_sg_written,
+                &frame) != S_OK) {
+            break;
+        }
+
+        sg_nfc_transact(
+                &replay_sg_nfc,
+                &replay_sg_readable,
+                frame.bytes,
+                frame.nbytes);
+
+        sg_led_transact(
+                &replay_sg_led,
+                &replay_sg_readable,
+                frame.bytes,
+                frame.nbytes);
+
+        replay_time(start);
+
+        if (!check) {
+            continue;
+        }
+
+        if (replay_sg_nranges == replay_sg_max_ranges) {
+            max_ranges = replay_sg_max_ranges ? replay_sg_max_ranges * 2 : 256;
+            ranges = realloc(
+                    replay_sg_ranges,
+                    max_ranges * sizeof(*ranges));
+
+            if (ranges == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+
+            replay_sg_ranges = ranges;
+            replay_sg_max_ranges = max_ranges;
+        }
+
+        replay_sg_ranges[replay_sg_nranges].index = index;
+        replay_sg_ranges[replay_sg_nranges].start = start_pos;
+        replay_sg_ranges[replay_sg_nranges].end = replay_sg_readable.pos;
+        replay_sg_nranges++;
+    }
+}
+
+static void replay_sg_end(bool check)
+{
+    const struct replay_range *range;
+    size_t expected_end;
+    size_t i;
+
+    if (!check) {
+        return;
+    }
+
+    /* Responses to requests that were still in flight when the capture ended
+       can't be checked, but everything before that should match up byte for
+       byte with what was read back. */
+
+    for (i = 0 ; i < replay_sg_nranges ; i++) {
+        range = &replay_sg_ranges[i];
+
+        if (range->start >= replay_rx_nbytes) {
+            break;
+        }
+
+        expected_end = range->end;
+
+        if (expected_end > replay_rx_nbytes) {
+            expected_end = replay_rx_nbytes;
+        }
+
+        replay_diff(
+                range->index,
+                "Response",
+                &replay_rx[range->start],
+                expected_end - range->start,
+                &replay_sg_readable.bytes[range->start],
+                expected_end - range->start);
+    }
+}
+
+static void replay_slider_init(void)
+{
+    struct replay_scan *scan;
+    uint8_t src_bytes[128];
+    uint8_t dest_bytes[64];
+    struct iobuf src;
+    struct iobuf dest;
+    size_t off;
+    size_t end;
+
+    /* Find every auto-scan report in the read stream, so that they can be
+       fed back in through the IO DLL callback just ahead of the read that
+       picked them up. Sync bytes never occur inside a frame. */
+
+    replay_slider_scans = calloc(
+            replay_rx_nbytes / 36 + 1,
+            sizeof(*replay_slider_scans));
+
+    if (replay_slider_scans == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (off = 0 ; off < replay_rx_nbytes ; off = end) {
+        for (   end = off + 1 ;
+                end < replay_rx_nbytes && replay_rx[end] != SLIDER_FRAME_SYNC ;
+                end++);
+
+        if (    replay_rx[off] != SLIDER_FRAME_SYNC ||
+                end - off > sizeof(src_bytes)) {
+            continue;
+        }
+
+        memcpy(src_bytes, &replay_rx[off], end - off);
+        src.bytes = src_bytes;
+        src.nbytes = sizeof(src_bytes);
+        src.pos = end - off;
+        dest.bytes = dest_bytes;
+        dest.nbytes = sizeof(dest_bytes);
+        dest.pos = 0;
+
+        if (    slider_frame_decode(&dest, &src) != S_OK ||
+                dest_bytes[1] != SLIDER_CMD_AUTO_SCAN ||
+                dest_bytes[2] != sizeof(scan->pressure)) {
+            continue;
+        }
+
+        scan = &replay_slider_scans[replay_slider_nscans++];
+        scan->off = off;
+        memcpy(scan->pressure, &dest_bytes[3], sizeof(scan->pressure));
+    }
+}
+
+static void replay_slider_begin(void)
+{
+    struct slider_config cfg;
+    struct slider_hdr req;
+    struct iobuf frame;
+    uint8_t bytes[16];
+    struct irp irp;
+
+    /* Same as the [slider] defaults in chunihook/config.c */
+
+    cfg.enable = true;
+    cfg.backlog = 1;
+
+    slider_hook_init(&cfg);
+
+    replay_slider_next_scan = 0;
+    replay_slider_rx_pos = 0;
+    replay_slider_callback = NULL;
+
+    if (replay_nxacts == 0 || replay_xacts[0].kind == FDSHARK_CAP_OPEN) {
+        return;
+    }
+
+    /* A capture that has lost its beginning to ring wrap most likely starts
+       in the middle of a game, with the slider already scanning. */
+
+    req.sync = SLIDER_FRAME_SYNC;
+    req.cmd = SLIDER_CMD_AUTO_SCAN_START;
+    req.nbytes = 0;
+
+    frame.bytes = bytes;
+    frame.nbytes = sizeof(bytes);
+    frame.pos = 0;
+    slider_frame_encode(&frame, &req, sizeof(req));
+
+    memset(&irp, 0, sizeof(irp));
+    irp.op = IRP_OP_WRITE;
+    irp.write.bytes = frame.bytes;
+    irp.write.nbytes = frame.pos;
+
+    stubs_irp_handler()(&irp);
+}
+
+static void replay_slider_xact(
+        size_t index,
+        const struct replay_xact *x,
+        bool check)
+{
+    struct replay_scan *scan;
+    uint8_t bytes[REPLAY_BUF_SIZE];
+    struct irp irp;
+    int64_t start;
+    HRESULT hr;
+
+    memset(&irp, 0, sizeof(irp));
+
+    switch (x->kind) {
+    case FDSHARK_CAP_OPEN:
+        irp.op = IRP_OP_OPEN;
+        irp.open_filename = replay_path;
+
+        break;
+
+    case FDSHARK_CAP_WRITE:
+        if (x->req == NULL) {
+            return;
+        }
+
+        irp.op = IRP_OP_WRITE;
+        irp.write.bytes = x->req;
+        irp.write.nbytes = x->req_nbytes;
+
+        break;
+
+    case FDSHARK_CAP_READ:
+        irp.op = IRP_OP_READ;
+        irp.read.bytes = bytes;
+        irp.read.nbytes = x->read_nbytes;
+
+        if (irp.read.nbytes == 0 || irp.read.nbytes > sizeof(bytes)) {
+            irp.read.nbytes = sizeof(bytes);
+        }
+
+        break;
+
+    default:
+        return;
+    }
+
+    /* Auto-scan reports come out of the emulator too, so the time it takes
+       to queue them up counts towards the read that returns them. */
+
+    start = replay_clock();
+
+    if (x->kind == FDSHARK_CAP_READ) {
+        while (replay_slider_next_scan < replay_slider_nscans) {
+            scan = &replay_slider_scans[replay_slider_next_scan];
+
+            if (scan->off >= replay_slider_rx_pos + x->res_nbytes) {
+                break;
+            }
+
+            if (replay_slider_callback != NULL) {
+                replay_slider_callback(scan->pressure);
+            }
+
+            replay_slider_next_scan++;
+        }
+
+        replay_slider_rx_pos += x->res_nbytes;
+    }
+
+    hr = stubs_irp_handler()(&irp);
+    replay_time(start);
+
+    if (!check || !x->complete || !replay_hr_known(x->hr)) {
+        return;
+    }
+
+    if (FAILED(hr) != FAILED(x->hr)) {
+        printf("IRP %u: Expected result %x, got %x\n",
+                (unsigned int) index,
+                (unsigned int) x->hr,
+                (unsigned int) hr);
+        replay_nmismatches++;
+    }
+
+    if (x->kind == FDSHARK_CAP_READ) {
+        replay_diff(
+                index,
+                "Read",
+                x->res,
+                x->res_nbytes,
+                bytes,
+                irp.read.pos);
+    }
+}
+
+HRESULT chuni_io_slider_init(void)
+{
+    return S_OK;
+}
+
+void chuni_io_slider_start(chuni_io_slider_callback_t callback)
+{
+    replay_slider_callback = callback;
+}
+
+void chuni_io_slider_stop(void)
+{
+    replay_slider_callback = NULL;
+}
+
+void chuni_io_slider_set_leds(const uint8_t *rgb)
+{
+}
+
+static HRESULT replay_io4_poll(void *ctx, struct io4_state *state)
+{
+    *state = replay_io4_state;
+
+    return S_OK;
+}
+
+static void replay_io4_begin(void)
+{
+    struct irp irp;
+
+    io4_hook_init(&replay_io4_ops, NULL);
+
+    /* The capture might not go back as far as the open */
+
+    memset(&irp, 0, sizeof(irp));
+    irp.op = IRP_OP_OPEN;
+    irp.open_filename = replay_path;
+    stubs_irp_handler()(&irp);
+
+    replay_io4_fd = irp.fd;
+}
+
+static void replay_io4_xact(
+        size_t index,
+        const struct replay_xact *x,
+        bool check)
+{
+    uint8_t bytes[REPLAY_BUF_SIZE];
+    const uint8_t *in;
+    struct irp irp;
+    int64_t start;
+    HRESULT hr;
+    size_t i;
+
+    memset(&irp, 0, sizeof(irp));
+    irp.fd = replay_io4_fd;
+    irp.read.bytes = bytes;
+    irp.read.nbytes = x->read_nbytes;
+
+    if (irp.read.nbytes == 0 || irp.read.nbytes > sizeof(bytes)) {
+        irp.read.nbytes = sizeof(bytes);
+    }
+
+    irp.write.bytes = x->req;
+    irp.write.nbytes = x->req_nbytes;
+
+    switch (x->kind) {
+    case FDSHARK_CAP_READ:
+        irp.op = IRP_OP_READ;
+
+        break;
+
+    case FDSHARK_CAP_WRITE:
+        irp.op = IRP_OP_WRITE;
+
+        break;
+
+    case FDSHARK_CAP_IOCTL:
+        irp.op = IRP_OP_IOCTL;
+        irp.ioctl = x->ioctl;
+
+        break;
+
+    default:
+        return;
+    }
+
+    /* Play back the inputs from the recorded IN report, see
+       struct io4_report_in in board/io4.c. Everything is little-endian. */
+
+    in = x->res;
+
+    if (x->kind == FDSHARK_CAP_READ && x->res_nbytes >= REPLAY_IO4_REPORT) {
+        for (i = 0 ; i < 8 ; i++) {
+            replay_io4_state.adcs[i] = in[1 + 2 * i] | (in[2 + 2 * i] << 8);
+        }
+
+        for (i = 0 ; i < 4 ; i++) {
+            replay_io4_state.spinners[i] =
+                    in[17 + 2 * i] | (in[18 + 2 * i] << 8);
+        }
+
+        for (i = 0 ; i < 2 ; i++) {
+            replay_io4_state.chutes[i] = in[25 + 2 * i] | (in[26 + 2 * i] << 8);
+            replay_io4_state.buttons[i] =
+                    in[29 + 2 * i] | (in[30 + 2 * i] << 8);
+        }
+    }
+
+    start = replay_clock();
+    hr = stubs_irp_handler()(&irp);
+    replay_time(start);
+
+    if (!check || !x->complete || !replay_hr_known(x->hr)) {
+        return;
+    }
+
+    if (FAILED(hr) != FAILED(x->hr)) {
+        printf("IRP %u: Expected result %x, got %x\n",
+                (unsigned int) index,
+                (unsigned int) x->hr,
+                (unsigned int) hr);
+        replay_nmismatches++;
+    }
+
+    if (x->kind != FDSHARK_CAP_WRITE && SUCCEEDED(x->hr)) {
+        replay_diff(index, "Read", x->res, x->res_nbytes, bytes, irp.read.pos);
+    }
+}
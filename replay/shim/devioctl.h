@@ -0,0 +1,10 @@
+#pragma once
+
+#define CTL_CODE(type, func, method, access) \
+        (((type) << 16) | ((access) << 14) | ((func) << 2) | (method))
+
+#define FILE_DEVICE_KEYBOARD    0x0000000B
+#define METHOD_IN_DIRECT        1
+#define METHOD_OUT_DIRECT       2
+#define METHOD_NEITHER          3
+#define FILE_ANY_ACCESS         0
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <devioctl.h>
+
+#define HID_CTL_CODE(id) \
+        CTL_CODE(FILE_DEVICE_KEYBOARD, (id), METHOD_NEITHER, FILE_ANY_ACCESS)
+#define HID_IN_CTL_CODE(id) \
+        CTL_CODE(FILE_DEVICE_KEYBOARD, (id), METHOD_IN_DIRECT, FILE_ANY_ACCESS)
+#define HID_OUT_CTL_CODE(id) \
+        CTL_CODE(FILE_DEVICE_KEYBOARD, (id), METHOD_OUT_DIRECT, FILE_ANY_ACCESS)
+
+#define IOCTL_HID_GET_MANUFACTURER_STRING   HID_OUT_CTL_CODE(110)
+#define IOCTL_HID_GET_PRODUCT_STRING        HID_OUT_CTL_CODE(111)
+#define IOCTL_HID_SET_OUTPUT_REPORT         HID_IN_CTL_CODE(101)
+#define IOCTL_HID_GET_INPUT_REPORT          HID_OUT_CTL_CODE(104)
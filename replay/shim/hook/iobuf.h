@@ -0,0 +1,34 @@
+#pragma once
+
+/* Host stand-in for capnhook's hook/iobuf.h, declaring only what the board
+   emulators use. Implemented in replay/shim/shim.c. */
+
+#include <windows.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct iobuf {
+    uint8_t *bytes;
+    size_t nbytes;
+    size_t pos;
+};
+
+struct const_iobuf {
+    const uint8_t *bytes;
+    size_t nbytes;
+    size_t pos;
+};
+
+void iobuf_flip(struct const_iobuf *child, struct iobuf *parent);
+size_t iobuf_move(struct iobuf *dest, struct iobuf *src);
+
+HRESULT iobuf_read(struct const_iobuf *src, void *bytes, size_t nbytes);
+HRESULT iobuf_read_8(struct const_iobuf *src, uint8_t *out);
+HRESULT iobuf_read_be16(struct const_iobuf *src, uint16_t *out);
+HRESULT iobuf_read_be64(struct const_iobuf *src, uint64_t *out);
+
+HRESULT iobuf_write(struct iobuf *dest, const void *bytes, size_t nbytes);
+HRESULT iobuf_write_8(struct iobuf *dest, uint8_t value);
+HRESULT iobuf_write_be16(struct iobuf *dest, uint16_t value);
+HRESULT iobuf_write_be64(struct iobuf *dest, uint64_t value);
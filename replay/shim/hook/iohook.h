@@ -0,0 +1,35 @@
+#pragma once
+
+/* Host stand-in for capnhook's hook/iohook.h */
+
+#include <windows.h>
+
+#include <stdint.h>
+
+#include "hook/iobuf.h"
+
+enum irp_op {
+    IRP_OP_OPEN,
+    IRP_OP_CLOSE,
+    IRP_OP_READ,
+    IRP_OP_WRITE,
+    IRP_OP_IOCTL,
+    IRP_OP_FSYNC,
+    IRP_OP_SEEK,
+};
+
+struct irp {
+    enum irp_op op;
+    size_t next_handler;
+    HANDLE fd;
+    OVERLAPPED *ovl;
+    struct const_iobuf write;
+    struct iobuf read;
+    uint32_t ioctl;
+    const wchar_t *open_filename;
+};
+
+typedef HRESULT (*iohook_fn_t)(struct irp *irp);
+
+HRESULT iohook_open_nul_fd(HANDLE *out);
+HRESULT iohook_invoke_next(struct irp *irp);
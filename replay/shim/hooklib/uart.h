@@ -0,0 +1,21 @@
+#pragma once
+
+/* Host stand-in for capnhook's hooklib/uart.h. Serial port ioctls are
+   accepted and ignored. */
+
+#include <windows.h>
+
+#include <stdbool.h>
+
+#include "hook/iobuf.h"
+#include "hook/iohook.h"
+
+struct uart {
+    struct iobuf written;
+    struct iobuf readable;
+    unsigned int port_no;
+};
+
+void uart_init(struct uart *uart, unsigned int port_no);
+bool uart_match_irp(const struct uart *uart, const struct irp *irp);
+HRESULT uart_handle_irp(struct uart *uart, struct irp *irp);
@@ -0,0 +1,211 @@
+#include <windows.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "hook/iobuf.h"
+#include "hook/iohook.h"
+
+#include "hooklib/uart.h"
+
+BOOL QueryPerformanceCounter(LARGE_INTEGER *out)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    out->QuadPart = (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+    return TRUE;
+}
+
+BOOL QueryPerformanceFrequency(LARGE_INTEGER *out)
+{
+    out->QuadPart = 1000000000;
+
+    return TRUE;
+}
+
+void iobuf_flip(struct const_iobuf *child, struct iobuf *parent)
+{
+    child->bytes = parent->bytes;
+    child->nbytes = parent->pos;
+    child->pos = 0;
+}
+
+size_t iobuf_move(struct iobuf *dest, struct iobuf *src)
+{
+    size_t nbytes;
+
+    nbytes = dest->nbytes - dest->pos;
+
+    if (nbytes > src->pos) {
+        nbytes = src->pos;
+    }
+
+    memcpy(&dest->bytes[dest->pos], src->bytes, nbytes);
+    memmove(src->bytes, &src->bytes[nbytes], src->pos - nbytes);
+    dest->pos += nbytes;
+    src->pos -= nbytes;
+
+    return nbytes;
+}
+
+HRESULT iobuf_read(struct const_iobuf *src, void *bytes, size_t nbytes)
+{
+    if (src->nbytes - src->pos < nbytes) {
+        return E_FAIL;
+    }
+
+    memcpy(bytes, &src->bytes[src->pos], nbytes);
+    src->pos += nbytes;
+
+    return S_OK;
+}
+
+HRESULT iobuf_read_8(struct const_iobuf *src, uint8_t *out)
+{
+    return iobuf_read(src, out, 1);
+}
+
+HRESULT iobuf_read_be16(struct const_iobuf *src, uint16_t *out)
+{
+    uint8_t bytes[2];
+    HRESULT hr;
+
+    hr = iobuf_read(src, bytes, sizeof(bytes));
+
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    *out = (bytes[0] << 8) | bytes[1];
+
+    return S_OK;
+}
+
+HRESULT iobuf_read_be64(struct const_iobuf *src, uint64_t *out)
+{
+    uint8_t bytes[8];
+    uint64_t value;
+    HRESULT hr;
+    size_t i;
+
+    hr = iobuf_read(src, bytes, sizeof(bytes));
+
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    for (i = 0, value = 0 ; i < sizeof(bytes) ; i++) {
+        value = (value << 8) | bytes[i];
+    }
+
+    *out = value;
+
+    return S_OK;
+}
+
+HRESULT iobuf_write(struct iobuf *dest, const void *bytes, size_t nbytes)
+{
+    if (dest->nbytes - dest->pos < nbytes) {
+        return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+    }
+
+    memcpy(&dest->bytes[dest->pos], bytes, nbytes);
+    dest->pos += nbytes;
+
+    return S_OK;
+}
+
+HRESULT iobuf_write_8(struct iobuf *dest, uint8_t value)
+{
+    return iobuf_write(dest, &value, 1);
+}
+
+HRESULT iobuf_write_be16(struct iobuf *dest, uint16_t value)
+{
+    uint8_t bytes[2];
+
+    bytes[0] = value >> 8;
+    bytes[1] = value;
+
+    return iobuf_write(dest, bytes, sizeof(bytes));
+}
+
+HRESULT iobuf_write_be64(struct iobuf *dest, uint64_t value)
+{
+    uint8_t bytes[8];
+    size_t i;
+
+    for (i = 0 ; i < sizeof(bytes) ; i++) {
+        bytes[i] = value >> (56 - 8 * i);
+    }
+
+    return iobuf_write(dest, bytes, sizeof(bytes));
+}
+
+HRESULT iohook_open_nul_fd(HANDLE *out)
+{
+    static uintptr_t next_fd;
+
+    *out = (HANDLE) ++next_fd;
+
+    return S_OK;
+}
+
+HRESULT iohook_invoke_next(struct irp *irp)
+{
+    /* There is nothing further down the chain, so behave like NUL */
+
+    if (irp->op == IRP_OP_WRITE) {
+        irp->write.pos = irp->write.nbytes;
+    }
+
+    return S_OK;
+}
+
+void uart_init(struct uart *uart, unsigned int port_no)
+{
+    memset(uart, 0, sizeof(*uart));
+    uart->port_no = port_no;
+}
+
+bool uart_match_irp(const struct uart *uart, const struct irp *irp)
+{
+    /* replay only ever talks to one device at a time */
+
+    return true;
+}
+
+HRESULT uart_handle_irp(struct uart *uart, struct irp *irp)
+{
+    struct const_iobuf *src;
+    size_t nbytes;
+    HRESULT hr;
+
+    switch (irp->op) {
+    case IRP_OP_READ:
+        iobuf_move(&irp->read, &uart->readable);
+
+        return S_OK;
+
+    case IRP_OP_WRITE:
+        src = &irp->write;
+        nbytes = src->nbytes - src->pos;
+        hr = iobuf_write(&uart->written, &src->bytes[src->pos], nbytes);
+
+        if (FAILED(hr)) {
+            return hr;
+        }
+
+        src->pos += nbytes;
+
+        return S_OK;
+
+    default:
+        return S_OK;
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+/* Just enough of the Win32 API for the board emulators to compile on a
+   non-Windows host, for the benefit of replay. None of this is used when
+   building the hooks themselves. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+
+/* glibc has a dprintf() of its own, with a different signature. Release
+   builds turn ours into a macro anyway, see util/dprintf.h. */
+
+#if !defined(NDEBUG) || (defined(DPRINTF_MAX_LEVEL) && DPRINTF_MAX_LEVEL > 0)
+#define dprintf segatools_dprintf
+#endif
+
+typedef int32_t HRESULT;
+typedef int32_t LONG;
+typedef int64_t LONG64;
+typedef uint32_t DWORD;
+typedef int BOOL;
+typedef unsigned int UINT;
+typedef void *HANDLE;
+
+#define TRUE 1
+#define FALSE 0
+#define MAX_PATH 260
+
+#define S_OK            ((HRESULT) 0)
+#define S_FALSE         ((HRESULT) 1)
+#define E_NOTIMPL       ((HRESULT) 0x80004001)
+#define E_FAIL          ((HRESULT) 0x80004005)
+#define E_OUTOFMEMORY   ((HRESULT) 0x8007000E)
+#define E_INVALIDARG    ((HRESULT) 0x80070057)
+
+#define SUCCEEDED(hr) ((HRESULT) (hr) >= 0)
+#define FAILED(hr) ((HRESULT) (hr) < 0)
+#define HRESULT_FROM_WIN32(x) ((HRESULT) (x) <= 0 ? \
+        (HRESULT) (x) : (HRESULT) (((x) & 0x0000FFFF) | 0x80070000))
+
+#define ERROR_FILE_NOT_FOUND        2L
+#define ERROR_INVALID_FUNCTION      1L
+#define ERROR_CRC                   23L
+#define ERROR_INSUFFICIENT_BUFFER   122L
+#define ERROR_IO_PENDING            997L
+
+#define _countof(x) (sizeof(x) / sizeof((x)[0]))
+#define _byteswap_ulong(x) __builtin_bswap32(x)
+#define _byteswap_uint64(x) __builtin_bswap64(x)
+#define CONTAINING_RECORD(ptr, type, field) \
+        ((type *) ((uint8_t *) (ptr) - offsetof(type, field)))
+
+typedef struct _GUID {
+    uint32_t Data1;
+    uint16_t Data2;
+    uint16_t Data3;
+    uint8_t Data4[8];
+} GUID;
+
+#define DEFINE_GUID(name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+        static const GUID name = \
+                { l, w1, w2, { b1, b2, b3, b4, b5, b6, b7, b8 } }
+
+typedef union _LARGE_INTEGER {
+    int64_t QuadPart;
+} LARGE_INTEGER;
+
+typedef struct _OVERLAPPED {
+    uintptr_t Internal;
+    uintptr_t InternalHigh;
+    uint64_t Offset;
+    HANDLE hEvent;
+} OVERLAPPED;
+
+/* replay is single-threaded, so locks don't need to do anything */
+
+typedef struct _CRITICAL_SECTION {
+    int unused;
+} CRITICAL_SECTION;
+
+typedef struct _CONDITION_VARIABLE {
+    void *unused;
+} CONDITION_VARIABLE;
+
+static inline void InitializeCriticalSection(CRITICAL_SECTION *cs) {}
+static inline void EnterCriticalSection(CRITICAL_SECTION *cs) {}
+static inline void LeaveCriticalSection(CRITICAL_SECTION *cs) {}
+
+static inline int strcpy_s(char *dest, size_t size, const char *src)
+{
+    snprintf(dest, size, "%s", src);
+
+    return 0;
+}
+
+BOOL QueryPerformanceCounter(LARGE_INTEGER *out);
+BOOL QueryPerformanceFrequency(LARGE_INTEGER *out);
@@ -0,0 +1,84 @@
+/* Stand-ins for the parts of segatools that the emulators register with at
+   startup. Nothing actually gets hooked: the IRP handler that an emulator
+   registers is simply remembered so that replay can call it directly, and
+   asynchronous IRPs are completed on the spot. */
+
+#include <windows.h>
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hook/iohook.h"
+
+#include "hooklib/iostat.h"
+#include "hooklib/setupapi.h"
+
+#include "replay/stubs.h"
+
+#include "util/async.h"
+#include "util/dprintf.h"
+
+static iohook_fn_t stubs_handler;
+
+#if DPRINTF_MAX_LEVEL > DPRINTF_LEVEL_OFF
+/* Every category is switched off, so only the messages that segatools logs
+   unconditionally get through to stderr. */
+
+uint8_t dprintf_levels[DPRINTF_NCATS_];
+#endif
+
+iohook_fn_t stubs_irp_handler(void)
+{
+    return stubs_handler;
+}
+
+HRESULT iostat_push_handler(const char *name, iohook_fn_t fn)
+{
+    stubs_handler = fn;
+
+    return S_OK;
+}
+
+HRESULT setupapi_add_phantom_dev(const GUID *iface_class, const wchar_t *path)
+{
+    return S_OK;
+}
+
+HRESULT async_init(struct async *async, void *ctx, size_t depth)
+{
+    async->ctx = ctx;
+
+    return S_OK;
+}
+
+HRESULT async_submit_deadline(
+        struct async *async,
+        struct irp *irp,
+        async_task_t task,
+        uint32_t delay_us)
+{
+    return task(async->ctx, irp);
+}
+
+#if DPRINTF_MAX_LEVEL > DPRINTF_LEVEL_OFF
+void dprintf(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    dprintfv(fmt, ap);
+    va_end(ap);
+}
+
+void dprintfv(const char *fmt, va_list ap)
+{
+    vfprintf(stderr, fmt, ap);
+}
+
+void dputs(const char *str)
+{
+    fputs(str, stderr);
+}
+#endif
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <windows.h>
+
+#include "hook/iohook.h"
+
+/* Returns the IRP handler most recently registered by an emulator's
+   *_hook_init() function, which replay calls directly in place of iohook. */
+
+iohook_fn_t stubs_irp_handler(void);
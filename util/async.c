@@ -8,44 +8,126 @@
 #include <assert.h>
 #include <process.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "hook/iohook.h"
 
 #include "util/async.h"
 
-static unsigned int __stdcall async_thread_proc(void *param);
-
-void async_init(struct async *async, void *ctx)
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+/* All struct asyncs in the process share one I/O completion port, a small
+   pool of worker threads that drain it, and a single scheduler thread that
+   waits out IRP deadlines on a waitable timer.
+
+   A struct async is posted to the port (with itself as the completion key)
+   whenever the IRP at the head of its queue is due. Only one worker at a time
+   ever owns a given struct async (tracked by its busy flag), so each device's
+   tasks still run one at a time and in submission order.
+
+   Lock order is async_engine_lock first, then an individual async->lock. */
+
+static BOOL CALLBACK async_engine_init_once(
+        INIT_ONCE *once,
+        void *param,
+        void **ctx);
+static unsigned int __stdcall async_engine_worker_proc(void *param);
+static unsigned int __stdcall async_engine_sched_proc(void *param);
+static void async_post_locked(struct async *async);
+static void async_run(struct async *async);
+static void async_complete(struct irp *irp, HRESULT hr);
+static void async_arm_timer(int64_t ticks);
+static int64_t async_qpc_now(void);
+static uint64_t async_qpc_to_us(int64_t ticks);
+
+static INIT_ONCE async_engine_once = INIT_ONCE_STATIC_INIT;
+static HRESULT async_engine_hr;
+static HANDLE async_engine_port;
+static HANDLE async_engine_timer;
+static HANDLE async_engine_wake;
+static CRITICAL_SECTION async_engine_lock;
+static struct async *async_engine_list;
+static CRITICAL_SECTION async_engine_stats_lock;
+static struct async_engine_stats async_engine_stats;
+static int64_t async_qpc_freq;
+
+HRESULT async_init(struct async *async, void *ctx, size_t depth)
 {
     assert(async != NULL);
+    assert(depth <= ASYNC_MAX_DEPTH);
+
+    InitOnceExecuteOnce(&async_engine_once, async_engine_init_once, NULL, NULL);
+
+    if (FAILED(async_engine_hr)) {
+        return async_engine_hr;
+    }
+
+    if (depth == 0) {
+        depth = ASYNC_DEFAULT_DEPTH;
+    }
 
     InitializeCriticalSection(&async->lock);
-    InitializeConditionVariable(&async->pend);
-    InitializeConditionVariable(&async->avail);
-    async->thread = NULL;
+    InitializeConditionVariable(&async->idle);
+    async->next = NULL;
+    async->nslots = depth;
+    async->head = 0;
+    async->count = 0;
+    memset(&async->stats, 0, sizeof(async->stats));
     async->ctx = ctx;
+    async->busy = false;
     async->stop = false;
+
+    EnterCriticalSection(&async_engine_lock);
+    async->next = async_engine_list;
+    async_engine_list = async;
+    LeaveCriticalSection(&async_engine_lock);
+
+    return S_OK;
 }
 
 void async_fini(struct async *async)
 {
-    HANDLE thread;
+    struct async **pos;
+    BOOL ok;
 
     if (async == NULL) {
         return;
     }
 
+    /* Unlink first so that the scheduler can no longer post us */
+
+    EnterCriticalSection(&async_engine_lock);
+
+    for (pos = &async_engine_list ; *pos != NULL ; pos = &(*pos)->next) {
+        if (*pos == async) {
+            *pos = async->next;
+
+            break;
+        }
+    }
+
+    LeaveCriticalSection(&async_engine_lock);
+
+    /* Then wait for any worker that currently owns us to let go. IRPs that
+       are still queued at this point are abandoned, as they always were. */
+
     EnterCriticalSection(&async->lock);
 
     async->stop = true;
-    thread = async->thread;
 
-    WakeConditionVariable(&async->pend);
-    LeaveCriticalSection(&async->lock);
+    while (async->busy) {
+        ok = SleepConditionVariableCS(&async->idle, &async->lock, INFINITE);
+
+        if (!ok) {
+            abort();
+        }
+    }
 
-    WaitForSingleObject(thread, INFINITE);
-    CloseHandle(thread);
+    LeaveCriticalSection(&async->lock);
     DeleteCriticalSection(&async->lock);
 
     /* There is no DeleteConditionVariable function in the Win32 API. */
@@ -53,7 +135,17 @@ void async_fini(struct async *async)
 
 HRESULT async_submit(struct async *async, struct irp *irp, async_task_t task)
 {
-    BOOL ok;
+    return async_submit_deadline(async, irp, task, 0);
+}
+
+HRESULT async_submit_deadline(
+        struct async *async,
+        struct irp *irp,
+        async_task_t task,
+        uint32_t delay_us)
+{
+    struct async_slot *slot;
+    int64_t now;
 
     assert(async != NULL);
     assert(irp != NULL);
@@ -66,134 +158,420 @@ HRESULT async_submit(struct async *async, struct irp *irp, async_task_t task)
 
     EnterCriticalSection(&async->lock);
 
-    if (async->thread == NULL) {
-        /* Ensure our worker thread is running */
-        async->thread = (HANDLE) _beginthreadex(
+    if (async->count == async->nslots) {
+        /* Never block the initiating thread; the caller gets to retry. */
+        async->stats.rejected++;
+        LeaveCriticalSection(&async->lock);
+
+        return HRESULT_FROM_WIN32(ERROR_BUSY);
+    }
+
+    now = async_qpc_now();
+    slot = &async->slots[(async->head + async->count) % async->nslots];
+    slot->task = task;
+    slot->submitted = now;
+    slot->deadline = now + (int64_t) delay_us * async_qpc_freq / 1000000;
+    memcpy(&slot->irp, irp, sizeof(*irp));
+    slot->irp.next_handler = (size_t) -1;
+    irp->ovl->Internal = STATUS_PENDING;
+
+    async->count++;
+    async->stats.submitted++;
+    async->stats.depth = async->count;
+
+    if (async->stats.max_depth < async->count) {
+        async->stats.max_depth = async->count;
+    }
+
+    /* If a worker owns us then it will pick this IRP up (or hand us back to
+       the scheduler) by itself. Otherwise, immediate IRPs go straight to the
+       port and delayed ones need the scheduler to re-arm its timer. */
+
+    if (!async->busy && async->count == 1) {
+        if (slot->deadline <= now) {
+            async_post_locked(async);
+        } else {
+            SetEvent(async_engine_wake);
+        }
+    }
+
+    LeaveCriticalSection(&async->lock);
+
+    return HRESULT_FROM_WIN32(ERROR_IO_PENDING);
+}
+
+void async_get_stats(struct async *async, struct async_stats *stats)
+{
+    assert(async != NULL);
+    assert(stats != NULL);
+
+    EnterCriticalSection(&async->lock);
+    memcpy(stats, &async->stats, sizeof(*stats));
+    LeaveCriticalSection(&async->lock);
+}
+
+void async_engine_get_stats(struct async_engine_stats *stats)
+{
+    assert(stats != NULL);
+
+    InitOnceExecuteOnce(&async_engine_once, async_engine_init_once, NULL, NULL);
+
+    if (FAILED(async_engine_hr)) {
+        memset(stats, 0, sizeof(*stats));
+
+        return;
+    }
+
+    EnterCriticalSection(&async_engine_stats_lock);
+    memcpy(stats, &async_engine_stats, sizeof(*stats));
+    LeaveCriticalSection(&async_engine_stats_lock);
+}
+
+static BOOL CALLBACK async_engine_init_once(
+        INIT_ONCE *once,
+        void *param,
+        void **ctx)
+{
+    LARGE_INTEGER freq;
+    HANDLE thread;
+    size_t i;
+
+    QueryPerformanceFrequency(&freq);
+    async_qpc_freq = freq.QuadPart;
+
+    InitializeCriticalSection(&async_engine_lock);
+    InitializeCriticalSection(&async_engine_stats_lock);
+
+    async_engine_port = CreateIoCompletionPort(
+            INVALID_HANDLE_VALUE,
+            NULL,
+            0,
+            ASYNC_ENGINE_WORKERS);
+
+    if (async_engine_port == NULL) {
+        goto fail;
+    }
+
+    /* High-resolution timers are only available on Windows 10 1803 and
+       later. Older systems get a regular timer, which is still no worse than
+       the Sleep() calls this replaces. */
+
+    async_engine_timer = CreateWaitableTimerExW(
+            NULL,
+            NULL,
+            CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+            TIMER_ALL_ACCESS);
+
+    if (async_engine_timer == NULL) {
+        async_engine_timer = CreateWaitableTimerW(NULL, FALSE, NULL);
+    }
+
+    if (async_engine_timer == NULL) {
+        goto fail;
+    }
+
+    async_engine_wake = CreateEventW(NULL, FALSE, FALSE, NULL);
+
+    if (async_engine_wake == NULL) {
+        goto fail;
+    }
+
+    /* These threads live for as long as the process does */
+
+    for (i = 0 ; i <= ASYNC_ENGINE_WORKERS ; i++) {
+        thread = (HANDLE) _beginthreadex(
                 NULL,
                 0,
-                async_thread_proc,
-                async,
+                i < ASYNC_ENGINE_WORKERS
+                        ? async_engine_worker_proc
+                        : async_engine_sched_proc,
+                NULL,
                 0,
                 NULL);
 
-        if (async->thread == NULL) {
-            return HRESULT_FROM_WIN32(GetLastError());
+        if (thread == NULL) {
+            goto fail;
         }
+
+        CloseHandle(thread);
     }
 
-    while (async->task != NULL) {
-        ok = SleepConditionVariableCS(&async->avail, &async->lock, INFINITE);
+    async_engine_hr = S_OK;
+
+    return TRUE;
+
+fail:
+    async_engine_hr = HRESULT_FROM_WIN32(GetLastError());
+
+    if (SUCCEEDED(async_engine_hr)) {
+        async_engine_hr = E_FAIL;
+    }
+
+    return TRUE;
+}
+
+static unsigned int __stdcall async_engine_worker_proc(void *param)
+{
+    OVERLAPPED *ovl;
+    ULONG_PTR key;
+    DWORD nbytes;
+    BOOL ok;
+
+    for (;;) {
+        ok = GetQueuedCompletionStatus(
+                async_engine_port,
+                &nbytes,
+                &key,
+                &ovl,
+                INFINITE);
 
         if (!ok) {
             abort();
         }
-    }
-
-    async->task = task;
-    memcpy(&async->irp, irp, sizeof(*irp));
-    async->irp.next_handler = (size_t) -1;
-    irp->ovl->Internal = STATUS_PENDING;
 
-    WakeConditionVariable(&async->pend);
-    LeaveCriticalSection(&async->lock);
+        async_run((struct async *) key);
+    }
 
-    return HRESULT_FROM_WIN32(ERROR_IO_PENDING);
+    return 0;
 }
 
-static unsigned int __stdcall async_thread_proc(void *param)
+static unsigned int __stdcall async_engine_sched_proc(void *param)
 {
+    HANDLE handles[2];
     struct async *async;
-    struct irp irp;
-    async_task_t task;
-    OVERLAPPED *ovl;
-    HANDLE event;
-    HRESULT hr;
-    BOOL ok;
+    int64_t deadline;
+    int64_t next;
+    int64_t now;
 
-    async = param;
+    handles[0] = async_engine_wake;
+    handles[1] = async_engine_timer;
 
     for (;;) {
-        EnterCriticalSection(&async->lock);
+        next = INT64_MAX;
 
-        if (async->stop) {
-            LeaveCriticalSection(&async->lock);
+        EnterCriticalSection(&async_engine_lock);
+        now = async_qpc_now();
 
-            break;
-        } else if (async->task == NULL) {
-            ok = SleepConditionVariableCS(&async->pend, &async->lock, INFINITE);
+        for (async = async_engine_list ; async != NULL ; async = async->next) {
+            EnterCriticalSection(&async->lock);
+
+            if (!async->busy && async->count > 0) {
+                deadline = async->slots[async->head].deadline;
 
-            if (!ok) {
-                abort();
+                if (deadline <= now) {
+                    async_post_locked(async);
+                } else if (deadline < next) {
+                    next = deadline;
+                }
             }
 
             LeaveCriticalSection(&async->lock);
+        }
+
+        LeaveCriticalSection(&async_engine_lock);
+
+        if (next != INT64_MAX) {
+            async_arm_timer(next - now);
         } else {
-            memcpy(&irp, &async->irp, sizeof(irp));
-            task = async->task;
-            ovl = async->irp.ovl;
-            async->task = NULL;
+            CancelWaitableTimer(async_engine_timer);
+        }
 
-            WakeConditionVariable(&async->avail);
-            LeaveCriticalSection(&async->lock);
+        WaitForMultipleObjects(_countof(handles), handles, FALSE, INFINITE);
+    }
+
+    return 0;
+}
 
-            assert(ovl != NULL);
+static void async_post_locked(struct async *async)
+{
+    BOOL ok;
 
-            hr = task(async->ctx, &irp);
+    async->busy = true;
+    ok = PostQueuedCompletionStatus(
+            async_engine_port,
+            0,
+            (ULONG_PTR) async,
+            NULL);
 
-            switch (irp.op) {
-            case IRP_OP_READ:
-            case IRP_OP_IOCTL:
-                ovl->InternalHigh = (DWORD) irp.read.pos;
+    if (!ok) {
+        abort();
+    }
+}
 
-                break;
+static void async_run(struct async *async)
+{
+    struct async_slot *slot;
+    struct irp irp;
+    async_task_t task;
+    uint64_t latency;
+    uint64_t wait;
+    uint64_t late;
+    int64_t submitted;
+    int64_t now;
+    bool reschedule;
+    HRESULT hr;
 
-            case IRP_OP_WRITE:
-                ovl->InternalHigh = (DWORD) irp.write.pos;
+    reschedule = false;
 
-                break;
+    EnterCriticalSection(&async->lock);
 
-            default:
-                break;
-            }
+    assert(async->busy);
 
-            /* We have to do a slightly tricky dance with the hooked process'
-               call to GetOverlappedResult() here. This thread might be blocked
-               on ovl->hEvent, or it might be just about to read ovl->Internal
-               to determine whether the IO has completed (and thus determine
-               whether it needs to block on ovl->hEvent or not). So to avoid
-               any races and *ovl getting invalidated under our feet we must
-               wake the initiating thread as follows:
+    while (!async->stop && async->count > 0) {
+        now = async_qpc_now();
+        slot = &async->slots[async->head];
 
-               1. Take a local copy of ovl->hEvent
+        if (slot->deadline > now) {
+            /* IRPs complete in submission order, so only the head of the
+               queue's deadline matters. */
+            reschedule = true;
 
-               2. Issue a memory fence to ensure that the previous load does
-                  not get re-ordered after the following store
+            break;
+        }
 
-                  https://bartoszmilewski.com/2008/11/05/who-ordered-memory-fences-on-an-x86/
+        memcpy(&irp, &slot->irp, sizeof(irp));
+        task = slot->task;
+        submitted = slot->submitted;
+        wait = async_qpc_to_us(now - slot->submitted);
+        late = async_qpc_to_us(now - slot->deadline);
 
-               3. Store the operation's NTSTATUS. At the moment that this store
-                  gets issued the memory pointed to by ovl ceases to be safely
-                  accessible.
+        async->head = (async->head + 1) % async->nslots;
+        async->count--;
+        async->stats.depth = async->count;
+        async->stats.wait_total_us += wait;
 
-               4. Using our local copy of the event handle (if present), signal
-                  the initiating thread to wake up and retire the IO. */
+        if (async->stats.wait_max_us < wait) {
+            async->stats.wait_max_us = wait;
+        }
 
-            event = ovl->hEvent;
-            MemoryBarrier();
+        async->stats.late_total_us += late;
 
-            if (SUCCEEDED(hr)) {
-                ovl->Internal = STATUS_SUCCESS;
-            } else if (hr & FACILITY_NT_BIT) {
-                ovl->Internal = hr & ~FACILITY_NT_BIT;
-            } else {
-                ovl->Internal = STATUS_UNSUCCESSFUL;
-            }
+        if (async->stats.late_max_us < late) {
+            async->stats.late_max_us = late;
+        }
 
-            if (event != NULL) {
-                SetEvent(event);
-            }
+        LeaveCriticalSection(&async->lock);
+
+        hr = task(async->ctx, &irp);
+        async_complete(&irp, hr);
+        latency = async_qpc_to_us(async_qpc_now() - submitted);
+
+        EnterCriticalSection(&async_engine_stats_lock);
+        async_engine_stats.completions++;
+        async_engine_stats.latency_total_us += latency;
+
+        if (async_engine_stats.latency_max_us < latency) {
+            async_engine_stats.latency_max_us = latency;
         }
+
+        LeaveCriticalSection(&async_engine_stats_lock);
+
+        EnterCriticalSection(&async->lock);
     }
 
-    return 0;
+    /* Clear the busy flag before waking the scheduler, otherwise it might
+       skip over us and then go back to sleep. */
+
+    async->busy = false;
+
+    if (reschedule && !async->stop) {
+        SetEvent(async_engine_wake);
+    }
+
+    WakeAllConditionVariable(&async->idle);
+    LeaveCriticalSection(&async->lock);
+}
+
+static void async_complete(struct irp *irp, HRESULT hr)
+{
+    OVERLAPPED *ovl;
+    HANDLE event;
+
+    ovl = irp->ovl;
+
+    assert(ovl != NULL);
+
+    switch (irp->op) {
+    case IRP_OP_READ:
+    case IRP_OP_IOCTL:
+        ovl->InternalHigh = (DWORD) irp->read.pos;
+
+        break;
+
+    case IRP_OP_WRITE:
+        ovl->InternalHigh = (DWORD) irp->write.pos;
+
+        break;
+
+    default:
+        break;
+    }
+
+    /* We have to do a slightly tricky dance with the hooked process' call to
+       GetOverlappedResult() here. This thread might be blocked on
+       ovl->hEvent, or it might be just about to read ovl->Internal to
+       determine whether the IO has completed (and thus determine whether it
+       needs to block on ovl->hEvent or not). So to avoid any races and *ovl
+       getting invalidated under our feet we must wake the initiating thread
+       as follows:
+
+       1. Take a local copy of ovl->hEvent
+
+       2. Issue a memory fence to ensure that the previous load does not get
+          re-ordered after the following store
+
+          https://bartoszmilewski.com/2008/11/05/who-ordered-memory-fences-on-an-x86/
+
+       3. Store the operation's NTSTATUS. At the moment that this store gets
+          issued the memory pointed to by ovl ceases to be safely accessible.
+
+       4. Using our local copy of the event handle (if present), signal the
+          initiating thread to wake up and retire the IO. */
+
+    event = ovl->hEvent;
+    MemoryBarrier();
+
+    if (SUCCEEDED(hr)) {
+        ovl->Internal = STATUS_SUCCESS;
+    } else if (hr & FACILITY_NT_BIT) {
+        ovl->Internal = hr & ~FACILITY_NT_BIT;
+    } else {
+        ovl->Internal = STATUS_UNSUCCESSFUL;
+    }
+
+    if (event != NULL) {
+        SetEvent(event);
+    }
+}
+
+static void async_arm_timer(int64_t ticks)
+{
+    LARGE_INTEGER due;
+
+    /* Relative due times are negative and in units of 100ns. Always wait at
+       least one unit, since a due time of zero is an absolute timestamp. */
+
+    due.QuadPart = -(ticks * 10000000 / async_qpc_freq) - 1;
+
+    if (!SetWaitableTimer(async_engine_timer, &due, 0, NULL, NULL, FALSE)) {
+        abort();
+    }
+}
+
+static int64_t async_qpc_now(void)
+{
+    LARGE_INTEGER now;
+
+    QueryPerformanceCounter(&now);
+
+    return now.QuadPart;
+}
+
+static uint64_t async_qpc_to_us(int64_t ticks)
+{
+    if (ticks <= 0) {
+        return 0;
+    }
+
+    return (uint64_t) ticks * 1000000 / (uint64_t) async_qpc_freq;
 }
@@ -3,22 +3,75 @@
 #include <windows.h>
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "hook/iohook.h"
 
+enum {
+    ASYNC_DEFAULT_DEPTH     = 8,
+    ASYNC_MAX_DEPTH         = 32,
+    ASYNC_ENGINE_WORKERS    = 2,
+};
+
 typedef HRESULT (*async_task_t)(void *ctx, struct irp *irp);
 
-struct async {
-    CRITICAL_SECTION lock;
-    CONDITION_VARIABLE pend;
-    CONDITION_VARIABLE avail;
-    HANDLE thread;
+struct async_slot {
     struct irp irp;
     async_task_t task;
+    int64_t submitted;
+    int64_t deadline;
+};
+
+struct async_stats {
+    uint64_t submitted;
+    uint64_t rejected;
+    size_t depth;
+    size_t max_depth;
+    uint64_t wait_total_us;
+    uint64_t wait_max_us;
+    uint64_t late_total_us;
+    uint64_t late_max_us;
+};
+
+struct async_engine_stats {
+    uint64_t completions;
+    uint64_t latency_total_us;
+    uint64_t latency_max_us;
+};
+
+struct async {
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE idle;
+    struct async *next;
+    struct async_slot slots[ASYNC_MAX_DEPTH];
+    size_t nslots;
+    size_t head;
+    size_t count;
+    struct async_stats stats;
     void *ctx;
+    bool busy;
     bool stop;
 };
 
-void async_init(struct async *async, void *ctx);
+/* Every struct async is serviced by one process-wide completion port and
+   worker pool, which is started by the first call to async_init().
+
+   Pass a depth of zero to get ASYNC_DEFAULT_DEPTH. Submissions beyond the
+   queue depth fail immediately with ERROR_BUSY instead of blocking.
+
+   async_submit_deadline() runs the task (and completes the OVERLAPPED) no
+   sooner than delay_us microseconds after submission. Tasks always complete
+   in submission order. IRPs without an OVERLAPPED run synchronously
+   and ignore the delay. */
+
+HRESULT async_init(struct async *async, void *ctx, size_t depth);
 void async_fini(struct async *async);
 HRESULT async_submit(struct async *async, struct irp *irp, async_task_t task);
+HRESULT async_submit_deadline(
+        struct async *async,
+        struct irp *irp,
+        async_task_t task,
+        uint32_t delay_us);
+void async_get_stats(struct async *async, struct async_stats *stats);
+void async_engine_get_stats(struct async_engine_stats *stats);
@@ -0,0 +1,211 @@
+#include <windows.h>
+
+#include <emmintrin.h>
+
+#ifndef __GNUC__
+#include <intrin.h>
+#endif
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hook/iobuf.h"
+
+#include "util/bytestuff.h"
+
+/* Every x86 CPU that can run any of the games we support has SSE2, so there
+   is no runtime check here. Frames top out at a few hundred bytes, which is
+   too short for wider vectors to pay for themselves. */
+
+#ifdef __GNUC__
+#define BYTESTUFF_TARGET_SSE2 __attribute__((target("sse2")))
+#else
+#define BYTESTUFF_TARGET_SSE2
+#endif
+
+static unsigned int bytestuff_ctz(unsigned int mask);
+
+static unsigned int bytestuff_ctz(unsigned int mask)
+{
+#ifdef __GNUC__
+    return __builtin_ctz(mask);
+#else
+    unsigned long index;
+
+    _BitScanForward(&index, mask);
+
+    return index;
+#endif
+}
+
+BYTESTUFF_TARGET_SSE2
+size_t bytestuff_scan(const void *src, size_t nbytes, uint8_t a, uint8_t b)
+{
+    const uint8_t *bytes;
+    __m128i va;
+    __m128i vb;
+    __m128i v;
+    unsigned int mask;
+    size_t i;
+
+    assert(src != NULL || nbytes == 0);
+
+    bytes = src;
+    va = _mm_set1_epi8((char) a);
+    vb = _mm_set1_epi8((char) b);
+
+    for (i = 0 ; i + 16 <= nbytes ; i += 16) {
+        v = _mm_loadu_si128((const __m128i *) &bytes[i]);
+        mask = (unsigned int) _mm_movemask_epi8(_mm_or_si128(
+                _mm_cmpeq_epi8(v, va),
+                _mm_cmpeq_epi8(v, vb)));
+
+        if (mask != 0) {
+            return i + bytestuff_ctz(mask);
+        }
+    }
+
+    while (i < nbytes && bytes[i] != a && bytes[i] != b) {
+        i++;
+    }
+
+    return i;
+}
+
+BYTESTUFF_TARGET_SSE2
+uint8_t bytestuff_sum(const void *src, size_t nbytes)
+{
+    const uint8_t *bytes;
+    __m128i zero;
+    __m128i acc;
+    __m128i v;
+    uint32_t sum;
+    size_t i;
+
+    assert(src != NULL || nbytes == 0);
+
+    bytes = src;
+    zero = _mm_setzero_si128();
+    acc = zero;
+
+    /* PSADBW against zero sums each half of the vector into a 64-bit lane */
+
+    for (i = 0 ; i + 16 <= nbytes ; i += 16) {
+        v = _mm_loadu_si128((const __m128i *) &bytes[i]);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+    }
+
+    sum = (uint32_t) _mm_cvtsi128_si32(acc)
+        + (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+
+    while (i < nbytes) {
+        sum += bytes[i++];
+    }
+
+    return (uint8_t) sum;
+}
+
+HRESULT bytestuff_encode(
+        struct iobuf *dest,
+        const void *src,
+        size_t nbytes,
+        uint8_t sync,
+        uint8_t esc)
+{
+    const uint8_t *bytes;
+    size_t run;
+    size_t i;
+
+    assert(dest != NULL);
+    assert(dest->bytes != NULL || dest->nbytes == 0);
+    assert(dest->pos <= dest->nbytes);
+    assert(src != NULL || nbytes == 0);
+
+    bytes = src;
+    i = 0;
+
+    while (i < nbytes) {
+        run = bytestuff_scan(&bytes[i], nbytes - i, sync, esc);
+
+        if (run > dest->nbytes - dest->pos) {
+            return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+        }
+
+        memcpy(&dest->bytes[dest->pos], &bytes[i], run);
+        dest->pos += run;
+        i += run;
+
+        if (i == nbytes) {
+            break;
+        }
+
+        if (dest->nbytes - dest->pos < 2) {
+            return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+        }
+
+        dest->bytes[dest->pos++] = esc;
+        dest->bytes[dest->pos++] = bytes[i++] - 1;
+    }
+
+    return S_OK;
+}
+
+HRESULT bytestuff_decode(
+        struct iobuf *dest,
+        const void *src,
+        size_t nbytes,
+        uint8_t sync,
+        uint8_t esc)
+{
+    const uint8_t *bytes;
+    size_t run;
+    size_t i;
+
+    assert(dest != NULL);
+    assert(dest->bytes != NULL || dest->nbytes == 0);
+    assert(dest->pos <= dest->nbytes);
+    assert(src != NULL || nbytes == 0);
+
+    bytes = src;
+    i = 0;
+
+    while (i < nbytes) {
+        run = bytestuff_scan(&bytes[i], nbytes - i, sync, esc);
+
+        if (run > dest->nbytes - dest->pos) {
+            return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+        }
+
+        memcpy(&dest->bytes[dest->pos], &bytes[i], run);
+        dest->pos += run;
+        i += run;
+
+        if (i == nbytes) {
+            break;
+        }
+
+        if (bytes[i] == sync) {
+            return E_FAIL;
+        }
+
+        /* Escape byte */
+
+        if (++i == nbytes) {
+            break;
+        }
+
+        if (bytes[i] == sync || bytes[i] == esc) {
+            return E_FAIL;
+        }
+
+        if (dest->pos >= dest->nbytes) {
+            return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+        }
+
+        dest->bytes[dest->pos++] = bytes[i++] + 1;
+    }
+
+    return S_OK;
+}
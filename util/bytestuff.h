@@ -0,0 +1,45 @@
+#pragma once
+
+#include <windows.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hook/iobuf.h"
+
+/* Byte stuffing as used by the SG, JVS and slider serial protocols. Each of
+   these reserves a sync byte and an escape byte; any occurrence of either in
+   the frame body is sent as the escape byte followed by the original byte
+   minus one.
+
+   All of these scan sixteen bytes at a time and move runs of ordinary bytes
+   with a single copy, which is most of the bytes in any real frame. */
+
+/* Returns the offset of the first byte equal to a or b, or nbytes if there is
+   no such byte. */
+
+size_t bytestuff_scan(const void *src, size_t nbytes, uint8_t a, uint8_t b);
+
+/* Returns the sum of all bytes, modulo 256. */
+
+uint8_t bytestuff_sum(const void *src, size_t nbytes);
+
+/* Appends the stuffed form of src to dest. */
+
+HRESULT bytestuff_encode(
+        struct iobuf *dest,
+        const void *src,
+        size_t nbytes,
+        uint8_t sync,
+        uint8_t esc);
+
+/* Appends the unstuffed form of src to dest. Fails with E_FAIL if src
+   contains a sync byte or an escaped escape byte. A trailing escape byte is
+   ignored. */
+
+HRESULT bytestuff_decode(
+        struct iobuf *dest,
+        const void *src,
+        size_t nbytes,
+        uint8_t sync,
+        uint8_t esc);
@@ -0,0 +1,50 @@
+#include <windows.h>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "util/config.h"
+#include "util/dprintf.h"
+
+static const wchar_t *const dprintf_cat_names[DPRINTF_NCATS_] = {
+    [DPRINTF_CAT_CLOCK]     = L"clock",
+    [DPRINTF_CAT_DNS]       = L"dns",
+    [DPRINTF_CAT_IO4]       = L"io4",
+    [DPRINTF_CAT_JVS]       = L"jvs",
+    [DPRINTF_CAT_REG]       = L"reg",
+    [DPRINTF_CAT_SG]        = L"sg",
+    [DPRINTF_CAT_SLIDER]    = L"slider",
+    [DPRINTF_CAT_VFS]       = L"vfs",
+};
+
+void dprintf_config_load(struct dprintf_config *cfg, const wchar_t *filename)
+{
+    UINT level;
+    size_t i;
+
+    assert(cfg != NULL);
+    assert(filename != NULL);
+
+    GetPrivateProfileStringW(
+            L"log",
+            L"file",
+            L"",
+            cfg->file,
+            _countof(cfg->file),
+            filename);
+
+    level = GetPrivateProfileIntW(
+            L"log",
+            L"level",
+            DPRINTF_LEVEL_INFO,
+            filename);
+
+    for (i = 0 ; i < DPRINTF_NCATS_ ; i++) {
+        cfg->levels[i] = GetPrivateProfileIntW(
+                L"log",
+                dprintf_cat_names[i],
+                level,
+                filename);
+    }
+}
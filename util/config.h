@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "util/dprintf.h"
+
+void dprintf_config_load(struct dprintf_config *cfg, const wchar_t *filename);
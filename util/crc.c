@@ -1,28 +1,326 @@
+#include <windows.h>
+
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+
+#ifdef __GNUC__
+#include <cpuid.h>
+#else
+#include <intrin.h>
+#endif
+
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "util/crc.h"
 
+/* Standard reflected CRC-32 (as used by zlib, PNG, etc).
+
+   Large inputs go through a PCLMULQDQ folding kernel if the CPU supports it
+   (see Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+   Instruction"), everything else goes through a slicing-by-8 table. All of
+   the internal routines work on the non-inverted CRC register. */
+
+#ifdef __GNUC__
+#define CRC32_TARGET_CLMUL __attribute__((target("pclmul,sse4.1")))
+#else
+#define CRC32_TARGET_CLMUL
+#endif
+
+enum {
+    CRC32_CLMUL_MIN = 64,
+};
+
+static BOOL CALLBACK crc32_init_once(
+        INIT_ONCE *once,
+        void *param,
+        void **ctx);
+static bool crc32_have_clmul(void);
+static uint32_t crc32_slice8(uint32_t crc, const uint8_t *bytes, size_t n);
+static uint32_t crc32_clmul(uint32_t crc, const uint8_t *bytes, size_t n);
+
+static INIT_ONCE crc32_once = INIT_ONCE_STATIC_INIT;
+static bool crc32_use_clmul;
+static uint32_t crc32_table[8][256];
+
 uint32_t crc32(const void *src, size_t nbytes, uint32_t in)
+{
+    return ~crc32_update_raw(~in, src, nbytes);
+}
+
+void crc32_stream_init(struct crc32_stream *s)
+{
+    s->crc = 0xFFFFFFFF;
+}
+
+void crc32_stream_update(
+        struct crc32_stream *s,
+        const void *src,
+        size_t nbytes)
+{
+    s->crc = crc32_update_raw(s->crc, src, nbytes);
+}
+
+uint32_t crc32_stream_finish(const struct crc32_stream *s)
+{
+    return ~s->crc;
+}
+
+uint32_t crc32_update_raw(uint32_t crc, const void *src, size_t nbytes)
+{
+    InitOnceExecuteOnce(&crc32_once, crc32_init_once, NULL, NULL);
+
+    if (crc32_use_clmul) {
+        return crc32_update_clmul(crc, src, nbytes);
+    }
+
+    return crc32_slice8(crc, src, nbytes);
+}
+
+bool crc32_clmul_supported(void)
+{
+    InitOnceExecuteOnce(&crc32_once, crc32_init_once, NULL, NULL);
+
+    return crc32_use_clmul;
+}
+
+uint32_t crc32_update_slice8(uint32_t crc, const void *src, size_t nbytes)
+{
+    InitOnceExecuteOnce(&crc32_once, crc32_init_once, NULL, NULL);
+
+    return crc32_slice8(crc, src, nbytes);
+}
+
+uint32_t crc32_update_clmul(uint32_t crc, const void *src, size_t nbytes)
 {
     const uint8_t *bytes;
-    uint32_t crc;
-    size_t i;
+    size_t chunk;
+
+    /* (The tail still goes through the tables) */
+
+    InitOnceExecuteOnce(&crc32_once, crc32_init_once, NULL, NULL);
 
     bytes = src;
-    crc = ~in;
 
-    for (i = 0 ; i < nbytes * 8 ; i++) {
-        if (i % 8 == 0) {
-            crc ^= *bytes++;
+    if (nbytes >= CRC32_CLMUL_MIN) {
+        /* The folding kernel eats whole 16-byte blocks */
+        chunk = nbytes & ~(size_t) 15;
+        crc = crc32_clmul(crc, bytes, chunk);
+        bytes += chunk;
+        nbytes -= chunk;
+    }
+
+    return crc32_slice8(crc, bytes, nbytes);
+}
+
+static BOOL CALLBACK crc32_init_once(
+        INIT_ONCE *once,
+        void *param,
+        void **ctx)
+{
+    uint32_t crc;
+    unsigned int i;
+    unsigned int j;
+
+    for (i = 0 ; i < 256 ; i++) {
+        crc = i;
+
+        for (j = 0 ; j < 8 ; j++) {
+            if (crc & 1) {
+                crc = (crc >> 1) ^ 0xEDB88320;
+            } else {
+                crc = (crc >> 1);
+            }
         }
 
-        if (crc & 1) {
-            crc = (crc >> 1) ^ 0xEDB88320;
-        } else {
-            crc = (crc >> 1);
+        crc32_table[0][i] = crc;
+    }
+
+    for (i = 0 ; i < 256 ; i++) {
+        crc = crc32_table[0][i];
+
+        for (j = 1 ; j < 8 ; j++) {
+            crc = (crc >> 8) ^ crc32_table[0][crc & 0xFF];
+            crc32_table[j][i] = crc;
         }
     }
 
-    return ~crc;
+    crc32_use_clmul = crc32_have_clmul();
+
+    return TRUE;
+}
+
+static bool crc32_have_clmul(void)
+{
+    uint32_t ecx;
+
+#ifdef __GNUC__
+    unsigned int regs[4];
+
+    if (!__get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3])) {
+        return false;
+    }
+
+    ecx = regs[2];
+#else
+    int regs[4];
+
+    __cpuid(regs, 1);
+    ecx = (uint32_t) regs[2];
+#endif
+
+    /* PCLMULQDQ is ECX bit 1, SSE4.1 (for PEXTRD) is ECX bit 19 */
+
+    return (ecx & (1 << 1)) && (ecx & (1 << 19));
+}
+
+static uint32_t crc32_slice8(uint32_t crc, const uint8_t *bytes, size_t n)
+{
+    uint32_t lo;
+    uint32_t hi;
+
+    while (n > 0 && ((uintptr_t) bytes & 3) != 0) {
+        crc = (crc >> 8) ^ crc32_table[0][(crc ^ *bytes++) & 0xFF];
+        n--;
+    }
+
+    while (n >= 8) {
+        /* Only ever built for little-endian x86 */
+        memcpy(&lo, bytes, 4);
+        memcpy(&hi, bytes + 4, 4);
+        lo ^= crc;
+
+        crc = crc32_table[7][ lo        & 0xFF]
+            ^ crc32_table[6][(lo >>  8) & 0xFF]
+            ^ crc32_table[5][(lo >> 16) & 0xFF]
+            ^ crc32_table[4][ lo >> 24        ]
+            ^ crc32_table[3][ hi        & 0xFF]
+            ^ crc32_table[2][(hi >>  8) & 0xFF]
+            ^ crc32_table[1][(hi >> 16) & 0xFF]
+            ^ crc32_table[0][ hi >> 24        ];
+
+        bytes += 8;
+        n -= 8;
+    }
+
+    while (n > 0) {
+        crc = (crc >> 8) ^ crc32_table[0][(crc ^ *bytes++) & 0xFF];
+        n--;
+    }
+
+    return crc;
+}
+
+/* n must be a multiple of 16 and at least 64. */
+
+CRC32_TARGET_CLMUL
+static uint32_t crc32_clmul(uint32_t crc, const uint8_t *bytes, size_t n)
+{
+    /* Folding constants for the reflected polynomial: x^(4*128+32) mod P,
+       x^(4*128-32) mod P, x^(128+32) mod P, x^(128-32) mod P, x^64 mod P,
+       then P itself and the Barrett constant mu. */
+
+    static const uint64_t k1k2[2] = { 0x0154442bd4, 0x01c6e41596 };
+    static const uint64_t k3k4[2] = { 0x01751997d0, 0x00ccaa009e };
+    static const uint64_t k5k0[2] = { 0x0163cd6124, 0x0000000000 };
+    static const uint64_t poly[2] = { 0x01db710641, 0x01f7011641 };
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+    __m128i y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i *) (bytes + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *) (bytes + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *) (bytes + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *) (bytes + 0x30));
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) crc));
+    x0 = _mm_loadu_si128((const __m128i *) k1k2);
+
+    bytes += 64;
+    n -= 64;
+
+    /* Fold four lanes in parallel, 64 bytes at a time */
+
+    while (n >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128((const __m128i *) (bytes + 0x00));
+        y6 = _mm_loadu_si128((const __m128i *) (bytes + 0x10));
+        y7 = _mm_loadu_si128((const __m128i *) (bytes + 0x20));
+        y8 = _mm_loadu_si128((const __m128i *) (bytes + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        bytes += 64;
+        n -= 64;
+    }
+
+    /* Fold the four lanes down into one */
+
+    x0 = _mm_loadu_si128((const __m128i *) k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /* Fold any remaining 16-byte blocks */
+
+    while (n >= 16) {
+        x2 = _mm_loadu_si128((const __m128i *) bytes);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        bytes += 16;
+        n -= 16;
+    }
+
+    /* Reduce 128 bits to 64 */
+
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((const __m128i *) k5k0);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduction down to 32 bits */
+
+    x0 = _mm_loadu_si128((const __m128i *) poly);
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t) _mm_extract_epi32(x1, 1);
 }
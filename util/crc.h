@@ -1,6 +1,37 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+struct crc32_stream {
+    uint32_t crc;
+};
+
+/* One-shot CRC-32. Pass the previous return value as `in' to continue a
+   running CRC, or 0 to start a new one. */
+
 uint32_t crc32(const void *src, size_t nbytes, uint32_t in);
+
+/* Incremental CRC-32 for inputs that arrive in pieces. Produces the same
+   result as a single crc32() call over the concatenated input. */
+
+void crc32_stream_init(struct crc32_stream *s);
+void crc32_stream_update(
+        struct crc32_stream *s,
+        const void *src,
+        size_t nbytes);
+uint32_t crc32_stream_finish(const struct crc32_stream *s);
+
+/* Advances a raw (non-inverted) CRC-32 register. */
+
+uint32_t crc32_update_raw(uint32_t crc, const void *src, size_t nbytes);
+
+/* The two kernels that crc32_update_raw() chooses between, exposed so that
+   crcbench can measure and check them separately. Both advance a raw CRC-32
+   register over input of any length. crc32_update_clmul() must only be
+   called if crc32_clmul_supported() returns true. */
+
+bool crc32_clmul_supported(void);
+uint32_t crc32_update_slice8(uint32_t crc, const void *src, size_t nbytes);
+uint32_t crc32_update_clmul(uint32_t crc, const void *src, size_t nbytes);
@@ -1,18 +1,118 @@
-#ifndef NDEBUG
-
 #include <windows.h>
 
+#include <assert.h>
+#include <process.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "util/dprintf.h"
 
-static long dbg_buf_lock_init;
-static CRITICAL_SECTION dbg_buf_lock;
-static char dbg_buf[16384];
-static size_t dbg_buf_pos;
+#if DPRINTF_MAX_LEVEL > DPRINTF_LEVEL_OFF
+
+/* Every thread that logs gets its own single-producer, single-consumer ring
+   of text, which a background thread drains into OutputDebugString() (and
+   optionally a log file). Logging threads therefore never take a lock or
+   enter the kernel on the common path. If a thread's ring is full then its
+   message is dropped and counted instead of blocking.
+
+   Rings are never freed. Once a thread exits its ring is released and gets
+   recycled by the next thread that wants one. */
+
+enum {
+    DPRINTF_RING_SIZE           = 16384, /* Must be a power of two */
+    DPRINTF_MSG_MAX             = 1024,
+    DPRINTF_FLUSH_INTERVAL_MS   = 10,
+};
+
+struct dprintf_ring {
+    struct dprintf_ring *next;
+    volatile LONG owned;
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    char bytes[DPRINTF_RING_SIZE];
+};
+
+static BOOL CALLBACK dprintf_init_once(
+        INIT_ONCE *once,
+        void *param,
+        void **ctx);
+static unsigned int __stdcall dprintf_thread_proc(void *param);
+static void NTAPI dprintf_thread_exit(void *ptr);
+static void dprintf_atexit(void);
+static struct dprintf_ring *dprintf_ring_get(void);
+static void dprintf_ring_put(
+        struct dprintf_ring *ring,
+        const char *msg,
+        size_t len);
+static void dprintf_drain(void);
+static void dprintf_emit(const char *str, size_t len);
+
+uint8_t dprintf_levels[DPRINTF_NCATS_] = {
+    [DPRINTF_CAT_CLOCK]     = DPRINTF_LEVEL_INFO,
+    [DPRINTF_CAT_DNS]       = DPRINTF_LEVEL_INFO,
+    [DPRINTF_CAT_IO4]       = DPRINTF_LEVEL_INFO,
+    [DPRINTF_CAT_JVS]       = DPRINTF_LEVEL_INFO,
+    [DPRINTF_CAT_REG]       = DPRINTF_LEVEL_INFO,
+    [DPRINTF_CAT_SG]        = DPRINTF_LEVEL_INFO,
+    [DPRINTF_CAT_SLIDER]    = DPRINTF_LEVEL_INFO,
+    [DPRINTF_CAT_VFS]       = DPRINTF_LEVEL_INFO,
+};
+
+static INIT_ONCE dprintf_once = INIT_ONCE_STATIC_INIT;
+static bool dprintf_async;
+static DWORD dprintf_fls;
+static HANDLE dprintf_wake;
+static struct dprintf_ring *volatile dprintf_rings;
+static HANDLE volatile dprintf_file = INVALID_HANDLE_VALUE;
+static volatile LONG dprintf_dropped;
+static volatile LONG dprintf_draining;
+
+void dprintf_init(const struct dprintf_config *cfg)
+{
+    HANDLE file;
+
+    assert(cfg != NULL);
+
+    memcpy(dprintf_levels, cfg->levels, sizeof(dprintf_levels));
+    InitOnceExecuteOnce(&dprintf_once, dprintf_init_once, NULL, NULL);
+
+    if (cfg->file[0] == L'\0') {
+        return;
+    }
+
+    /* The same log file is usually configured for every process that we get
+       injected into. Appending and sharing write access lets all of them log
+       to it at once: each WriteFile() then lands atomically at the current
+       end of the file instead of at a per-handle offset. */
+
+    file = CreateFileW(
+            cfg->file,
+            FILE_APPEND_DATA,
+            FILE_SHARE_READ | FILE_SHARE_WRITE,
+            NULL,
+            OPEN_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL,
+            NULL);
+
+    if (file == INVALID_HANDLE_VALUE) {
+        dwprintf(L"dprintf: Failed to open log file %s: %08x\n",
+                cfg->file,
+                (int) HRESULT_FROM_WIN32(GetLastError()));
+
+        return;
+    }
+
+    file = InterlockedExchangePointer((void *volatile *) &dprintf_file, file);
+
+    if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+    }
+}
 
 void dprintf(const char *fmt, ...)
 {
@@ -25,44 +125,24 @@ void dprintf(const char *fmt, ...)
 
 void dprintfv(const char *fmt, va_list ap)
 {
-    long init;
-
-    /* Static constructors in C are difficult to do in a way that works under
-       both GCC and MSVC, so we have to use atomic ops to ensure that the
-       buffer mutex is correctly initialized instead. */
-
-    do {
-        init = InterlockedCompareExchange(&dbg_buf_lock_init, 0, 1);
-
-        if (init == 0) {
-            /* We won the init race, global variable is now set to 1, other
-               threads will spin until it becomes -1. */
-            InitializeCriticalSection(&dbg_buf_lock);
-            dbg_buf_lock_init = -1;
-            init = -1;
-        }
-    } while (init >= 0);
+    struct dprintf_ring *ring;
+    char msg[DPRINTF_MSG_MAX];
+    int len;
 
-    EnterCriticalSection(&dbg_buf_lock);
+    len = vsnprintf_s(msg, sizeof(msg), sizeof(msg) - 1, fmt, ap);
 
-    dbg_buf_pos += vsnprintf_s(
-            dbg_buf + dbg_buf_pos,
-            sizeof(dbg_buf) - dbg_buf_pos,
-            sizeof(dbg_buf) - dbg_buf_pos - 1,
-            fmt,
-            ap);
-
-    if (dbg_buf_pos + 1 > sizeof(dbg_buf)) {
-        abort();
+    if (len < 0) {
+        /* Truncated */
+        len = (int) strlen(msg);
     }
 
-    if (strchr(dbg_buf, '\n') != NULL) {
-        OutputDebugStringA(dbg_buf);
-        dbg_buf_pos = 0;
-        dbg_buf[0] = '\0';
-    }
+    ring = dprintf_ring_get();
 
-    LeaveCriticalSection(&dbg_buf_lock);
+    if (ring != NULL) {
+        dprintf_ring_put(ring, msg, len);
+    } else {
+        OutputDebugStringA(msg);
+    }
 }
 
 void dwprintf(const wchar_t *fmt, ...)
@@ -76,10 +156,298 @@ void dwprintf(const wchar_t *fmt, ...)
 
 void dwprintfv(const wchar_t *fmt, va_list ap)
 {
-    wchar_t msg[512];
+    struct dprintf_ring *ring;
+    wchar_t wmsg[512];
+    char msg[DPRINTF_MSG_MAX];
+    int len;
+
+    _vsnwprintf_s(wmsg, _countof(wmsg), _countof(wmsg) - 1, fmt, ap);
+    ring = dprintf_ring_get();
+
+    if (ring == NULL) {
+        OutputDebugStringW(wmsg);
+
+        return;
+    }
+
+    len = WideCharToMultiByte(
+            CP_ACP,
+            0,
+            wmsg,
+            -1,
+            msg,
+            sizeof(msg),
+            NULL,
+            NULL);
+
+    if (len > 0) {
+        /* Length includes the NUL terminator */
+        dprintf_ring_put(ring, msg, len - 1);
+    }
+}
+
+void dputs(const char *str)
+{
+    struct dprintf_ring *ring;
+
+    assert(str != NULL);
+
+    ring = dprintf_ring_get();
+
+    if (ring != NULL) {
+        dprintf_ring_put(ring, str, strlen(str));
+    } else {
+        OutputDebugStringA(str);
+    }
+}
+
+static BOOL CALLBACK dprintf_init_once(
+        INIT_ONCE *once,
+        void *param,
+        void **ctx)
+{
+    HANDLE thread;
+
+    /* If any of this fails then we just log synchronously instead. */
+
+    dprintf_fls = FlsAlloc(dprintf_thread_exit);
+
+    if (dprintf_fls == FLS_OUT_OF_INDEXES) {
+        return TRUE;
+    }
+
+    dprintf_wake = CreateEventW(NULL, FALSE, FALSE, NULL);
+
+    if (dprintf_wake == NULL) {
+        return TRUE;
+    }
+
+    thread = (HANDLE) _beginthreadex(
+            NULL,
+            0,
+            dprintf_thread_proc,
+            NULL,
+            0,
+            NULL);
+
+    if (thread == NULL) {
+        return TRUE;
+    }
+
+    CloseHandle(thread);
+    atexit(dprintf_atexit);
+    dprintf_async = true;
+
+    return TRUE;
+}
+
+static unsigned int __stdcall dprintf_thread_proc(void *param)
+{
+    for (;;) {
+        WaitForSingleObject(dprintf_wake, DPRINTF_FLUSH_INTERVAL_MS);
+        dprintf_drain();
+    }
+
+    return 0;
+}
+
+static void NTAPI dprintf_thread_exit(void *ptr)
+{
+    struct dprintf_ring *ring;
+
+    ring = ptr;
+
+    if (ring != NULL) {
+        /* Whatever is left in the ring still gets drained as normal. */
+        InterlockedExchange(&ring->owned, 0);
+    }
+}
+
+static void dprintf_atexit(void)
+{
+    /* Runs when our module detaches. Other threads, including the flusher,
+       may still be alive at this point if we are being unloaded rather than
+       torn down along with the process, so this drain has to be able to
+       coexist with theirs. */
+
+    dprintf_drain();
+}
+
+static struct dprintf_ring *dprintf_ring_get(void)
+{
+    struct dprintf_ring *ring;
+    struct dprintf_ring *head;
+
+    InitOnceExecuteOnce(&dprintf_once, dprintf_init_once, NULL, NULL);
+
+    if (!dprintf_async) {
+        return NULL;
+    }
+
+    ring = FlsGetValue(dprintf_fls);
+
+    if (ring != NULL) {
+        return ring;
+    }
+
+    /* Reuse a ring abandoned by an exited thread if possible */
+
+    for (ring = dprintf_rings ; ring != NULL ; ring = ring->next) {
+        if (InterlockedCompareExchange(&ring->owned, 1, 0) == 0) {
+            break;
+        }
+    }
+
+    if (ring == NULL) {
+        ring = calloc(1, sizeof(*ring));
+
+        if (ring == NULL) {
+            return NULL;
+        }
+
+        ring->owned = 1;
+
+        do {
+            head = dprintf_rings;
+            ring->next = head;
+        } while (InterlockedCompareExchangePointer(
+                (void *volatile *) &dprintf_rings,
+                ring,
+                head) != head);
+    }
+
+    FlsSetValue(dprintf_fls, ring);
+
+    return ring;
+}
+
+static void dprintf_ring_put(
+        struct dprintf_ring *ring,
+        const char *msg,
+        size_t len)
+{
+    uint32_t head;
+    uint32_t used;
+    size_t off;
+    size_t chunk;
+
+    head = ring->head;
+    used = head - ring->tail;
+
+    if (len > DPRINTF_RING_SIZE - used) {
+        InterlockedIncrement(&dprintf_dropped);
+
+        return;
+    }
+
+    off = head & (DPRINTF_RING_SIZE - 1);
+    chunk = DPRINTF_RING_SIZE - off;
+
+    if (chunk > len) {
+        chunk = len;
+    }
+
+    memcpy(&ring->bytes[off], msg, chunk);
+    memcpy(&ring->bytes[0], msg + chunk, len - chunk);
+
+    /* Publish the text before the new head position */
 
-    _vsnwprintf_s(msg, _countof(msg), _countof(msg) - 1, fmt, ap);
-    OutputDebugStringW(msg);
+    MemoryBarrier();
+    ring->head = head + (uint32_t) len;
+
+    /* Only bother the flusher early if we are getting close to full. */
+
+    if (used + len > DPRINTF_RING_SIZE / 2) {
+        SetEvent(dprintf_wake);
+    }
+}
+
+static void dprintf_drain(void)
+{
+    static char text[DPRINTF_RING_SIZE + 1];
+    struct dprintf_ring *ring;
+    uint32_t head;
+    uint32_t tail;
+    size_t nbytes;
+    size_t off;
+    size_t chunk;
+    LONG dropped;
+    char msg[64];
+
+    /* Rings only have a single consumer. Whoever gets here second just leaves
+       the work to the other drain; in particular the exit drain must not
+       wait on a flusher that ExitProcess() may have killed part-way through
+       a drain of its own. */
+
+    if (InterlockedCompareExchange(&dprintf_draining, 1, 0) != 0) {
+        return;
+    }
+
+    for (ring = dprintf_rings ; ring != NULL ; ring = ring->next) {
+        tail = ring->tail;
+        head = ring->head;
+        MemoryBarrier();
+
+        nbytes = head - tail;
+
+        if (nbytes == 0) {
+            continue;
+        }
+
+        off = tail & (DPRINTF_RING_SIZE - 1);
+        chunk = DPRINTF_RING_SIZE - off;
+
+        if (chunk > nbytes) {
+            chunk = nbytes;
+        }
+
+        memcpy(&text[0], &ring->bytes[off], chunk);
+        memcpy(&text[chunk], &ring->bytes[0], nbytes - chunk);
+
+        /* Only emit complete lines, unless the ring is completely full of one
+           enormous unterminated line. */
+
+        if (nbytes < DPRINTF_RING_SIZE) {
+            while (nbytes > 0 && text[nbytes - 1] != '\n') {
+                nbytes--;
+            }
+
+            if (nbytes == 0) {
+                continue;
+            }
+        }
+
+        /* Finish reading the text before handing the space back */
+
+        MemoryBarrier();
+        ring->tail = tail + (uint32_t) nbytes;
+
+        text[nbytes] = '\0';
+        dprintf_emit(text, nbytes);
+    }
+
+    dropped = InterlockedExchange(&dprintf_dropped, 0);
+
+    if (dropped > 0) {
+        _snprintf(msg, sizeof(msg), "dprintf: Dropped %ld messages\n", dropped);
+        msg[sizeof(msg) - 1] = '\0';
+        dprintf_emit(msg, strlen(msg));
+    }
+
+    InterlockedExchange(&dprintf_draining, 0);
+}
+
+static void dprintf_emit(const char *str, size_t len)
+{
+    HANDLE file;
+    DWORD nwritten;
+
+    OutputDebugStringA(str);
+    file = dprintf_file;
+
+    if (file != INVALID_HANDLE_VALUE) {
+        WriteFile(file, str, (DWORD) len, &nwritten, NULL);
+    }
 }
 
 #endif
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <windows.h>
+
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __GNUC__
 #define DPRINTF_CHK __attribute__(( format(printf, 1, 2) ))
@@ -9,14 +12,84 @@
 #define DPRINTF_CHK
 #endif
 
-#ifndef NDEBUG
+/* Log levels. These are macros rather than an enum so that they can be used
+   in preprocessor conditionals. */
+
+#define DPRINTF_LEVEL_OFF   0
+#define DPRINTF_LEVEL_ERROR 1
+#define DPRINTF_LEVEL_INFO  2
+#define DPRINTF_LEVEL_DEBUG 3
+#define DPRINTF_LEVEL_TRACE 4
+
+/* Highest level that gets compiled in at all. Logging is compiled out
+   entirely in NDEBUG builds unless this is overridden from the command line,
+   e.g. -DDPRINTF_MAX_LEVEL=2 keeps errors and informational messages
+   available in a release build. */
+
+#ifndef DPRINTF_MAX_LEVEL
+#ifdef NDEBUG
+#define DPRINTF_MAX_LEVEL DPRINTF_LEVEL_OFF
+#else
+#define DPRINTF_MAX_LEVEL DPRINTF_LEVEL_TRACE
+#endif
+#endif
+
+enum dprintf_cat {
+    DPRINTF_CAT_CLOCK,
+    DPRINTF_CAT_DNS,
+    DPRINTF_CAT_IO4,
+    DPRINTF_CAT_JVS,
+    DPRINTF_CAT_REG,
+    DPRINTF_CAT_SG,
+    DPRINTF_CAT_SLIDER,
+    DPRINTF_CAT_VFS,
+
+    DPRINTF_NCATS_,
+};
+
+struct dprintf_config {
+    wchar_t file[MAX_PATH];
+    uint8_t levels[DPRINTF_NCATS_];
+};
+
+#if DPRINTF_MAX_LEVEL > DPRINTF_LEVEL_OFF
+extern uint8_t dprintf_levels[DPRINTF_NCATS_];
+
+void dprintf_init(const struct dprintf_config *cfg);
 void dprintf(const char *fmt, ...) DPRINTF_CHK;
 void dprintfv(const char *fmt, va_list ap);
 void dwprintf(const wchar_t *fmt, ...);
 void dwprintfv(const wchar_t *fmt, va_list ap);
+
+/* Emits already formatted text verbatim and in a single piece. */
+
+void dputs(const char *str);
+
+/* Levels above DPRINTF_MAX_LEVEL fold to a constant false and get discarded
+   by the compiler, everything else costs a single load and compare. */
+
+#define dprintf_enabled(cat, level) \
+        ((level) <= DPRINTF_MAX_LEVEL && (level) <= dprintf_levels[(cat)])
 #else
+#define dprintf_init(cfg)
 #define dprintf(...)
 #define dprintfv(fmt, ap)
 #define dwprintf(...)
 #define dwprintfv(fmt, ap)
+#define dputs(str)
+#define dprintf_enabled(cat, level) 0
 #endif
+
+#define dprintfc(cat, level, ...) \
+        do { \
+            if (dprintf_enabled(cat, level)) { \
+                dprintf(__VA_ARGS__); \
+            } \
+        } while (0)
+
+#define dwprintfc(cat, level, ...) \
+        do { \
+            if (dprintf_enabled(cat, level)) { \
+                dwprintf(__VA_ARGS__); \
+            } \
+        } while (0)
@@ -1,56 +1,166 @@
-#ifndef NDEBUG
-
 #include <assert.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "hook/iobuf.h"
 
 #include "util/dprintf.h"
 #include "util/dump.h"
 
-void dump(const void *ptr, size_t nbytes)
+enum {
+    /* "    %08x:", then 16 * " %02x", a space, 16 chars of ASCII and a
+       newline. Shorter for a final partial line. */
+    DUMP_LINE_MAX = 13 + 16 * 3 + 1 + 16 + 1,
+
+    /* Lines rendered per dputs() call */
+    DUMP_BATCH_LINES = 12,
+};
+
+static size_t dump_line(char *out, const uint8_t *bytes, size_t n, size_t i);
+
+static const char dump_empty[] = "\t--- Empty ---\n";
+static const char dump_digits[] = "0123456789abcdef";
+
+size_t dump_format(char *dest, size_t destsz, const void *ptr, size_t nbytes)
 {
     const uint8_t *bytes;
-    uint8_t c;
+    size_t written;
+    size_t total;
+    size_t len;
     size_t i;
-    size_t j;
+    size_t n;
 
+    assert(dest != NULL || destsz == 0);
     assert(ptr != NULL || nbytes == 0);
 
+    bytes = ptr;
+    written = 0;
+    total = 0;
+
+    /* Once something fails to fit we stop writing but keep counting, so
+       that the caller learns how big the buffer needs to be. */
+
     if (nbytes == 0) {
-        dprintf("\t--- Empty ---\n");
-    }
+        len = strlen(dump_empty);
 
-    bytes = ptr;
+        if (total + len < destsz) {
+            memcpy(&dest[total], dump_empty, len);
+            written += len;
+        }
+
+        total += len;
+    }
 
     for (i = 0 ; i < nbytes ; i += 16) {
-        dprintf("    %08x:", (int) i);
+        n = nbytes - i < 16 ? nbytes - i : 16;
+        len = DUMP_LINE_MAX - 16 + n;
+
+        if (written == total && total + len < destsz) {
+            dump_line(&dest[total], &bytes[i], n, i);
+            written += len;
+        }
+
+        total += len;
+    }
+
+    if (written == total && total + 1 < destsz) {
+        dest[total] = '\n';
+        written++;
+    }
+
+    total++;
+
+    if (destsz > 0) {
+        dest[written] = '\0';
+    }
+
+    return total;
+}
+
+static size_t dump_line(char *out, const uint8_t *bytes, size_t n, size_t i)
+{
+    char *pos;
+    uint8_t c;
+    size_t j;
+    int shift;
+
+    pos = out;
+    memcpy(pos, "    ", 4);
+    pos += 4;
+
+    for (shift = 28 ; shift >= 0 ; shift -= 4) {
+        *pos++ = dump_digits[(i >> shift) & 0xF];
+    }
+
+    *pos++ = ':';
 
-        for (j = 0 ; i + j < nbytes && j < 16 ; j++) {
-            dprintf(" %02x", bytes[i + j]);
+    for (j = 0 ; j < 16 ; j++) {
+        if (j < n) {
+            *pos++ = ' ';
+            *pos++ = dump_digits[bytes[j] >> 4];
+            *pos++ = dump_digits[bytes[j] & 0xF];
+        } else {
+            memcpy(pos, "   ", 3);
+            pos += 3;
         }
+    }
+
+    *pos++ = ' ';
 
-        while (j < 16) {
-            dprintf("   ");
-            j++;
+    for (j = 0 ; j < n ; j++) {
+        c = bytes[j];
+
+        if (c < 0x20 || c >= 0x7F) {
+            c = '.';
         }
 
-        dprintf(" ");
+        *pos++ = c;
+    }
+
+    *pos++ = '\n';
+
+    return pos - out;
+}
+
+#if DPRINTF_MAX_LEVEL > DPRINTF_LEVEL_OFF
+
+void dump(const void *ptr, size_t nbytes)
+{
+    char text[DUMP_BATCH_LINES * DUMP_LINE_MAX + 2];
+    const uint8_t *bytes;
+    size_t len;
+    size_t i;
+    size_t n;
+
+    assert(ptr != NULL || nbytes == 0);
+
+    if (nbytes == 0) {
+        dump_format(text, sizeof(text), ptr, 0);
+        dputs(text);
 
-        for (j = 0 ; i + j < nbytes && j < 16 ; j++) {
-            c = bytes[i + j];
+        return;
+    }
 
-            if (c < 0x20 || c >= 0x7F) {
-                c = '.';
-            }
+    /* Render lines into a stack buffer and log them a batch at a time. */
 
-            dprintf("%c", c);
+    bytes = ptr;
+    len = 0;
+
+    for (i = 0 ; i < nbytes ; i += 16) {
+        if (len + DUMP_LINE_MAX > DUMP_BATCH_LINES * DUMP_LINE_MAX) {
+            text[len] = '\0';
+            dputs(text);
+            len = 0;
         }
 
-        dprintf("\n");
+        n = nbytes - i < 16 ? nbytes - i : 16;
+        len += dump_line(&text[len], &bytes[i], n, i);
     }
 
-    dprintf("\n");
+    text[len++] = '\n';
+    text[len] = '\0';
+    dputs(text);
 }
 
 void dump_iobuf(const struct iobuf *iobuf)
@@ -4,7 +4,17 @@
 
 #include "hook/iobuf.h"
 
-#ifndef NDEBUG
+#include "util/dprintf.h"
+
+/* Renders a hex dump of nbytes bytes at ptr into dest, in the same format
+   that dump() logs. Output is always NUL terminated (if destsz is nonzero)
+   and is truncated at a line boundary if dest is too small. Returns the
+   length of the complete dump excluding the NUL terminator, like snprintf(),
+   so dump_format(NULL, 0, ptr, nbytes) + 1 is the buffer size required. */
+
+size_t dump_format(char *dest, size_t destsz, const void *ptr, size_t nbytes);
+
+#if DPRINTF_MAX_LEVEL > DPRINTF_LEVEL_OFF
 void dump(const void *ptr, size_t nbytes);
 void dump_iobuf(const struct iobuf *iobuf);
 void dump_const_iobuf(const struct const_iobuf *iobuf);